@@ -19,9 +19,13 @@ SOURCES += \
     A3D/cubemap.cpp \
     A3D/cubemapcache.cpp \
     A3D/cubemapcacheogl.cpp \
+    A3D/dynamicaabbtree.cpp \
     A3D/entity.cpp \
+    A3D/glstatecache.cpp \
+    A3D/frustum.cpp \
     A3D/group.cpp \
     A3D/image.cpp \
+    A3D/lightclusters.cpp \
     A3D/material.cpp \
     A3D/materialcache.cpp \
     A3D/materialcacheogl.cpp \
@@ -29,15 +33,24 @@ SOURCES += \
     A3D/materialpropertiescache.cpp \
     A3D/materialpropertiescacheogl.cpp \
     A3D/mesh.cpp \
+    A3D/mesh_optimize.cpp \
+    A3D/mesh_simplify.cpp \
+    A3D/meshbvh.cpp \
     A3D/meshcache.cpp \
     A3D/meshcacheogl.cpp \
     A3D/model.cpp \
+    A3D/modelimport.cpp \
+    A3D/modelloadtask.cpp \
+    A3D/occlusionbuffer.cpp \
     A3D/renderer.cpp \
     A3D/rendererogl.cpp \
     A3D/resource.cpp \
     A3D/resourcemanager.cpp \
+    A3D/resourcemanager_cache.cpp \
+    A3D/resourcemanager_gltf.cpp \
     A3D/resourcemanager_obj.cpp \
     A3D/scene.cpp \
+    A3D/scene_index.cpp \
     A3D/texture.cpp \
     A3D/texturecache.cpp \
     A3D/texturecacheogl.cpp \
@@ -54,9 +67,13 @@ HEADERS += \
 	A3D/cubemap.h \
 	A3D/cubemapcache.h \
 	A3D/cubemapcacheogl.h \
+	A3D/dynamicaabbtree.h \
 	A3D/entity.h \
+	A3D/glstatecache.h \
+	A3D/frustum.h \
 	A3D/group.h \
 	A3D/image.h \
+	A3D/lightclusters.h \
 	A3D/material.h \
 	A3D/materialcache.h \
 	A3D/materialcacheogl.h \
@@ -64,9 +81,13 @@ HEADERS += \
 	A3D/materialpropertiescache.h \
 	A3D/materialpropertiescacheogl.h \
 	A3D/mesh.h \
+	A3D/meshbvh.h \
 	A3D/meshcache.h \
 	A3D/meshcacheogl.h \
 	A3D/model.h \
+	A3D/modelimport.h \
+	A3D/modelloadtask.h \
+	A3D/occlusionbuffer.h \
 	A3D/renderer.h \
 	A3D/rendererogl.h \
 	A3D/resource.h \
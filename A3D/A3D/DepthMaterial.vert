@@ -0,0 +1,14 @@
+#version 330 core
+
+layout (location = 0) in vec3 inVertex;
+
+layout (std140) uniform MeshUBO_Data {
+	mat4 mvpMatrix;
+};
+
+// Same depth as PBRMaterial.vert, for the GL_LEQUAL test of the colour pass
+invariant gl_Position;
+
+void main() {
+	gl_Position = mvpMatrix * vec4(inVertex, 1.0);
+}
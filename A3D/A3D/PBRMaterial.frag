@@ -3,15 +3,27 @@
 in vec3 WorldPos;
 in vec2 TexCoord;
 in vec3 Normal;
+in vec4 ClipPos;
 out vec4 fragColor;
 
 layout (std140) uniform SceneUBO_Data {
 	vec4 cameraPos;
-	
-	vec4 lightsPos[4];
-	vec4 lightsColor[4];
+	vec4 cameraForward;
+
+	// Width, height and depth of the light cluster grid, then 1 for orthogonal projections
+	ivec4 clusterGrid;
+
+	// Slice of a depth (of its log for perspective projections): depth * x + y
+	vec4 clusterDepth;
 };
 
+// Two texels per light: position and range, then radiance
+uniform samplerBuffer ClusterLights;
+
+// Offset and count of the lights of each cluster in ClusterLightIndices
+uniform usamplerBuffer ClusterRecords;
+uniform usamplerBuffer ClusterLightIndices;
+
 uniform sampler2D AlbedoTexture;
 uniform sampler2D NormalTexture;
 uniform sampler2D MetallicTexture;
@@ -100,19 +112,28 @@ void main() {
 	vec3 F0 = mix(vec3(0.04), albedo, metallic);
 	vec3 Lo = vec3(0.0);
 
-	for(int i = 0; i < 4; ++i)
-	{
-		if(lightsPos[i].w <= -0.001f)
-			continue;
+	// Cluster of the fragment, see LightClusters
+	float depth = dot(WorldPos.xyz - cameraPos.xyz, cameraForward.xyz);
+	float slice = (clusterGrid.w != 0 ? depth : log(max(depth, 1e-6))) * clusterDepth.x + clusterDepth.y;
+	vec2 screen = (ClipPos.xy / ClipPos.w) * 0.5 + 0.5;
+	ivec3 cell = clamp(ivec3(floor(vec3(screen * vec2(clusterGrid.xy), slice))), ivec3(0), clusterGrid.xyz - 1);
+	uvec2 cluster = texelFetch(ClusterRecords, cell.x + clusterGrid.x * (cell.y + clusterGrid.y * cell.z)).rg;
 
-		vec3 lightPos = lightsPos[i].xyz;
-		vec3 lightColor = (lightsColor[i].rgb) * (1 + lightsColor[i].w + lightsPos[i].w);
+	for(uint i = 0u; i < cluster.y; ++i)
+	{
+		int light = int(texelFetch(ClusterLightIndices, int(cluster.x + i)).r);
+		vec4 lightPosRange = texelFetch(ClusterLights, 2 * light);
+		vec3 lightRadiance = texelFetch(ClusterLights, 2 * light + 1).rgb;
 
+		vec3 lightPos = lightPosRange.xyz;
 		vec3 L = normalize(lightPos - WorldPos.xyz);
 		vec3 H = normalize(V + L);
 		float distance = length(lightPos - WorldPos.xyz);
-		float attenuation = 1.0 / (distance * distance);
-		vec3 radiance = lightColor * attenuation;
+
+		// Fades out to 0 at the range of the light
+		float fade = clamp(1.0 - pow(distance / lightPosRange.w, 4.0), 0.0, 1.0);
+		float attenuation = fade * fade / (distance * distance);
+		vec3 radiance = lightRadiance * attenuation;
 		
 		float NDF = DistributionGGX(N, H, roughness);
 		float G = GeometrySmith(N, V, L, roughness);
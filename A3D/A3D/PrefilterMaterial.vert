@@ -7,14 +7,6 @@ layout (location = 3) in vec3 inNormal;
 layout (std140) uniform MeshUBO_Data {
 	mat4 pMatrix;
 	mat4 vMatrix;
-	mat4 mMatrix;
-
-	mat4 mvMatrix;
-	mat4 mvpMatrix;
-
-	mat4 mNormalMatrix;
-	mat4 mvNormalMatrix;
-	mat4 mvpNormalMatrix;
 };
 
 out vec3 WorldPos;
@@ -161,4 +161,8 @@ QMatrix4x4 const& Camera::getProjection() const {
 	return m_projMatrix;
 }
 
+Frustum Camera::frustum() const {
+	return Frustum(getProjection() * getView());
+}
+
 }
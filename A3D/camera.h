@@ -2,6 +2,7 @@
 #define A3DCAMERAVIEW_H
 
 #include "A3D/common.h"
+#include "A3D/frustum.h"
 
 namespace A3D {
 
@@ -77,6 +78,9 @@ public:
 
 	QMatrix4x4 const& getProjection() const;
 
+	// World space frustum of getProjection() * getView()
+	Frustum frustum() const;
+
 private:
 	mutable bool m_viewMatrixIsDirty;
 	mutable QMatrix4x4 m_viewMatrix;
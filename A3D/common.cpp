@@ -1,6 +1,9 @@
 #include "A3D/common.h"
 #include <QDebug>
 #include <QDateTime>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <atomic>
 
 namespace A3D {
 
@@ -39,4 +42,59 @@ void log(LogChannel channel, QString text) {
 	log(channel, QStringView(text));
 }
 
+void parallelFor(std::size_t count, std::function<void(std::size_t)> const& fn) {
+	if(count == 0)
+		return;
+
+	QThreadPool* pool         = QThreadPool::globalInstance();
+	std::size_t const helpers = std::min<std::size_t>(count, static_cast<std::size_t>(std::max(1, pool->maxThreadCount()))) - 1;
+	if(helpers == 0) {
+		for(std::size_t i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<std::size_t> next(0);
+	auto work = [&]() {
+		for(std::size_t i = next++; i < count; i = next++)
+			fn(i);
+	};
+
+	class Helper : public QRunnable {
+	public:
+		Helper(std::function<void()> const& work, QSemaphore& done)
+			: m_work(work),
+			  m_done(done) {
+			setAutoDelete(false);
+		}
+		void run() override {
+			m_work();
+			m_done.release();
+		}
+
+	private:
+		std::function<void()> const& m_work;
+		QSemaphore& m_done;
+	};
+
+	std::function<void()> const workFn = work;
+	QSemaphore done;
+	std::vector<std::unique_ptr<Helper>> tasks;
+	tasks.reserve(helpers);
+	for(std::size_t i = 0; i < helpers; ++i) {
+		tasks.emplace_back(std::make_unique<Helper>(workFn, done));
+		pool->start(tasks.back().get());
+	}
+
+	workFn();
+
+	// Helpers that did not get a thread yet have nothing left to do.
+	int pending = static_cast<int>(helpers);
+	for(auto it = tasks.begin(); it != tasks.end(); ++it) {
+		if(pool->tryTake(it->get()))
+			--pending;
+	}
+	done.acquire(pending);
+}
+
 }
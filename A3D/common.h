@@ -24,6 +24,7 @@
 #include <vector>
 #include <list>
 #include <chrono>
+#include <functional>
 
 namespace A3D {
 
@@ -71,6 +72,10 @@ void cleanupQPointers(std::map<K, QPointer<T>>& container) {
 	}
 }
 
+// Runs fn(i) for every i in [0, count) on the global QThreadPool and waits for all of them.
+// The calling thread takes part in the work, so this is safe to call from a pool thread too.
+void parallelFor(std::size_t count, std::function<void(std::size_t)> const& fn);
+
 inline QImage const* imageWithFormat(QImage::Format format, QImage const& base, QImage& storage) {
 	if(base.format() == format)
 		return &base;
@@ -61,7 +61,7 @@ void CubemapCacheOGL::update(RendererOGL* renderer, CoreGLFunctions* gl) {
 	if(!m_cubemap)
 		return;
 
-	gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
+	renderer->m_state.bindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -154,7 +154,7 @@ void CubemapCacheOGL::calcPrefilter(GLenum format, RendererOGL* renderer, CoreGL
 	static int const prefilterSideLength = 4 * static_cast<int>(std::powf(2.f, static_cast<float>(maxMipLevels)) + 0.1f);
 	static QSize const prefilterSize(prefilterSideLength, prefilterSideLength);
 
-	gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapPrefilter);
+	renderer->m_state.bindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapPrefilter);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -198,22 +198,22 @@ void CubemapCacheOGL::calcPrefilter(GLenum format, RendererOGL* renderer, CoreGL
 		int const mipLevelSideLength = 4 * static_cast<int>(std::powf(2.f, static_cast<float>(i)) + 0.1f);
 		QSize const mipLevelSize(mipLevelSideLength, mipLevelSideLength);
 
-		gl->glViewport(0, 0, mipLevelSize.width(), mipLevelSize.height());
+		renderer->m_state.setViewport(0, 0, mipLevelSize.width(), mipLevelSize.height());
 
 		float roughness = static_cast<float>(i - 1) / static_cast<float>(maxMipLevels - 1);
 		matCache->applyUniform("Roughness", roughness);
 
-		gl->glActiveTexture(GL_TEXTURE0 + static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot));
-		gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
+		renderer->m_state.bindTexture(static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot), GL_TEXTURE_CUBE_MAP, m_cubemap);
 
-		matCache->install(gl);
+		matCache->install(renderer->m_state);
 
 		for(int j = 0; j < 6; ++j) {
 			// Bind shader & set matrices
 			gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, m_cubemapPrefilter, glMipLevel);
 			gl->glClear(GL_COLOR_BUFFER_BIT);
 
-			meshCache->render(gl, QMatrix4x4(), viewMatrices[j], projMatrix);
+			renderer->bindTransforms(matCache, QMatrix4x4(), viewMatrices[j], projMatrix);
+			meshCache->render(gl, renderer->m_state);
 		}
 	}
 }
@@ -236,7 +236,7 @@ void CubemapCacheOGL::calcIrradiance(GLenum format, RendererOGL* renderer, CoreG
 	MeshCacheOGL* meshCache    = renderer->buildMeshCache(irradianceMesh);
 	MaterialCacheOGL* matCache = renderer->buildMaterialCache(irradianceMat);
 
-	gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapIrradiance);
+	renderer->m_state.bindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapIrradiance);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	gl->glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -266,42 +266,36 @@ void CubemapCacheOGL::calcIrradiance(GLenum format, RendererOGL* renderer, CoreG
 	};
 	static QMatrix4x4 const projMatrix = proj();
 
-	gl->glViewport(0, 0, irradianceSize.width(), irradianceSize.height());
-	gl->glDisable(GL_DEPTH_TEST);
-	gl->glDisable(GL_CULL_FACE);
+	renderer->m_state.setViewport(0, 0, irradianceSize.width(), irradianceSize.height());
+	renderer->m_state.setEnabled(GLStateCache::DepthTest, false);
+	renderer->m_state.setEnabled(GLStateCache::CullFace, false);
 
-	gl->glActiveTexture(GL_TEXTURE0 + static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot));
-	gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
+	renderer->m_state.bindTexture(static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot), GL_TEXTURE_CUBE_MAP, m_cubemap);
 
-	matCache->install(gl);
+	matCache->install(renderer->m_state);
 
 	for(int i = 0; i < 6; ++i) {
 		// Bind shader & set matrices
 		gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, m_cubemapIrradiance, 0);
 		gl->glClear(GL_COLOR_BUFFER_BIT);
 
-		meshCache->render(gl, QMatrix4x4(), viewMatrices[i], projMatrix);
+		renderer->bindTransforms(matCache, QMatrix4x4(), viewMatrices[i], projMatrix);
+		meshCache->render(gl, renderer->m_state);
 	}
 }
 
-void CubemapCacheOGL::applyToSlot(CoreGLFunctions* gl, GLint environmentSlot, GLint irradianceSlot, GLint prefilterSlot) {
+void CubemapCacheOGL::applyToSlot(GLStateCache& state, GLint environmentSlot, GLint irradianceSlot, GLint prefilterSlot) {
 	if(!m_cubemap)
 		return;
 
-	if(environmentSlot >= 0) {
-		gl->glActiveTexture(GL_TEXTURE0 + environmentSlot);
-		gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
-	}
+	if(environmentSlot >= 0)
+		state.bindTexture(static_cast<GLuint>(environmentSlot), GL_TEXTURE_CUBE_MAP, m_cubemap);
 
-	if(irradianceSlot >= 0) {
-		gl->glActiveTexture(GL_TEXTURE0 + irradianceSlot);
-		gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapIrradiance);
-	}
+	if(irradianceSlot >= 0)
+		state.bindTexture(static_cast<GLuint>(irradianceSlot), GL_TEXTURE_CUBE_MAP, m_cubemapIrradiance);
 
-	if(prefilterSlot >= 0) {
-		gl->glActiveTexture(GL_TEXTURE0 + prefilterSlot);
-		gl->glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapPrefilter);
-	}
+	if(prefilterSlot >= 0)
+		state.bindTexture(static_cast<GLuint>(prefilterSlot), GL_TEXTURE_CUBE_MAP, m_cubemapPrefilter);
 }
 
 }
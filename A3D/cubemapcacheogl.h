@@ -8,6 +8,7 @@
 namespace A3D {
 
 class RendererOGL;
+class GLStateCache;
 class CubemapCacheOGL : public CubemapCache {
 	Q_OBJECT
 public:
@@ -15,7 +16,7 @@ public:
 	~CubemapCacheOGL();
 
 	void update(RendererOGL*, CoreGLFunctions*);
-	void applyToSlot(CoreGLFunctions*, GLint environmentSlot, GLint irradianceSlot, GLint prefilterSlot);
+	void applyToSlot(GLStateCache&, GLint environmentSlot, GLint irradianceSlot, GLint prefilterSlot);
 
 private:
 	void calcIrradiance(GLenum format, RendererOGL*, CoreGLFunctions*);
@@ -0,0 +1,278 @@
+#include "A3D/dynamicaabbtree.h"
+
+namespace A3D {
+
+namespace {
+
+// Margin added around the boxes of the leaves, relative to their largest dimension
+constexpr float FatMarginRatio = 0.1f;
+
+inline QVector3D combinedMin(QVector3D const& a, QVector3D const& b) {
+	return QVector3D(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
+}
+inline QVector3D combinedMax(QVector3D const& a, QVector3D const& b) {
+	return QVector3D(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
+}
+
+inline bool contains(QVector3D const& outerMin, QVector3D const& outerMax, QVector3D const& min, QVector3D const& max) {
+	return outerMin.x() <= min.x() && outerMin.y() <= min.y() && outerMin.z() <= min.z() && max.x() <= outerMax.x() && max.y() <= outerMax.y() && max.z() <= outerMax.z();
+}
+
+}
+
+DynamicAabbTree::DynamicAabbTree()
+	: m_root(NullNode),
+	  m_freeList(NullNode),
+	  m_leafCount(0) {}
+
+std::uint32_t DynamicAabbTree::insert(QVector3D const& min, QVector3D const& max, std::uint32_t userData) {
+	QVector3D const size = max - min;
+	QVector3D const margin(1.f, 1.f, 1.f);
+	float const fatMargin = FatMarginRatio * std::max({ size.x(), size.y(), size.z() });
+
+	std::uint32_t const leaf = allocateNode();
+	Node& node               = m_nodes[leaf];
+	node.min                 = min - margin * fatMargin;
+	node.max                 = max + margin * fatMargin;
+	node.height              = 0;
+	node.userData            = userData;
+
+	insertLeaf(leaf);
+	++m_leafCount;
+	return leaf;
+}
+
+void DynamicAabbTree::remove(std::uint32_t leaf) {
+	removeLeaf(leaf);
+	freeNode(leaf);
+	--m_leafCount;
+}
+
+bool DynamicAabbTree::update(std::uint32_t leaf, QVector3D const& min, QVector3D const& max) {
+	if(contains(m_nodes[leaf].min, m_nodes[leaf].max, min, max))
+		return false;
+
+	std::uint32_t const userData = m_nodes[leaf].userData;
+	remove(leaf);
+	std::uint32_t const newLeaf = insert(min, max, userData);
+
+	// The freed node is the first one allocateNode() reuses, and the leaf ends up at the same id.
+	Q_ASSERT(newLeaf == leaf);
+	Q_UNUSED(newLeaf);
+	return true;
+}
+
+void DynamicAabbTree::clear() {
+	m_nodes.clear();
+	m_root      = NullNode;
+	m_freeList  = NullNode;
+	m_leafCount = 0;
+}
+
+std::uint32_t DynamicAabbTree::userData(std::uint32_t leaf) const {
+	return m_nodes[leaf].userData;
+}
+
+std::size_t DynamicAabbTree::leafCount() const {
+	return m_leafCount;
+}
+
+int DynamicAabbTree::height() const {
+	return m_root == NullNode ? 0 : m_nodes[m_root].height;
+}
+
+std::uint32_t DynamicAabbTree::allocateNode() {
+	std::uint32_t id = m_freeList;
+	if(id != NullNode)
+		m_freeList = m_nodes[id].parent;
+	else {
+		id = static_cast<std::uint32_t>(m_nodes.size());
+		m_nodes.emplace_back();
+	}
+
+	Node& node    = m_nodes[id];
+	node.parent   = NullNode;
+	node.child1   = NullNode;
+	node.child2   = NullNode;
+	node.height   = 0;
+	node.userData = 0;
+	return id;
+}
+
+void DynamicAabbTree::freeNode(std::uint32_t id) {
+	m_nodes[id].parent = m_freeList;
+	m_nodes[id].height = -1;
+	m_freeList         = id;
+}
+
+float DynamicAabbTree::surfaceArea(QVector3D const& min, QVector3D const& max) {
+	QVector3D const size = max - min;
+	return 2.f * (size.x() * size.y() + size.y() * size.z() + size.z() * size.x());
+}
+
+void DynamicAabbTree::insertLeaf(std::uint32_t leaf) {
+	if(m_root == NullNode) {
+		m_root               = leaf;
+		m_nodes[leaf].parent = NullNode;
+		return;
+	}
+
+	// Walks down to the sibling that increases the total surface area of the tree the least (Catto, Box2D).
+	QVector3D const leafMin = m_nodes[leaf].min;
+	QVector3D const leafMax = m_nodes[leaf].max;
+
+	std::uint32_t index = m_root;
+	while(!m_nodes[index].isLeaf()) {
+		Node const& node = m_nodes[index];
+
+		float const area         = surfaceArea(node.min, node.max);
+		float const combinedArea = surfaceArea(combinedMin(node.min, leafMin), combinedMax(node.max, leafMax));
+
+		// Cost of a new parent for this node and the leaf, and the cost of pushing the leaf further down
+		float const cost            = 2.f * combinedArea;
+		float const inheritanceCost = 2.f * (combinedArea - area);
+
+		auto descendCost = [&](std::uint32_t child) -> float {
+			Node const& c        = m_nodes[child];
+			float const enlarged = surfaceArea(combinedMin(c.min, leafMin), combinedMax(c.max, leafMax));
+			return (c.isLeaf() ? enlarged : enlarged - surfaceArea(c.min, c.max)) + inheritanceCost;
+		};
+		float const cost1 = descendCost(node.child1);
+		float const cost2 = descendCost(node.child2);
+
+		if(cost < cost1 && cost < cost2)
+			break;
+		index = (cost1 < cost2) ? node.child1 : node.child2;
+	}
+
+	std::uint32_t const sibling   = index;
+	std::uint32_t const oldParent = m_nodes[sibling].parent;
+	std::uint32_t const newParent = allocateNode();
+
+	Node& parent  = m_nodes[newParent];
+	parent.parent = oldParent;
+	parent.min    = combinedMin(leafMin, m_nodes[sibling].min);
+	parent.max    = combinedMax(leafMax, m_nodes[sibling].max);
+	parent.height = m_nodes[sibling].height + 1;
+	parent.child1 = sibling;
+	parent.child2 = leaf;
+
+	if(oldParent != NullNode) {
+		if(m_nodes[oldParent].child1 == sibling)
+			m_nodes[oldParent].child1 = newParent;
+		else
+			m_nodes[oldParent].child2 = newParent;
+	}
+	else
+		m_root = newParent;
+
+	m_nodes[sibling].parent = newParent;
+	m_nodes[leaf].parent    = newParent;
+
+	refitUpwards(m_nodes[leaf].parent);
+}
+
+void DynamicAabbTree::removeLeaf(std::uint32_t leaf) {
+	if(leaf == m_root) {
+		m_root = NullNode;
+		return;
+	}
+
+	std::uint32_t const parent      = m_nodes[leaf].parent;
+	std::uint32_t const grandParent = m_nodes[parent].parent;
+	std::uint32_t const sibling     = (m_nodes[parent].child1 == leaf) ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+	// The sibling takes the place of the parent
+	if(grandParent != NullNode) {
+		if(m_nodes[grandParent].child1 == parent)
+			m_nodes[grandParent].child1 = sibling;
+		else
+			m_nodes[grandParent].child2 = sibling;
+		m_nodes[sibling].parent = grandParent;
+		freeNode(parent);
+
+		refitUpwards(grandParent);
+	}
+	else {
+		m_root                  = sibling;
+		m_nodes[sibling].parent = NullNode;
+		freeNode(parent);
+	}
+}
+
+void DynamicAabbTree::refitUpwards(std::uint32_t index) {
+	while(index != NullNode) {
+		index = balance(index);
+
+		Node& node         = m_nodes[index];
+		Node const& child1 = m_nodes[node.child1];
+		Node const& child2 = m_nodes[node.child2];
+		node.height        = 1 + std::max(child1.height, child2.height);
+		node.min           = combinedMin(child1.min, child2.min);
+		node.max           = combinedMax(child1.max, child2.max);
+
+		index = node.parent;
+	}
+}
+
+std::uint32_t DynamicAabbTree::balance(std::uint32_t iA) {
+	Node& a = m_nodes[iA];
+	if(a.isLeaf() || a.height < 2)
+		return iA;
+
+	std::uint32_t const iB = a.child1;
+	std::uint32_t const iC = a.child2;
+	Node& b                = m_nodes[iB];
+	Node& c                = m_nodes[iC];
+
+	int const balance = c.height - b.height;
+
+	// Rotates the higher child up, in place of A. A keeps the lower one, and the lower of the grandchildren.
+	auto rotateUp = [&](std::uint32_t iUp, Node& up, Node& other, bool upIsChild2) -> std::uint32_t {
+		std::uint32_t const iF = up.child1;
+		std::uint32_t const iG = up.child2;
+		Node& f                = m_nodes[iF];
+		Node& g                = m_nodes[iG];
+
+		up.child1 = iA;
+		up.parent = a.parent;
+		a.parent  = iUp;
+
+		if(up.parent != NullNode) {
+			if(m_nodes[up.parent].child1 == iA)
+				m_nodes[up.parent].child1 = iUp;
+			else
+				m_nodes[up.parent].child2 = iUp;
+		}
+		else
+			m_root = iUp;
+
+		std::uint32_t const iKept  = (f.height > g.height) ? iF : iG;
+		std::uint32_t const iMoved = (f.height > g.height) ? iG : iF;
+		Node& kept                 = m_nodes[iKept];
+		Node& moved                = m_nodes[iMoved];
+
+		up.child2 = iKept;
+		if(upIsChild2)
+			a.child2 = iMoved;
+		else
+			a.child1 = iMoved;
+		moved.parent = iA;
+
+		a.min     = combinedMin(other.min, moved.min);
+		a.max     = combinedMax(other.max, moved.max);
+		a.height  = 1 + std::max(other.height, moved.height);
+		up.min    = combinedMin(a.min, kept.min);
+		up.max    = combinedMax(a.max, kept.max);
+		up.height = 1 + std::max(a.height, kept.height);
+		return iUp;
+	};
+
+	if(balance > 1)
+		return rotateUp(iC, c, b, true);
+	if(balance < -1)
+		return rotateUp(iB, b, c, false);
+	return iA;
+}
+
+}
@@ -0,0 +1,262 @@
+#ifndef A3DDYNAMICAABBTREE_H
+#define A3DDYNAMICAABBTREE_H
+
+#include "A3D/common.h"
+#include "A3D/frustum.h"
+#include <cmath>
+#include <cstdint>
+#include <queue>
+
+namespace A3D {
+
+// Bounding volume hierarchy of axis-aligned boxes, with insertions, removals and moves, kept balanced with tree rotations.
+// Leaves store a slightly larger copy of their box, so that objects moving a little do not change the tree.
+class DynamicAabbTree {
+public:
+	static constexpr std::uint32_t NullNode = std::numeric_limits<std::uint32_t>::max();
+
+	DynamicAabbTree();
+
+	// Returns the id of the new leaf, which stays valid until it is removed.
+	std::uint32_t insert(QVector3D const& min, QVector3D const& max, std::uint32_t userData);
+	void remove(std::uint32_t leaf);
+
+	// Returns false when the box still fits in the enlarged box of the leaf, and nothing had to change.
+	bool update(std::uint32_t leaf, QVector3D const& min, QVector3D const& max);
+
+	void clear();
+
+	std::uint32_t userData(std::uint32_t leaf) const;
+	std::size_t leafCount() const;
+
+	// Number of levels below the root, 0 for an empty tree or a single leaf
+	int height() const;
+
+	// The queries test the enlarged boxes of the leaves, the caller refines the results if it needs to.
+
+	// visit(userData) for every leaf overlapping the box.
+	template <typename F>
+	void queryBox(QVector3D const& min, QVector3D const& max, F&& visit) const {
+		std::vector<std::uint32_t> stack;
+		if(m_root != NullNode)
+			stack.push_back(m_root);
+
+		while(!stack.empty()) {
+			Node const& node = m_nodes[stack.back()];
+			stack.pop_back();
+			if(!overlaps(node.min, node.max, min, max))
+				continue;
+
+			if(node.isLeaf())
+				visit(node.userData);
+			else {
+				stack.push_back(node.child1);
+				stack.push_back(node.child2);
+			}
+		}
+	}
+
+	// visit(userData) for every leaf overlapping the sphere.
+	template <typename F>
+	void querySphere(QVector3D const& center, float radius, F&& visit) const {
+		std::vector<std::uint32_t> stack;
+		if(m_root != NullNode)
+			stack.push_back(m_root);
+
+		float const radiusSquared = radius * radius;
+		while(!stack.empty()) {
+			Node const& node = m_nodes[stack.back()];
+			stack.pop_back();
+			if(distanceSquared(center, node.min, node.max) > radiusSquared)
+				continue;
+
+			if(node.isLeaf())
+				visit(node.userData);
+			else {
+				stack.push_back(node.child1);
+				stack.push_back(node.child2);
+			}
+		}
+	}
+
+	// visit(userData, contained) for every leaf of the nodes that are not outside the frustum.
+	// contained is true when the leaf is known to be entirely inside; otherwise only one of its ancestors intersected it.
+	template <typename F>
+	void queryFrustum(Frustum const& frustum, F&& visit) const {
+		struct Entry {
+			std::uint32_t node;
+			unsigned planeMask;
+		};
+		std::vector<Entry> stack;
+		std::vector<std::uint32_t> containedStack;
+		if(m_root != NullNode)
+			stack.push_back(Entry{ m_root, Frustum::AllPlanes });
+
+		while(!stack.empty()) {
+			Entry entry = stack.back();
+			stack.pop_back();
+
+			Node const& node                   = m_nodes[entry.node];
+			Frustum::Containment const content = frustum.classifyBox(node.min, node.max, entry.planeMask);
+			if(content == Frustum::Outside)
+				continue;
+
+			if(content == Frustum::Inside) {
+				// Everything below is visible, without any more tests
+				containedStack.push_back(entry.node);
+				while(!containedStack.empty()) {
+					Node const& contained = m_nodes[containedStack.back()];
+					containedStack.pop_back();
+					if(contained.isLeaf())
+						visit(contained.userData, true);
+					else {
+						containedStack.push_back(contained.child1);
+						containedStack.push_back(contained.child2);
+					}
+				}
+			}
+			else if(node.isLeaf())
+				visit(node.userData, false);
+			else {
+				stack.push_back(Entry{ node.child1, entry.planeMask });
+				stack.push_back(Entry{ node.child2, entry.planeMask });
+			}
+		}
+	}
+
+	// Visits the leaves by increasing distance from the point: visit(userData, distance) until it returns false.
+	// leafDistance(userData) gives the exact distance of a leaf, which must not be smaller than the distance to its box.
+	template <typename D, typename F>
+	void queryNearest(QVector3D const& point, D&& leafDistance, F&& visit) const {
+		struct Entry {
+			float distance;
+			std::uint32_t node;
+			bool exact;
+
+			bool operator>(Entry const& o) const { return distance > o.distance; }
+		};
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+		if(m_root != NullNode)
+			queue.push(Entry{ std::sqrt(distanceSquared(point, m_nodes[m_root].min, m_nodes[m_root].max)), m_root, false });
+
+		while(!queue.empty()) {
+			Entry const entry = queue.top();
+			queue.pop();
+
+			Node const& node = m_nodes[entry.node];
+			if(entry.exact) {
+				if(!visit(node.userData, entry.distance))
+					return;
+			}
+			else if(node.isLeaf())
+				queue.push(Entry{ leafDistance(node.userData), entry.node, true });
+			else {
+				queue.push(Entry{ std::sqrt(distanceSquared(point, m_nodes[node.child1].min, m_nodes[node.child1].max)), node.child1, false });
+				queue.push(Entry{ std::sqrt(distanceSquared(point, m_nodes[node.child2].min, m_nodes[node.child2].max)), node.child2, false });
+			}
+		}
+	}
+
+	// Visits the leaves the ray origin + t * direction crosses for t in [0, maxDistance], by increasing entry distance t.
+	// visit(userData, entryDistance) returns the new maxDistance, e.g. the distance of the closest hit so far.
+	template <typename F>
+	void queryRay(QVector3D const& origin, QVector3D const& direction, float maxDistance, F&& visit) const {
+		struct Entry {
+			float distance;
+			std::uint32_t node;
+
+			bool operator>(Entry const& o) const { return distance > o.distance; }
+		};
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+
+		// Null components are nudged, so that the slab tests never compute 0 * infinity.
+		QVector3D invDirection;
+		for(int axis = 0; axis < 3; ++axis)
+			invDirection[axis] = 1.f / (std::fabs(direction[axis]) > 1e-20f ? direction[axis] : std::copysign(1e-20f, direction[axis]));
+
+		auto push = [&](std::uint32_t node) {
+			float const distance = rayEntry(origin, invDirection, m_nodes[node].min, m_nodes[node].max, maxDistance);
+			if(distance <= maxDistance)
+				queue.push(Entry{ distance, node });
+		};
+		if(m_root != NullNode)
+			push(m_root);
+
+		while(!queue.empty() && queue.top().distance <= maxDistance) {
+			Entry const entry = queue.top();
+			queue.pop();
+
+			Node const& node = m_nodes[entry.node];
+			if(node.isLeaf()) {
+				maxDistance = visit(node.userData, entry.distance);
+				continue;
+			}
+
+			push(node.child1);
+			push(node.child2);
+		}
+	}
+
+	// Distance along a ray at which it enters the box, or infinity when it misses it within [0, maxDistance].
+	static inline float rayEntry(QVector3D const& origin, QVector3D const& invDirection, QVector3D const& min, QVector3D const& max, float maxDistance) {
+		float enter = 0.f;
+		float exit  = maxDistance;
+		for(int axis = 0; axis < 3; ++axis) {
+			float const t1 = (min[axis] - origin[axis]) * invDirection[axis];
+			float const t2 = (max[axis] - origin[axis]) * invDirection[axis];
+			enter          = std::max(enter, std::min(t1, t2));
+			exit           = std::min(exit, std::max(t1, t2));
+		}
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+
+	// Squared distance from a point to a box, 0 when the point is inside.
+	static inline float distanceSquared(QVector3D const& point, QVector3D const& min, QVector3D const& max) {
+		float const dx = std::max({ min.x() - point.x(), 0.f, point.x() - max.x() });
+		float const dy = std::max({ min.y() - point.y(), 0.f, point.y() - max.y() });
+		float const dz = std::max({ min.z() - point.z(), 0.f, point.z() - max.z() });
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	static inline bool overlaps(QVector3D const& minA, QVector3D const& maxA, QVector3D const& minB, QVector3D const& maxB) {
+		return minA.x() <= maxB.x() && minB.x() <= maxA.x() && minA.y() <= maxB.y() && minB.y() <= maxA.y() && minA.z() <= maxB.z() && minB.z() <= maxA.z();
+	}
+
+private:
+	struct Node {
+		QVector3D min;
+		QVector3D max;
+
+		// Parent node, or the next unused node when this one is unused
+		std::uint32_t parent;
+		std::uint32_t child1;
+		std::uint32_t child2;
+
+		// 0 for leaves, -1 for unused nodes
+		int height;
+		std::uint32_t userData;
+
+		inline bool isLeaf() const { return child1 == NullNode; }
+	};
+
+	std::uint32_t allocateNode();
+	void freeNode(std::uint32_t);
+
+	void insertLeaf(std::uint32_t leaf);
+	void removeLeaf(std::uint32_t leaf);
+
+	// Recomputes the boxes and heights from the node up to the root, rotating unbalanced nodes on the way.
+	void refitUpwards(std::uint32_t node);
+	std::uint32_t balance(std::uint32_t node);
+
+	static float surfaceArea(QVector3D const& min, QVector3D const& max);
+
+	std::vector<Node> m_nodes;
+	std::uint32_t m_root;
+	std::uint32_t m_freeList;
+	std::size_t m_leafCount;
+};
+
+}
+
+#endif // A3DDYNAMICAABBTREE_H
@@ -1,25 +1,37 @@
 #include "A3D/entity.h"
+#include "A3D/scene.h"
 
 namespace A3D {
 
 Entity::Entity(Entity* parent)
 	: QObject{ parent },
+	  m_scene(parent ? parent->m_scene : nullptr),
 	  m_parent(parent),
 	  m_renderOptions(NoOptions),
 	  m_scale(1.f, 1.f, 1.f),
-	  m_matrixDirty(true) {
+	  m_matrixDirty(true),
+	  m_worldMatrixDirty(true) {
 	log(LC_Debug, "Constructor: Entity");
 }
 
 Entity::~Entity() {
 	log(LC_Debug, "Destructor: Entity");
+
+	// The children are still alive here, the scene forgets them too.
+	if(m_scene && static_cast<Entity*>(m_scene.data()) != this)
+		m_scene->entityRemoved(this);
+	if(m_model)
+		m_model->removeEntity(this);
 }
 
 Entity::RenderOptions Entity::renderOptions() const {
 	return m_renderOptions;
 }
 void Entity::setRenderOptions(RenderOptions renderOptions) {
+	if(m_renderOptions == renderOptions)
+		return;
 	m_renderOptions = renderOptions;
+	markIndexDirty();
 }
 
 Entity* Entity::parentEntity() const {
@@ -33,10 +45,23 @@ std::vector<QPointer<Entity>> const& Entity::childrenEntities() const {
 void Entity::addChildEntity(Entity* entity) {
 	cleanupQPointers(m_entities);
 	m_entities.emplace_back(entity);
+	entity->markIndexDirty();
+}
+
+void Entity::markIndexDirty() {
+	if(m_scene)
+		m_scene->entityChanged(this);
 }
 
 void Entity::setModel(Model* model) {
+	if(m_model == model)
+		return;
+	if(m_model)
+		m_model->removeEntity(this);
 	m_model = model;
+	if(m_model)
+		m_model->addEntity(this);
+	markIndexDirty();
 }
 Model* Entity::model() const {
 	return m_model;
@@ -47,6 +72,8 @@ void Entity::setPosition(QVector3D const& pos) {
 		return;
 	m_position    = pos;
 	m_matrixDirty = true;
+	markWorldMatrixDirty();
+	markIndexDirty();
 }
 QVector3D Entity::position() const {
 	return m_position;
@@ -57,6 +84,8 @@ void Entity::setRotation(QQuaternion const& rot) {
 		return;
 	m_rotation    = rot;
 	m_matrixDirty = true;
+	markWorldMatrixDirty();
+	markIndexDirty();
 }
 QQuaternion Entity::rotation() const {
 	return m_rotation;
@@ -67,6 +96,8 @@ void Entity::setScale(QVector3D const& scale) {
 		return;
 	m_scale       = scale;
 	m_matrixDirty = true;
+	markWorldMatrixDirty();
+	markIndexDirty();
 }
 QVector3D Entity::scale() const {
 	return m_scale;
@@ -83,6 +114,26 @@ QMatrix4x4 const& Entity::entityMatrix() const {
 	return m_matrix;
 }
 
+QMatrix4x4 const& Entity::worldMatrix() const {
+	if(m_worldMatrixDirty) {
+		m_worldMatrixDirty = false;
+		m_worldMatrix      = m_parent ? m_parent->worldMatrix() * entityMatrix() : entityMatrix();
+		if(m_scene)
+			++m_scene->m_transformUpdateCount;
+	}
+	return m_worldMatrix;
+}
+
+void Entity::markWorldMatrixDirty() {
+	if(m_worldMatrixDirty)
+		return;
+	m_worldMatrixDirty = true;
+	for(auto it = m_entities.begin(); it != m_entities.end(); ++it) {
+		if(!it->isNull())
+			(*it)->markWorldMatrixDirty();
+	}
+}
+
 void Entity::addController(EntityController* ec) {
 	removeController(ec);
 	m_entityControllers.push_back(ec);
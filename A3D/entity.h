@@ -11,6 +11,8 @@
 
 namespace A3D {
 
+class Scene;
+
 class Entity : public QObject {
 	Q_OBJECT
 
@@ -60,6 +62,9 @@ public:
 
 	QMatrix4x4 const& entityMatrix() const;
 
+	// entityMatrix() combined with those of the parents. Kept until this entity or one of its parents moves.
+	QMatrix4x4 const& worldMatrix() const;
+
 	void addController(EntityController*);
 	void removeController(EntityController*);
 
@@ -68,9 +73,19 @@ protected:
 	bool updateEntity(std::chrono::milliseconds);
 
 private:
+	friend class Scene;
+	friend class Model;
+
 	// Adds a child Entity
 	void addChildEntity(Entity*);
 
+	// Tells the scene to index the entity and its children again.
+	void markIndexDirty();
+
+	// The world matrices below a dirty one are always dirty too.
+	void markWorldMatrixDirty();
+
+	QPointer<Scene> m_scene;
 	QPointer<Entity> m_parent;
 	std::vector<QPointer<Entity>> m_entities;
 	std::vector<QPointer<EntityController>> m_entityControllers;
@@ -78,6 +93,8 @@ private:
 
 	mutable bool m_matrixDirty;
 	mutable QMatrix4x4 m_matrix;
+	mutable bool m_worldMatrixDirty;
+	mutable QMatrix4x4 m_worldMatrix;
 
 	QVector3D m_position;
 	QQuaternion m_rotation;
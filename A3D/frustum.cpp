@@ -0,0 +1,121 @@
+#include "A3D/frustum.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define A3D_FRUSTUM_SSE
+#endif
+
+namespace A3D {
+
+Frustum::Frustum() {
+	for(std::size_t i = 0; i < PlaneCount; ++i)
+		m_planes[i] = QVector4D(0.f, 0.f, 0.f, std::numeric_limits<float>::max());
+}
+
+Frustum::Frustum(QMatrix4x4 const& viewProjection) {
+	QVector4D const x = viewProjection.row(0);
+	QVector4D const y = viewProjection.row(1);
+	QVector4D const z = viewProjection.row(2);
+	QVector4D const w = viewProjection.row(3);
+
+	m_planes[LeftPlane]   = w + x;
+	m_planes[RightPlane]  = w - x;
+	m_planes[BottomPlane] = w + y;
+	m_planes[TopPlane]    = w - y;
+	m_planes[NearPlane]   = w + z;
+	m_planes[FarPlane]    = w - z;
+
+	for(std::size_t i = 0; i < PlaneCount; ++i) {
+		float const length = m_planes[i].toVector3D().length();
+		if(length > 0.f)
+			m_planes[i] /= length;
+	}
+}
+
+QVector4D const& Frustum::plane(Plane p) const {
+	return m_planes[p];
+}
+
+bool Frustum::intersectsSphere(QVector3D const& center, float radius) const {
+	for(std::size_t i = 0; i < PlaneCount; ++i) {
+		if(QVector3D::dotProduct(m_planes[i].toVector3D(), center) + m_planes[i].w() < -radius)
+			return false;
+	}
+	return true;
+}
+
+bool Frustum::intersectsBox(QVector3D const& min, QVector3D const& max) const {
+	unsigned planeMask = AllPlanes;
+	return classifyBox(min, max, planeMask) != Outside;
+}
+
+Frustum::Containment Frustum::classifyBox(QVector3D const& min, QVector3D const& max, unsigned& planeMask) const {
+	Containment result = Inside;
+	for(std::size_t i = 0; i < PlaneCount; ++i) {
+		unsigned const bit = 1u << i;
+		if(!(planeMask & bit))
+			continue;
+
+		// Corners of the box the farthest along the plane normal, and against it
+		QVector3D const normal = m_planes[i].toVector3D();
+		QVector3D const farthest(normal.x() >= 0.f ? max.x() : min.x(), normal.y() >= 0.f ? max.y() : min.y(), normal.z() >= 0.f ? max.z() : min.z());
+		QVector3D const nearest(normal.x() >= 0.f ? min.x() : max.x(), normal.y() >= 0.f ? min.y() : max.y(), normal.z() >= 0.f ? min.z() : max.z());
+
+		if(QVector3D::dotProduct(normal, farthest) + m_planes[i].w() < 0.f)
+			return Outside;
+		if(QVector3D::dotProduct(normal, nearest) + m_planes[i].w() >= 0.f)
+			planeMask &= ~bit;
+		else
+			result = Intersecting;
+	}
+	return result;
+}
+
+std::size_t Frustum::cullSpheres(float const* x, float const* y, float const* z, float const* radius, std::size_t count, std::uint8_t* visible) const {
+	std::size_t visibleCount = 0;
+	std::size_t i            = 0;
+
+#ifdef A3D_FRUSTUM_SSE
+	__m128 planeX[PlaneCount];
+	__m128 planeY[PlaneCount];
+	__m128 planeZ[PlaneCount];
+	__m128 planeW[PlaneCount];
+	for(std::size_t p = 0; p < PlaneCount; ++p) {
+		planeX[p] = _mm_set1_ps(m_planes[p].x());
+		planeY[p] = _mm_set1_ps(m_planes[p].y());
+		planeZ[p] = _mm_set1_ps(m_planes[p].z());
+		planeW[p] = _mm_set1_ps(m_planes[p].w());
+	}
+
+	__m128 const zero = _mm_setzero_ps();
+	for(; i + 4 <= count; i += 4) {
+		__m128 const cx = _mm_loadu_ps(x + i);
+		__m128 const cy = _mm_loadu_ps(y + i);
+		__m128 const cz = _mm_loadu_ps(z + i);
+		__m128 const r  = _mm_loadu_ps(radius + i);
+
+		// Smallest signed distance of the spheres to the planes, a sphere is outside when it is below zero.
+		__m128 distance = _mm_set1_ps(std::numeric_limits<float>::max());
+		for(std::size_t p = 0; p < PlaneCount; ++p) {
+			__m128 d = _mm_add_ps(_mm_mul_ps(cx, planeX[p]), planeW[p]);
+			d        = _mm_add_ps(d, _mm_mul_ps(cy, planeY[p]));
+			d        = _mm_add_ps(d, _mm_mul_ps(cz, planeZ[p]));
+			distance = _mm_min_ps(distance, _mm_add_ps(d, r));
+		}
+
+		int const mask = _mm_movemask_ps(_mm_cmpge_ps(distance, zero));
+		for(std::size_t k = 0; k < 4; ++k) {
+			visible[i + k] = static_cast<std::uint8_t>((mask >> k) & 1);
+			visibleCount += visible[i + k];
+		}
+	}
+#endif
+
+	for(; i < count; ++i) {
+		visible[i] = intersectsSphere(QVector3D(x[i], y[i], z[i]), radius[i]) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef A3DFRUSTUM_H
+#define A3DFRUSTUM_H
+
+#include "A3D/common.h"
+#include <cstdint>
+
+namespace A3D {
+
+// View frustum as six world space planes (a, b, c, d) with unit normals pointing inwards:
+// a point p is on the inner side of a plane when a * p.x + b * p.y + c * p.z + d >= 0.
+class Frustum {
+public:
+	enum Plane {
+		LeftPlane,
+		RightPlane,
+		BottomPlane,
+		TopPlane,
+		NearPlane,
+		FarPlane,
+
+		PlaneCount,
+	};
+
+	static constexpr unsigned AllPlanes = (1u << PlaneCount) - 1;
+
+	enum Containment {
+		Outside,
+		Intersecting,
+		Inside,
+	};
+
+	// Everything is inside a default-constructed frustum.
+	Frustum();
+
+	// Extracts the planes of a projection * view matrix (Gribb / Hartmann).
+	explicit Frustum(QMatrix4x4 const& viewProjection);
+
+	QVector4D const& plane(Plane) const;
+
+	bool intersectsSphere(QVector3D const& center, float radius) const;
+	bool intersectsBox(QVector3D const& min, QVector3D const& max) const;
+
+	// Only tests the planes in planeMask (bit i for plane i), and clears the bits of the planes the box is entirely inside of,
+	// so that the children of a box in a hierarchy do not test them again.
+	Containment classifyBox(QVector3D const& min, QVector3D const& max, unsigned& planeMask) const;
+
+	// Tests count spheres at once, given as separate coordinate arrays, four at a time with SSE when available.
+	// visible[i] is set to 1 when sphere i intersects the frustum, 0 otherwise. Returns the number of visible spheres.
+	std::size_t cullSpheres(float const* x, float const* y, float const* z, float const* radius, std::size_t count, std::uint8_t* visible) const;
+
+private:
+	QVector4D m_planes[PlaneCount];
+};
+
+}
+
+#endif // A3DFRUSTUM_H
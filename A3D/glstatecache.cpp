@@ -0,0 +1,282 @@
+#include "A3D/glstatecache.h"
+
+namespace A3D {
+
+GLStateCache::GLStateCache(CoreGLFunctions* gl)
+	: m_gl(gl),
+	  m_state(),
+	  m_stack(),
+	  m_counters() {
+	forgetState(m_state);
+}
+
+GLenum GLStateCache::featureEnum(Feature feature) {
+	switch(feature) {
+	case DepthTest:
+		return GL_DEPTH_TEST;
+	case CullFace:
+		return GL_CULL_FACE;
+	case Blend:
+		return GL_BLEND;
+	case Multisample:
+		return GL_MULTISAMPLE;
+	case CubemapSeamless:
+		return GL_TEXTURE_CUBE_MAP_SEAMLESS;
+	default:
+		return GL_NONE;
+	}
+}
+
+void GLStateCache::forgetBindings(State& state) {
+	state.program       = Unknown;
+	state.vertexArray   = Unknown;
+	state.activeTexture = Unknown;
+	for(int i = 0; i < MaxUniformBufferBindings; ++i) {
+		state.uniformBuffers[i]       = Unknown;
+		state.uniformBufferOffsets[i] = 0;
+		state.uniformBufferSizes[i]   = 0;
+	}
+	for(int i = 0; i < MaxTextureUnits; ++i) {
+		state.textures2D[i]      = Unknown;
+		state.texturesCubemap[i] = Unknown;
+		state.texturesBuffer[i]  = Unknown;
+	}
+}
+
+void GLStateCache::forgetState(State& state) {
+	forgetBindings(state);
+	for(int i = 0; i < FeatureCount; ++i)
+		state.features[i] = Unknown;
+	state.depthMask        = Unknown;
+	state.colorMask        = Unknown;
+	state.depthFunc        = Unknown;
+	state.blendSource      = Unknown;
+	state.blendDestination = Unknown;
+	state.viewportKnown    = false;
+	state.drawFramebuffer  = Unknown;
+	state.readFramebuffer  = Unknown;
+}
+
+void GLStateCache::sync() {
+	GLint drawFramebuffer = 0;
+	GLint readFramebuffer = 0;
+	m_gl->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+	m_gl->glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	m_gl->glGetIntegerv(GL_VIEWPORT, m_state.viewport);
+
+	forgetState(m_state);
+	m_state.viewportKnown   = true;
+	m_state.drawFramebuffer = static_cast<GLuint>(drawFramebuffer);
+	m_state.readFramebuffer = static_cast<GLuint>(readFramebuffer);
+}
+
+void GLStateCache::invalidateBindings() {
+	forgetBindings(m_state);
+}
+
+void GLStateCache::useProgram(GLuint program) {
+	if(changes(m_state.program, program))
+		m_gl->glUseProgram(program);
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray) {
+	if(changes(m_state.vertexArray, vertexArray))
+		m_gl->glBindVertexArray(vertexArray);
+}
+
+void GLStateCache::bindUniformBuffer(GLuint index, GLuint buffer) {
+	bindUniformBufferRange(index, buffer, 0, 0);
+}
+
+void GLStateCache::bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+	if(index < MaxUniformBufferBindings) {
+		if(m_state.uniformBuffers[index] == buffer && m_state.uniformBufferOffsets[index] == offset && m_state.uniformBufferSizes[index] == size) {
+			++m_counters.filteredCalls;
+			return;
+		}
+
+		m_state.uniformBuffers[index]       = buffer;
+		m_state.uniformBufferOffsets[index] = offset;
+		m_state.uniformBufferSizes[index]   = size;
+	}
+
+	++m_counters.issuedCalls;
+	if(size)
+		m_gl->glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+	else
+		m_gl->glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+}
+
+void GLStateCache::activeTexture(GLuint unit) {
+	if(changes(m_state.activeTexture, unit))
+		m_gl->glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+	GLuint* binding = nullptr;
+	if(unit < MaxTextureUnits) {
+		if(target == GL_TEXTURE_2D)
+			binding = &m_state.textures2D[unit];
+		else if(target == GL_TEXTURE_CUBE_MAP)
+			binding = &m_state.texturesCubemap[unit];
+		else if(target == GL_TEXTURE_BUFFER)
+			binding = &m_state.texturesBuffer[unit];
+	}
+
+	if(binding && !changes(*binding, texture))
+		return;
+	if(!binding)
+		++m_counters.issuedCalls;
+
+	activeTexture(unit);
+	m_gl->glBindTexture(target, texture);
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture) {
+	bindTexture(m_state.activeTexture != Unknown ? m_state.activeTexture : 0, target, texture);
+}
+
+void GLStateCache::setEnabled(Feature feature, bool enabled) {
+	if(!changes(m_state.features[feature], enabled ? GL_TRUE : GL_FALSE))
+		return;
+
+	if(enabled)
+		m_gl->glEnable(featureEnum(feature));
+	else
+		m_gl->glDisable(featureEnum(feature));
+}
+
+void GLStateCache::setDepthMask(bool enabled) {
+	if(changes(m_state.depthMask, enabled ? GL_TRUE : GL_FALSE))
+		m_gl->glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void GLStateCache::setColorMask(bool enabled) {
+	GLboolean const mask = enabled ? GL_TRUE : GL_FALSE;
+	if(changes(m_state.colorMask, mask))
+		m_gl->glColorMask(mask, mask, mask, mask);
+}
+
+void GLStateCache::setDepthFunc(GLenum func) {
+	if(changes(m_state.depthFunc, func))
+		m_gl->glDepthFunc(func);
+}
+
+void GLStateCache::setBlendFunc(GLenum source, GLenum destination) {
+	if(m_state.blendSource == source && m_state.blendDestination == destination) {
+		++m_counters.filteredCalls;
+		return;
+	}
+
+	++m_counters.issuedCalls;
+	m_state.blendSource      = source;
+	m_state.blendDestination = destination;
+	m_gl->glBlendFunc(source, destination);
+}
+
+void GLStateCache::setViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+	if(m_state.viewportKnown && m_state.viewport[0] == x && m_state.viewport[1] == y && m_state.viewport[2] == width && m_state.viewport[3] == height) {
+		++m_counters.filteredCalls;
+		return;
+	}
+
+	++m_counters.issuedCalls;
+	m_state.viewport[0]   = x;
+	m_state.viewport[1]   = y;
+	m_state.viewport[2]   = width;
+	m_state.viewport[3]   = height;
+	m_state.viewportKnown = true;
+	m_gl->glViewport(x, y, width, height);
+}
+
+void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer) {
+	switch(target) {
+	case GL_DRAW_FRAMEBUFFER: {
+		if(changes(m_state.drawFramebuffer, framebuffer))
+			m_gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	} break;
+	case GL_READ_FRAMEBUFFER: {
+		if(changes(m_state.readFramebuffer, framebuffer))
+			m_gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	} break;
+	default: {
+		if(m_state.drawFramebuffer == framebuffer && m_state.readFramebuffer == framebuffer) {
+			++m_counters.filteredCalls;
+			return;
+		}
+
+		++m_counters.issuedCalls;
+		m_state.drawFramebuffer = framebuffer;
+		m_state.readFramebuffer = framebuffer;
+		m_gl->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	} break;
+	}
+}
+
+void GLStateCache::push() {
+	m_stack.push_back(m_state);
+}
+
+void GLStateCache::pop() {
+	if(m_stack.empty())
+		return;
+
+	State const saved = m_stack.back();
+	m_stack.pop_back();
+
+	// What was unknown when the state was saved cannot be restored: it stays unknown.
+	auto restore = [&](GLuint& current, GLuint value, auto apply) {
+		if(value == Unknown)
+			current = Unknown;
+		else
+			apply(value);
+	};
+
+	restore(m_state.drawFramebuffer, saved.drawFramebuffer, [&](GLuint v) { bindFramebuffer(GL_DRAW_FRAMEBUFFER, v); });
+	restore(m_state.readFramebuffer, saved.readFramebuffer, [&](GLuint v) { bindFramebuffer(GL_READ_FRAMEBUFFER, v); });
+	if(saved.viewportKnown)
+		setViewport(saved.viewport[0], saved.viewport[1], saved.viewport[2], saved.viewport[3]);
+	else
+		m_state.viewportKnown = false;
+
+	for(int i = 0; i < FeatureCount; ++i)
+		restore(m_state.features[i], saved.features[i], [&](GLuint v) { setEnabled(static_cast<Feature>(i), v == GL_TRUE); });
+	restore(m_state.depthMask, saved.depthMask, [&](GLuint v) { setDepthMask(v == GL_TRUE); });
+	restore(m_state.colorMask, saved.colorMask, [&](GLuint v) { setColorMask(v == GL_TRUE); });
+	restore(m_state.depthFunc, saved.depthFunc, [&](GLuint v) { setDepthFunc(v); });
+	if(saved.blendSource == Unknown || saved.blendDestination == Unknown) {
+		m_state.blendSource      = Unknown;
+		m_state.blendDestination = Unknown;
+	}
+	else
+		setBlendFunc(saved.blendSource, saved.blendDestination);
+
+	restore(m_state.program, saved.program, [&](GLuint v) { useProgram(v); });
+	restore(m_state.vertexArray, saved.vertexArray, [&](GLuint v) { bindVertexArray(v); });
+	for(GLuint i = 0; i < MaxUniformBufferBindings; ++i)
+		restore(m_state.uniformBuffers[i], saved.uniformBuffers[i], [&](GLuint v) { bindUniformBufferRange(i, v, saved.uniformBufferOffsets[i], saved.uniformBufferSizes[i]); });
+	for(GLuint i = 0; i < MaxTextureUnits; ++i) {
+		restore(m_state.textures2D[i], saved.textures2D[i], [&](GLuint v) { bindTexture(i, GL_TEXTURE_2D, v); });
+		restore(m_state.texturesCubemap[i], saved.texturesCubemap[i], [&](GLuint v) { bindTexture(i, GL_TEXTURE_CUBE_MAP, v); });
+		restore(m_state.texturesBuffer[i], saved.texturesBuffer[i], [&](GLuint v) { bindTexture(i, GL_TEXTURE_BUFFER, v); });
+	}
+	restore(m_state.activeTexture, saved.activeTexture, [&](GLuint v) { activeTexture(v); });
+}
+
+bool GLStateCache::isStackEmpty() const {
+	return m_stack.empty();
+}
+
+std::size_t GLStateCache::stackSize() const {
+	return m_stack.size();
+}
+
+GLStateCache::Counters const& GLStateCache::counters() const {
+	return m_counters;
+}
+
+void GLStateCache::resetCounters() {
+	m_counters = Counters();
+}
+
+}
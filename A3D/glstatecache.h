@@ -0,0 +1,132 @@
+#ifndef A3DGLSTATECACHE_H
+#define A3DGLSTATECACHE_H
+
+#include "A3D/common.h"
+#include <cstdint>
+#include <vector>
+
+namespace A3D {
+
+// CPU copy of the OpenGL state RendererOGL changes: calls that would not change anything are skipped,
+// and the state is saved and restored without querying the driver.
+// Code changing the bindings behind its back (e.g. Qt's QOpenGLTexture or QOpenGLVertexArrayObject) has to call invalidateBindings() afterwards.
+class GLStateCache : public NonCopyable {
+public:
+	enum {
+		MaxTextureUnits          = 16,
+		MaxUniformBufferBindings = 8,
+	};
+
+	// Capabilities the cache tracks; the others go straight to the driver.
+	enum Feature {
+		DepthTest,
+		CullFace,
+		Blend,
+		Multisample,
+		CubemapSeamless,
+
+		FeatureCount,
+	};
+
+	struct Counters {
+		// State changes sent to the driver
+		std::size_t issuedCalls;
+
+		// State changes skipped, as the state already had the requested value
+		std::size_t filteredCalls;
+	};
+
+	explicit GLStateCache(CoreGLFunctions*);
+
+	// Reads the framebuffer bindings and the viewport from the driver, and forgets everything else:
+	// the next change of every other state is issued. Called once per frame, as other code may use the context in between.
+	void sync();
+
+	// Forgets the program, vertex array, uniform buffer and texture bindings.
+	void invalidateBindings();
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vertexArray);
+
+	// glBindBufferBase(GL_UNIFORM_BUFFER, ...), and glBindBufferRange(GL_UNIFORM_BUFFER, ...) for a part of the buffer.
+	void bindUniformBuffer(GLuint index, GLuint buffer);
+	void bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	void activeTexture(GLuint unit);
+
+	// Binds on the given unit, or on the active one.
+	void bindTexture(GLuint unit, GLenum target, GLuint texture);
+	void bindTexture(GLenum target, GLuint texture);
+
+	void setEnabled(Feature, bool enabled);
+	void setDepthMask(bool);
+	void setColorMask(bool);
+	void setDepthFunc(GLenum);
+	void setBlendFunc(GLenum source, GLenum destination);
+	void setViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+	// GL_FRAMEBUFFER binds both the draw and the read framebuffers.
+	void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+	// Saves the whole state; pop() restores it, issuing only what changed in between.
+	void push();
+	void pop();
+	bool isStackEmpty() const;
+	std::size_t stackSize() const;
+
+	Counters const& counters() const;
+	void resetCounters();
+
+private:
+	static constexpr GLuint Unknown = std::numeric_limits<GLuint>::max();
+
+	// Unknown in every field that was not set since the last sync() or invalidation
+	struct State {
+		GLuint program;
+		GLuint vertexArray;
+		GLuint uniformBuffers[MaxUniformBufferBindings];
+
+		// Size 0 for the whole buffer
+		GLintptr uniformBufferOffsets[MaxUniformBufferBindings];
+		GLsizeiptr uniformBufferSizes[MaxUniformBufferBindings];
+		GLuint activeTexture;
+		GLuint textures2D[MaxTextureUnits];
+		GLuint texturesCubemap[MaxTextureUnits];
+		GLuint texturesBuffer[MaxTextureUnits];
+		GLuint features[FeatureCount];
+		GLuint depthMask;
+		GLuint colorMask;
+		GLuint depthFunc;
+		GLuint blendSource;
+		GLuint blendDestination;
+		GLint viewport[4];
+		bool viewportKnown;
+		GLuint drawFramebuffer;
+		GLuint readFramebuffer;
+	};
+
+	static GLenum featureEnum(Feature);
+
+	// Counts the change, and tells whether it has to be issued.
+	inline bool changes(GLuint& current, GLuint value) {
+		if(current == value) {
+			++m_counters.filteredCalls;
+			return false;
+		}
+		++m_counters.issuedCalls;
+		current = value;
+		return true;
+	}
+
+	void forgetBindings(State&);
+	void forgetState(State&);
+
+	CoreGLFunctions* m_gl;
+	State m_state;
+	std::vector<State> m_stack;
+	Counters m_counters;
+};
+
+}
+
+#endif // A3DGLSTATECACHE_H
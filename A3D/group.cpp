@@ -8,12 +8,14 @@ Group::Group(Model* model)
 	  m_renderOptions(NoOptions),
 	  m_model(model),
 	  m_matrixDirty(true),
+	  m_entitySpaceMatrixDirty(true),
 	  m_scale(1.f, 1.f, 1.f) {
 	log(LC_Debug, "Constructor: Group");
 }
 
 Group::~Group() {
 	log(LC_Debug, "Destructor: Group");
+	markChanged();
 }
 
 Group* Group::clone(Model* m, bool deepClone) const {
@@ -48,7 +50,10 @@ Group::RenderOptions Group::renderOptions() const {
 	return m_renderOptions;
 }
 void Group::setRenderOptions(RenderOptions renderOptions) {
+	if(m_renderOptions == renderOptions)
+		return;
 	m_renderOptions = renderOptions;
+	markChanged();
 }
 
 Model* Group::model() const {
@@ -59,7 +64,9 @@ void Group::setPosition(QVector3D const& pos) {
 	if(m_position == pos)
 		return;
 	m_position    = pos;
-	m_matrixDirty = true;
+	m_matrixDirty            = true;
+	m_entitySpaceMatrixDirty = true;
+	markChanged();
 }
 QVector3D Group::position() const {
 	return m_position;
@@ -69,7 +76,9 @@ void Group::setRotation(QQuaternion const& rot) {
 	if(m_rotation == rot)
 		return;
 	m_rotation    = rot;
-	m_matrixDirty = true;
+	m_matrixDirty            = true;
+	m_entitySpaceMatrixDirty = true;
+	markChanged();
 }
 QQuaternion Group::rotation() const {
 	return m_rotation;
@@ -79,7 +88,9 @@ void Group::setScale(QVector3D const& scale) {
 	if(m_scale == scale)
 		return;
 	m_scale       = scale;
-	m_matrixDirty = true;
+	m_matrixDirty            = true;
+	m_entitySpaceMatrixDirty = true;
+	markChanged();
 }
 QVector3D Group::scale() const {
 	return m_scale;
@@ -96,6 +107,19 @@ QMatrix4x4 const& Group::groupMatrix() const {
 	return m_matrix;
 }
 
+QMatrix4x4 const& Group::entitySpaceMatrix() const {
+	if(m_entitySpaceMatrixDirty) {
+		m_entitySpaceMatrixDirty = false;
+		m_entitySpaceMatrix      = m_model ? m_model->modelMatrix() * groupMatrix() : groupMatrix();
+	}
+	return m_entitySpaceMatrix;
+}
+
+void Group::markChanged() {
+	if(m_model)
+		m_model->markChanged();
+}
+
 Mesh* Group::mesh() const {
 	return m_mesh;
 }
@@ -112,6 +136,7 @@ void Group::setMesh(Mesh* mesh) {
 	if(m_mesh && m_mesh->parent() == this)
 		delete m_mesh;
 	m_mesh = mesh;
+	markChanged();
 }
 
 void Group::setMaterial(Material* material) {
@@ -120,6 +145,7 @@ void Group::setMaterial(Material* material) {
 	if(m_material && m_material->parent() == this)
 		delete m_material;
 	m_material = material;
+	markChanged();
 }
 
 void Group::setMaterialProperties(MaterialProperties* materialProperties) {
@@ -128,6 +154,7 @@ void Group::setMaterialProperties(MaterialProperties* materialProperties) {
 	if(m_materialProperties && m_materialProperties->parent() == this)
 		delete m_materialProperties;
 	m_materialProperties = materialProperties;
+	markChanged();
 }
 
 }
@@ -42,6 +42,10 @@ public:
 
 	QMatrix4x4 const& groupMatrix() const;
 
+	// model()->modelMatrix() * groupMatrix(): the group in the space of the entities showing the model.
+	// Kept until the group or its model moves.
+	QMatrix4x4 const& entitySpaceMatrix() const;
+
 	Mesh* mesh() const;
 	Material* material() const;
 	MaterialProperties* materialProperties() const;
@@ -51,11 +55,18 @@ public:
 	void setMaterialProperties(MaterialProperties*);
 
 private:
+	friend class Model;
+
+	// Lets the entities showing the model know that the group changed.
+	void markChanged();
+
 	RenderOptions m_renderOptions;
 
 	QPointer<Model> m_model;
 	mutable bool m_matrixDirty;
 	mutable QMatrix4x4 m_matrix;
+	mutable bool m_entitySpaceMatrixDirty;
+	mutable QMatrix4x4 m_entitySpaceMatrix;
 
 	QVector3D m_position;
 	QQuaternion m_rotation;
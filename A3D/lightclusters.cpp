@@ -0,0 +1,208 @@
+#include "A3D/lightclusters.h"
+#include <cmath>
+
+namespace A3D {
+
+// Distance from a value to the range [min, max], 0 inside
+static inline float distanceToRange(float value, float min, float max) {
+	return std::max({ min - value, 0.f, value - max });
+}
+
+LightClusters::LightClusters()
+	: m_view(),
+	  m_projection(),
+	  m_columns(),
+	  m_rows(),
+	  m_sliceDepths(),
+	  m_depthScale(0.f),
+	  m_depthBias(0.f),
+	  m_orthogonal(false),
+	  m_visibleLights(),
+	  m_lights(),
+	  m_viewLights(),
+	  m_clusterLights(ClusterCount),
+	  m_clusters(ClusterCount, Cluster{ 0, 0 }),
+	  m_lightIndices() {}
+
+void LightClusters::build(Camera const& camera, Scene const& scene) {
+	m_view                = camera.getView();
+	m_projection          = camera.getProjection();
+	m_orthogonal          = (camera.projectionMode() == Camera::PM_ORTHOGONAL);
+	float const nearPlane = camera.nearPlane();
+	float const farPlane  = camera.farPlane();
+
+	if(m_orthogonal) {
+		m_depthScale = GridDepth / (farPlane - nearPlane);
+		m_depthBias  = -nearPlane * m_depthScale;
+	}
+	else {
+		m_depthScale = GridDepth / std::log(farPlane / nearPlane);
+		m_depthBias  = -std::log(nearPlane) * m_depthScale;
+	}
+	for(int slice = 0; slice <= GridDepth; ++slice) {
+		float const t        = static_cast<float>(slice) / GridDepth;
+		m_sliceDepths[slice] = m_orthogonal ? nearPlane + (farPlane - nearPlane) * t : nearPlane * std::pow(farPlane / nearPlane, t);
+	}
+
+	// The tile boundaries are the lines through the points of the near and far planes at the same NDC coordinates.
+	QMatrix4x4 const inverseProjection = m_projection.inverted();
+	auto boundary = [&](float ndcX, float ndcY, int axis) {
+		QVector4D nearPoint = inverseProjection * QVector4D(ndcX, ndcY, -1.f, 1.f);
+		QVector4D farPoint  = inverseProjection * QVector4D(ndcX, ndcY, 1.f, 1.f);
+		nearPoint          /= nearPoint.w();
+		farPoint           /= farPoint.w();
+
+		TileBoundary b;
+		b.m_b = (farPoint[axis] - nearPoint[axis]) / (nearPoint.z() - farPoint.z());
+		b.m_a = nearPoint[axis] + b.m_b * nearPoint.z();
+		return b;
+	};
+	for(int x = 0; x <= GridWidth; ++x)
+		m_columns[x] = boundary(-1.f + 2.f * x / GridWidth, 0.f, 0);
+	for(int y = 0; y <= GridHeight; ++y)
+		m_rows[y] = boundary(0.f, -1.f + 2.f * y / GridHeight, 1);
+
+	// The application may have modified lights through references it kept
+	scene.updateLightIndex();
+	scene.queryLights(Frustum(m_projection * m_view), m_visibleLights);
+
+	m_lights.clear();
+	m_viewLights.clear();
+	for(std::size_t id: m_visibleLights) {
+		PointLightInfo const& info = *scene.getLight(id);
+		float const range          = info.range();
+		QVector3D const& position  = info.position;
+		QVector3D const radiance   = info.radiance();
+		m_lights.push_back(PackedLight{ { position.x(), position.y(), position.z() }, range, { radiance.x(), radiance.y(), radiance.z() }, 0.f });
+
+		QVector3D const center = m_view.map(position);
+		float const depth      = -center.z();
+		if(depth + range < nearPlane || depth - range > farPlane)
+			continue;
+
+		ViewLight light;
+		light.m_index      = static_cast<std::uint32_t>(m_lights.size() - 1);
+		light.m_x          = center.x();
+		light.m_y          = center.y();
+		light.m_depth      = depth;
+		light.m_radius     = range;
+		light.m_firstSlice = depthSlice(depth - range);
+		light.m_lastSlice  = depthSlice(depth + range);
+		m_viewLights.push_back(light);
+	}
+
+	parallelFor(GridDepth, [this](std::size_t slice) { binSlice(static_cast<int>(slice)); });
+
+	std::uint32_t offset = 0;
+	for(std::size_t i = 0; i < ClusterCount; ++i) {
+		std::uint32_t const count = static_cast<std::uint32_t>(m_clusterLights[i].size());
+		m_clusters[i]             = Cluster{ offset, count };
+		offset                   += count;
+	}
+
+	m_lightIndices.resize(offset);
+	for(std::size_t i = 0; i < ClusterCount; ++i)
+		std::copy(m_clusterLights[i].begin(), m_clusterLights[i].end(), m_lightIndices.begin() + m_clusters[i].m_offset);
+}
+
+int LightClusters::depthSlice(float depth) const {
+	float const slice = (m_orthogonal ? depth : std::log(std::max(depth, std::numeric_limits<float>::min()))) * m_depthScale + m_depthBias;
+	return std::clamp(static_cast<int>(std::floor(slice)), 0, GridDepth - 1);
+}
+
+void LightClusters::binSlice(int slice) {
+	float const sliceNear = m_sliceDepths[slice];
+	float const sliceFar  = m_sliceDepths[slice + 1];
+
+	// Bounds of the columns and rows over the depth range of the slice. A projection may flip an axis: the boundaries are not assumed to be in order.
+	float columnMin[GridWidth];
+	float columnMax[GridWidth];
+	float rowMin[GridHeight];
+	float rowMax[GridHeight];
+	auto bounds = [&](TileBoundary const& first, TileBoundary const& second, float& min, float& max) {
+		float const a = first.m_a + first.m_b * sliceNear;
+		float const b = first.m_a + first.m_b * sliceFar;
+		float const c = second.m_a + second.m_b * sliceNear;
+		float const d = second.m_a + second.m_b * sliceFar;
+		min           = std::min({ a, b, c, d });
+		max           = std::max({ a, b, c, d });
+	};
+	for(int x = 0; x < GridWidth; ++x)
+		bounds(m_columns[x], m_columns[x + 1], columnMin[x], columnMax[x]);
+	for(int y = 0; y < GridHeight; ++y)
+		bounds(m_rows[y], m_rows[y + 1], rowMin[y], rowMax[y]);
+
+	std::vector<std::uint32_t>* cells = &m_clusterLights[static_cast<std::size_t>(slice) * GridWidth * GridHeight];
+	for(int i = 0; i < GridWidth * GridHeight; ++i)
+		cells[i].clear();
+
+	// Sphere against the bounds of each cluster, one axis at a time
+	float columnDistances[GridWidth];
+	for(ViewLight const& light: m_viewLights) {
+		if(slice < light.m_firstSlice || slice > light.m_lastSlice)
+			continue;
+
+		float const radiusSquared = light.m_radius * light.m_radius;
+		float const dz            = distanceToRange(light.m_depth, sliceNear, sliceFar);
+		if(dz * dz > radiusSquared)
+			continue;
+
+		for(int x = 0; x < GridWidth; ++x) {
+			float const dx     = distanceToRange(light.m_x, columnMin[x], columnMax[x]);
+			columnDistances[x] = dx * dx;
+		}
+
+		for(int y = 0; y < GridHeight; ++y) {
+			float const dy         = distanceToRange(light.m_y, rowMin[y], rowMax[y]);
+			float const distanceYZ = dz * dz + dy * dy;
+			if(distanceYZ > radiusSquared)
+				continue;
+
+			for(int x = 0; x < GridWidth; ++x) {
+				std::vector<std::uint32_t>& cell = cells[x + GridWidth * y];
+				if(distanceYZ + columnDistances[x] <= radiusSquared)
+					cell.push_back(light.m_index);
+			}
+		}
+	}
+}
+
+int LightClusters::clusterAt(QVector3D const& position) const {
+	QVector3D const viewPosition = m_view.map(position);
+	float const depth            = -viewPosition.z();
+	if(depth < m_sliceDepths[0] || depth > m_sliceDepths[GridDepth])
+		return -1;
+
+	QVector4D clip = m_projection * QVector4D(viewPosition, 1.f);
+	clip          /= clip.w();
+
+	int const x = std::clamp(static_cast<int>((clip.x() * 0.5f + 0.5f) * GridWidth), 0, GridWidth - 1);
+	int const y = std::clamp(static_cast<int>((clip.y() * 0.5f + 0.5f) * GridHeight), 0, GridHeight - 1);
+	return x + GridWidth * (y + GridHeight * depthSlice(depth));
+}
+
+std::vector<LightClusters::PackedLight> const& LightClusters::lights() const {
+	return m_lights;
+}
+
+std::vector<LightClusters::Cluster> const& LightClusters::clusters() const {
+	return m_clusters;
+}
+
+std::vector<std::uint32_t> const& LightClusters::lightIndices() const {
+	return m_lightIndices;
+}
+
+float LightClusters::depthScale() const {
+	return m_depthScale;
+}
+
+float LightClusters::depthBias() const {
+	return m_depthBias;
+}
+
+bool LightClusters::isOrthogonal() const {
+	return m_orthogonal;
+}
+
+}
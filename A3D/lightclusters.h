@@ -0,0 +1,101 @@
+#ifndef A3DLIGHTCLUSTERS_H
+#define A3DLIGHTCLUSTERS_H
+
+#include "A3D/common.h"
+#include "A3D/camera.h"
+#include "A3D/scene.h"
+#include <cstdint>
+
+namespace A3D {
+
+// Point lights binned in a grid of view space cells (froxels) for clustered forward shading:
+// GridWidth x GridHeight tiles of the screen, times GridDepth slices along the view direction between the near and far planes,
+// spaced exponentially for perspective projections and linearly for orthogonal ones.
+// Each cluster lists the lights whose range intersects its bounds, so that a fragment only evaluates those.
+class LightClusters {
+public:
+	enum {
+		GridWidth    = 16,
+		GridHeight   = 9,
+		GridDepth    = 24,
+		ClusterCount = GridWidth * GridHeight * GridDepth,
+	};
+
+	// Two RGBA32F texels: position and range, then radiance
+	struct PackedLight {
+		float m_position[3];
+		float m_range;
+		float m_radiance[3];
+		float m_padding;
+	};
+
+	// Lights of a cluster: lightIndices()[m_offset .. m_offset + m_count), by increasing light id. There is no limit to their count.
+	struct Cluster {
+		std::uint32_t m_offset;
+		std::uint32_t m_count;
+	};
+
+	LightClusters();
+
+	// Bins the lights of the scene whose range (see PointLightInfo::range()) intersects the view frustum.
+	// The depth slices are processed in parallel on the global QThreadPool.
+	void build(Camera const&, Scene const&);
+
+	// Lights intersecting the view frustum, by increasing id
+	std::vector<PackedLight> const& lights() const;
+
+	// At index x + GridWidth * (y + GridHeight * slice), y going up the screen
+	std::vector<Cluster> const& clusters() const;
+	std::vector<std::uint32_t> const& lightIndices() const;
+
+	// The slice of a view space depth is depth * depthScale() + depthBias(), with the log of the depth for perspective projections.
+	float depthScale() const;
+	float depthBias() const;
+	bool isOrthogonal() const;
+
+	// Index in clusters() of a world space point, or -1 outside the near and far planes
+	int clusterAt(QVector3D const& position) const;
+
+private:
+	// Sphere of a light in view space
+	struct ViewLight {
+		std::uint32_t m_index;
+		float m_x;
+		float m_y;
+		float m_depth;
+		float m_radius;
+		int m_firstSlice;
+		int m_lastSlice;
+	};
+
+	// View space coordinate a + b * depth of a tile boundary
+	struct TileBoundary {
+		float m_a;
+		float m_b;
+	};
+
+	int depthSlice(float depth) const;
+	void binSlice(int slice);
+
+	QMatrix4x4 m_view;
+	QMatrix4x4 m_projection;
+	TileBoundary m_columns[GridWidth + 1];
+	TileBoundary m_rows[GridHeight + 1];
+	float m_sliceDepths[GridDepth + 1];
+	float m_depthScale;
+	float m_depthBias;
+	bool m_orthogonal;
+
+	std::vector<std::size_t> m_visibleLights;
+	std::vector<PackedLight> m_lights;
+	std::vector<ViewLight> m_viewLights;
+
+	// Lights of each cluster, written by the task of its slice before they are packed in m_lightIndices
+	std::vector<std::vector<std::uint32_t>> m_clusterLights;
+	std::vector<Cluster> m_clusters;
+	std::vector<std::uint32_t> m_lightIndices;
+};
+
+}
+
+#endif // A3DLIGHTCLUSTERS_H
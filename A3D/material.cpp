@@ -17,6 +17,7 @@ Material* Material::standardMaterial(StandardMaterial stdMat) {
 	case PBRMaterial:
 		newMat.setShaderFile(GLSL, VertexShader, ":/A3D/PBRMaterial.vert");
 		newMat.setShaderFile(GLSL, FragmentShader, ":/A3D/PBRMaterial.frag");
+		newMat.setRenderOptions(DepthPrePassCompatible);
 		break;
 	case SkyboxMaterial:
 		newMat.setShaderFile(GLSL, VertexShader, ":/A3D/SkyboxMaterial.vert");
@@ -34,6 +35,10 @@ Material* Material::standardMaterial(StandardMaterial stdMat) {
 		newMat.setShaderFile(GLSL, VertexShader, ":/A3D/BRDFMaterial.vert");
 		newMat.setShaderFile(GLSL, FragmentShader, ":/A3D/BRDFMaterial.frag");
 		break;
+	case DepthMaterial:
+		newMat.setShaderFile(GLSL, VertexShader, ":/A3D/DepthMaterial.vert");
+		newMat.setShaderFile(GLSL, FragmentShader, ":/A3D/DepthMaterial.frag");
+		break;
 	}
 	newMat.invalidateCache();
 	return &newMat;
@@ -21,6 +21,11 @@ public:
 		// Mark this material as a translucent material.
 		// Will render the entity on a separate draw pass.
 		Translucent = 0x1,
+
+		// The vertex shader writes an invariant gl_Position = mvpMatrix * inVertex, exactly as DepthMaterial does:
+		// the groups using this material take part in the depth pre-pass (see Renderer::setDepthPrePass()).
+		// Only set on PBRMaterial; clear it on a copy given another vertex shader.
+		DepthPrePassCompatible = 0x2,
 	};
 	Q_DECLARE_FLAGS(RenderOptions, RenderOption)
 
@@ -30,6 +35,9 @@ public:
 		IrradianceMaterial,
 		PrefilterMaterial,
 		BRDFMaterial,
+
+		// Depth only, for the depth pre-pass
+		DepthMaterial,
 	};
 	static Material* standardMaterial(StandardMaterial);
 
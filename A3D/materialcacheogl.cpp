@@ -11,7 +11,8 @@ MaterialCacheOGL::MaterialCacheOGL(Material* parent)
 	: MaterialCache{ parent },
 	  m_meshUBO_index(GL_INVALID_INDEX),
 	  m_matpropUBO_index(GL_INVALID_INDEX),
-	  m_sceneUBO_index(GL_INVALID_INDEX) {
+	  m_sceneUBO_index(GL_INVALID_INDEX),
+	  m_transformLayout() {
 	log(LC_Debug, "Constructor: MaterialCacheOGL");
 }
 
@@ -87,7 +88,7 @@ void MaterialCacheOGL::applyUniforms(std::map<QString, QVariant> const& uniforms
 	}
 }
 
-void MaterialCacheOGL::install(CoreGLFunctions* gl) {
+void MaterialCacheOGL::install(GLStateCache& state) {
 	if(!m_program)
 		return;
 
@@ -95,19 +96,12 @@ void MaterialCacheOGL::install(CoreGLFunctions* gl) {
 	if(!m)
 		return;
 
-	m_program->bind();
-
-	if(m_meshUBO_index != GL_INVALID_INDEX)
-		gl->glUniformBlockBinding(m_program->programId(), m_meshUBO_index, RendererOGL::UBO_MeshBinding);
-
-	if(m_matpropUBO_index != GL_INVALID_INDEX)
-		gl->glUniformBlockBinding(m_program->programId(), m_matpropUBO_index, RendererOGL::UBO_MaterialPropertiesBinding);
-
-	if(m_sceneUBO_index != GL_INVALID_INDEX)
-		gl->glUniformBlockBinding(m_program->programId(), m_sceneUBO_index, RendererOGL::UBO_SceneBinding);
+	state.useProgram(m_program->programId());
 }
 
 void MaterialCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
+	m_transformLayout.m_size = 0;
+
 	Material* m = material();
 	if(!m) {
 		m_program.reset();
@@ -161,9 +155,56 @@ void MaterialCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 	applyUniform("PrefilterTexture", GLuint(MaterialProperties::PrefilterTextureSlot));
 	applyUniform("BrdfTexture", GLuint(MaterialProperties::BrdfTextureSlot));
 
+	applyUniform("ClusterLights", GLuint(RendererOGL::TU_ClusterLights));
+	applyUniform("ClusterRecords", GLuint(RendererOGL::TU_ClusterRecords));
+	applyUniform("ClusterLightIndices", GLuint(RendererOGL::TU_ClusterLightIndices));
+
 	m_meshUBO_index    = gl->glGetUniformBlockIndex(m_program->programId(), "MeshUBO_Data");
 	m_matpropUBO_index = gl->glGetUniformBlockIndex(m_program->programId(), "MaterialUBO_Data");
-	m_sceneUBO_index = gl->glGetUniformBlockIndex(m_program->programId(), "SceneUBO_Data");
+	m_sceneUBO_index   = gl->glGetUniformBlockIndex(m_program->programId(), "SceneUBO_Data");
+
+	// The block bindings are part of the program object: set once after linking.
+	if(m_meshUBO_index != GL_INVALID_INDEX)
+		gl->glUniformBlockBinding(m_program->programId(), m_meshUBO_index, RendererOGL::UBO_MeshBinding);
+
+	if(m_matpropUBO_index != GL_INVALID_INDEX)
+		gl->glUniformBlockBinding(m_program->programId(), m_matpropUBO_index, RendererOGL::UBO_MaterialPropertiesBinding);
+
+	if(m_sceneUBO_index != GL_INVALID_INDEX)
+		gl->glUniformBlockBinding(m_program->programId(), m_sceneUBO_index, RendererOGL::UBO_SceneBinding);
+
+	// The renderer only computes the matrices the program declares, and writes them at the offsets the driver chose.
+	for(GLint& offset: m_transformLayout.m_offsets)
+		offset = -1;
+	if(m_meshUBO_index != GL_INVALID_INDEX) {
+		// Members of a block with an instance name are only known by their block-qualified name
+		static GLchar const* const matrixNames[TransformMatrixCount] = {
+			"pMatrix", "vMatrix", "mMatrix", "mvMatrix", "mvpMatrix", "mNormalMatrix", "mvNormalMatrix", "mvpNormalMatrix",
+		};
+		static GLchar const* const qualifiedMatrixNames[TransformMatrixCount] = {
+			"MeshUBO_Data.pMatrix", "MeshUBO_Data.vMatrix", "MeshUBO_Data.mMatrix", "MeshUBO_Data.mvMatrix",
+			"MeshUBO_Data.mvpMatrix", "MeshUBO_Data.mNormalMatrix", "MeshUBO_Data.mvNormalMatrix", "MeshUBO_Data.mvpNormalMatrix",
+		};
+		GLuint matrixIndices[TransformMatrixCount];
+		GLuint qualifiedMatrixIndices[TransformMatrixCount];
+
+		gl->glGetActiveUniformBlockiv(m_program->programId(), m_meshUBO_index, GL_UNIFORM_BLOCK_DATA_SIZE, &m_transformLayout.m_size);
+		gl->glGetUniformIndices(m_program->programId(), TransformMatrixCount, matrixNames, matrixIndices);
+		gl->glGetUniformIndices(m_program->programId(), TransformMatrixCount, qualifiedMatrixNames, qualifiedMatrixIndices);
+
+		bool anyMatrix = false;
+		for(int i = 0; i < TransformMatrixCount; ++i) {
+			GLuint const index = (matrixIndices[i] != GL_INVALID_INDEX) ? matrixIndices[i] : qualifiedMatrixIndices[i];
+			if(index != GL_INVALID_INDEX) {
+				gl->glGetActiveUniformsiv(m_program->programId(), 1, &index, GL_UNIFORM_OFFSET, &m_transformLayout.m_offsets[i]);
+				anyMatrix = true;
+			}
+		}
+
+		// Nothing would be written to the block: the mesh would be drawn with whatever the buffer holds
+		if(!anyMatrix)
+			log(LC_Warning, "MaterialCacheOGL::update: MeshUBO_Data declares none of the known matrices (pMatrix, vMatrix, mMatrix, mvMatrix, mvpMatrix, mNormalMatrix, mvNormalMatrix, mvpNormalMatrix)");
+	}
 	m_program->release();
 
 	markClean();
@@ -11,19 +11,43 @@ namespace A3D {
 
 class MaterialPropertiesCacheOGL;
 class RendererOGL;
+class GLStateCache;
 class MaterialCacheOGL : public MaterialCache {
 	Q_OBJECT
 public:
+	// Matrices of the MeshUBO_Data uniform block
+	enum TransformMatrix {
+		ProjectionMatrix,
+		ViewMatrix,
+		ModelMatrix,
+		ModelViewMatrix,
+		ModelViewProjectionMatrix,
+		ModelNormalMatrix,
+		ModelViewNormalMatrix,
+		ModelViewProjectionNormalMatrix,
+
+		TransformMatrixCount,
+	};
+
+	// Layout of the MeshUBO_Data block of the linked program: its size, 0 when the program has no such block,
+	// and the offset of each matrix it declares, -1 for the others.
+	struct TransformLayout {
+		GLint m_size;
+		GLint m_offsets[TransformMatrixCount];
+	};
+
 	explicit MaterialCacheOGL(Material*);
 	~MaterialCacheOGL();
 
 	void update(RendererOGL*, CoreGLFunctions*);
-	void install(CoreGLFunctions*);
+	void install(GLStateCache&);
 
 	int searchUniform(QString const& name);
 	void applyUniform(QString const& name, QVariant const& value);
 	void applyUniforms(std::map<QString, QVariant> const& uniforms);
 
+	inline TransformLayout const& transformLayout() const { return m_transformLayout; }
+
 private:
 	std::unique_ptr<QOpenGLShaderProgram> m_program;
 
@@ -40,6 +64,7 @@ private:
 	GLuint m_meshUBO_index;
 	GLuint m_matpropUBO_index;
 	GLuint m_sceneUBO_index;
+	TransformLayout m_transformLayout;
 };
 
 }
@@ -18,7 +18,7 @@ MaterialPropertiesCacheOGL::~MaterialPropertiesCacheOGL() {
 	}
 }
 
-void MaterialPropertiesCacheOGL::install(CoreGLFunctions* gl, MaterialCacheOGL* materialCache) {
+void MaterialPropertiesCacheOGL::install(GLStateCache& state, MaterialCacheOGL* materialCache) {
 	if(!m_materialUBO)
 		return;
 
@@ -27,7 +27,7 @@ void MaterialPropertiesCacheOGL::install(CoreGLFunctions* gl, MaterialCacheOGL*
 		materialCache->applyUniforms(matProp->rawValues());
 	}
 
-	gl->glBindBufferBase(GL_UNIFORM_BUFFER, RendererOGL::UBO_MaterialPropertiesBinding, m_materialUBO);
+	state.bindUniformBuffer(RendererOGL::UBO_MaterialPropertiesBinding, m_materialUBO);
 }
 
 void MaterialPropertiesCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
@@ -10,6 +10,7 @@ namespace A3D {
 
 class RendererOGL;
 class MaterialCacheOGL;
+class GLStateCache;
 class MaterialPropertiesCacheOGL : public MaterialPropertiesCache {
 	Q_OBJECT
 public:
@@ -17,7 +18,7 @@ public:
 	~MaterialPropertiesCacheOGL();
 
 	void update(RendererOGL*, CoreGLFunctions*);
-	void install(CoreGLFunctions*, MaterialCacheOGL*);
+	void install(GLStateCache&, MaterialCacheOGL*);
 
 private:
 	struct MaterialUBO_Data {
@@ -1,6 +1,8 @@
 #include "A3D/mesh.h"
 #include "A3D/renderer.h"
 #include <QDebug>
+#include <cmath>
+#include <cstring>
 
 namespace A3D {
 
@@ -110,7 +112,12 @@ Mesh* Mesh::standardMesh(StandardMesh stdMesh) {
 Mesh::Mesh(ResourceManager* resourceManager)
 	: Resource{ resourceManager },
 	  m_drawMode(Triangles),
-	  m_renderOptions(NoOptions) {
+	  m_packedBuffers(),
+	  m_renderOptions(NoOptions),
+	  m_bounds(),
+	  m_boundsDirty(true),
+	  m_bvhDirty(true),
+	  m_occluderGeometryDirty(true) {
 	log(LC_Debug, "Constructor: Mesh");
 }
 
@@ -136,6 +143,8 @@ Mesh* Mesh::clone() const {
 	newMesh->m_drawMode      = m_drawMode;
 	newMesh->m_vertices      = m_vertices;
 	newMesh->m_indices       = m_indices;
+	newMesh->m_packedBuffers = m_packedBuffers;
+	newMesh->m_lods          = m_lods;
 	newMesh->m_renderOptions = m_renderOptions;
 	newMesh->m_contents      = m_contents;
 	newMesh->m_packedData    = m_packedData;
@@ -156,6 +165,7 @@ void Mesh::setContents(Contents contents) {
 	if(m_contents == contents)
 		return;
 
+	releasePackedBuffers();
 	m_contents = contents;
 	m_packedData.clear();
 	invalidateCache();
@@ -184,57 +194,119 @@ std::size_t Mesh::packedVertexSize(Contents contents) {
 	return vCount;
 }
 
+std::size_t Mesh::packedAttributeOffset(Contents contents, Content attribute) {
+	return packedVertexSize(contents & Contents(QFlag(static_cast<int>(attribute) - 1)));
+}
+
+std::uint8_t* Mesh::packVertex(Vertex const& v, Contents contents, std::uint8_t* pDst) {
+	if(contents & Position2D) {
+		std::memcpy(pDst, &v.Position2D, sizeof(v.Position2D));
+		pDst += sizeof(v.Position2D);
+	}
+	if(contents & Position3D) {
+		std::memcpy(pDst, &v.Position3D, sizeof(v.Position3D));
+		pDst += sizeof(v.Position3D);
+	}
+	if(contents & TextureCoord2D) {
+		std::memcpy(pDst, &v.TextureCoord2D, sizeof(v.TextureCoord2D));
+		pDst += sizeof(v.TextureCoord2D);
+	}
+	if(contents & Normal3D) {
+		std::memcpy(pDst, &v.Normal3D, sizeof(v.Normal3D));
+		pDst += sizeof(v.Normal3D);
+	}
+	if(contents & Color3D) {
+		std::memcpy(pDst, &v.Color3D, sizeof(v.Color3D));
+		pDst += sizeof(v.Color3D);
+	}
+	if(contents & Color4D) {
+		std::memcpy(pDst, &v.Color4D, sizeof(v.Color4D));
+		pDst += sizeof(v.Color4D);
+	}
+	if(contents & BoneIDs) {
+		std::memcpy(pDst, v.BoneIDs, sizeof(v.BoneIDs));
+		pDst += sizeof(v.BoneIDs);
+	}
+	if(contents & BoneWeights) {
+		std::memcpy(pDst, &v.BoneWeights, sizeof(v.BoneWeights));
+		pDst += sizeof(v.BoneWeights);
+	}
+	if(contents & SmoothingGroup) {
+		std::memcpy(pDst, &v.SmoothingGroup, sizeof(v.SmoothingGroup));
+		pDst += sizeof(v.SmoothingGroup);
+	}
+	return pDst;
+}
+
+std::uint8_t const* Mesh::unpackVertex(std::uint8_t const* pSrc, Contents contents, Vertex& v) {
+	if(contents & Position2D) {
+		std::memcpy(&v.Position2D, pSrc, sizeof(v.Position2D));
+		pSrc += sizeof(v.Position2D);
+	}
+	if(contents & Position3D) {
+		std::memcpy(&v.Position3D, pSrc, sizeof(v.Position3D));
+		pSrc += sizeof(v.Position3D);
+	}
+	if(contents & TextureCoord2D) {
+		std::memcpy(&v.TextureCoord2D, pSrc, sizeof(v.TextureCoord2D));
+		pSrc += sizeof(v.TextureCoord2D);
+	}
+	if(contents & Normal3D) {
+		std::memcpy(&v.Normal3D, pSrc, sizeof(v.Normal3D));
+		pSrc += sizeof(v.Normal3D);
+	}
+	if(contents & Color3D) {
+		std::memcpy(&v.Color3D, pSrc, sizeof(v.Color3D));
+		pSrc += sizeof(v.Color3D);
+	}
+	if(contents & Color4D) {
+		std::memcpy(&v.Color4D, pSrc, sizeof(v.Color4D));
+		pSrc += sizeof(v.Color4D);
+	}
+	if(contents & BoneIDs) {
+		std::memcpy(v.BoneIDs, pSrc, sizeof(v.BoneIDs));
+		pSrc += sizeof(v.BoneIDs);
+	}
+	if(contents & BoneWeights) {
+		std::memcpy(&v.BoneWeights, pSrc, sizeof(v.BoneWeights));
+		pSrc += sizeof(v.BoneWeights);
+	}
+	if(contents & SmoothingGroup) {
+		std::memcpy(&v.SmoothingGroup, pSrc, sizeof(v.SmoothingGroup));
+		pSrc += sizeof(v.SmoothingGroup);
+	}
+	return pSrc;
+}
+
 std::vector<std::uint8_t> const& Mesh::packedData() const {
-	if(m_packedData.empty()) {
-		std::size_t const vertexSize = packedVertexSize(m_contents);
-		m_packedData.resize(vertexSize * m_vertices.size());
-
-		std::uint8_t* pDstBase = m_packedData.data();
-		for(auto it = m_vertices.begin(); it != m_vertices.end(); ++it, pDstBase += vertexSize) {
-			std::uint8_t* pDst = pDstBase;
-			Vertex const& v    = *it;
-
-			if(m_contents & Position2D) {
-				std::memcpy(pDst, &v.Position2D, sizeof(v.Position2D));
-				pDst += sizeof(v.Position2D);
-			}
-			if(m_contents & Position3D) {
-				std::memcpy(pDst, &v.Position3D, sizeof(v.Position3D));
-				pDst += sizeof(v.Position3D);
-			}
-			if(m_contents & TextureCoord2D) {
-				std::memcpy(pDst, &v.TextureCoord2D, sizeof(v.TextureCoord2D));
-				pDst += sizeof(v.TextureCoord2D);
-			}
-			if(m_contents & Normal3D) {
-				std::memcpy(pDst, &v.Normal3D, sizeof(v.Normal3D));
-				pDst += sizeof(v.Normal3D);
-			}
-			if(m_contents & Color3D) {
-				std::memcpy(pDst, &v.Color3D, sizeof(v.Color3D));
-				pDst += sizeof(v.Color3D);
-			}
-			if(m_contents & Color4D) {
-				std::memcpy(pDst, &v.Color4D, sizeof(v.Color4D));
-				pDst += sizeof(v.Color4D);
-			}
-			if(m_contents & BoneIDs) {
-				std::memcpy(pDst, v.BoneIDs, sizeof(v.BoneIDs));
-				pDst += sizeof(v.BoneIDs);
-			}
-			if(m_contents & BoneWeights) {
-				std::memcpy(pDst, &v.BoneWeights, sizeof(v.BoneWeights));
-				pDst += sizeof(v.BoneWeights);
-			}
-			if(m_contents & SmoothingGroup) {
-				std::memcpy(pDst, &v.SmoothingGroup, sizeof(v.SmoothingGroup));
-				pDst += sizeof(v.SmoothingGroup);
-			}
-		}
+	if(m_packedData.empty() && hasPackedBuffers()) {
+		std::uint8_t const* pSrc = m_packedBuffers.vertexData;
+		m_packedData.assign(pSrc, pSrc + packedVertexSize(m_contents) * m_packedBuffers.vertexCount);
+	}
+	else if(m_packedData.empty()) {
+		m_packedData = packVertices(m_vertices, m_contents);
 	}
 	return m_packedData;
 }
 
+std::size_t Mesh::packedIndexSize(std::uint32_t maxIndex) {
+	// Same rule as the renderers: the largest value of each type is kept free for primitive restart.
+	if(maxIndex < std::numeric_limits<std::uint8_t>::max())
+		return sizeof(std::uint8_t);
+	if(maxIndex < std::numeric_limits<std::uint16_t>::max())
+		return sizeof(std::uint16_t);
+	return sizeof(std::uint32_t);
+}
+
+std::vector<std::uint8_t> Mesh::packVertices(std::vector<Vertex> const& vertices, Contents contents) {
+	std::vector<std::uint8_t> packed(packedVertexSize(contents) * vertices.size());
+
+	std::uint8_t* pDst = packed.data();
+	for(auto it = vertices.begin(); it != vertices.end(); ++it)
+		pDst = packVertex(*it, contents, pDst);
+	return packed;
+}
+
 void Mesh::setDrawMode(DrawMode drawMode) {
 	m_drawMode = drawMode;
 }
@@ -264,53 +336,397 @@ bool Mesh::Vertex::Equals(Vertex const& o, Contents c) const {
 	return true;
 }
 
-void Mesh::optimizeIndices() {
-	if(drawMode() != Mesh::IndexedTriangles && drawMode() != Mesh::IndexedTriangleStrips)
+// Same layout and size as packVertex, but the bytes are only meant to be compared.
+// Floats are either normalized (-0 becomes +0, so that the result matches Vertex::Equals)
+// or snapped to weldEpsilon-sized integer steps.
+std::uint8_t* Mesh::packWeldKey(Vertex const& v, Contents contents, float weldEpsilon, std::uint8_t* pDst) {
+	auto writeFloats = [&](float const* src, std::size_t count) {
+		for(std::size_t i = 0; i < count; ++i, pDst += sizeof(float)) {
+			if(weldEpsilon > 0.f) {
+				std::int32_t const q = static_cast<std::int32_t>(std::lround(src[i] / weldEpsilon));
+				std::memcpy(pDst, &q, sizeof(q));
+			}
+			else {
+				float const f = src[i] + 0.f;
+				std::memcpy(pDst, &f, sizeof(f));
+			}
+		}
+	};
+
+	auto writeVector2D = [&](QVector2D const& vec) {
+		float const f[2] = { vec.x(), vec.y() };
+		writeFloats(f, 2);
+	};
+	auto writeVector3D = [&](QVector3D const& vec) {
+		float const f[3] = { vec.x(), vec.y(), vec.z() };
+		writeFloats(f, 3);
+	};
+	auto writeVector4D = [&](QVector4D const& vec) {
+		float const f[4] = { vec.x(), vec.y(), vec.z(), vec.w() };
+		writeFloats(f, 4);
+	};
+
+	if(contents & Position2D)
+		writeVector2D(v.Position2D);
+	if(contents & Position3D)
+		writeVector3D(v.Position3D);
+	if(contents & TextureCoord2D)
+		writeVector2D(v.TextureCoord2D);
+	if(contents & Normal3D)
+		writeVector3D(v.Normal3D);
+	if(contents & Color3D)
+		writeVector3D(v.Color3D);
+	if(contents & Color4D)
+		writeVector4D(v.Color4D);
+	if(contents & BoneIDs) {
+		std::memcpy(pDst, v.BoneIDs, sizeof(v.BoneIDs));
+		pDst += sizeof(v.BoneIDs);
+	}
+	if(contents & BoneWeights)
+		writeVector4D(v.BoneWeights);
+	if(contents & SmoothingGroup) {
+		std::memcpy(pDst, &v.SmoothingGroup, sizeof(v.SmoothingGroup));
+		pDst += sizeof(v.SmoothingGroup);
+	}
+	return pDst;
+}
+
+void Mesh::setPackedBuffers(Contents contents, PackedBuffers buffers) {
+	m_vertices.clear();
+	m_indices.clear();
+	m_lods.clear();
+	m_contents      = contents;
+	m_packedBuffers = std::move(buffers);
+	invalidateCache();
+}
+bool Mesh::hasPackedBuffers() const {
+	return m_packedBuffers.vertexData != nullptr;
+}
+Mesh::PackedBuffers const& Mesh::packedBuffers() const {
+	return m_packedBuffers;
+}
+
+std::vector<Mesh::Vertex> Mesh::unpackVertices(PackedBuffers const& buffers, Contents contents) {
+	std::vector<Vertex> vertices(buffers.vertexCount);
+	std::uint8_t const* pSrc = buffers.vertexData;
+	for(auto it = vertices.begin(); it != vertices.end(); ++it)
+		pSrc = unpackVertex(pSrc, contents, *it);
+	return vertices;
+}
+
+std::vector<std::uint32_t> Mesh::unpackIndices(PackedBuffers const& buffers) {
+	std::vector<std::uint32_t> indices(buffers.indexCount);
+	std::uint8_t const* pIndex = buffers.indexData;
+	for(auto it = indices.begin(); it != indices.end(); ++it, pIndex += buffers.indexSize) {
+		switch(buffers.indexSize) {
+		case sizeof(std::uint8_t):
+			*it = *pIndex;
+			break;
+		case sizeof(std::uint16_t): {
+			std::uint16_t ix;
+			std::memcpy(&ix, pIndex, sizeof(ix));
+			*it = ix;
+		} break;
+		default:
+			std::memcpy(&*it, pIndex, sizeof(std::uint32_t));
+			break;
+		}
+	}
+	return indices;
+}
+
+std::size_t Mesh::triangleCount(std::size_t lodLevel) const {
+	if(lodLevel > 0 && lodLevel <= m_lods.size())
+		return m_lods[lodLevel - 1].indices.size() / 3;
+
+	bool const isIndexed      = (m_drawMode == IndexedTriangles || m_drawMode == IndexedTriangleStrips);
+	std::size_t elementCount = 0;
+	if(hasPackedBuffers())
+		elementCount = isIndexed ? m_packedBuffers.indexCount : m_packedBuffers.vertexCount;
+	else
+		elementCount = isIndexed ? m_indices.size() : m_vertices.size();
+
+	if(m_drawMode == TriangleStrips || m_drawMode == IndexedTriangleStrips)
+		return elementCount > 2 ? elementCount - 2 : 0;
+	return elementCount / 3;
+}
+
+Mesh::Bounds const& Mesh::bounds() const {
+	if(m_boundsDirty) {
+		computeBounds();
+		m_boundsDirty = false;
+	}
+	return m_bounds;
+}
+
+void Mesh::computeBounds() const {
+	m_bounds = Bounds();
+
+	bool const is3D = (m_contents & Position3D);
+	if(!is3D && !(m_contents & Position2D))
 		return;
-	std::vector<Mesh::Vertex> optimizedVertices;
-	std::vector<std::uint32_t> optimizedIndices;
 
-	optimizedVertices.reserve(m_indices.size() / 2);
-	optimizedIndices.reserve(m_indices.size());
+	// Positions are read in place, so that packed buffers do not have to be unpacked.
+	std::size_t stride            = 0;
+	std::size_t vertexCount       = 0;
+	std::uint8_t const* pPosition = positionData(is3D ? Position3D : Position2D, stride, vertexCount);
+	if(!vertexCount)
+		return;
 
-	for(auto it = m_indices.begin(); it != m_indices.end(); ++it) {
-		Mesh::Vertex* currentVertex = &m_vertices[*it];
+	auto position = [&](std::size_t i) -> QVector3D {
+		float p[3] = { 0.f, 0.f, 0.f };
+		std::memcpy(p, pPosition + i * stride, (is3D ? 3 : 2) * sizeof(float));
+		return QVector3D(p[0], p[1], p[2]);
+	};
 
-		optimizedIndices.push_back(static_cast<std::uint32_t>(optimizedVertices.size()));
+	QVector3D minimum = position(0);
+	QVector3D maximum = minimum;
+	for(std::size_t i = 1; i < vertexCount; ++i) {
+		QVector3D const p = position(i);
+		minimum           = QVector3D(std::min(minimum.x(), p.x()), std::min(minimum.y(), p.y()), std::min(minimum.z(), p.z()));
+		maximum           = QVector3D(std::max(maximum.x(), p.x()), std::max(maximum.y(), p.y()), std::max(maximum.z(), p.z()));
+	}
 
-		for(std::uint32_t prevIndex = 0; prevIndex < optimizedVertices.size(); ++prevIndex) {
-			if(currentVertex->Equals(optimizedVertices[prevIndex], m_contents)) {
-				optimizedIndices.back() = prevIndex;
-				break;
-			}
+	// Sphere around the center of the box, through the farthest vertex: tighter than the half diagonal.
+	QVector3D const center = (minimum + maximum) * 0.5f;
+	float radiusSquared    = 0.f;
+	for(std::size_t i = 0; i < vertexCount; ++i)
+		radiusSquared = std::max(radiusSquared, (position(i) - center).lengthSquared());
+
+	m_bounds.min    = minimum;
+	m_bounds.max    = maximum;
+	m_bounds.center = center;
+	m_bounds.radius = std::sqrt(radiusSquared);
+}
+
+std::uint8_t const* Mesh::positionData(Content position, std::size_t& stride, std::size_t& vertexCount) const {
+	if(hasPackedBuffers()) {
+		stride      = packedVertexSize(m_contents);
+		vertexCount = m_packedBuffers.vertexCount;
+		return m_packedBuffers.vertexData + packedAttributeOffset(m_contents, position);
+	}
+
+	stride      = sizeof(Vertex);
+	vertexCount = m_vertices.size();
+	if(m_vertices.empty())
+		return nullptr;
+	return reinterpret_cast<std::uint8_t const*>(position == Position3D ? static_cast<void const*>(&m_vertices.front().Position3D) : static_cast<void const*>(&m_vertices.front().Position2D));
+}
+
+std::uint32_t Mesh::elementVertex(std::size_t element) const {
+	if(m_drawMode == Triangles || m_drawMode == TriangleStrips)
+		return static_cast<std::uint32_t>(element);
+	if(!hasPackedBuffers())
+		return m_indices[element];
+
+	std::uint8_t const* pIndex = m_packedBuffers.indexData + element * m_packedBuffers.indexSize;
+	std::uint32_t index        = 0;
+	switch(m_packedBuffers.indexSize) {
+	case sizeof(std::uint8_t):
+		index = *pIndex;
+		break;
+	case sizeof(std::uint16_t): {
+		std::uint16_t ix;
+		std::memcpy(&ix, pIndex, sizeof(ix));
+		index = ix;
+	} break;
+	default:
+		std::memcpy(&index, pIndex, sizeof(index));
+		break;
+	}
+	return index;
+}
+
+bool Mesh::triangleVertices(std::size_t triangle, std::uint32_t vertices[3]) const {
+	if(triangle >= triangleCount())
+		return false;
+
+	bool const isStrip      = (m_drawMode == TriangleStrips || m_drawMode == IndexedTriangleStrips);
+	std::size_t const first = isStrip ? triangle : triangle * 3;
+	for(std::size_t i = 0; i < 3; ++i)
+		vertices[i] = elementVertex(first + i);
+	return true;
+}
+
+MeshBvh const& Mesh::bvh() const {
+	if(m_bvhDirty) {
+		m_bvhDirty = false;
+
+		std::size_t stride            = 0;
+		std::size_t vertexCount       = 0;
+		std::uint8_t const* pPosition = (m_contents & Position3D) ? positionData(Position3D, stride, vertexCount) : nullptr;
+		std::size_t const count       = triangleCount();
+		if(pPosition && count) {
+			std::vector<std::uint32_t> triangles(count * 3);
+			for(std::size_t i = 0; i < count; ++i)
+				triangleVertices(i, &triangles[i * 3]);
+			m_bvh.build(pPosition, stride, vertexCount, triangles.data(), count);
 		}
+	}
+	return m_bvh;
+}
 
-		if(optimizedIndices.back() == optimizedVertices.size())
-			optimizedVertices.push_back(*currentVertex);
+Mesh::OccluderGeometry const& Mesh::occluderGeometry() const {
+	if(m_occluderGeometryDirty) {
+		m_occluderGeometryDirty = false;
+
+		std::size_t stride            = 0;
+		std::size_t vertexCount       = 0;
+		std::uint8_t const* pPosition = (m_contents & Position3D) ? positionData(Position3D, stride, vertexCount) : nullptr;
+		std::size_t const count       = triangleCount();
+		if(pPosition && count) {
+			m_occluderGeometry.positions.resize(vertexCount * 3);
+			for(std::size_t i = 0; i < vertexCount; ++i)
+				std::memcpy(&m_occluderGeometry.positions[i * 3], pPosition + i * stride, 3 * sizeof(float));
+
+			m_occluderGeometry.triangles.resize(count * 3);
+			for(std::size_t i = 0; i < count; ++i)
+				triangleVertices(i, &m_occluderGeometry.triangles[i * 3]);
+		}
 	}
+	return m_occluderGeometry;
+}
+
+void Mesh::unpackBuffers() const {
+	if(!hasPackedBuffers() || !m_vertices.empty() || !m_indices.empty())
+		return;
+
+	m_vertices = unpackVertices(m_packedBuffers, m_contents);
+	m_indices  = unpackIndices(m_packedBuffers);
+}
+
+void Mesh::releasePackedBuffers() {
+	if(!hasPackedBuffers())
+		return;
+
+	unpackBuffers();
+	m_packedBuffers = PackedBuffers();
+}
+
+Mesh::WeldStats Mesh::optimizeIndices(float weldEpsilon) {
+	releasePackedBuffers();
+	if(drawMode() != Mesh::IndexedTriangles && drawMode() != Mesh::IndexedTriangleStrips)
+		return WeldStats{ m_indices.size(), m_vertices.size() };
 
-	m_vertices = std::move(optimizedVertices);
-	m_indices  = std::move(optimizedIndices);
+	WeldStats stats = optimizeIndices(m_vertices, m_indices, m_contents, weldEpsilon);
+	m_lods.clear();
 	invalidateCache();
+	return stats;
+}
+
+Mesh::WeldStats Mesh::optimizeIndices(std::vector<Vertex>& vertices, std::vector<std::uint32_t>& indices, Contents contents, float weldEpsilon) {
+	VertexWelder welder(contents, weldEpsilon);
+	welder.reserve(indices.size());
+
+	for(auto it = indices.begin(); it != indices.end(); ++it)
+		*it = welder.add(vertices[*it]);
+
+	WeldStats const stats = welder.stats();
+	vertices              = std::move(welder.vertices());
+	return stats;
+}
+
+Mesh::VertexWelder::VertexWelder(Contents contents, float weldEpsilon)
+	: m_contents(contents),
+	  m_weldEpsilon(weldEpsilon),
+	  m_keySize(packedVertexSize(contents)),
+	  m_inputVertexCount(0),
+	  m_currentKey(m_keySize),
+	  m_table(16, std::numeric_limits<std::uint32_t>::max()) {}
+
+void Mesh::VertexWelder::reserve(std::size_t inputVertexCount) {
+	std::size_t tableSize = m_table.size();
+	while(tableSize < inputVertexCount * 2)
+		tableSize <<= 1;
+	if(tableSize != m_table.size())
+		rehash(tableSize);
+
+	m_vertices.reserve(inputVertexCount / 2);
+	m_keys.reserve((inputVertexCount / 2) * m_keySize);
+}
+
+std::uint32_t Mesh::VertexWelder::add(Vertex const& vertex) {
+	++m_inputVertexCount;
+
+	// Keep the table at most half full
+	if((m_vertices.size() + 1) * 2 > m_table.size())
+		rehash(m_table.size() * 2);
+
+	packWeldKey(vertex, m_contents, m_weldEpsilon, m_currentKey.data());
+
+	std::uint32_t const emptyBucket = std::numeric_limits<std::uint32_t>::max();
+	std::size_t const tableMask     = m_table.size() - 1;
+
+	std::size_t bucket = static_cast<std::size_t>(hashKey(m_currentKey.data())) & tableMask;
+	while(m_table[bucket] != emptyBucket && std::memcmp(&m_keys[m_table[bucket] * m_keySize], m_currentKey.data(), m_keySize) != 0)
+		bucket = (bucket + 1) & tableMask;
+
+	if(m_table[bucket] == emptyBucket) {
+		m_table[bucket] = static_cast<std::uint32_t>(m_vertices.size());
+		m_vertices.push_back(vertex);
+		m_keys.insert(m_keys.end(), m_currentKey.begin(), m_currentKey.end());
+	}
+
+	return m_table[bucket];
+}
+
+std::size_t Mesh::VertexWelder::memoryUsage() const {
+	return m_vertices.capacity() * sizeof(Vertex) + m_keys.capacity() + m_table.capacity() * sizeof(std::uint32_t);
+}
+
+std::uint64_t Mesh::VertexWelder::hashKey(std::uint8_t const* key) const {
+	// FNV-1a
+	std::uint64_t h = 14695981039346656037ull;
+	for(std::size_t i = 0; i < m_keySize; ++i) {
+		h ^= key[i];
+		h *= 1099511628211ull;
+	}
+	return h ^ (h >> 32);
+}
+
+void Mesh::VertexWelder::rehash(std::size_t tableSize) {
+	std::uint32_t const emptyBucket = std::numeric_limits<std::uint32_t>::max();
+	std::size_t const tableMask     = tableSize - 1;
+
+	m_table.assign(tableSize, emptyBucket);
+	for(std::size_t i = 0; i < m_vertices.size(); ++i) {
+		std::size_t bucket = static_cast<std::size_t>(hashKey(&m_keys[i * m_keySize])) & tableMask;
+		while(m_table[bucket] != emptyBucket)
+			bucket = (bucket + 1) & tableMask;
+		m_table[bucket] = static_cast<std::uint32_t>(i);
+	}
 }
 
 std::vector<Mesh::Vertex>& Mesh::vertices() {
+	releasePackedBuffers();
 	return m_vertices;
 }
 std::vector<Mesh::Vertex> const& Mesh::vertices() const {
+	unpackBuffers();
 	return m_vertices;
 }
 
 std::vector<std::uint32_t>& Mesh::indices() {
+	releasePackedBuffers();
 	return m_indices;
 }
 std::vector<std::uint32_t> const& Mesh::indices() const {
+	unpackBuffers();
 	return m_indices;
 }
 
 void Mesh::invalidateCache(std::uintptr_t rendererID) {
 	if(rendererID == std::numeric_limits<std::uintptr_t>::max()) {
 		m_packedData.clear();
+		m_boundsDirty = true;
+		if(!m_bvhDirty) {
+			m_bvh      = MeshBvh();
+			m_bvhDirty = true;
+		}
+		if(!m_occluderGeometryDirty) {
+			m_occluderGeometry      = OccluderGeometry();
+			m_occluderGeometryDirty = true;
+		}
 		for(auto it = m_meshCache.begin(); it != m_meshCache.end();) {
 			if(it->second.isNull()) {
 				it = m_meshCache.erase(it);
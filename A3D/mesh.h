@@ -7,6 +7,7 @@
 #include <limits>
 #include <cstdint>
 #include "A3D/meshcache.h"
+#include "A3D/meshbvh.h"
 #include "A3D/resource.h"
 
 namespace A3D {
@@ -19,6 +20,10 @@ public:
 
 		// Disable back-face culling for this entity
 		DisableCulling = 0x1,
+
+		// Large mesh hiding others: drawn into the occlusion buffer of the renderers with software occlusion culling
+		// (see Renderer::setSoftwareOcclusionCulling()). Only opaque instances occlude.
+		Occluder = 0x2,
 	};
 	Q_DECLARE_FLAGS(RenderOptions, RenderOption)
 
@@ -63,6 +68,112 @@ public:
 		bool Equals(Vertex const& o, Contents c) const;
 	};
 
+	struct WeldStats {
+		std::size_t inputVertexCount;
+		std::size_t outputVertexCount;
+
+		// How many input vertices map to a single output vertex, on average.
+		// 1.0 means nothing could be merged.
+		inline float dedupRatio() const { return outputVertexCount ? static_cast<float>(inputVertexCount) / static_cast<float>(outputVertexCount) : 1.f; }
+	};
+
+	// Post-transform vertex cache efficiency of an index buffer, simulated with a FIFO cache.
+	struct VertexCacheStats {
+		std::size_t triangleCount;
+		std::size_t vertexCount;
+		std::size_t transformedVertexCount;
+
+		// Average cache miss ratio: vertices transformed per triangle, from 3 (no reuse) down to about 0.5.
+		inline float acmr() const { return triangleCount ? static_cast<float>(transformedVertexCount) / static_cast<float>(triangleCount) : 0.f; }
+
+		// Average transformed vertex ratio: vertices transformed per vertex, 1.0 is optimal.
+		inline float atvr() const { return vertexCount ? static_cast<float>(transformedVertexCount) / static_cast<float>(vertexCount) : 0.f; }
+	};
+
+	struct VertexCacheOptimizeStats {
+		VertexCacheStats before;
+		VertexCacheStats after;
+	};
+
+	// Simplified version of a mesh: a subset of its vertices, indexed as triangles.
+	struct Lod {
+		// Estimated deviation from the full mesh, in model space units
+		float error;
+		std::vector<std::uint32_t> indices;
+	};
+
+	// 3D positions of the full mesh, as OcclusionBuffer::addOccluder() reads them. The indices of lods() refer to the same positions.
+	struct OccluderGeometry {
+		// xyz of each vertex
+		std::vector<float> positions;
+
+		// 3 vertex indices per triangle, in draw order
+		std::vector<std::uint32_t> triangles;
+	};
+
+	// Axis-aligned box and bounding sphere of the vertex positions, in model space.
+	struct Bounds {
+		QVector3D min;
+		QVector3D max;
+		QVector3D center;
+		float radius;
+	};
+
+	// Size of the cache optimizeVertexCache() optimizes for, and analyzeVertexCache() simulates by default.
+	static constexpr std::size_t VertexCacheSize = 16;
+
+	// Welds vertices as they are added, the same way optimizeIndices() does on whole buffers,
+	// so that the unwelded vertices never have to be stored.
+	class VertexWelder {
+	public:
+		explicit VertexWelder(Contents, float weldEpsilon = 0.f);
+
+		// Avoids rehashing while up to inputVertexCount vertices are added.
+		void reserve(std::size_t inputVertexCount);
+
+		// Returns the index of the vertex, which is only stored if no identical one was added before.
+		std::uint32_t add(Vertex const&);
+
+		std::vector<Vertex>& vertices() { return m_vertices; }
+		WeldStats stats() const { return WeldStats{ m_inputVertexCount, m_vertices.size() }; }
+
+		// Heap memory held by the welder, in bytes
+		std::size_t memoryUsage() const;
+
+	private:
+		std::uint64_t hashKey(std::uint8_t const* key) const;
+		void rehash(std::size_t tableSize);
+
+		Contents m_contents;
+		float m_weldEpsilon;
+		std::size_t m_keySize;
+		std::size_t m_inputVertexCount;
+		std::vector<Vertex> m_vertices;
+
+		// m_keys[i * m_keySize] holds the weld key of m_vertices[i].
+		std::vector<std::uint8_t> m_keys;
+		std::vector<std::uint8_t> m_currentKey;
+
+		// Open addressing hash table of indices into m_vertices.
+		std::vector<std::uint32_t> m_table;
+	};
+
+	// Vertex and index buffers that are already in the format the renderers upload,
+	// typically pointing straight into a memory-mapped mesh cache file.
+	struct PackedBuffers {
+		// Keeps vertexData and indexData alive.
+		std::shared_ptr<void const> storage;
+
+		// vertexCount vertices in packedVertexSize(contents()) layout
+		std::uint8_t const* vertexData;
+		std::size_t vertexCount;
+
+		// indexCount unsigned indices of indexSize (1, 2 or 4) bytes each
+		std::uint8_t const* indexData;
+		std::size_t indexCount;
+		std::size_t indexSize;
+	};
+
 	explicit Mesh(ResourceManager* = nullptr);
 	~Mesh();
 
@@ -80,12 +191,72 @@ public:
 	//void setBoneTransform(QString const& bone, QMatrix4x4 const& matrix);
 	//void boneTransform(QString const& bone, QMatrix4x4 const& matrix);
 	//std::vector<QMatrix4x4> const& boneTransforms();
-	void optimizeIndices();
+
+	// Merges duplicate vertices and rebuilds the index buffer.
+	// Only the attributes enabled in contents() are compared.
+	// With weldEpsilon > 0, floating point attributes are snapped to a grid of
+	// that size before comparison, so nearly-identical vertices are merged too.
+	WeldStats optimizeIndices(float weldEpsilon = 0.f);
+
+	// Same as above, on buffers that do not belong to a Mesh (e.g. while importing on a worker thread).
+	// The buffers are assumed to be indexed.
+	static WeldStats optimizeIndices(std::vector<Vertex>& vertices, std::vector<std::uint32_t>& indices, Contents, float weldEpsilon = 0.f);
+
+	// Reorders the triangles of an IndexedTriangles mesh for the post-transform vertex cache (Tipsify),
+	// then the resulting clusters so that the ones more likely to occlude others are drawn first,
+	// as long as that costs less than overdrawThreshold times the ACMR.
+	// Vertices are finally reordered by first use, for fetch locality; unreferenced vertices are dropped.
+	VertexCacheOptimizeStats optimizeVertexCache(float overdrawThreshold = 1.05f);
+
+	// Same as above, on buffers that do not belong to a Mesh.
+	// The buffers are assumed to be indexed triangles.
+	static VertexCacheOptimizeStats optimizeVertexCache(std::vector<Vertex>& vertices, std::vector<std::uint32_t>& indices, Contents, float overdrawThreshold = 1.05f);
+
+	// Builds one simplified level per triangle ratio (e.g. 0.5 keeps half of the triangles) of an IndexedTriangles mesh,
+	// with quadric error metrics. Each level continues from the previous one, so the ratios are expected in decreasing order.
+	// Edges are only collapsed onto existing vertices, so every level shares the vertex buffer of the mesh;
+	// vertices on UV / normal seams and on open borders only move along them.
+	// Levels that are barely smaller than the previous one are left out. Returns the number of levels.
+	std::size_t generateLods(std::vector<float> const& triangleRatios = defaultLodTriangleRatios());
+
+	// Same as above, on buffers that do not belong to a Mesh.
+	static std::vector<Lod> generateLods(std::vector<Vertex> const& vertices, std::vector<std::uint32_t> const& indices, Contents, std::vector<float> const& triangleRatios);
+
+	static std::vector<float> defaultLodTriangleRatios();
+
+	// Levels of detail, from the most detailed one. The full mesh is not part of them.
+	// They index vertices(), and have to be generated again after the buffers are modified.
+	std::vector<Lod> const& lods() const;
+	void setLods(std::vector<Lod>);
+
+	// Triangles drawn at a level of detail: 0 is the full mesh, n is lods()[n - 1].
+	std::size_t triangleCount(std::size_t lodLevel = 0) const;
+
+	// Computed on first use, from the packed buffers when there are any; invalidateCache() discards them.
+	Bounds const& bounds() const;
+
+	// Vertex indices of a triangle of the full mesh, in draw order. Returns false past the last triangle.
+	bool triangleVertices(std::size_t triangle, std::uint32_t vertices[3]) const;
+
+	// Triangle hierarchy of the 3D positions, for ray casts. Built on first use, like bounds().
+	MeshBvh const& bvh() const;
+
+	// Built on first use, like bounds(). Empty for meshes without 3D positions.
+	OccluderGeometry const& occluderGeometry() const;
+
+	static VertexCacheStats analyzeVertexCache(std::vector<std::uint32_t> const& indices, std::size_t vertexCount, std::size_t cacheSize = VertexCacheSize);
 
 	std::vector<Vertex>& vertices();
 	std::vector<Vertex> const& vertices() const;
 	std::vector<std::uint8_t> const& packedData() const;
 
+	// Replaces vertices and indices with pre-packed buffers.
+	// vertices() and indices() are only rebuilt from them when they are accessed;
+	// the non-const accessors also drop the packed buffers, as the mesh may be modified afterwards.
+	void setPackedBuffers(Contents, PackedBuffers);
+	bool hasPackedBuffers() const;
+	PackedBuffers const& packedBuffers() const;
+
 	std::vector<std::uint32_t>& indices();
 	std::vector<std::uint32_t> const& indices() const;
 
@@ -117,11 +288,42 @@ public:
 
 	static std::size_t packedVertexSize(Contents);
 
+	// Offset of an attribute within a packed vertex: attributes are packed in the order of their Content bit.
+	static std::size_t packedAttributeOffset(Contents, Content attribute);
+	static std::vector<std::uint8_t> packVertices(std::vector<Vertex> const&, Contents);
+	static std::vector<Vertex> unpackVertices(PackedBuffers const&, Contents);
+	static std::vector<std::uint32_t> unpackIndices(PackedBuffers const&);
+
+	// Smallest index size (1, 2 or 4 bytes) the renderers use for indices up to maxIndex.
+	static std::size_t packedIndexSize(std::uint32_t maxIndex);
+
 private:
+	static std::uint8_t* packVertex(Vertex const&, Contents, std::uint8_t* pDst);
+	static std::uint8_t* packWeldKey(Vertex const&, Contents, float weldEpsilon, std::uint8_t* pDst);
+	static std::uint8_t const* unpackVertex(std::uint8_t const* pSrc, Contents, Vertex&);
+
+	void unpackBuffers() const;
+	void releasePackedBuffers();
+	void computeBounds() const;
+
+	// Position attribute of the first vertex, read in place from the packed buffers when there are any.
+	std::uint8_t const* positionData(Content position, std::size_t& stride, std::size_t& vertexCount) const;
+
+	// Vertex used by the n-th element of the draw mode
+	std::uint32_t elementVertex(std::size_t element) const;
+
 	DrawMode m_drawMode;
-	std::vector<Vertex> m_vertices;
-	std::vector<std::uint32_t> m_indices;
+	mutable std::vector<Vertex> m_vertices;
+	mutable std::vector<std::uint32_t> m_indices;
+	PackedBuffers m_packedBuffers;
+	std::vector<Lod> m_lods;
 	RenderOptions m_renderOptions;
+	mutable Bounds m_bounds;
+	mutable bool m_boundsDirty;
+	mutable MeshBvh m_bvh;
+	mutable bool m_bvhDirty;
+	mutable OccluderGeometry m_occluderGeometry;
+	mutable bool m_occluderGeometryDirty;
 
 	//std::map<QString, std::size_t> m_bones;
 	//std::vector<QMatrix4x4> m_boneTransforms;
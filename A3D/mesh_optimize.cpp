@@ -0,0 +1,248 @@
+#include "A3D/mesh.h"
+#include <algorithm>
+
+namespace A3D {
+
+namespace {
+
+// Triangles using each vertex, as ranges of one array.
+struct VertexTriangles {
+	std::vector<std::uint32_t> offsets;
+	std::vector<std::uint32_t> counts;
+	std::vector<std::uint32_t> triangles;
+
+	VertexTriangles(std::vector<std::uint32_t> const& indices, std::size_t vertexCount)
+		: offsets(vertexCount + 1, 0),
+		  counts(vertexCount, 0),
+		  triangles(indices.size()) {
+		for(auto it = indices.begin(); it != indices.end(); ++it)
+			++counts[*it];
+		for(std::size_t i = 0; i < vertexCount; ++i)
+			offsets[i + 1] = offsets[i] + counts[i];
+
+		std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for(std::size_t i = 0; i < indices.size(); ++i)
+			triangles[fill[indices[i]]++] = static_cast<std::uint32_t>(i / 3);
+	}
+};
+
+// Tipsify (Sander, Nehab, Barczak - "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+// Fans around a vertex at a time, choosing the next one among the vertices just emitted that will still be in the cache.
+// clusters receives the first triangle of each run that had to restart from a dead end.
+std::vector<std::uint32_t> tipsify(std::vector<std::uint32_t> const& indices, std::size_t vertexCount, std::size_t cacheSize, std::vector<std::uint32_t>& clusters) {
+	std::size_t const triangleCount = indices.size() / 3;
+	VertexTriangles const adjacency(indices, vertexCount);
+
+	std::vector<std::uint32_t> liveTriangles = adjacency.counts;
+	std::vector<std::size_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<std::uint32_t> deadEnds;
+	std::vector<std::uint32_t> candidates;
+
+	std::vector<std::uint32_t> output;
+	output.reserve(indices.size());
+	clusters.clear();
+
+	std::size_t time   = cacheSize + 1;
+	std::size_t cursor = 0;
+
+	auto nextDeadEnd = [&]() -> std::size_t {
+		while(!deadEnds.empty()) {
+			std::uint32_t const v = deadEnds.back();
+			deadEnds.pop_back();
+			if(liveTriangles[v] > 0)
+				return v;
+		}
+		for(; cursor < vertexCount; ++cursor) {
+			if(liveTriangles[cursor] > 0)
+				return cursor;
+		}
+		return vertexCount;
+	};
+
+	std::size_t fan = nextDeadEnd();
+	while(fan < vertexCount) {
+		if(candidates.empty())
+			clusters.push_back(static_cast<std::uint32_t>(output.size() / 3));
+
+		candidates.clear();
+		for(std::uint32_t i = adjacency.offsets[fan]; i < adjacency.offsets[fan + 1]; ++i) {
+			std::uint32_t const triangle = adjacency.triangles[i];
+			if(emitted[triangle])
+				continue;
+			emitted[triangle] = true;
+
+			for(std::size_t corner = 0; corner < 3; ++corner) {
+				std::uint32_t const v = indices[triangle * 3 + corner];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				--liveTriangles[v];
+
+				if(time - cacheTime[v] > cacheSize)
+					cacheTime[v] = time++;
+			}
+		}
+
+		// Prefer the candidate that entered the cache first, provided its remaining triangles will not push it out.
+		std::size_t best         = vertexCount;
+		std::size_t bestPriority = 0;
+		for(auto it = candidates.begin(); it != candidates.end(); ++it) {
+			std::uint32_t const v = *it;
+			if(liveTriangles[v] == 0)
+				continue;
+
+			std::size_t priority = 0;
+			if(time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+				priority = time - cacheTime[v];
+			if(best == vertexCount || priority > bestPriority) {
+				best         = v;
+				bestPriority = priority;
+			}
+		}
+
+		if(best == vertexCount) {
+			candidates.clear();
+			best = nextDeadEnd();
+		}
+		fan = best;
+	}
+
+	return output;
+}
+
+// View-independent overdraw order (same paper): clusters facing away from the center of the mesh are more likely
+// to occlude the others, so they are drawn first.
+std::vector<std::uint32_t> sortClustersForOverdraw(std::vector<std::uint32_t> const& indices, std::vector<Mesh::Vertex> const& vertices, std::vector<std::uint32_t> const& clusters) {
+	std::size_t const triangleCount = indices.size() / 3;
+
+	QVector3D meshCenter;
+	for(auto it = vertices.begin(); it != vertices.end(); ++it)
+		meshCenter += it->Position3D;
+	if(!vertices.empty())
+		meshCenter /= static_cast<float>(vertices.size());
+
+	struct Cluster {
+		std::uint32_t begin;
+		std::uint32_t end;
+		float sortKey;
+	};
+	std::vector<Cluster> sorted;
+	sorted.reserve(clusters.size());
+
+	for(std::size_t i = 0; i < clusters.size(); ++i) {
+		Cluster cluster;
+		cluster.begin = clusters[i];
+		cluster.end   = (i + 1 < clusters.size()) ? clusters[i + 1] : static_cast<std::uint32_t>(triangleCount);
+
+		// Area-weighted center and normal
+		QVector3D center;
+		QVector3D normal;
+		float area = 0.f;
+		for(std::uint32_t triangle = cluster.begin; triangle < cluster.end; ++triangle) {
+			QVector3D const& p0 = vertices[indices[triangle * 3 + 0]].Position3D;
+			QVector3D const& p1 = vertices[indices[triangle * 3 + 1]].Position3D;
+			QVector3D const& p2 = vertices[indices[triangle * 3 + 2]].Position3D;
+
+			QVector3D const n   = QVector3D::crossProduct(p1 - p0, p2 - p0);
+			float const nLength = n.length();
+
+			center += (p0 + p1 + p2) * (nLength / 3.f);
+			normal += n;
+			area += nLength;
+		}
+		if(area > 0.f)
+			center /= area;
+
+		cluster.sortKey = QVector3D::dotProduct(center - meshCenter, normal.normalized());
+		sorted.push_back(cluster);
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](Cluster const& a, Cluster const& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<std::uint32_t> output;
+	output.reserve(indices.size());
+	for(auto it = sorted.begin(); it != sorted.end(); ++it)
+		output.insert(output.end(), indices.begin() + it->begin * 3, indices.begin() + it->end * 3);
+	return output;
+}
+
+}
+
+Mesh::VertexCacheStats Mesh::analyzeVertexCache(std::vector<std::uint32_t> const& indices, std::size_t vertexCount, std::size_t cacheSize) {
+	VertexCacheStats stats{ indices.size() / 3, 0, 0 };
+
+	// A vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded.
+	std::vector<std::size_t> loadedAt(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	for(auto it = indices.begin(); it != indices.end(); ++it) {
+		std::uint32_t const v = *it;
+		if(v >= vertexCount)
+			continue;
+
+		if(!referenced[v]) {
+			referenced[v] = true;
+			++stats.vertexCount;
+		}
+		if(loadedAt[v] == 0 || stats.transformedVertexCount + 1 - loadedAt[v] > cacheSize)
+			loadedAt[v] = ++stats.transformedVertexCount;
+	}
+	return stats;
+}
+
+Mesh::VertexCacheOptimizeStats Mesh::optimizeVertexCache(float overdrawThreshold) {
+	releasePackedBuffers();
+	if(drawMode() != Mesh::IndexedTriangles) {
+		VertexCacheStats const stats = analyzeVertexCache(m_indices, m_vertices.size());
+		return VertexCacheOptimizeStats{ stats, stats };
+	}
+
+	VertexCacheOptimizeStats stats = optimizeVertexCache(m_vertices, m_indices, m_contents, overdrawThreshold);
+	m_lods.clear();
+	invalidateCache();
+	return stats;
+}
+
+Mesh::VertexCacheOptimizeStats Mesh::optimizeVertexCache(std::vector<Vertex>& vertices, std::vector<std::uint32_t>& indices, Contents contents, float overdrawThreshold) {
+	VertexCacheOptimizeStats stats;
+	stats.before = analyzeVertexCache(indices, vertices.size());
+	if(indices.size() < 3 || vertices.empty()) {
+		stats.after = stats.before;
+		return stats;
+	}
+
+	// A trailing partial triangle is never drawn anyway
+	indices.resize(indices.size() - indices.size() % 3);
+
+	std::vector<std::uint32_t> clusters;
+	std::vector<std::uint32_t> reordered = tipsify(indices, vertices.size(), VertexCacheSize, clusters);
+
+	if(contents & Position3D) {
+		std::vector<std::uint32_t> sorted   = sortClustersForOverdraw(reordered, vertices, clusters);
+		VertexCacheStats const tipsifyStats = analyzeVertexCache(reordered, vertices.size());
+		VertexCacheStats const sortedStats  = analyzeVertexCache(sorted, vertices.size());
+		if(sortedStats.acmr() <= tipsifyStats.acmr() * overdrawThreshold)
+			reordered = std::move(sorted);
+	}
+
+	// Vertex fetch: vertices in the order the indices first use them
+	std::uint32_t const unused = std::numeric_limits<std::uint32_t>::max();
+	std::vector<std::uint32_t> remap(vertices.size(), unused);
+	std::vector<Vertex> fetchOrdered;
+	fetchOrdered.reserve(vertices.size());
+	for(auto it = reordered.begin(); it != reordered.end(); ++it) {
+		std::uint32_t& newIndex = remap[*it];
+		if(newIndex == unused) {
+			newIndex = static_cast<std::uint32_t>(fetchOrdered.size());
+			fetchOrdered.push_back(vertices[*it]);
+		}
+		*it = newIndex;
+	}
+
+	vertices    = std::move(fetchOrdered);
+	indices     = std::move(reordered);
+	stats.after = analyzeVertexCache(indices, vertices.size());
+	return stats;
+}
+
+}
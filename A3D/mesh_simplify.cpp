@@ -0,0 +1,431 @@
+#include "A3D/mesh.h"
+#include <algorithm>
+#include <cmath>
+
+namespace A3D {
+
+namespace {
+
+// Sum of squared distances to a set of planes (Garland, Heckbert - "Surface Simplification Using Quadric Error Metrics", 1997).
+// Q(p) = p'Ap + 2b'p + c
+struct Quadric {
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+
+	// Area the planes were weighted with; border and seam constraints do not count.
+	double weight;
+
+	static Quadric plane(QVector3D const& normal, float distance, double planeWeight, double areaWeight) {
+		double const x = normal.x(), y = normal.y(), z = normal.z(), d = distance;
+		return Quadric{ planeWeight * x * x, planeWeight * x * y, planeWeight * x * z, planeWeight * y * y, planeWeight * y * z, planeWeight * z * z,
+			            planeWeight * x * d, planeWeight * y * d, planeWeight * z * d, planeWeight * d * d, areaWeight };
+	}
+
+	Quadric& operator+=(Quadric const& o) {
+		a00 += o.a00;
+		a01 += o.a01;
+		a02 += o.a02;
+		a11 += o.a11;
+		a12 += o.a12;
+		a22 += o.a22;
+		b0 += o.b0;
+		b1 += o.b1;
+		b2 += o.b2;
+		c += o.c;
+		weight += o.weight;
+		return *this;
+	}
+
+	// Mean squared distance of p to the planes
+	double error(QVector3D const& p) const {
+		double const x = p.x(), y = p.y(), z = p.z();
+		double const q = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return weight > 0.0 ? std::max(q, 0.0) / weight : std::max(q, 0.0);
+	}
+};
+
+// Relative weight of the planes that keep borders and seams in place
+double const ConstraintWeight = 10.0;
+
+// Collapses edges onto one of their vertices, cheapest first, in passes of independent collapses.
+// The mesh is seen as positions (vertices welded on Position3D only), each of which may have several wedges:
+// the vertices with different attributes at a UV or normal seam. A collapse moves every wedge of a position.
+class Simplifier {
+public:
+	Simplifier(std::vector<Mesh::Vertex> const& vertices, std::vector<std::uint32_t> const& indices)
+		: m_indices(indices),
+		  m_error(0.0) {
+		m_indices.resize(m_indices.size() - m_indices.size() % 3);
+
+		Mesh::VertexWelder welder(Mesh::Position3D);
+		welder.reserve(vertices.size());
+		m_positionOf.reserve(vertices.size());
+		for(auto it = vertices.begin(); it != vertices.end(); ++it)
+			m_positionOf.push_back(welder.add(*it));
+
+		m_positions.reserve(welder.vertices().size());
+		for(auto it = welder.vertices().begin(); it != welder.vertices().end(); ++it)
+			m_positions.push_back(it->Position3D);
+
+		removeDegenerateTriangles();
+		buildTopology();
+		buildQuadrics();
+	}
+
+	// Collapses edges until at most targetIndexCount indices are left, or no edge can be collapsed.
+	void simplify(std::size_t targetIndexCount) {
+		while(m_indices.size() > targetIndexCount) {
+			if(!collapsePass(targetIndexCount))
+				break;
+			removeDegenerateTriangles();
+			buildTopology();
+		}
+	}
+
+	std::vector<std::uint32_t> const& indices() const { return m_indices; }
+
+	// Largest distance a collapse moved the surface by, estimated from the quadrics
+	float error() const { return static_cast<float>(std::sqrt(m_error)); }
+
+private:
+	struct Edge {
+		std::uint32_t from;
+		std::uint32_t to;
+		std::uint32_t triangle;
+	};
+	struct Collapse {
+		double cost;
+		std::uint32_t from;
+		std::uint32_t to;
+		std::uint32_t edge;
+	};
+
+	inline std::uint32_t position(std::size_t corner) const { return m_positionOf[m_indices[corner]]; }
+
+	void removeDegenerateTriangles() {
+		std::size_t out = 0;
+		for(std::size_t i = 0; i < m_indices.size(); i += 3) {
+			std::uint32_t const p0 = position(i), p1 = position(i + 1), p2 = position(i + 2);
+			if(p0 == p1 || p1 == p2 || p2 == p0)
+				continue;
+
+			m_indices[out++] = m_indices[i];
+			m_indices[out++] = m_indices[i + 1];
+			m_indices[out++] = m_indices[i + 2];
+		}
+		m_indices.resize(out);
+	}
+
+	// Edges, triangles around each position, wedges, and which positions can move.
+	void buildTopology() {
+		std::size_t const positionCount = m_positions.size();
+		std::size_t const triangleCount = m_indices.size() / 3;
+
+		m_edges.clear();
+		m_edges.reserve(m_indices.size());
+		for(std::size_t t = 0; t < triangleCount; ++t) {
+			for(std::size_t c = 0; c < 3; ++c) {
+				std::uint32_t const a = position(t * 3 + c), b = position(t * 3 + (c + 1) % 3);
+				m_edges.push_back(Edge{ std::min(a, b), std::max(a, b), static_cast<std::uint32_t>(t) });
+			}
+		}
+		std::sort(m_edges.begin(), m_edges.end(), [](Edge const& x, Edge const& y) {
+			return x.from != y.from ? x.from < y.from : x.to != y.to ? x.to < y.to : x.triangle < y.triangle;
+		});
+
+		m_triangleOffsets.assign(positionCount + 1, 0);
+		for(std::size_t i = 0; i < m_indices.size(); ++i)
+			++m_triangleOffsets[position(i) + 1];
+		for(std::size_t p = 0; p < positionCount; ++p)
+			m_triangleOffsets[p + 1] += m_triangleOffsets[p];
+
+		m_triangles.resize(m_indices.size());
+		std::vector<std::uint32_t> fill(m_triangleOffsets.begin(), m_triangleOffsets.end() - 1);
+		for(std::size_t i = 0; i < m_indices.size(); ++i)
+			m_triangles[fill[position(i)]++] = static_cast<std::uint32_t>(i / 3);
+
+		// Wedges: distinct vertices of a position, over its triangles
+		m_wedgeCount.assign(positionCount, 0);
+		m_border.assign(positionCount, false);
+		m_locked.assign(positionCount, false);
+		for(std::size_t p = 0; p < positionCount; ++p) {
+			std::uint32_t wedges[2] = { 0, 0 };
+			for(std::uint32_t i = m_triangleOffsets[p]; i < m_triangleOffsets[p + 1] && m_wedgeCount[p] <= 2; ++i) {
+				std::uint32_t const wedge = wedgeIn(m_triangles[i], static_cast<std::uint32_t>(p));
+				if((m_wedgeCount[p] > 0 && wedges[0] == wedge) || (m_wedgeCount[p] > 1 && wedges[1] == wedge))
+					continue;
+				if(m_wedgeCount[p] < 2)
+					wedges[m_wedgeCount[p]] = wedge;
+				++m_wedgeCount[p];
+			}
+		}
+
+		for(std::size_t i = 0; i < m_edges.size();) {
+			std::size_t const count = edgeTriangleCount(i);
+			if(count == 1) {
+				m_border[m_edges[i].from] = true;
+				m_border[m_edges[i].to]   = true;
+			}
+			else if(count > 2) {
+				m_locked[m_edges[i].from] = true;
+				m_locked[m_edges[i].to]   = true;
+			}
+			i += count;
+		}
+
+		// Corners of seams, seams meeting borders, and the like are kept.
+		for(std::size_t p = 0; p < positionCount; ++p) {
+			if(m_wedgeCount[p] > 2 || (m_border[p] && m_wedgeCount[p] > 1))
+				m_locked[p] = true;
+		}
+	}
+
+	std::size_t edgeTriangleCount(std::size_t edge) const {
+		std::size_t end = edge + 1;
+		while(end < m_edges.size() && m_edges[end].from == m_edges[edge].from && m_edges[end].to == m_edges[edge].to)
+			++end;
+		return end - edge;
+	}
+
+	// Vertex of triangle t at position p
+	std::uint32_t wedgeIn(std::uint32_t t, std::uint32_t p) const {
+		for(std::size_t c = 0; c < 3; ++c) {
+			if(position(t * 3 + c) == p)
+				return m_indices[t * 3 + c];
+		}
+		return m_indices[t * 3];
+	}
+
+	QVector3D triangleNormal(std::uint32_t t) const {
+		QVector3D const& p0 = m_positions[position(t * 3)];
+		QVector3D const& p1 = m_positions[position(t * 3 + 1)];
+		QVector3D const& p2 = m_positions[position(t * 3 + 2)];
+		return QVector3D::crossProduct(p1 - p0, p2 - p0);
+	}
+
+	void buildQuadrics() {
+		m_quadrics.assign(m_positions.size(), Quadric{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 });
+
+		for(std::size_t t = 0; t < m_indices.size() / 3; ++t) {
+			QVector3D normal   = triangleNormal(static_cast<std::uint32_t>(t));
+			float const length = normal.length();
+			if(length <= 0.f)
+				continue;
+			normal /= length;
+
+			double const area     = 0.5 * length;
+			QVector3D const& p0   = m_positions[position(t * 3)];
+			Quadric const quadric = Quadric::plane(normal, -QVector3D::dotProduct(normal, p0), area, area);
+			for(std::size_t c = 0; c < 3; ++c)
+				m_quadrics[position(t * 3 + c)] += quadric;
+		}
+
+		// Planes through border and seam edges, perpendicular to their triangle, hold them in place.
+		for(std::size_t i = 0; i < m_edges.size();) {
+			std::size_t const count = edgeTriangleCount(i);
+			Edge const& edge        = m_edges[i];
+
+			bool constrained = (count == 1);
+			if(count == 2) {
+				std::uint32_t const t0 = edge.triangle, t1 = m_edges[i + 1].triangle;
+				constrained            = wedgeIn(t0, edge.from) != wedgeIn(t1, edge.from) || wedgeIn(t0, edge.to) != wedgeIn(t1, edge.to);
+			}
+
+			if(constrained) {
+				QVector3D const& a       = m_positions[edge.from];
+				QVector3D const& b       = m_positions[edge.to];
+				QVector3D const edgeDir  = b - a;
+				QVector3D const normal   = QVector3D::crossProduct(edgeDir, triangleNormal(edge.triangle)).normalized();
+				double const lengthSq    = static_cast<double>(QVector3D::dotProduct(edgeDir, edgeDir));
+				Quadric const constraint = Quadric::plane(normal, -QVector3D::dotProduct(normal, a), lengthSq * ConstraintWeight, 0.0);
+				m_quadrics[edge.from] += constraint;
+				m_quadrics[edge.to] += constraint;
+			}
+			i += count;
+		}
+	}
+
+	// Checks that the edge can collapse from -> to, and fills the wedge mapping: the wedges of from,
+	// and the wedge of to each one becomes, as seen on the triangles of the edge.
+	bool canCollapse(std::size_t edge, std::size_t edgeTriangles, std::uint32_t from, std::uint32_t to, std::uint32_t (&fromWedges)[2], std::uint32_t (&toWedges)[2]) const {
+		if(m_locked[from] || (m_border[from] && edgeTriangles != 1))
+			return false;
+
+		std::size_t mapped = 0;
+		for(std::size_t i = edge; i < edge + edgeTriangles; ++i) {
+			std::uint32_t const fromWedge = wedgeIn(m_edges[i].triangle, from);
+			std::uint32_t const toWedge   = wedgeIn(m_edges[i].triangle, to);
+
+			bool known = false;
+			for(std::size_t w = 0; w < mapped; ++w) {
+				if(fromWedges[w] == fromWedge) {
+					if(toWedges[w] != toWedge)
+						return false;
+					known = true;
+				}
+			}
+			if(!known) {
+				fromWedges[mapped] = fromWedge;
+				toWedges[mapped]   = toWedge;
+				++mapped;
+			}
+		}
+
+		// Every wedge of from has to follow the edge: a seam vertex only moves along its seam.
+		return mapped == m_wedgeCount[from];
+	}
+
+	// Rejects collapses that would flip or squash a triangle around from.
+	bool keepsOrientation(std::uint32_t from, std::uint32_t to) const {
+		QVector3D const& target = m_positions[to];
+		for(std::uint32_t i = m_triangleOffsets[from]; i < m_triangleOffsets[from + 1]; ++i) {
+			std::uint32_t const t = m_triangles[i];
+
+			QVector3D p[3];
+			bool hasTo = false;
+			for(std::size_t c = 0; c < 3; ++c) {
+				std::uint32_t const pc = position(t * 3 + c);
+				hasTo                  = hasTo || pc == to;
+				p[c]                   = (pc == from) ? target : m_positions[pc];
+			}
+			if(hasTo)
+				continue;
+
+			QVector3D const before = triangleNormal(t);
+			QVector3D const after  = QVector3D::crossProduct(p[1] - p[0], p[2] - p[0]);
+			if(QVector3D::dotProduct(before, after) <= 0.25f * before.length() * after.length())
+				return false;
+		}
+		return true;
+	}
+
+	bool collapsePass(std::size_t targetIndexCount) {
+		std::vector<Collapse> collapses;
+		collapses.reserve(m_edges.size() / 2);
+
+		std::uint32_t fromWedges[2], toWedges[2];
+		for(std::size_t i = 0; i < m_edges.size();) {
+			std::size_t const count = edgeTriangleCount(i);
+			std::uint32_t const a   = m_edges[i].from;
+			std::uint32_t const b   = m_edges[i].to;
+
+			Quadric q = m_quadrics[a];
+			q += m_quadrics[b];
+
+			Collapse best{ -1.0, 0, 0, static_cast<std::uint32_t>(i) };
+			if(count <= 2 && canCollapse(i, count, a, b, fromWedges, toWedges))
+				best = Collapse{ q.error(m_positions[b]), a, b, static_cast<std::uint32_t>(i) };
+			if(count <= 2 && canCollapse(i, count, b, a, fromWedges, toWedges)) {
+				double const cost = q.error(m_positions[a]);
+				if(best.cost < 0.0 || cost < best.cost)
+					best = Collapse{ cost, b, a, static_cast<std::uint32_t>(i) };
+			}
+			if(best.cost >= 0.0)
+				collapses.push_back(best);
+			i += count;
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](Collapse const& x, Collapse const& y) { return x.cost < y.cost; });
+
+		// A collapse freezes the positions around it for the rest of the pass, so that the checks of the next ones stay valid.
+		std::vector<bool> frozen(m_positions.size(), false);
+		std::vector<std::uint32_t> remap(m_positionOf.size());
+		for(std::size_t v = 0; v < remap.size(); ++v)
+			remap[v] = static_cast<std::uint32_t>(v);
+
+		std::size_t indexCount = m_indices.size();
+		bool collapsed         = false;
+		for(auto it = collapses.begin(); it != collapses.end() && indexCount > targetIndexCount; ++it) {
+			if(frozen[it->from] || frozen[it->to] || !keepsOrientation(it->from, it->to))
+				continue;
+
+			std::size_t const count = edgeTriangleCount(it->edge);
+			canCollapse(it->edge, count, it->from, it->to, fromWedges, toWedges);
+			for(std::size_t w = 0; w < m_wedgeCount[it->from]; ++w)
+				remap[fromWedges[w]] = toWedges[w];
+
+			m_quadrics[it->to] += m_quadrics[it->from];
+			m_error = std::max(m_error, it->cost);
+
+			for(std::uint32_t i = m_triangleOffsets[it->from]; i < m_triangleOffsets[it->from + 1]; ++i) {
+				for(std::size_t c = 0; c < 3; ++c)
+					frozen[position(m_triangles[i] * 3 + c)] = true;
+			}
+			frozen[it->to] = true;
+
+			indexCount -= count * 3;
+			collapsed = true;
+		}
+
+		for(auto it = m_indices.begin(); it != m_indices.end(); ++it)
+			*it = remap[*it];
+		return collapsed;
+	}
+
+	std::vector<std::uint32_t> m_indices;
+	std::vector<std::uint32_t> m_positionOf;
+	std::vector<QVector3D> m_positions;
+	std::vector<Quadric> m_quadrics;
+	double m_error;
+
+	// Rebuilt after every pass
+	std::vector<Edge> m_edges;
+	std::vector<std::uint32_t> m_triangleOffsets;
+	std::vector<std::uint32_t> m_triangles;
+	std::vector<std::uint32_t> m_wedgeCount;
+	std::vector<bool> m_border;
+	std::vector<bool> m_locked;
+};
+
+}
+
+std::vector<float> Mesh::defaultLodTriangleRatios() {
+	return std::vector<float>{ 0.5f, 0.25f, 0.125f };
+}
+
+std::vector<Mesh::Lod> const& Mesh::lods() const {
+	return m_lods;
+}
+void Mesh::setLods(std::vector<Lod> lods) {
+	m_lods = std::move(lods);
+	invalidateCache();
+}
+
+std::size_t Mesh::generateLods(std::vector<float> const& triangleRatios) {
+	if(drawMode() != Mesh::IndexedTriangles) {
+		setLods(std::vector<Lod>());
+		return 0;
+	}
+
+	// The packed buffers, if any, are kept for the renderers: the vertices are only read here.
+	Mesh const* self = this;
+	setLods(generateLods(self->vertices(), self->indices(), m_contents, triangleRatios));
+	return m_lods.size();
+}
+
+std::vector<Mesh::Lod> Mesh::generateLods(std::vector<Vertex> const& vertices, std::vector<std::uint32_t> const& indices, Contents contents, std::vector<float> const& triangleRatios) {
+	std::vector<Lod> lods;
+	if(!(contents & Position3D) || indices.size() < 3 || triangleRatios.empty())
+		return lods;
+
+	Simplifier simplifier(vertices, indices);
+	std::size_t const triangleCount = indices.size() / 3;
+	std::size_t previousCount       = triangleCount;
+
+	for(auto it = triangleRatios.begin(); it != triangleRatios.end(); ++it) {
+		std::size_t const target = static_cast<std::size_t>(std::max(1.0, std::floor(static_cast<double>(triangleCount) * std::min(1.f, std::max(0.f, *it)))));
+		simplifier.simplify(target * 3);
+
+		// Not worth a level: the mesh can not be simplified much further.
+		std::size_t const count = simplifier.indices().size() / 3;
+		if(count == 0 || count > previousCount * 9 / 10)
+			break;
+
+		lods.push_back(Lod{ simplifier.error(), simplifier.indices() });
+		previousCount = count;
+	}
+	return lods;
+}
+
+}
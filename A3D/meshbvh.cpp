@@ -0,0 +1,426 @@
+#include "A3D/meshbvh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define A3D_MESHBVH_SSE
+#endif
+
+namespace A3D {
+
+namespace {
+
+constexpr std::size_t PacketSize = 4;
+
+// Leaves are split further while it pays off, and always above this size
+constexpr std::size_t MaxLeafTriangles = 4 * PacketSize;
+constexpr std::size_t BinCount         = 16;
+
+// Cost of visiting a node, relative to testing a packet of triangles
+constexpr float TraversalCost = 1.f;
+
+inline std::size_t packetCount(std::size_t triangleCount) {
+	return (triangleCount + PacketSize - 1) / PacketSize;
+}
+
+inline float halfArea(QVector3D const& min, QVector3D const& max) {
+	QVector3D const d = max - min;
+	return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+}
+
+inline QVector3D minimum(QVector3D const& a, QVector3D const& b) {
+	return QVector3D(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
+}
+
+inline QVector3D maximum(QVector3D const& a, QVector3D const& b) {
+	return QVector3D(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
+}
+
+struct Ray {
+	float origin[4];
+	float direction[4];
+	float invDirection[4];
+};
+
+// Distance at which the ray enters the box, or infinity when it misses it within [0, maxDistance].
+#ifdef A3D_MESHBVH_SSE
+inline float entryDistance(float const* min, float const* max, Ray const& ray, float maxDistance) {
+	// The 4th lanes hold the offset and count of the node: they are ignored.
+	__m128 const origin       = _mm_loadu_ps(ray.origin);
+	__m128 const invDirection = _mm_loadu_ps(ray.invDirection);
+	__m128 const t1           = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min), origin), invDirection);
+	__m128 const t2           = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max), origin), invDirection);
+	__m128 const tNear        = _mm_min_ps(t1, t2);
+	__m128 const tFar         = _mm_max_ps(t1, t2);
+
+	__m128 const nearXY = _mm_max_ss(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(3, 2, 0, 1)));
+	__m128 const farXY  = _mm_min_ss(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(3, 2, 0, 1)));
+	__m128 const enter  = _mm_max_ss(_mm_max_ss(nearXY, _mm_movehl_ps(tNear, tNear)), _mm_setzero_ps());
+	__m128 const exit   = _mm_min_ss(_mm_min_ss(farXY, _mm_movehl_ps(tFar, tFar)), _mm_set_ss(maxDistance));
+
+	return _mm_comile_ss(enter, exit) ? _mm_cvtss_f32(enter) : std::numeric_limits<float>::infinity();
+}
+#else
+inline float entryDistance(float const* min, float const* max, Ray const& ray, float maxDistance) {
+	float enter = 0.f;
+	float exit  = maxDistance;
+	for(int axis = 0; axis < 3; ++axis) {
+		float const t1 = (min[axis] - ray.origin[axis]) * ray.invDirection[axis];
+		float const t2 = (max[axis] - ray.origin[axis]) * ray.invDirection[axis];
+		enter          = std::max(enter, std::min(t1, t2));
+		exit           = std::min(exit, std::max(t1, t2));
+	}
+	return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+#endif
+
+}
+
+MeshBvh::MeshBvh() {
+}
+
+bool MeshBvh::isEmpty() const {
+	return m_nodes.empty();
+}
+
+std::size_t MeshBvh::nodeCount() const {
+	return m_nodes.size();
+}
+
+std::size_t MeshBvh::memoryUsage() const {
+	return m_nodes.capacity() * sizeof(Node) + m_packets.capacity() * sizeof(TrianglePacket);
+}
+
+void MeshBvh::build(std::uint8_t const* positions, std::size_t positionStride, std::size_t vertexCount, std::uint32_t const* triangleVertices, std::size_t triangleCount) {
+	m_nodes.clear();
+	m_packets.clear();
+
+	std::vector<QVector3D> corners;
+	std::vector<BuildTriangle> triangles;
+	corners.reserve(triangleCount * 3);
+	triangles.reserve(triangleCount);
+	for(std::size_t i = 0; i < triangleCount; ++i) {
+		std::uint32_t const* t = triangleVertices + i * 3;
+		if(t[0] == t[1] || t[1] == t[2] || t[2] == t[0] || t[0] >= vertexCount || t[1] >= vertexCount || t[2] >= vertexCount)
+			continue;
+
+		BuildTriangle triangle;
+		triangle.index  = static_cast<std::uint32_t>(i);
+		triangle.corner = static_cast<std::uint32_t>(corners.size());
+		for(int c = 0; c < 3; ++c) {
+			float p[3];
+			std::memcpy(p, positions + t[c] * positionStride, sizeof(p));
+			corners.emplace_back(p[0], p[1], p[2]);
+		}
+
+		QVector3D const& a = corners[triangle.corner];
+		QVector3D const& b = corners[triangle.corner + 1];
+		QVector3D const& c = corners[triangle.corner + 2];
+		triangle.min       = minimum(minimum(a, b), c);
+		triangle.max       = maximum(maximum(a, b), c);
+		triangle.centroid  = (triangle.min + triangle.max) * 0.5f;
+		triangles.push_back(triangle);
+	}
+	if(triangles.empty())
+		return;
+
+	m_nodes.reserve(2 * triangles.size() / PacketSize + 1);
+	m_packets.reserve(packetCount(triangles.size()) * 2);
+	m_nodes.emplace_back();
+	buildNode(0, triangles, 0, triangles.size(), corners);
+	m_nodes.shrink_to_fit();
+	m_packets.shrink_to_fit();
+}
+
+void MeshBvh::buildNode(std::uint32_t node, std::vector<BuildTriangle>& triangles, std::size_t begin, std::size_t end, std::vector<QVector3D> const& corners) {
+	QVector3D boundsMin   = triangles[begin].min;
+	QVector3D boundsMax   = triangles[begin].max;
+	QVector3D centroidMin = triangles[begin].centroid;
+	QVector3D centroidMax = centroidMin;
+	for(std::size_t i = begin + 1; i < end; ++i) {
+		boundsMin   = minimum(boundsMin, triangles[i].min);
+		boundsMax   = maximum(boundsMax, triangles[i].max);
+		centroidMin = minimum(centroidMin, triangles[i].centroid);
+		centroidMax = maximum(centroidMax, triangles[i].centroid);
+	}
+	for(int axis = 0; axis < 3; ++axis) {
+		m_nodes[node].min[axis] = boundsMin[axis];
+		m_nodes[node].max[axis] = boundsMax[axis];
+	}
+
+	std::size_t const count = end - begin;
+	if(count <= PacketSize) {
+		buildLeaf(node, triangles, begin, end, corners);
+		return;
+	}
+
+	// Binned surface area heuristic, along the longest axis of the centroids
+	QVector3D const extent = centroidMax - centroidMin;
+	int axis               = 0;
+	if(extent.y() > extent[axis])
+		axis = 1;
+	if(extent.z() > extent[axis])
+		axis = 2;
+
+	std::size_t middle = begin + count / 2;
+	if(extent[axis] > 0.f) {
+		struct Bin {
+			QVector3D min;
+			QVector3D max;
+			std::size_t count;
+		};
+		Bin bins[BinCount];
+		for(std::size_t b = 0; b < BinCount; ++b) {
+			bins[b].min   = QVector3D(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+			bins[b].max   = -bins[b].min;
+			bins[b].count = 0;
+		}
+
+		float const binScale = BinCount / extent[axis];
+		auto binOf           = [&](BuildTriangle const& t) {
+			return std::min(static_cast<std::size_t>((t.centroid[axis] - centroidMin[axis]) * binScale), BinCount - 1);
+		};
+		for(std::size_t i = begin; i < end; ++i) {
+			Bin& bin = bins[binOf(triangles[i])];
+			bin.min  = minimum(bin.min, triangles[i].min);
+			bin.max  = maximum(bin.max, triangles[i].max);
+			++bin.count;
+		}
+
+		// Cost of splitting after each bin, swept from the right then from the left
+		float rightCost[BinCount];
+		QVector3D sweepMin     = bins[BinCount - 1].min;
+		QVector3D sweepMax     = bins[BinCount - 1].max;
+		std::size_t sweepCount = bins[BinCount - 1].count;
+		for(std::size_t b = BinCount - 1; b > 0; --b) {
+			rightCost[b - 1] = sweepCount ? halfArea(sweepMin, sweepMax) * packetCount(sweepCount) : 0.f;
+			sweepMin         = minimum(sweepMin, bins[b - 1].min);
+			sweepMax         = maximum(sweepMax, bins[b - 1].max);
+			sweepCount += bins[b - 1].count;
+		}
+
+		float bestCost      = std::numeric_limits<float>::max();
+		std::size_t bestBin = 0;
+		sweepMin            = bins[0].min;
+		sweepMax            = bins[0].max;
+		sweepCount          = bins[0].count;
+		for(std::size_t b = 0; b + 1 < BinCount; ++b) {
+			float const cost = (sweepCount ? halfArea(sweepMin, sweepMax) * packetCount(sweepCount) : 0.f) + rightCost[b];
+			if(cost < bestCost) {
+				bestCost = cost;
+				bestBin  = b;
+			}
+			sweepMin = minimum(sweepMin, bins[b + 1].min);
+			sweepMax = maximum(sweepMax, bins[b + 1].max);
+			sweepCount += bins[b + 1].count;
+		}
+
+		float const area     = halfArea(boundsMin, boundsMax);
+		float const leafCost = area * packetCount(count);
+		if(count <= MaxLeafTriangles && TraversalCost * area + bestCost >= leafCost) {
+			buildLeaf(node, triangles, begin, end, corners);
+			return;
+		}
+
+		middle = std::partition(triangles.begin() + begin, triangles.begin() + end, [&](BuildTriangle const& t) { return binOf(t) <= bestBin; }) - triangles.begin();
+	}
+	else if(count <= MaxLeafTriangles) {
+		buildLeaf(node, triangles, begin, end, corners);
+		return;
+	}
+
+	// The first child directly follows its parent
+	m_nodes.emplace_back();
+	buildNode(node + 1, triangles, begin, middle, corners);
+
+	std::uint32_t const second = static_cast<std::uint32_t>(m_nodes.size());
+	m_nodes.emplace_back();
+	m_nodes[node].offset = second;
+	m_nodes[node].count  = 0;
+	buildNode(second, triangles, middle, end, corners);
+}
+
+void MeshBvh::buildLeaf(std::uint32_t node, std::vector<BuildTriangle> const& triangles, std::size_t begin, std::size_t end, std::vector<QVector3D> const& corners) {
+	m_nodes[node].offset = static_cast<std::uint32_t>(m_packets.size());
+	m_nodes[node].count  = static_cast<std::uint32_t>(packetCount(end - begin));
+
+	for(std::size_t first = begin; first < end; first += PacketSize) {
+		TrianglePacket packet;
+		std::memset(&packet, 0, sizeof(packet));
+		for(std::size_t lane = 0; lane < PacketSize; ++lane) {
+			if(first + lane >= end) {
+				packet.triangle[lane] = std::numeric_limits<std::uint32_t>::max();
+				continue;
+			}
+
+			BuildTriangle const& t = triangles[first + lane];
+			QVector3D const& v0    = corners[t.corner];
+			QVector3D const e1     = corners[t.corner + 1] - v0;
+			QVector3D const e2     = corners[t.corner + 2] - v0;
+			for(int axis = 0; axis < 3; ++axis) {
+				packet.v0[axis][lane] = v0[axis];
+				packet.e1[axis][lane] = e1[axis];
+				packet.e2[axis][lane] = e2[axis];
+			}
+			packet.triangle[lane] = t.index;
+		}
+		m_packets.push_back(packet);
+	}
+}
+
+bool MeshBvh::intersect(QVector3D const& origin, QVector3D const& direction, Hit& hit, float maxDistance) const {
+	if(m_nodes.empty())
+		return false;
+
+	// Null components are nudged, so that the slab tests never compute 0 * infinity.
+	Ray ray;
+	for(int axis = 0; axis < 3; ++axis) {
+		float const d          = direction[axis];
+		ray.origin[axis]       = origin[axis];
+		ray.direction[axis]    = d;
+		ray.invDirection[axis] = 1.f / (std::fabs(d) > 1e-20f ? d : std::copysign(1e-20f, d));
+	}
+	ray.origin[3]       = 0.f;
+	ray.direction[3]    = 0.f;
+	ray.invDirection[3] = 0.f;
+
+#ifdef A3D_MESHBVH_SSE
+	__m128 const ox = _mm_set1_ps(ray.origin[0]);
+	__m128 const oy = _mm_set1_ps(ray.origin[1]);
+	__m128 const oz = _mm_set1_ps(ray.origin[2]);
+	__m128 const dx = _mm_set1_ps(ray.direction[0]);
+	__m128 const dy = _mm_set1_ps(ray.direction[1]);
+	__m128 const dz = _mm_set1_ps(ray.direction[2]);
+#endif
+
+	bool found    = false;
+	float best    = maxDistance;
+	auto testLeaf = [&](Node const& leaf) {
+		for(std::uint32_t p = leaf.offset; p < leaf.offset + leaf.count; ++p) {
+			TrianglePacket const& packet = m_packets[p];
+
+			// Möller-Trumbore, on the 4 triangles at once
+			float t[PacketSize];
+			float u[PacketSize];
+			float v[PacketSize];
+			int hitMask = 0;
+#ifdef A3D_MESHBVH_SSE
+			__m128 const e1x = _mm_loadu_ps(packet.e1[0]);
+			__m128 const e1y = _mm_loadu_ps(packet.e1[1]);
+			__m128 const e1z = _mm_loadu_ps(packet.e1[2]);
+			__m128 const e2x = _mm_loadu_ps(packet.e2[0]);
+			__m128 const e2y = _mm_loadu_ps(packet.e2[1]);
+			__m128 const e2z = _mm_loadu_ps(packet.e2[2]);
+
+			__m128 const px  = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 const py  = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 const pz  = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 const det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+			__m128 const sx = _mm_sub_ps(ox, _mm_loadu_ps(packet.v0[0]));
+			__m128 const sy = _mm_sub_ps(oy, _mm_loadu_ps(packet.v0[1]));
+			__m128 const sz = _mm_sub_ps(oz, _mm_loadu_ps(packet.v0[2]));
+			__m128 const qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 const qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 const qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+			__m128 const invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+			__m128 const uu     = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+			__m128 const vv     = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			__m128 const tt     = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			// Comparisons with the NaNs of null determinants are false
+			__m128 const zero = _mm_setzero_ps();
+			__m128 mask       = _mm_cmpneq_ps(det, zero);
+			mask              = _mm_and_ps(mask, _mm_cmpge_ps(uu, zero));
+			mask              = _mm_and_ps(mask, _mm_cmpge_ps(vv, zero));
+			mask              = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.f)));
+			mask              = _mm_and_ps(mask, _mm_cmpge_ps(tt, zero));
+			mask              = _mm_and_ps(mask, _mm_cmple_ps(tt, _mm_set1_ps(best)));
+			hitMask           = _mm_movemask_ps(mask);
+			if(!hitMask)
+				continue;
+
+			_mm_storeu_ps(t, tt);
+			_mm_storeu_ps(u, uu);
+			_mm_storeu_ps(v, vv);
+#else
+			for(std::size_t lane = 0; lane < PacketSize; ++lane) {
+				float const e1[3] = { packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane] };
+				float const e2[3] = { packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane] };
+				float const p[3]  = { ray.direction[1] * e2[2] - ray.direction[2] * e2[1], ray.direction[2] * e2[0] - ray.direction[0] * e2[2], ray.direction[0] * e2[1] - ray.direction[1] * e2[0] };
+				float const det   = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+				if(det == 0.f)
+					continue;
+
+				float const s[3]   = { ray.origin[0] - packet.v0[0][lane], ray.origin[1] - packet.v0[1][lane], ray.origin[2] - packet.v0[2][lane] };
+				float const q[3]   = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+				float const invDet = 1.f / det;
+				u[lane]            = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+				v[lane]            = (ray.direction[0] * q[0] + ray.direction[1] * q[1] + ray.direction[2] * q[2]) * invDet;
+				t[lane]            = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+				if(u[lane] >= 0.f && v[lane] >= 0.f && u[lane] + v[lane] <= 1.f && t[lane] >= 0.f && t[lane] <= best)
+					hitMask |= 1 << lane;
+			}
+#endif
+			for(std::size_t lane = 0; lane < PacketSize; ++lane) {
+				if(!(hitMask & (1 << lane)) || t[lane] > best)
+					continue;
+				best         = t[lane];
+				found        = true;
+				hit.triangle = packet.triangle[lane];
+				hit.u        = u[lane];
+				hit.v        = v[lane];
+				hit.distance = t[lane];
+			}
+		}
+	};
+
+	if(entryDistance(m_nodes[0].min, m_nodes[0].max, ray, best) == std::numeric_limits<float>::infinity())
+		return false;
+
+	// Children are visited closest first, and skipped once a closer triangle has been hit.
+	struct Entry {
+		std::uint32_t node;
+		float distance;
+	};
+	std::vector<Entry> stack;
+	stack.reserve(64);
+	stack.push_back(Entry{ 0, 0.f });
+	while(!stack.empty()) {
+		Entry const entry = stack.back();
+		stack.pop_back();
+		if(entry.distance > best)
+			continue;
+
+		std::uint32_t current = entry.node;
+		for(;;) {
+			Node const& node = m_nodes[current];
+			if(node.count) {
+				testLeaf(node);
+				break;
+			}
+
+			std::uint32_t nearChild = current + 1;
+			std::uint32_t farChild  = node.offset;
+			float nearDistance      = entryDistance(m_nodes[nearChild].min, m_nodes[nearChild].max, ray, best);
+			float farDistance       = entryDistance(m_nodes[farChild].min, m_nodes[farChild].max, ray, best);
+			if(farDistance < nearDistance) {
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+
+			if(nearDistance == std::numeric_limits<float>::infinity())
+				break;
+			if(farDistance != std::numeric_limits<float>::infinity())
+				stack.push_back(Entry{ farChild, farDistance });
+			current = nearChild;
+		}
+	}
+
+	return found;
+}
+
+}
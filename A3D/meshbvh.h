@@ -0,0 +1,79 @@
+#ifndef A3DMESHBVH_H
+#define A3DMESHBVH_H
+
+#include "A3D/common.h"
+#include <cstdint>
+#include <vector>
+
+namespace A3D {
+
+// Bounding volume hierarchy over the triangles of a mesh, for ray casts.
+// Built once with binned SAH splits; the triangles of each leaf are stored in packets of 4, for 4-wide intersection tests.
+class MeshBvh {
+public:
+	struct Hit {
+		// Index of the triangle in draw order (the n-th triangle of the strip for strip meshes)
+		std::uint32_t triangle;
+
+		// Weights of the second and third vertex of the triangle; the first one gets 1 - u - v.
+		float u;
+		float v;
+
+		// In units of the ray direction
+		float distance;
+	};
+
+	MeshBvh();
+
+	// positions points to the xyz floats of the first vertex, the next ones are positionStride bytes apart.
+	// triangleVertices holds 3 vertex indices per triangle. Triangles using the same vertex twice are left out (e.g. degenerate strip triangles).
+	void build(std::uint8_t const* positions, std::size_t positionStride, std::size_t vertexCount, std::uint32_t const* triangleVertices, std::size_t triangleCount);
+
+	// Nearest triangle hit by origin + t * direction for t in [0, maxDistance], from either side.
+	bool intersect(QVector3D const& origin, QVector3D const& direction, Hit& hit, float maxDistance = std::numeric_limits<float>::max()) const;
+
+	bool isEmpty() const;
+	std::size_t nodeCount() const;
+
+	// Heap memory held by the hierarchy, in bytes
+	std::size_t memoryUsage() const;
+
+private:
+	// Interior nodes are followed by their first child; offset is the second one.
+	// Leaves (count > 0) hold count packets from offset.
+	struct Node {
+		float min[3];
+		std::uint32_t offset;
+		float max[3];
+		std::uint32_t count;
+	};
+
+	// First vertex and two edges of 4 triangles, component by component.
+	// Unused lanes have null edges, which no ray hits.
+	struct TrianglePacket {
+		float v0[3][4];
+		float e1[3][4];
+		float e2[3][4];
+		std::uint32_t triangle[4];
+	};
+
+	struct BuildTriangle {
+		QVector3D min;
+		QVector3D max;
+		QVector3D centroid;
+
+		// Index of the triangle, and of its first corner in the corner list
+		std::uint32_t index;
+		std::uint32_t corner;
+	};
+
+	void buildNode(std::uint32_t node, std::vector<BuildTriangle>& triangles, std::size_t begin, std::size_t end, std::vector<QVector3D> const& corners);
+	void buildLeaf(std::uint32_t node, std::vector<BuildTriangle> const& triangles, std::size_t begin, std::size_t end, std::vector<QVector3D> const& corners);
+
+	std::vector<Node> m_nodes;
+	std::vector<TrianglePacket> m_packets;
+};
+
+}
+
+#endif // A3DMESHBVH_H
@@ -4,49 +4,52 @@
 
 namespace A3D {
 
+namespace {
+
+// Indices of every level of detail, one after the other, narrowed to T.
+template <typename T>
+void appendLodIndices(std::vector<T>& dst, std::vector<Mesh::Lod> const& lods) {
+	for(auto it = lods.begin(); it != lods.end(); ++it)
+		std::copy(it->indices.begin(), it->indices.end(), std::back_inserter(dst));
+}
+
+template <typename T>
+void appendLodIndexBytes(std::vector<std::uint8_t>& dst, std::vector<Mesh::Lod> const& lods) {
+	std::vector<T> narrowed;
+	appendLodIndices(narrowed, lods);
+	std::uint8_t const* pData = reinterpret_cast<std::uint8_t const*>(narrowed.data());
+	dst.insert(dst.end(), pData, pData + narrowed.size() * sizeof(T));
+}
+
+}
+
 MeshCacheOGL::MeshCacheOGL(Mesh* parent)
 	: MeshCache{ parent },
 	  m_drawMode(Mesh::Triangles),
 	  m_vbo(QOpenGLBuffer::VertexBuffer),
 	  m_ibo(QOpenGLBuffer::IndexBuffer),
 	  m_elementCount(0),
-	  m_iboFormat(GL_UNSIGNED_INT),
-	  m_meshUBO(0) {
+	  m_iboFormat(GL_UNSIGNED_INT) {
 	log(LC_Debug, "Constructor: MeshCacheOGL");
 }
 
 MeshCacheOGL::~MeshCacheOGL() {
 	log(LC_Debug, "Destructor: MeshCacheOGL");
-
-	if(m_meshUBO) {
-		QOpenGLContext::currentContext()->functions()->glDeleteBuffers(1, &m_meshUBO);
-		m_meshUBO = 0;
-	}
 }
 
-void MeshCacheOGL::render(CoreGLFunctions* gl, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix) {
-	if(!m_elementCount || !m_meshUBO)
+void MeshCacheOGL::render(CoreGLFunctions* gl, GLStateCache& state, std::size_t lodLevel) {
+	if(!m_elementCount)
 		return;
 
-	m_vao.bind();
+	state.bindVertexArray(m_vao.objectId());
 
-	if(m_meshUBO_data.mMatrix != modelMatrix || m_meshUBO_data.vMatrix != viewMatrix || m_meshUBO_data.pMatrix != projMatrix) {
-		m_meshUBO_data.mMatrix         = modelMatrix;
-		m_meshUBO_data.vMatrix         = viewMatrix;
-		m_meshUBO_data.pMatrix         = projMatrix;
-		m_meshUBO_data.mvMatrix        = (viewMatrix * modelMatrix);
-		m_meshUBO_data.mvpMatrix       = (projMatrix * viewMatrix * modelMatrix);
-		m_meshUBO_data.mNormalMatrix   = modelMatrix.inverted().transposed();
-		m_meshUBO_data.mvNormalMatrix  = (viewMatrix * modelMatrix).inverted().transposed();
-		m_meshUBO_data.mvpNormalMatrix = (projMatrix * viewMatrix * modelMatrix).inverted().transposed();
-
-		gl->glBindBuffer(GL_UNIFORM_BUFFER, m_meshUBO);
-		gl->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(MeshUBO_Data), &m_meshUBO_data);
-		gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	std::size_t elementCount = m_elementCount;
+	std::size_t indexOffset  = 0;
+	if(lodLevel > 0 && lodLevel <= m_lodRanges.size()) {
+		indexOffset  = m_lodRanges[lodLevel - 1].first;
+		elementCount = m_lodRanges[lodLevel - 1].second;
 	}
 
-	gl->glBindBufferBase(GL_UNIFORM_BUFFER, RendererOGL::UBO_MeshBinding, m_meshUBO);
-
 	switch(m_drawMode) {
 	case Mesh::Triangles:
 		gl->glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(m_elementCount));
@@ -55,18 +58,17 @@ void MeshCacheOGL::render(CoreGLFunctions* gl, QMatrix4x4 const& modelMatrix, QM
 		gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, static_cast<GLsizei>(m_elementCount));
 		break;
 	case Mesh::IndexedTriangles:
-		gl->glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(m_elementCount), m_iboFormat, 0);
+		gl->glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(elementCount), m_iboFormat, reinterpret_cast<void const*>(indexOffset));
 		break;
 	case Mesh::IndexedTriangleStrips:
-		gl->glDrawElements(GL_TRIANGLE_STRIP, static_cast<GLsizei>(m_elementCount), m_iboFormat, 0);
+		gl->glDrawElements(GL_TRIANGLE_STRIP, static_cast<GLsizei>(elementCount), m_iboFormat, reinterpret_cast<void const*>(indexOffset));
 		break;
 	}
-
-	m_vao.release();
 }
 
 void MeshCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 	Mesh* m = mesh();
+	m_lodRanges.clear();
 	if(!m) {
 		m_elementCount = 0;
 		return;
@@ -74,7 +76,16 @@ void MeshCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 
 	bool isIndexed = (m->drawMode() == Mesh::IndexedTriangles || m->drawMode() == Mesh::IndexedTriangleStrips);
 
-	if(isIndexed)
+	// Levels of detail share the vertex buffer, their indices are stored after the full mesh's.
+	std::vector<Mesh::Lod> const& lods = m->lods();
+
+	// Pre-packed buffers (e.g. from a mesh cache file) are uploaded as they are.
+	Mesh::PackedBuffers const& packed = m->packedBuffers();
+	bool const hasPackedBuffers       = m->hasPackedBuffers();
+
+	if(hasPackedBuffers)
+		m_elementCount = isIndexed ? packed.indexCount : packed.vertexCount;
+	else if(isIndexed)
 		m_elementCount = m->indices().size();
 	else
 		m_elementCount = m->vertices().size();
@@ -93,13 +104,49 @@ void MeshCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 
 	m_vao.bind();
 
-	{
+	if(hasPackedBuffers) {
+		m_vbo.bind();
+		m_vbo.allocate(packed.vertexData, static_cast<int>(packed.vertexCount * Mesh::packedVertexSize(m->contents())));
+	}
+	else {
 		std::vector<std::uint8_t> const& data = m->packedData();
 		m_vbo.bind();
 		m_vbo.allocate(data.data(), static_cast<int>(data.size() * sizeof(*data.data())));
 	}
 
-	if(isIndexed) {
+	if(isIndexed && hasPackedBuffers) {
+		m_ibo.bind();
+		if(lods.empty())
+			m_ibo.allocate(packed.indexData, static_cast<int>(packed.indexCount * packed.indexSize));
+		else {
+			std::vector<std::uint8_t> indexData(packed.indexData, packed.indexData + packed.indexCount * packed.indexSize);
+			switch(packed.indexSize) {
+			case sizeof(GLubyte):
+				appendLodIndexBytes<GLubyte>(indexData, lods);
+				break;
+			case sizeof(GLushort):
+				appendLodIndexBytes<GLushort>(indexData, lods);
+				break;
+			default:
+				appendLodIndexBytes<GLuint>(indexData, lods);
+				break;
+			}
+			m_ibo.allocate(indexData.data(), static_cast<int>(indexData.size()));
+		}
+
+		switch(packed.indexSize) {
+		case sizeof(GLubyte):
+			m_iboFormat = GL_UNSIGNED_BYTE;
+			break;
+		case sizeof(GLushort):
+			m_iboFormat = GL_UNSIGNED_SHORT;
+			break;
+		default:
+			m_iboFormat = GL_UNSIGNED_INT;
+			break;
+		}
+	}
+	else if(isIndexed) {
 		// GLuint != uint32_t, but technically they should always be the same.
 		// If that is not the case, change the GLxxxx type and update GL_UNSIGNED_INT in render().
 		std::vector<GLuint> const& indices = m->indices();
@@ -114,6 +161,7 @@ void MeshCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 			std::vector<GLubyte> byteIndices;
 			byteIndices.reserve(indices.size());
 			std::copy(indices.begin(), indices.end(), std::back_inserter(byteIndices));
+			appendLodIndices(byteIndices, lods);
 			m_ibo.allocate(byteIndices.data(), static_cast<int>(byteIndices.size() * sizeof(*byteIndices.data())));
 			m_iboFormat = GL_UNSIGNED_BYTE;
 		}
@@ -121,13 +169,29 @@ void MeshCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 			std::vector<GLushort> shortIndices;
 			shortIndices.reserve(indices.size());
 			std::copy(indices.begin(), indices.end(), std::back_inserter(shortIndices));
+			appendLodIndices(shortIndices, lods);
 			m_ibo.allocate(shortIndices.data(), static_cast<int>(shortIndices.size() * sizeof(*shortIndices.data())));
 			m_iboFormat = GL_UNSIGNED_SHORT;
 		}
-		else {
+		else if(lods.empty()) {
 			m_ibo.allocate(indices.data(), static_cast<int>(indices.size() * sizeof(*indices.data())));
 			m_iboFormat = GL_UNSIGNED_INT;
 		}
+		else {
+			std::vector<GLuint> allIndices(indices.begin(), indices.end());
+			appendLodIndices(allIndices, lods);
+			m_ibo.allocate(allIndices.data(), static_cast<int>(allIndices.size() * sizeof(*allIndices.data())));
+			m_iboFormat = GL_UNSIGNED_INT;
+		}
+	}
+
+	if(isIndexed) {
+		std::size_t const indexSize = (m_iboFormat == GL_UNSIGNED_BYTE) ? sizeof(GLubyte) : (m_iboFormat == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+		std::size_t offset          = m_elementCount * indexSize;
+		for(auto it = lods.begin(); it != lods.end(); ++it) {
+			m_lodRanges.emplace_back(offset, it->indices.size());
+			offset += it->indices.size() * indexSize;
+		}
 	}
 
 	Mesh::Contents contents        = m->contents();
@@ -193,16 +257,6 @@ void MeshCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 	if(isIndexed)
 		m_ibo.release();
 
-	if(!m_meshUBO) {
-		gl->glGenBuffers(1, &m_meshUBO);
-
-		if(m_meshUBO) {
-			gl->glBindBuffer(GL_UNIFORM_BUFFER, m_meshUBO);
-			gl->glBufferData(GL_UNIFORM_BUFFER, sizeof(MeshUBO_Data), nullptr, GL_DYNAMIC_DRAW);
-			gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
-		}
-	}
-
 	markClean();
 }
 
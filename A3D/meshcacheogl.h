@@ -9,6 +9,7 @@
 
 namespace A3D {
 class RendererOGL;
+class GLStateCache;
 class MeshCacheOGL : public MeshCache {
 	Q_OBJECT
 public:
@@ -28,7 +29,9 @@ public:
 	~MeshCacheOGL();
 
 	void update(RendererOGL*, CoreGLFunctions*);
-	void render(CoreGLFunctions*, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix);
+	// lodLevel 0 draws the full mesh, n draws Mesh::lods()[n - 1].
+	// The transforms are bound by the renderer beforehand; the vertex array stays bound afterwards.
+	void render(CoreGLFunctions*, GLStateCache&, std::size_t lodLevel = 0);
 
 private:
 	Mesh::DrawMode m_drawMode;
@@ -38,31 +41,8 @@ private:
 	std::size_t m_elementCount;
 	GLenum m_iboFormat;
 
-	struct RawMatrix4x4 {
-		inline RawMatrix4x4()
-			: RawMatrix4x4(QMatrix4x4()) {}
-		inline RawMatrix4x4(QMatrix4x4 const& m) { *this = m; }
-		inline RawMatrix4x4& operator=(QMatrix4x4 const& m) {
-			std::memcpy(data, m.data(), sizeof(data));
-			return *this;
-		}
-		inline bool operator==(QMatrix4x4 const& o) const { return std::memcmp(data, o.data(), sizeof(data)) == 0; }
-		inline bool operator!=(QMatrix4x4 const& o) const { return !(*this == o); }
-		float data[16];
-	};
-	struct MeshUBO_Data {
-		RawMatrix4x4 pMatrix;
-		RawMatrix4x4 vMatrix;
-		RawMatrix4x4 mMatrix;
-
-		RawMatrix4x4 mvMatrix;
-		RawMatrix4x4 mvpMatrix;
-
-		RawMatrix4x4 mNormalMatrix;
-		RawMatrix4x4 mvNormalMatrix;
-		RawMatrix4x4 mvpNormalMatrix;
-	} m_meshUBO_data;
-	GLuint m_meshUBO;
+	// Byte offset and index count of each level of detail, stored after the full mesh in m_ibo.
+	std::vector<std::pair<std::size_t, std::size_t>> m_lodRanges;
 };
 
 }
@@ -1,4 +1,5 @@
 #include "A3D/model.h"
+#include "A3D/entity.h"
 
 namespace A3D {
 
@@ -12,6 +13,7 @@ Model::Model(QObject* parent)
 
 Model::~Model() {
 	log(LC_Debug, "Destructor: Model");
+	markChanged();
 }
 
 Model* Model::clone(bool deepClone) const {
@@ -34,7 +36,10 @@ Model::RenderOptions Model::renderOptions() const {
 	return m_renderOptions;
 }
 void Model::setRenderOptions(RenderOptions renderOptions) {
+	if(m_renderOptions == renderOptions)
+		return;
 	m_renderOptions = renderOptions;
+	markChanged();
 }
 
 Group* Model::addGroup(QString name) {
@@ -42,12 +47,15 @@ Group* Model::addGroup(QString name) {
 	if(g)
 		delete g;
 	g = new Group(this);
+	markChanged();
 	return g;
 }
 Group* Model::getOrAddGroup(QString name) {
 	QPointer<Group>& g = m_groups[std::move(name)];
-	if(!g)
+	if(!g) {
 		g = new Group(this);
+		markChanged();
+	}
 	return g;
 }
 Group* Model::getGroup(QString const& name) {
@@ -75,6 +83,8 @@ void Model::setPosition(QVector3D const& pos) {
 		return;
 	m_position    = pos;
 	m_matrixDirty = true;
+	markGroupMatricesDirty();
+	markChanged();
 }
 QVector3D Model::position() const {
 	return m_position;
@@ -85,6 +95,8 @@ void Model::setRotation(QQuaternion const& rot) {
 		return;
 	m_rotation    = rot;
 	m_matrixDirty = true;
+	markGroupMatricesDirty();
+	markChanged();
 }
 QQuaternion Model::rotation() const {
 	return m_rotation;
@@ -95,6 +107,8 @@ void Model::setScale(QVector3D const& scale) {
 		return;
 	m_scale       = scale;
 	m_matrixDirty = true;
+	markGroupMatricesDirty();
+	markChanged();
 }
 QVector3D Model::scale() const {
 	return m_scale;
@@ -111,4 +125,27 @@ QMatrix4x4 const& Model::modelMatrix() const {
 	return m_matrix;
 }
 
+void Model::markGroupMatricesDirty() {
+	for(auto it = m_groups.begin(); it != m_groups.end(); ++it) {
+		if(!it->second.isNull())
+			it->second->m_entitySpaceMatrixDirty = true;
+	}
+}
+
+void Model::addEntity(Entity* entity) {
+	cleanupQPointers(m_entities);
+	m_entities.emplace_back(entity);
+}
+
+void Model::removeEntity(Entity* entity) {
+	m_entities.erase(std::remove(m_entities.begin(), m_entities.end(), entity), m_entities.end());
+}
+
+void Model::markChanged() {
+	for(auto it = m_entities.begin(); it != m_entities.end(); ++it) {
+		if(!it->isNull())
+			(*it)->markIndexDirty();
+	}
+}
+
 }
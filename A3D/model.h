@@ -7,6 +7,8 @@
 
 namespace A3D {
 
+class Entity;
+
 class Model : public QObject {
 	Q_OBJECT
 public:
@@ -45,6 +47,15 @@ public:
 	QMatrix4x4 const& modelMatrix() const;
 
 private:
+	friend class Entity;
+	friend class Group;
+
+	// Entities showing this model are told when it, or one of its groups, changes.
+	void addEntity(Entity*);
+	void removeEntity(Entity*);
+	void markChanged();
+	void markGroupMatricesDirty();
+
 	RenderOptions m_renderOptions;
 
 	mutable bool m_matrixDirty;
@@ -55,6 +66,7 @@ private:
 	QVector3D m_scale;
 
 	std::map<QString, QPointer<Group>> m_groups;
+	std::vector<QPointer<Entity>> m_entities;
 };
 
 }
@@ -0,0 +1,25 @@
+#include "A3D/modelimport.h"
+
+namespace A3D {
+
+Image ModelImport::TextureRef::decode() const {
+	QImage const image = data.isEmpty() ? QImage(path) : QImage::fromData(data);
+	if(image.isNull() || channel == AllChannels)
+		return Image{ image };
+
+	// Position of the channel in a QRgb (0xAARRGGBB)
+	int const shift = (channel == RedChannel) ? 16 : (channel == GreenChannel) ? 8 : 0;
+
+	QImage const rgb = image.convertToFormat(QImage::Format_RGB32);
+	QImage gray(rgb.width(), rgb.height(), QImage::Format_Grayscale8);
+	for(int y = 0; y < rgb.height(); ++y) {
+		QRgb const* pSrc = reinterpret_cast<QRgb const*>(rgb.constScanLine(y));
+		uchar* pDst      = gray.scanLine(y);
+		for(int x = 0; x < rgb.width(); ++x)
+			pDst[x] = static_cast<uchar>(pSrc[x] >> shift);
+	}
+
+	return Image{ gray };
+}
+
+}
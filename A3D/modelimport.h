@@ -0,0 +1,74 @@
+#ifndef A3DMODELIMPORT_H
+#define A3DMODELIMPORT_H
+
+#include "A3D/common.h"
+#include "A3D/mesh.h"
+#include "A3D/materialproperties.h"
+#include "A3D/image.h"
+
+namespace A3D {
+
+// Plain-data result of reading a model file.
+// It does not hold any QObject, so it can be filled on a worker thread;
+// ResourceManager turns it into a Model on its own thread.
+struct ModelImport {
+	struct TextureRef {
+		// The texture slots sample the red channel, while some formats pack several maps into one image
+		// (e.g. glTF metallic / roughness): such a channel is extracted into a grayscale image.
+		enum Channel {
+			AllChannels,
+			RedChannel,
+			GreenChannel,
+			BlueChannel,
+		};
+
+		MaterialProperties::TextureSlot slot;
+
+		// Name the texture is registered under: the image path, unless the image is embedded or a single channel is used.
+		QString name;
+
+		// Image file, or the encoded image itself when it is stored in the model file.
+		QString path;
+		QByteArray data;
+
+		Channel channel;
+
+		// Decodes the image. Can run on any thread.
+		Image decode() const;
+	};
+
+	struct Group {
+		QString name;
+
+		// Set as dynamic properties on the Group, e.g. "obj_Material"
+		std::map<QByteArray, QVariant> properties;
+
+		// Textures are applied in order: a later reference to the same slot wins if it can be loaded.
+		std::vector<TextureRef> textures;
+
+		Mesh::Contents contents;
+		Mesh::DrawMode drawMode;
+		Mesh::RenderOptions renderOptions;
+
+		// Transform of the Group within the Model
+		QVector3D position;
+		QQuaternion rotation;
+		QVector3D scale;
+
+		// Either vertices and indices are filled, or packed is (see Mesh::setPackedBuffers).
+		std::vector<Mesh::Vertex> vertices;
+		std::vector<std::uint32_t> indices;
+		Mesh::PackedBuffers packed;
+
+		// Index the same vertices as the group
+		std::vector<Mesh::Lod> lods;
+	};
+
+	QString name;
+	QString uri;
+	std::vector<Group> groups;
+};
+
+}
+
+#endif // A3DMODELIMPORT_H
@@ -0,0 +1,63 @@
+#include "A3D/modelloadtask.h"
+#include "A3D/resourcemanager.h"
+#include "A3D/model.h"
+
+namespace A3D {
+
+ModelLoadTask::ModelLoadTask(ResourceManager* parent)
+	: QObject{ parent },
+	  m_shared(std::make_shared<SharedState>()),
+	  m_state(Importing),
+	  m_progress(0.f),
+	  m_textureCount(0) {
+	m_shared->cancelled = false;
+}
+
+ModelLoadTask::~ModelLoadTask() {
+	m_shared->cancelled = true;
+}
+
+ModelLoadTask::State ModelLoadTask::state() const {
+	return m_state;
+}
+
+bool ModelLoadTask::isDone() const {
+	return m_state == Finished || m_state == Cancelled || m_state == Failed;
+}
+
+float ModelLoadTask::progress() const {
+	return m_progress;
+}
+
+Model* ModelLoadTask::model() const {
+	return m_model;
+}
+
+void ModelLoadTask::cancel() {
+	m_shared->cancelled = true;
+	if(!isDone())
+		finish(Cancelled);
+}
+
+void ModelLoadTask::setProgress(float progress) {
+	if(isDone() || progress <= m_progress)
+		return;
+
+	m_progress = progress;
+	emit progressChanged(m_progress);
+}
+
+void ModelLoadTask::finish(State state) {
+	if(isDone())
+		return;
+
+	if(state == Finished)
+		setProgress(1.f);
+
+	m_state = state;
+	m_pendingSlots.clear();
+	m_pendingTextures.clear();
+	emit finished();
+}
+
+}
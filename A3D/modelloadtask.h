@@ -0,0 +1,87 @@
+#ifndef A3DMODELLOADTASK_H
+#define A3DMODELLOADTASK_H
+
+#include "A3D/common.h"
+#include <QObject>
+#include <atomic>
+#include "A3D/modelimport.h"
+
+namespace A3D {
+
+class Model;
+class ResourceManager;
+
+// Handle to a ResourceManager::loadModelAsync() call.
+// All the signals are emitted on the ResourceManager's thread.
+class ModelLoadTask : public QObject {
+	Q_OBJECT
+public:
+	enum State {
+		// Reading and parsing the file
+		Importing,
+
+		// model() is available, its textures are still being decoded
+		LoadingTextures,
+
+		Finished,
+		Cancelled,
+		Failed,
+	};
+
+	~ModelLoadTask();
+
+	State state() const;
+	bool isDone() const;
+
+	// From 0 to 1
+	float progress() const;
+
+	// Null until modelReady() is emitted
+	Model* model() const;
+
+	void cancel();
+
+signals:
+	void progressChanged(float progress);
+	void modelReady(A3D::Model* model);
+
+	// Emitted once, when the task is done for whatever reason (see state()).
+	void finished();
+
+private:
+	friend class ResourceManager;
+	explicit ModelLoadTask(ResourceManager* parent);
+
+	// Parsing counts for this much of the progress, decoding textures for the rest.
+	static constexpr float ImportProgressWeight = 0.8f;
+
+	// Shared with the worker threads, which may outlive the task.
+	struct SharedState {
+		std::atomic<bool> cancelled;
+	};
+
+	// A texture slot that waits for some of its images (candidates are texture names).
+	// Once all of them are decoded, the last one that could be loaded goes into the slot.
+	struct PendingSlot {
+		QPointer<MaterialProperties> materialProperties;
+		MaterialProperties::TextureSlot slot;
+		std::vector<QString> candidates;
+	};
+
+	void setProgress(float);
+	void finish(State);
+
+	std::shared_ptr<SharedState> m_shared;
+	State m_state;
+	float m_progress;
+	QPointer<Model> m_model;
+
+	std::vector<PendingSlot> m_pendingSlots;
+	// Images still being decoded, by texture name
+	std::map<QString, ModelImport::TextureRef> m_pendingTextures;
+	std::size_t m_textureCount;
+};
+
+}
+
+#endif // A3DMODELLOADTASK_H
@@ -0,0 +1,277 @@
+#include "A3D/occlusionbuffer.h"
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define A3D_OCCLUSIONBUFFER_SSE
+#endif
+
+namespace A3D {
+
+OcclusionBuffer::OcclusionBuffer()
+	: m_width(0),
+	  m_height(0),
+	  m_tilesX(0),
+	  m_tilesY(0),
+	  m_screenScaleX(0.f),
+	  m_screenScaleY(0.f),
+	  m_viewProjection(),
+	  m_depth(),
+	  m_tileMaxDepth(),
+	  m_occluders(),
+	  m_setups(),
+	  m_bandTriangles(),
+	  m_rasterizedTriangles(0) {
+	setResolution(QSize(256, 128));
+}
+
+void OcclusionBuffer::setResolution(QSize const& size) {
+	m_tilesX = std::max((size.width() + TileSize - 1) / TileSize, 1);
+	m_tilesY = std::max((size.height() + TileSize - 1) / TileSize, 1);
+	m_width  = m_tilesX * TileSize;
+	m_height = m_tilesY * TileSize;
+
+	m_screenScaleX = static_cast<float>(m_width - 2) * 0.5f;
+	m_screenScaleY = static_cast<float>(m_height - 2) * 0.5f;
+
+	m_depth.assign(static_cast<std::size_t>(m_width) * m_height, 1.f);
+	m_tileMaxDepth.assign(static_cast<std::size_t>(m_tilesX) * m_tilesY, 1.f);
+	m_bandTriangles.resize(m_tilesY);
+}
+
+QSize OcclusionBuffer::resolution() const {
+	return QSize(m_width, m_height);
+}
+
+void OcclusionBuffer::clear(QMatrix4x4 const& viewProjection) {
+	m_viewProjection = viewProjection;
+	m_occluders.clear();
+	std::fill(m_depth.begin(), m_depth.end(), 1.f);
+	std::fill(m_tileMaxDepth.begin(), m_tileMaxDepth.end(), 1.f);
+	m_rasterizedTriangles = 0;
+}
+
+void OcclusionBuffer::addOccluder(float const* positions, std::size_t vertexCount, std::uint32_t const* triangles, std::size_t triangleCount, QMatrix4x4 const& modelMatrix) {
+	if(!positions || !triangles || !vertexCount || !triangleCount)
+		return;
+	m_occluders.push_back(Occluder{ positions, vertexCount, triangles, triangleCount, m_viewProjection * modelMatrix });
+}
+
+void OcclusionBuffer::rasterize() {
+	// Each occluder is set up in its own buffers, then binned in order: the bands see the triangles in the same order every time.
+	if(m_setups.size() < m_occluders.size())
+		m_setups.resize(m_occluders.size());
+	parallelFor(m_occluders.size(), [this](std::size_t occluder) { setupOccluder(occluder); });
+
+	for(std::vector<Triangle const*>& band: m_bandTriangles)
+		band.clear();
+	for(std::size_t i = 0; i < m_occluders.size(); ++i) {
+		for(Triangle const& t: m_setups[i].m_triangles) {
+			for(int band = t.m_minY / TileSize; band <= t.m_maxY / TileSize; ++band)
+				m_bandTriangles[band].push_back(&t);
+		}
+		m_rasterizedTriangles += m_setups[i].m_triangles.size();
+	}
+
+	parallelFor(m_tilesY, [this](std::size_t band) { rasterizeBand(band); });
+}
+
+void OcclusionBuffer::setupOccluder(std::size_t occluder) {
+	Occluder const& o    = m_occluders[occluder];
+	OccluderSetup& setup = m_setups[occluder];
+	setup.m_triangles.clear();
+
+	setup.m_clipPositions.resize(o.m_vertexCount);
+	for(std::size_t i = 0; i < o.m_vertexCount; ++i) {
+		float const* p          = o.m_positions + i * 3;
+		setup.m_clipPositions[i] = o.m_modelViewProjection * QVector4D(p[0], p[1], p[2], 1.f);
+	}
+
+	float const width  = static_cast<float>(m_width);
+	float const height = static_cast<float>(m_height);
+	for(std::size_t i = 0; i < o.m_triangleCount; ++i) {
+		std::uint32_t const* indices = o.m_triangles + i * 3;
+		if(indices[0] >= o.m_vertexCount || indices[1] >= o.m_vertexCount || indices[2] >= o.m_vertexCount)
+			continue;
+
+		float x[3];
+		float y[3];
+		float z[3];
+		bool clipped = false;
+		for(int v = 0; v < 3; ++v) {
+			QVector4D const& clip = setup.m_clipPositions[indices[v]];
+			if(clip.w() <= 0.f || clip.z() < -clip.w()) {
+				clipped = true;
+				break;
+			}
+			QVector3D const screen = toScreen(clip);
+			x[v]                   = screen.x();
+			y[v]                   = screen.y();
+			z[v]                   = screen.z();
+		}
+		if(clipped)
+			continue;
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if(area < 0.f) {
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+		if(!(area > 1e-6f))
+			continue;
+
+		// Pixels whose center is within the bounds, the bounds being clamped first as vertices may be far off screen
+		float const minX = std::clamp(std::min({ x[0], x[1], x[2] }), -1.f, width + 1.f);
+		float const maxX = std::clamp(std::max({ x[0], x[1], x[2] }), -1.f, width + 1.f);
+		float const minY = std::clamp(std::min({ y[0], y[1], y[2] }), -1.f, height + 1.f);
+		float const maxY = std::clamp(std::max({ y[0], y[1], y[2] }), -1.f, height + 1.f);
+
+		Triangle t;
+		t.m_minX = std::max(static_cast<int>(std::ceil(minX - 0.5f)), 0);
+		t.m_maxX = std::min(static_cast<int>(std::floor(maxX - 0.5f)), m_width - 1);
+		t.m_minY = std::max(static_cast<int>(std::ceil(minY - 0.5f)), 0);
+		t.m_maxY = std::min(static_cast<int>(std::floor(maxY - 0.5f)), m_height - 1);
+		if(t.m_minX > t.m_maxX || t.m_minY > t.m_maxY)
+			continue;
+
+		for(int e = 0; e < 3; ++e) {
+			int const from = e;
+			int const to   = (e + 1) % 3;
+			t.m_edgeA[e]   = y[from] - y[to];
+			t.m_edgeB[e]   = x[to] - x[from];
+			t.m_edgeC[e]   = -(t.m_edgeA[e] * x[from] + t.m_edgeB[e] * y[from]);
+		}
+
+		float const depthX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+		float const depthY = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+		t.m_depthA         = depthX;
+		t.m_depthB         = depthY;
+		t.m_depthC         = z[0] - depthX * x[0] - depthY * y[0] + 0.5f * (std::abs(depthX) + std::abs(depthY));
+		setup.m_triangles.push_back(t);
+	}
+}
+
+void OcclusionBuffer::rasterizeBand(std::size_t band) {
+	int const bandMinY = static_cast<int>(band) * TileSize;
+	int const bandMaxY = bandMinY + TileSize - 1;
+
+	for(Triangle const* t: m_bandTriangles[band]) {
+		int const minY = std::max(t->m_minY, bandMinY);
+		int const maxY = std::min(t->m_maxY, bandMaxY);
+
+		// Groups of 4 pixels: the width is a multiple of 4
+		int const minX = t->m_minX & ~3;
+		int const maxX = t->m_maxX;
+
+		for(int py = minY; py <= maxY; ++py) {
+			float const centerY = static_cast<float>(py) + 0.5f;
+			float const row0    = t->m_edgeB[0] * centerY + t->m_edgeC[0];
+			float const row1    = t->m_edgeB[1] * centerY + t->m_edgeC[1];
+			float const row2    = t->m_edgeB[2] * centerY + t->m_edgeC[2];
+			float const rowZ    = t->m_depthB * centerY + t->m_depthC;
+			float* depth        = m_depth.data() + static_cast<std::size_t>(py) * m_width;
+
+#ifdef A3D_OCCLUSIONBUFFER_SSE
+			__m128 const a0    = _mm_set1_ps(t->m_edgeA[0]);
+			__m128 const a1    = _mm_set1_ps(t->m_edgeA[1]);
+			__m128 const a2    = _mm_set1_ps(t->m_edgeA[2]);
+			__m128 const aZ    = _mm_set1_ps(t->m_depthA);
+			__m128 const r0    = _mm_set1_ps(row0);
+			__m128 const r1    = _mm_set1_ps(row1);
+			__m128 const r2    = _mm_set1_ps(row2);
+			__m128 const rZ    = _mm_set1_ps(rowZ);
+			__m128 const zero  = _mm_setzero_ps();
+			__m128 const lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			for(int px = minX; px <= maxX; px += 4) {
+				__m128 const centerX = _mm_add_ps(_mm_set1_ps(static_cast<float>(px)), lanes);
+				__m128 inside        = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centerX), r0), zero);
+				inside               = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centerX), r1), zero));
+				inside               = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centerX), r2), zero));
+				if(!_mm_movemask_ps(inside))
+					continue;
+
+				__m128 const current = _mm_loadu_ps(depth + px);
+				__m128 const nearest = _mm_min_ps(current, _mm_add_ps(_mm_mul_ps(aZ, centerX), rZ));
+				_mm_storeu_ps(depth + px, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+			}
+#else
+			for(int px = minX; px <= maxX; ++px) {
+				float const centerX = static_cast<float>(px) + 0.5f;
+				if(t->m_edgeA[0] * centerX + row0 >= 0.f && t->m_edgeA[1] * centerX + row1 >= 0.f && t->m_edgeA[2] * centerX + row2 >= 0.f)
+					depth[px] = std::min(depth[px], t->m_depthA * centerX + rowZ);
+			}
+#endif
+		}
+	}
+
+	for(int tx = 0; tx < m_tilesX; ++tx) {
+		float farthest = -1.f;
+		for(int py = bandMinY; py <= bandMaxY; ++py) {
+			float const* depth = m_depth.data() + static_cast<std::size_t>(py) * m_width + tx * TileSize;
+			for(int px = 0; px < TileSize; ++px)
+				farthest = std::max(farthest, depth[px]);
+		}
+		m_tileMaxDepth[band * m_tilesX + tx] = farthest;
+	}
+}
+
+bool OcclusionBuffer::isOccluded(QVector3D const& min, QVector3D const& max) const {
+	float minX  = std::numeric_limits<float>::max();
+	float maxX  = -std::numeric_limits<float>::max();
+	float minY  = std::numeric_limits<float>::max();
+	float maxY  = -std::numeric_limits<float>::max();
+	float nearZ = std::numeric_limits<float>::max();
+	for(int corner = 0; corner < 8; ++corner) {
+		QVector4D const point((corner & 1) ? max.x() : min.x(), (corner & 2) ? max.y() : min.y(), (corner & 4) ? max.z() : min.z(), 1.f);
+		QVector4D const clip = m_viewProjection * point;
+		if(clip.w() <= 0.f || clip.z() < -clip.w())
+			return false;
+
+		QVector3D const screen = toScreen(clip);
+		minX                   = std::min(minX, screen.x());
+		maxX                   = std::max(maxX, screen.x());
+		minY                   = std::min(minY, screen.y());
+		maxY                   = std::max(maxY, screen.y());
+		nearZ                  = std::min(nearZ, screen.z());
+	}
+	if(maxX < 0.f || maxY < 0.f || minX > m_width || minY > m_height)
+		return false;
+
+	// The pixels the box touches, and one more on each side
+	int const x0 = std::max(static_cast<int>(std::floor(minX)) - 1, 0);
+	int const x1 = std::min(static_cast<int>(std::floor(maxX)) + 1, m_width - 1);
+	int const y0 = std::max(static_cast<int>(std::floor(minY)) - 1, 0);
+	int const y1 = std::min(static_cast<int>(std::floor(maxY)) + 1, m_height - 1);
+
+	for(int ty = y0 / TileSize; ty <= y1 / TileSize; ++ty) {
+		for(int tx = x0 / TileSize; tx <= x1 / TileSize; ++tx) {
+			if(m_tileMaxDepth[ty * m_tilesX + tx] < nearZ)
+				continue;
+
+			int const tileX0 = std::max(tx * TileSize, x0);
+			int const tileX1 = std::min(tx * TileSize + TileSize - 1, x1);
+			int const tileY0 = std::max(ty * TileSize, y0);
+			int const tileY1 = std::min(ty * TileSize + TileSize - 1, y1);
+			for(int py = tileY0; py <= tileY1; ++py) {
+				float const* depth = m_depth.data() + static_cast<std::size_t>(py) * m_width;
+				for(int px = tileX0; px <= tileX1; ++px) {
+					if(depth[px] >= nearZ)
+						return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+float OcclusionBuffer::depth(int x, int y) const {
+	return m_depth[static_cast<std::size_t>(y) * m_width + x];
+}
+
+std::size_t OcclusionBuffer::rasterizedTriangles() const {
+	return m_rasterizedTriangles;
+}
+
+}
@@ -0,0 +1,114 @@
+#ifndef A3DOCCLUSIONBUFFER_H
+#define A3DOCCLUSIONBUFFER_H
+
+#include "A3D/common.h"
+#include <QSize>
+#include <cstdint>
+#include <vector>
+
+namespace A3D {
+
+// Low resolution depth buffer of the occluders, rasterized on the CPU, to cull what they hide before it is drawn.
+// A pixel keeps the nearest depth of the triangles covering its center, whatever their order, so the result does not depend on
+// how the work is scheduled: the rows are split in bands of TileSize rows rasterized on the global QThreadPool, 4 pixels at a time
+// with SSE when available. Each tile of TileSize x TileSize pixels also keeps its farthest depth, where most tests stop.
+// No OpenGL context is needed.
+class OcclusionBuffer {
+public:
+	enum {
+		TileSize = 8,
+	};
+
+	OcclusionBuffer();
+
+	// Rounded up to whole tiles. Defaults to 256 x 128.
+	// The first and last rows and columns lie past the edges of the screen, so that the tests see what the occluders cover there.
+	void setResolution(QSize const&);
+	QSize resolution() const;
+
+	// Starts a frame: forgets the occluders, and clears the depth to the far plane.
+	void clear(QMatrix4x4 const& viewProjection);
+
+	// positions holds the xyz floats of vertexCount vertices, triangles 3 vertex indices per triangle.
+	// The arrays are only read by rasterize(): they have to stay valid until then.
+	void addOccluder(float const* positions, std::size_t vertexCount, std::uint32_t const* triangles, std::size_t triangleCount, QMatrix4x4 const& modelMatrix);
+
+	// Rasterizes the occluders added since clear(). Triangles reaching the near plane are left out, which only hides less.
+	void rasterize();
+
+	// Whether the box, in world space, is hidden behind the occluders: every pixel its projection touches, and the ones
+	// next to them (the silhouettes of the occluders only cover part of their pixels), holds a nearer depth.
+	// Boxes reaching the near plane, or entirely off screen, never are. A gap narrower than a pixel between two occluders
+	// is not seen through.
+	bool isOccluded(QVector3D const& min, QVector3D const& max) const;
+
+	// Normalized device depth (-1 near, 1 far) of a pixel, the first row at the bottom of the screen
+	float depth(int x, int y) const;
+
+	// Triangles written by the last rasterize()
+	std::size_t rasterizedTriangles() const;
+
+private:
+	// Screen space triangle, counter-clockwise. The edge functions a * x + b * y + c are positive inside, the pixel centers
+	// being at half coordinates. The depth plane is raised by its largest change within half a pixel, so that a pixel never
+	// hides more than the triangle does.
+	struct Triangle {
+		float m_edgeA[3];
+		float m_edgeB[3];
+		float m_edgeC[3];
+		float m_depthA;
+		float m_depthB;
+		float m_depthC;
+
+		// Pixels whose center may be covered, inclusive
+		int m_minX;
+		int m_maxX;
+		int m_minY;
+		int m_maxY;
+	};
+
+	struct Occluder {
+		float const* m_positions;
+		std::size_t m_vertexCount;
+		std::uint32_t const* m_triangles;
+		std::size_t m_triangleCount;
+		QMatrix4x4 m_modelViewProjection;
+	};
+
+	// Clip space positions of the vertices of an occluder, and the triangles set up from them
+	struct OccluderSetup {
+		std::vector<QVector4D> m_clipPositions;
+		std::vector<Triangle> m_triangles;
+	};
+
+	// Pixel coordinates and normalized device depth of a clip space position in front of the camera
+	inline QVector3D toScreen(QVector4D const& clip) const {
+		float const inverseW = 1.f / clip.w();
+		return QVector3D(clip.x() * inverseW * m_screenScaleX + m_screenScaleX + 1.f, clip.y() * inverseW * m_screenScaleY + m_screenScaleY + 1.f, clip.z() * inverseW);
+	}
+
+	void setupOccluder(std::size_t occluder);
+	void rasterizeBand(std::size_t band);
+
+	int m_width;
+	int m_height;
+	int m_tilesX;
+	int m_tilesY;
+	float m_screenScaleX;
+	float m_screenScaleY;
+	QMatrix4x4 m_viewProjection;
+
+	std::vector<float> m_depth;
+	std::vector<float> m_tileMaxDepth;
+
+	std::vector<Occluder> m_occluders;
+	std::vector<OccluderSetup> m_setups;
+
+	// Triangles overlapping each band of TileSize rows, in the order of the occluders
+	std::vector<std::vector<Triangle const*>> m_bandTriangles;
+	std::size_t m_rasterizedTriangles;
+};
+
+}
+
+#endif // A3DOCCLUSIONBUFFER_H
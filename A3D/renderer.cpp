@@ -1,7 +1,61 @@
 #include "A3D/renderer.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define A3D_RENDERER_SSE
+#endif
+
 namespace A3D {
 
+// Fraction of lodPixelError() a coarser level of detail has to stay under to replace the current one
+static constexpr float LodHysteresis = 0.8f;
+
+// Bits of the opaque sort keys. Resources past the range of their field share its last value.
+static constexpr unsigned MaterialKeyBits           = 10;
+static constexpr unsigned MaterialPropertiesKeyBits = 14;
+static constexpr unsigned MeshKeyBits               = 16;
+static constexpr unsigned DepthKeyBits              = 24;
+
+// Candidates of a draw list chunk: a task of a few hundred microseconds
+static constexpr std::size_t DrawListChunkSize = 4096;
+
+// depth[i] = dot(center[i] - position, forward) - radius[i], the depth of the nearest point of each sphere.
+static void sphereDepths(float const* x, float const* y, float const* z, float const* radius, std::size_t count, QVector3D const& position, QVector3D const& forward, float* depth) {
+	std::size_t i = 0;
+
+#ifdef A3D_RENDERER_SSE
+	__m128 const px = _mm_set1_ps(position.x());
+	__m128 const py = _mm_set1_ps(position.y());
+	__m128 const pz = _mm_set1_ps(position.z());
+	__m128 const fx = _mm_set1_ps(forward.x());
+	__m128 const fy = _mm_set1_ps(forward.y());
+	__m128 const fz = _mm_set1_ps(forward.z());
+	for(; i + 4 <= count; i += 4) {
+		__m128 d = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), px), fx);
+		d        = _mm_add_ps(d, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(y + i), py), fy));
+		d        = _mm_add_ps(d, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(z + i), pz), fz));
+		_mm_storeu_ps(depth + i, _mm_sub_ps(d, _mm_loadu_ps(radius + i)));
+	}
+#endif
+
+	for(; i < count; ++i) {
+		float d  = (x[i] - position.x()) * forward.x();
+		d       += (y[i] - position.y()) * forward.y();
+		d       += (z[i] - position.z()) * forward.z();
+		depth[i] = d - radius[i];
+	}
+}
+
+// For affine transforms, without the checks of QMatrix4x4::map()
+static inline QVector3D transformPoint(QMatrix4x4 const& m, QVector3D const& p) {
+	float const* d = m.constData();
+	return QVector3D(
+		d[0] * p.x() + d[4] * p.y() + d[8] * p.z() + d[12],
+		d[1] * p.x() + d[5] * p.y() + d[9] * p.z() + d[13],
+		d[2] * p.x() + d[6] * p.y() + d[10] * p.z() + d[14]
+	);
+}
+
 static std::uintptr_t g_lastRendererID = 0;
 static std::map<std::uintptr_t, Renderer*> g_renderers;
 
@@ -28,6 +82,21 @@ Renderer* Renderer::getRenderer(std::uintptr_t rendererID) {
 
 Renderer::Renderer()
 	: m_rendererID(0),
+	  m_opaqueSortPolicy(StateFirst),
+	  m_depthPrePass(DepthPrePassAuto),
+	  m_depthPrePassOverdraw(3.f),
+	  m_materialSortIds(),
+	  m_materialPropertiesSortIds(),
+	  m_meshSortIds(),
+	  m_viewportSize(),
+	  m_lodPixelError(1.f),
+	  m_minimumPixelSize(0.f),
+	  m_drawStats(),
+	  m_frameIndex(0),
+	  m_lightClusters(),
+	  m_closestLightIds(),
+	  m_softwareOcclusionCulling(false),
+	  m_occlusionBuffer(),
 	  m_currentScene(nullptr) {
 	log(LC_Debug, "Constructor: Renderer");
 	m_rendererID = Renderer::createRendererID(this);
@@ -50,14 +119,76 @@ void Renderer::CleanupRenderCache() {
 	cleanupQPointers(m_cubemapCaches);
 }
 
-bool Renderer::OpaqueSorter(GroupBufferData const& a, GroupBufferData const& b) {
-	return a.m_distanceFromCamera < b.m_distanceFromCamera;
-}
-
 bool Renderer::TranslucentSorter(GroupBufferData const& a, GroupBufferData const& b) {
 	return a.m_distanceFromCamera > b.m_distanceFromCamera;
 }
 
+void Renderer::RadixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch) {
+	std::size_t const count = entries.size();
+	if(count < 2)
+		return;
+
+	std::size_t histograms[8][256] = {};
+	for(auto it = entries.begin(); it != entries.end(); ++it) {
+		for(unsigned pass = 0; pass < 8; ++pass)
+			++histograms[pass][(it->m_key >> (pass * 8)) & 0xFF];
+	}
+
+	scratch.resize(count);
+	for(unsigned pass = 0; pass < 8; ++pass) {
+		std::size_t* histogram = histograms[pass];
+		unsigned const shift   = pass * 8;
+
+		// Every key has the same digit: the pass would not move anything
+		if(histogram[(entries.front().m_key >> shift) & 0xFF] == count)
+			continue;
+
+		std::size_t offset = 0;
+		for(unsigned digit = 0; digit < 256; ++digit) {
+			std::size_t const digitCount = histogram[digit];
+			histogram[digit]             = offset;
+			offset                      += digitCount;
+		}
+
+		for(auto it = entries.begin(); it != entries.end(); ++it)
+			scratch[histogram[(it->m_key >> shift) & 0xFF]++] = *it;
+		entries.swap(scratch);
+	}
+}
+
+std::uint32_t Renderer::sortId(SortIds& ids, ResourceHandle handle) {
+	if(ids.m_frame != m_frameIndex) {
+		ids.m_frame = m_frameIndex;
+		ids.m_count = 0;
+	}
+
+	if(handle.index >= ids.m_frames.size()) {
+		ids.m_frames.resize(handle.index + 1, 0);
+		ids.m_ids.resize(handle.index + 1, 0);
+	}
+
+	if(ids.m_frames[handle.index] != m_frameIndex) {
+		ids.m_frames[handle.index] = m_frameIndex;
+		ids.m_ids[handle.index]    = ids.m_count++;
+	}
+	return ids.m_ids[handle.index];
+}
+
+std::uint64_t Renderer::opaqueSortKey(GroupBufferData const& gbd, float maxDistance) {
+	std::uint64_t const material           = std::min<std::uint32_t>(sortId(m_materialSortIds, gbd.m_material->handle()), (1u << MaterialKeyBits) - 1);
+	std::uint64_t const materialProperties = std::min<std::uint32_t>(sortId(m_materialPropertiesSortIds, gbd.m_materialProperties->handle()), (1u << MaterialPropertiesKeyBits) - 1);
+	std::uint64_t const mesh               = std::min<std::uint32_t>(sortId(m_meshSortIds, gbd.m_mesh->handle()), (1u << MeshKeyBits) - 1);
+
+	float const maxDepth      = static_cast<float>((1u << DepthKeyBits) - 1);
+	float const relativeDepth = maxDistance > 0.f ? gbd.m_distanceFromCamera / maxDistance : 0.f;
+	std::uint64_t const depth = static_cast<std::uint64_t>(std::min(std::max(relativeDepth, 0.f), 1.f) * maxDepth);
+
+	std::uint64_t const state = (((material << MaterialPropertiesKeyBits) | materialProperties) << MeshKeyBits) | mesh;
+	if(m_opaqueSortPolicy == FrontToBack)
+		return (depth << (MaterialKeyBits + MaterialPropertiesKeyBits + MeshKeyBits)) | state;
+	return (state << DepthKeyBits) | depth;
+}
+
 void Renderer::PreLoadEntityTree(Entity* root) {
 	this->PreLoadEntity(root);
 
@@ -72,12 +203,21 @@ void Renderer::PreLoadEntityTree(Entity* root) {
 void Renderer::DrawAll(Scene* root, Camera const& camera) {
 	m_opaqueGroupBuffer.clear();
 	m_translucentGroupBuffer.clear();
+	m_drawStats = DrawStats();
+	++m_frameIndex;
 
-	BuildDrawLists(camera, root, root->entityMatrix());
+	BuildDrawLists(camera, root);
 
-	std::stable_sort(m_opaqueGroupBuffer.begin(), m_opaqueGroupBuffer.end(), Renderer::OpaqueSorter);
+	m_opaqueOrder.resize(m_opaqueGroupBuffer.size());
+	for(std::size_t i = 0; i < m_opaqueGroupBuffer.size(); ++i) {
+		m_opaqueOrder[i].m_key   = opaqueSortKey(m_opaqueGroupBuffer[i], camera.farPlane());
+		m_opaqueOrder[i].m_index = static_cast<std::uint32_t>(i);
+	}
+	RadixSort(m_opaqueOrder, m_sortScratch);
 	std::stable_sort(m_translucentGroupBuffer.begin(), m_translucentGroupBuffer.end(), Renderer::TranslucentSorter);
 
+	m_lightClusters.build(camera, *root);
+
 	DrawInfo drawInfo;
 	drawInfo.m_scene      = root;
 	drawInfo.m_projMatrix = camera.getProjection();
@@ -85,73 +225,374 @@ void Renderer::DrawAll(Scene* root, Camera const& camera) {
 
 	this->BeginDrawing(camera, root);
 
+	// Resources of the previous draw, to count the state changes
+	Mesh const* lastMesh                             = nullptr;
+	Material const* lastMaterial                     = nullptr;
+	MaterialProperties const* lastMaterialProperties = nullptr;
+
+	auto countSwitches = [&](GroupBufferData const& gbd) {
+		m_drawStats.programSwitches     += (gbd.m_material != lastMaterial);
+		m_drawStats.textureSwitches     += (gbd.m_materialProperties != lastMaterialProperties);
+		m_drawStats.vertexArraySwitches += (gbd.m_mesh != lastMesh);
+
+		lastMaterial           = gbd.m_material;
+		lastMaterialProperties = gbd.m_materialProperties;
+		lastMesh               = gbd.m_mesh;
+	};
+
 	this->BeginOpaque();
-	for(auto it = m_opaqueGroupBuffer.begin(); it != m_opaqueGroupBuffer.end(); ++it) {
-		drawInfo.m_modelMatrix = it->m_transform;
-		drawInfo.m_groupPosition = it->m_position;
-		this->Draw(it->m_group, drawInfo);
+
+	std::size_t const opaqueCount = m_opaqueOrder.size();
+	std::size_t const drawCount   = frameDrawCount();
+	bool const depthPrePass       = opaqueCount && (m_depthPrePass == DepthPrePassOn || (m_depthPrePass == DepthPrePassAuto && m_drawStats.opaqueOverdraw >= m_depthPrePassOverdraw));
+	this->PrepareDraws(drawInfo, depthPrePass);
+
+	if(depthPrePass) {
+		this->BeginDepthPrePass();
+		for(std::size_t i = 0; i < opaqueCount; ++i) {
+			GroupBufferData const& gbd = m_opaqueGroupBuffer[m_opaqueOrder[i].m_index];
+			if(!(gbd.m_material->renderOptions() & Material::DepthPrePassCompatible))
+				continue;
+
+			frameDrawInfo(i, drawInfo);
+			this->DrawDepth(gbd.m_group, drawInfo);
+			++m_drawStats.depthPrePassGroups;
+		}
+		this->EndDepthPrePass();
+	}
+
+	for(std::size_t i = 0; i < opaqueCount; ++i) {
+		GroupBufferData const& gbd = m_opaqueGroupBuffer[m_opaqueOrder[i].m_index];
+		countSwitches(gbd);
+		frameDrawInfo(i, drawInfo);
+		this->Draw(gbd.m_group, drawInfo);
 	}
 	this->EndOpaque();
 
 	this->BeginTranslucent();
-	for(auto it = m_translucentGroupBuffer.begin(); it != m_translucentGroupBuffer.end(); ++it) {
-		drawInfo.m_modelMatrix = it->m_transform;
-		drawInfo.m_groupPosition = it->m_position;
-		this->Draw(it->m_group, drawInfo);
+	for(std::size_t i = opaqueCount; i < drawCount; ++i) {
+		GroupBufferData const& gbd = m_translucentGroupBuffer[i - opaqueCount];
+		countSwitches(gbd);
+		frameDrawInfo(i, drawInfo);
+		this->Draw(gbd.m_group, drawInfo);
 	}
 	this->EndTranslucent();
 
 	this->EndDrawing(root);
 }
 
-void Renderer::BuildDrawLists(Camera const& camera, Entity* e, QMatrix4x4 const& cascadeMatrix) {
-	if(!e || e->renderOptions() & Entity::Hidden)
-		return;
+std::size_t Renderer::frameDrawCount() const {
+	return m_opaqueOrder.size() + m_translucentGroupBuffer.size();
+}
+std::size_t Renderer::frameOpaqueDrawCount() const {
+	return m_opaqueOrder.size();
+}
 
-	Model* m = e->model();
-	if(m && !(m->renderOptions() & Model::Hidden)) {
-		QMatrix4x4 baseMatrix                            = cascadeMatrix * m->modelMatrix();
-		std::map<QString, QPointer<Group>> const& groups = m->groups();
-		for(auto it = groups.begin(); it != groups.end(); ++it) {
-			Group* g = it->second;
-			if(!g || g->renderOptions() & Group::Hidden)
-				continue;
+void Renderer::frameDrawInfo(std::size_t index, DrawInfo& drawInfo) const {
+	std::size_t const opaqueCount = m_opaqueOrder.size();
+	GroupBufferData const& gbd    = index < opaqueCount ? m_opaqueGroupBuffer[m_opaqueOrder[index].m_index] : m_translucentGroupBuffer[index - opaqueCount];
+
+	drawInfo.m_modelMatrix        = drawInfo.m_scene->instanceTransform(gbd.m_instance);
+	drawInfo.m_groupPosition      = gbd.m_position;
+	drawInfo.m_instance           = gbd.m_instance;
+	drawInfo.m_mesh               = gbd.m_mesh;
+	drawInfo.m_material           = gbd.m_material;
+	drawInfo.m_materialProperties = gbd.m_materialProperties;
+	drawInfo.m_lodLevel           = gbd.m_lodLevel;
+	drawInfo.m_drawIndex          = index;
+}
 
-			Mesh* mesh                  = g->mesh();
-			Material* mat               = g->material();
-			MaterialProperties* matProp = g->materialProperties();
-
-			if(mesh && mat && matProp) {
-				GroupBufferData* gbd = nullptr;
-				if(mat->renderOptions() & Material::Translucent || matProp->isTranslucent()) {
-					m_translucentGroupBuffer.emplace_back();
-					gbd = &m_translucentGroupBuffer.back();
-				}
-				else {
-					m_opaqueGroupBuffer.emplace_back();
-					gbd = &m_opaqueGroupBuffer.back();
-				}
-
-				gbd->m_group              = g;
-				gbd->m_transform          = baseMatrix * g->groupMatrix();
-				gbd->m_position = (gbd->m_transform * g->position());
-				gbd->m_distanceFromCamera = QVector3D::dotProduct(gbd->m_position - camera.position(), camera.forward());
-			}
-		}
+void Renderer::BuildDrawLists(Camera const& camera, Scene* scene) {
+	Frustum const frustum = camera.frustum();
+
+	DrawListView view;
+	view.m_position         = camera.position();
+	view.m_forward          = camera.forward();
+	view.m_pixelScale       = m_viewportSize.height() > 0 ? camera.getProjection()(1, 1) * 0.5f * static_cast<float>(m_viewportSize.height()) : 0.f;
+	view.m_viewportArea     = static_cast<float>(m_viewportSize.width()) * static_cast<float>(m_viewportSize.height());
+	view.m_nearPlane        = camera.nearPlane();
+	view.m_orthogonal       = (camera.projectionMode() == Camera::PM_ORTHOGONAL);
+	view.m_occlusionCulling = m_softwareOcclusionCulling;
+
+	// The hierarchy only rejects whole nodes, the instances it returns are tested in batches below.
+	std::size_t const transformUpdateCount = scene->transformUpdateCount();
+	scene->queryFrustum(frustum, m_drawCandidates, false);
+	m_drawStats.updatedTransforms = scene->transformUpdateCount() - transformUpdateCount;
+
+	std::size_t const candidateCount = m_drawCandidates.size();
+	m_boundsX.resize(candidateCount);
+	m_boundsY.resize(candidateCount);
+	m_boundsZ.resize(candidateCount);
+	m_boundsRadius.resize(candidateCount);
+	m_boundsVisible.resize(candidateCount);
+	m_boundsDepth.resize(candidateCount);
+
+	// Sized beforehand, so that each chunk only writes the entries of its own instances
+	if(m_lodLevels.size() < scene->instanceCapacity()) {
+		m_lodLevels.resize(scene->instanceCapacity(), 0);
+		m_lodFrames.resize(scene->instanceCapacity(), 0);
 	}
 
-	std::vector<QPointer<Entity>> const& subEntities = e->childrenEntities();
-	for(auto it = subEntities.begin(); it != subEntities.end(); ++it) {
-		if(it->isNull())
+	if(view.m_occlusionCulling)
+		rasterizeOccluders(camera, view, scene);
+
+	std::size_t const chunkCount = (candidateCount + DrawListChunkSize - 1) / DrawListChunkSize;
+	if(m_drawListChunks.size() < chunkCount)
+		m_drawListChunks.resize(chunkCount);
+	parallelFor(chunkCount, [&](std::size_t chunk) { buildDrawListChunk(chunk, frustum, view, scene); });
+
+	std::size_t visibleCount     = 0;
+	std::size_t opaqueCount      = 0;
+	std::size_t translucentCount = 0;
+	float opaqueArea             = 0.f;
+	for(std::size_t chunk = 0; chunk < chunkCount; ++chunk) {
+		DrawListChunk& c = m_drawListChunks[chunk];
+		visibleCount                      += c.m_visible;
+		opaqueArea                        += c.m_opaqueArea;
+		m_drawStats.drawnGroups           += c.m_stats.drawnGroups;
+		m_drawStats.sizeCulledGroups      += c.m_stats.sizeCulledGroups;
+		m_drawStats.occlusionCulledGroups += c.m_stats.occlusionCulledGroups;
+		m_drawStats.submittedTriangles    += c.m_stats.submittedTriangles;
+		m_drawStats.fullDetailTriangles   += c.m_stats.fullDetailTriangles;
+
+		c.m_opaqueOffset      = opaqueCount;
+		c.m_translucentOffset = translucentCount;
+		opaqueCount          += c.m_opaque.size();
+		translucentCount     += c.m_translucent.size();
+	}
+	m_drawStats.frustumCulledGroups = scene->indexedInstanceCount() - visibleCount;
+	m_drawStats.opaqueOverdraw      = view.m_viewportArea > 0.f ? opaqueArea / view.m_viewportArea : 0.f;
+
+	// The chunks copy their draws to disjoint ranges, in the order of the candidates
+	m_opaqueGroupBuffer.resize(opaqueCount);
+	m_translucentGroupBuffer.resize(translucentCount);
+	parallelFor(chunkCount, [&](std::size_t chunk) {
+		DrawListChunk const& c = m_drawListChunks[chunk];
+		std::copy(c.m_opaque.begin(), c.m_opaque.end(), m_opaqueGroupBuffer.begin() + c.m_opaqueOffset);
+		std::copy(c.m_translucent.begin(), c.m_translucent.end(), m_translucentGroupBuffer.begin() + c.m_translucentOffset);
+	});
+}
+
+void Renderer::rasterizeOccluders(Camera const& camera, DrawListView const& view, Scene const* scene) {
+	m_occlusionBuffer.clear(camera.getProjection() * camera.getView());
+	for(Scene::InstanceHandle instance: m_drawCandidates) {
+		Mesh* mesh                  = scene->instanceMesh(instance);
+		Material* mat               = scene->instanceMaterial(instance);
+		MaterialProperties* matProp = scene->instanceMaterialProperties(instance);
+		if(!mesh || !mat || !matProp || !(mesh->renderOptions() & Mesh::Occluder))
+			continue;
+		if(mat->renderOptions() & Material::Translucent || matProp->isTranslucent())
+			continue;
+
+		// Same size and level of detail as buildDrawListChunk() gives the instance: only what is drawn occludes
+		QVector3D const center = scene->instanceSphereCenter(instance);
+		float const x          = center.x();
+		float const y          = center.y();
+		float const z          = center.z();
+		float const radius     = scene->instanceSphereRadius(instance);
+		float depth            = 0.f;
+		sphereDepths(&x, &y, &z, &radius, 1, view.m_position, view.m_forward, &depth);
+
+		float const pixelScale = pixelsPerUnit(view, depth);
+		if(pixelScale > 0.f && 2.f * radius * pixelScale < m_minimumPixelSize)
 			continue;
-		BuildDrawLists(camera, *it, cascadeMatrix * (*it)->entityMatrix());
+
+		std::size_t const previousLevel = (m_lodFrames[instance.index] + 1 == m_frameIndex) ? m_lodLevels[instance.index] : 0;
+		std::size_t const lodLevel      = selectLodLevel(mesh, pixelScale * scene->instanceScale(instance), previousLevel);
+
+		// Built here, on this thread, the first time
+		Mesh::OccluderGeometry const& geometry = mesh->occluderGeometry();
+		if(geometry.positions.empty())
+			continue;
+
+		// The levels of detail index the same positions
+		std::vector<std::uint32_t> const& triangles = lodLevel ? mesh->lods()[lodLevel - 1].indices : geometry.triangles;
+		m_occlusionBuffer.addOccluder(geometry.positions.data(), geometry.positions.size() / 3, triangles.data(), triangles.size() / 3, scene->instanceTransform(instance));
+	}
+	m_occlusionBuffer.rasterize();
+	m_drawStats.occluderTriangles = m_occlusionBuffer.rasterizedTriangles();
+}
+
+void Renderer::buildDrawListChunk(std::size_t chunk, Frustum const& frustum, DrawListView const& view, Scene const* scene) {
+	std::size_t const begin = chunk * DrawListChunkSize;
+	std::size_t const count = std::min(DrawListChunkSize, m_drawCandidates.size() - begin);
+
+	DrawListChunk& c = m_drawListChunks[chunk];
+	c.m_opaque.clear();
+	c.m_translucent.clear();
+	c.m_stats      = DrawStats();
+	c.m_opaqueArea = 0.f;
+
+	Scene::InstanceHandle const* candidates = m_drawCandidates.data() + begin;
+	float* x                                = m_boundsX.data() + begin;
+	float* y                                = m_boundsY.data() + begin;
+	float* z                                = m_boundsZ.data() + begin;
+	float* radius                           = m_boundsRadius.data() + begin;
+	float* depth                            = m_boundsDepth.data() + begin;
+	std::uint8_t* visible                   = m_boundsVisible.data() + begin;
+
+	for(std::size_t i = 0; i < count; ++i) {
+		QVector3D const center = scene->instanceSphereCenter(candidates[i]);
+		x[i]                   = center.x();
+		y[i]                   = center.y();
+		z[i]                   = center.z();
+		radius[i]              = scene->instanceSphereRadius(candidates[i]);
+	}
+
+	c.m_visible = frustum.cullSpheres(x, y, z, radius, count, visible);
+	sphereDepths(x, y, z, radius, count, view.m_position, view.m_forward, depth);
+
+	for(std::size_t i = 0; i < count; ++i) {
+		if(!visible[i])
+			continue;
+
+		Scene::InstanceHandle const instance = candidates[i];
+		Mesh* mesh                           = scene->instanceMesh(instance);
+		Material* mat                        = scene->instanceMaterial(instance);
+		MaterialProperties* matProp          = scene->instanceMaterialProperties(instance);
+		if(!mesh || !mat || !matProp)
+			continue;
+
+		// Measured at the nearest point of the sphere
+		float const pixelScale = pixelsPerUnit(view, depth[i]);
+
+		if(pixelScale > 0.f && 2.f * radius[i] * pixelScale < m_minimumPixelSize) {
+			++c.m_stats.sizeCulledGroups;
+			continue;
+		}
+
+		// The buffer is only read here: the chunks test their instances concurrently
+		if(view.m_occlusionCulling && std::isfinite(radius[i]) && m_occlusionBuffer.isOccluded(scene->instanceBoundsMin(instance), scene->instanceBoundsMax(instance))) {
+			++c.m_stats.occlusionCulledGroups;
+			continue;
+		}
+
+		// Instances that were not drawn in the previous frame start over from the full mesh.
+		std::size_t const previousLevel = (m_lodFrames[instance.index] + 1 == m_frameIndex) ? m_lodLevels[instance.index] : 0;
+		std::size_t const lodLevel      = selectLodLevel(mesh, pixelScale * scene->instanceScale(instance), previousLevel);
+		m_lodLevels[instance.index]           = lodLevel;
+		m_lodFrames[instance.index]           = m_frameIndex;
+
+		++c.m_stats.drawnGroups;
+		c.m_stats.submittedTriangles  += mesh->triangleCount(lodLevel);
+		c.m_stats.fullDetailTriangles += mesh->triangleCount();
+
+		bool const translucent               = (mat->renderOptions() & Material::Translucent || matProp->isTranslucent());
+		std::vector<GroupBufferData>& buffer = translucent ? c.m_translucent : c.m_opaque;
+		if(!translucent && pixelScale > 0.f) {
+			float const pixelRadius = radius[i] * pixelScale;
+			c.m_opaqueArea         += std::min(3.14159265f * pixelRadius * pixelRadius, view.m_viewportArea);
+		}
+		buffer.emplace_back();
+		GroupBufferData* gbd = &buffer.back();
+
+		// Groups are placed at their position, instances without a group at their origin
+		QMatrix4x4 const& transform = scene->instanceTransform(instance);
+		Group* g                    = scene->instanceGroup(instance);
+
+		gbd->m_instance           = instance;
+		gbd->m_group              = g;
+		gbd->m_mesh               = mesh;
+		gbd->m_material           = mat;
+		gbd->m_materialProperties = matProp;
+		gbd->m_position           = g ? transformPoint(transform, g->position()) : transform.column(3).toVector3D();
+		gbd->m_distanceFromCamera = QVector3D::dotProduct(gbd->m_position - view.m_position, view.m_forward);
+		gbd->m_lodLevel           = lodLevel;
 	}
 }
 
+float Renderer::pixelsPerUnit(DrawListView const& view, float depth) {
+	if(view.m_orthogonal)
+		return view.m_pixelScale;
+
+	// Meshes reaching the near plane are as large as they will ever be.
+	return view.m_pixelScale / std::max(depth, view.m_nearPlane);
+}
+
+std::size_t Renderer::selectLodLevel(Mesh const* mesh, float pixelsPerModelUnit, std::size_t previousLevel) const {
+	if(pixelsPerModelUnit <= 0.f)
+		return 0;
+
+	std::vector<Mesh::Lod> const& lods = mesh->lods();
+	std::size_t level                  = 0;
+	for(std::size_t i = 0; i < lods.size(); ++i) {
+		float budget = m_lodPixelError;
+		if(i + 1 > previousLevel)
+			budget *= LodHysteresis;
+		if(lods[i].error * pixelsPerModelUnit > budget)
+			break;
+		level = i + 1;
+	}
+	return level;
+}
+
+void Renderer::setViewportSize(QSize const& size) {
+	m_viewportSize = size;
+}
+QSize const& Renderer::viewportSize() const {
+	return m_viewportSize;
+}
+
+void Renderer::setLodPixelError(float pixels) {
+	m_lodPixelError = pixels;
+}
+float Renderer::lodPixelError() const {
+	return m_lodPixelError;
+}
+
+void Renderer::setMinimumPixelSize(float pixels) {
+	m_minimumPixelSize = pixels;
+}
+float Renderer::minimumPixelSize() const {
+	return m_minimumPixelSize;
+}
+
+void Renderer::setOpaqueSortPolicy(OpaqueSortPolicy policy) {
+	m_opaqueSortPolicy = policy;
+}
+Renderer::OpaqueSortPolicy Renderer::opaqueSortPolicy() const {
+	return m_opaqueSortPolicy;
+}
+
+void Renderer::setDepthPrePass(DepthPrePass mode) {
+	m_depthPrePass = mode;
+}
+Renderer::DepthPrePass Renderer::depthPrePass() const {
+	return m_depthPrePass;
+}
+
+void Renderer::setDepthPrePassOverdraw(float viewports) {
+	m_depthPrePassOverdraw = viewports;
+}
+float Renderer::depthPrePassOverdraw() const {
+	return m_depthPrePassOverdraw;
+}
+
+void Renderer::setSoftwareOcclusionCulling(bool enabled) {
+	m_softwareOcclusionCulling = enabled;
+}
+bool Renderer::softwareOcclusionCulling() const {
+	return m_softwareOcclusionCulling;
+}
+
+void Renderer::setOcclusionBufferResolution(QSize const& size) {
+	m_occlusionBuffer.setResolution(size);
+}
+OcclusionBuffer const& Renderer::occlusionBuffer() const {
+	return m_occlusionBuffer;
+}
+
+Renderer::DrawStats const& Renderer::drawStats() const {
+	return m_drawStats;
+}
+
 void Renderer::BeginDrawing(Camera const&, Scene const* scene) { m_currentScene = scene; }
 void Renderer::EndDrawing(Scene const*) { m_currentScene = nullptr; }
 void Renderer::BeginOpaque() {}
+void Renderer::PrepareDraws(DrawInfo const&, bool) {}
 void Renderer::EndOpaque() {}
+void Renderer::BeginDepthPrePass() {}
+void Renderer::EndDepthPrePass() {}
 void Renderer::BeginTranslucent() {}
 void Renderer::EndTranslucent() {}
 
@@ -242,27 +683,20 @@ void Renderer::getClosestSceneLights(QVector3D const& pos, size_t desiredLightCo
 		return;
 	}
 
-	std::map<std::size_t, PointLightInfo> const& l = sceneOverride->lights();
-
-	result.resize(std::min<std::size_t>(desiredLightCount, l.size()));
-
-	std::partial_sort_copy(
-		l.begin(),
-		l.end(),
-		result.begin(),
-		result.end(),
-		[&](std::pair<std::size_t, PointLightInfo> const& l,
-	       std::pair<std::size_t, PointLightInfo> const& r) -> bool
-		{
-			return l.second.position.distanceToPoint(pos) < r.second.position.distanceToPoint(pos);
-		}
-	);
+	sceneOverride->queryNearestLights(pos, desiredLightCount, m_closestLightIds);
+	result.resize(m_closestLightIds.size());
+	for(std::size_t i = 0; i < m_closestLightIds.size(); ++i)
+		result[i] = std::make_pair(m_closestLightIds[i], *sceneOverride->getLight(m_closestLightIds[i]));
 }
 
 Scene const* Renderer::currentScene() const {
 	return m_currentScene;
 }
 
+LightClusters const& Renderer::lightClusters() const {
+	return m_lightClusters;
+}
+
 void Renderer::addToMaterialCaches(QPointer<MaterialCache> material) {
 	m_materialCaches.push_back(std::move(material));
 }
@@ -3,8 +3,11 @@
 
 #include "A3D/common.h"
 #include <cstdint>
+#include <QSize>
 #include "A3D/scene.h"
 #include "A3D/camera.h"
+#include "A3D/lightclusters.h"
+#include "A3D/occlusionbuffer.h"
 
 namespace A3D {
 
@@ -19,31 +22,136 @@ public:
 		QMatrix4x4 m_projMatrix;
 		QMatrix4x4 m_viewMatrix;
 		QVector3D m_groupPosition;
+
+		// Instance drawn in m_scene, and its resources; the group passed to Draw() is null for the instances added with Scene::addInstance().
+		Scene::InstanceHandle m_instance;
+		Mesh* m_mesh;
+		Material* m_material;
+		MaterialProperties* m_materialProperties;
+
+		// Level of detail of the mesh: 0 is the full mesh, n is Mesh::lods()[n - 1].
+		std::size_t m_lodLevel;
+
+		// Position of the draw in the frame (see frameDrawInfo()); DrawDepth() gets the one of the Draw() of the same group.
+		std::size_t m_drawIndex;
+	};
+
+	// Order of the opaque draws. Translucent draws are always sorted back to front.
+	enum OpaqueSortPolicy {
+		// By depth, then by state: the least overdraw
+		FrontToBack,
+
+		// By material (shader program), material properties (textures), mesh (vertex array), then depth: the fewest state changes
+		StateFirst,
+	};
+
+	// Depth-only pass over the opaque draws before they are shaded, so that only the visible fragments are.
+	// Only the materials with Material::DepthPrePassCompatible take part: the others are drawn as without it.
+	enum DepthPrePass {
+		DepthPrePassOff,
+		DepthPrePassOn,
+
+		// When the estimated overdraw of the opaque draws (see DrawStats::opaqueOverdraw) reaches depthPrePassOverdraw()
+		DepthPrePassAuto,
+	};
+
+	// Counters of the last DrawAll().
+	struct DrawStats {
+		std::size_t drawnGroups;
+		std::size_t frustumCulledGroups;
+		std::size_t sizeCulledGroups;
+		std::size_t submittedTriangles;
+
+		// Triangles the drawn groups would have submitted at full detail
+		std::size_t fullDetailTriangles;
+
+		// World matrices computed for the frame (see Scene::transformUpdateCount()), 0 when nothing moved
+		std::size_t updatedTransforms;
+
+		// Draws using another material, material properties or mesh than the previous draw, the first draw included
+		std::size_t programSwitches;
+		std::size_t textureSwitches;
+		std::size_t vertexArraySwitches;
+
+		// Screen area covered by the bounding spheres of the opaque draws, in viewports; 0 when the viewport size is unknown
+		float opaqueOverdraw;
+
+		// Draws of the depth pre-pass, 0 when there was none
+		std::size_t depthPrePassGroups;
+
+		// Software occlusion culling: triangles of the occluders rasterized, and groups found hidden behind them
+		std::size_t occluderTriangles;
+		std::size_t occlusionCulledGroups;
 	};
 
 	virtual ~Renderer();
 
 	std::uintptr_t rendererID() const;
 
-	virtual void Draw(Group*, DrawInfo const&)    = 0;
-	virtual void PreLoadEntity(Entity*)           = 0;
-	virtual void Delete(MeshCache*)               = 0;
-	virtual void Delete(MaterialCache*)           = 0;
-	virtual void Delete(MaterialPropertiesCache*) = 0;
-	virtual void Delete(TextureCache*)            = 0;
-	virtual void Delete(CubemapCache*)            = 0;
-	virtual void DeleteAllResources()             = 0;
+	virtual void Draw(Group*, DrawInfo const&)      = 0;
+	virtual void DrawDepth(Group*, DrawInfo const&) = 0;
+	virtual void PreLoadEntity(Entity*)             = 0;
+	virtual void Delete(MeshCache*)                 = 0;
+	virtual void Delete(MaterialCache*)             = 0;
+	virtual void Delete(MaterialPropertiesCache*)   = 0;
+	virtual void Delete(TextureCache*)              = 0;
+	virtual void Delete(CubemapCache*)              = 0;
+	virtual void DeleteAllResources()               = 0;
 
 	void PreLoadEntityTree(Entity*);
 	void CleanupRenderCache();
 	void DrawAll(Scene* root, Camera const& camera);
 
+	// Size, in pixels, of the surface DrawAll() renders to.
+	// Until it is set, meshes are drawn at full detail and none is culled for its size.
+	void setViewportSize(QSize const&);
+	QSize const& viewportSize() const;
+
+	// Largest error, in pixels, of the level of detail drawn for a mesh. Defaults to 1.
+	void setLodPixelError(float pixels);
+	float lodPixelError() const;
+
+	// Groups whose bounding sphere is smaller than this on screen, in pixels, are not drawn. 0 (the default) disables it.
+	void setMinimumPixelSize(float pixels);
+	float minimumPixelSize() const;
+
+	// Defaults to StateFirst.
+	void setOpaqueSortPolicy(OpaqueSortPolicy);
+	OpaqueSortPolicy opaqueSortPolicy() const;
+
+	// Defaults to DepthPrePassAuto, with an overdraw of 3: the bounding spheres cover more than the meshes do.
+	void setDepthPrePass(DepthPrePass);
+	DepthPrePass depthPrePass() const;
+	void setDepthPrePassOverdraw(float viewports);
+	float depthPrePassOverdraw() const;
+
+	// Before the draw lists are built, the opaque instances of Mesh::Occluder meshes are rasterized into a low resolution
+	// depth buffer on the CPU, and the groups whose bounding box they hide are left out. Off by default.
+	void setSoftwareOcclusionCulling(bool);
+	bool softwareOcclusionCulling() const;
+
+	// Defaults to 256 x 128 pixels.
+	void setOcclusionBufferResolution(QSize const&);
+
+	// Buffer of the current (or last) DrawAll()
+	OcclusionBuffer const& occlusionBuffer() const;
+
+	DrawStats const& drawStats() const;
+
 protected:
 	virtual void BeginDrawing(Camera const&, Scene const*);
 	virtual void EndDrawing(Scene const*);
 
 	virtual void BeginOpaque();
 	virtual void EndOpaque();
+
+	// After BeginOpaque(), once every draw of the frame is known and before the first of them: per-draw data can be prepared at once.
+	// frameInfo holds the fields the draws share (scene and camera matrices); depthPrePass tells whether DrawDepth() will be called.
+	virtual void PrepareDraws(DrawInfo const& frameInfo, bool depthPrePass);
+
+	// Around the DrawDepth() calls, after BeginOpaque() and before the Draw() calls of the opaque draws
+	virtual void BeginDepthPrePass();
+	virtual void EndDepthPrePass();
 	virtual void BeginTranslucent();
 	virtual void EndTranslucent();
 
@@ -54,22 +162,104 @@ protected:
 	void addToCubemapCaches(QPointer<CubemapCache>);
 	void runDeleteOnAllResources();
 	void invalidateCache();
+	// Up to desiredLightCount lights of the scene (the current one by default), the closest first, from the light index of the scene.
 	void getClosestSceneLights(QVector3D const& pos, std::size_t desiredLightCount, std::vector<std::pair<std::size_t, PointLightInfo>>& result, Scene const* =nullptr);
 	Scene const* currentScene() const;
 
+	// Draws of the current frame, in the order of the Draw() calls: the opaque ones, then the translucent ones.
+	std::size_t frameDrawCount() const;
+	std::size_t frameOpaqueDrawCount() const;
+
+	// Sets the fields of drawInfo that change from one draw to the next; its m_scene has to be set.
+	void frameDrawInfo(std::size_t index, DrawInfo& drawInfo) const;
+
+	// Lights of the scene binned for the camera of the current (or last) DrawAll(), before BeginDrawing()
+	LightClusters const& lightClusters() const;
+
 private:
-	void BuildDrawLists(Camera const& camera, Entity* root, QMatrix4x4 const& cascadeMatrix);
+	// Camera values the draw lists are built from, read once per frame
+	struct DrawListView {
+		QVector3D m_position;
+		QVector3D m_forward;
+
+		// Pixels per unit of length at depth 1 (or at any depth for orthogonal projections), 0 when the viewport size is unknown
+		float m_pixelScale;
+		float m_viewportArea;
+		float m_nearPlane;
+		bool m_orthogonal;
+
+		// The occlusion buffer was rasterized for this frame
+		bool m_occlusionCulling;
+	};
 
+	// Collects the instances of the scene index that intersect the view frustum,
+	// then culls them by their bounding sphere and their size on screen, before they are sorted.
+	// The candidates are split in chunks processed on the global QThreadPool, each one into its own buffers,
+	// which are then copied at their offset in the draw lists: the result is the same as a sequential build.
+	void BuildDrawLists(Camera const& camera, Scene* scene);
+
+	// Rasterizes the occluders among the candidates, at the level of detail they are drawn with
+	void rasterizeOccluders(Camera const& camera, DrawListView const& view, Scene const* scene);
+
+	// Bounds, frustum test, depth and draw data of the candidates of one chunk
+	void buildDrawListChunk(std::size_t chunk, Frustum const& frustum, DrawListView const& view, Scene const* scene);
+
+	// Pixels covered on screen by one unit of length at the given depth, 0 when the viewport size is unknown.
+	static float pixelsPerUnit(DrawListView const& view, float depth);
+
+	// Coarsest level of detail whose error stays within lodPixelError(). Coarser levels than the previous one
+	// have to fit a slightly smaller budget, so that a mesh does not switch back and forth at the boundary.
+	std::size_t selectLodLevel(Mesh const* mesh, float pixelsPerModelUnit, std::size_t previousLevel) const;
+
+	// The transform is read from the scene when the instance is drawn.
 	struct GroupBufferData {
+		Scene::InstanceHandle m_instance;
 		Group* m_group;
-		QMatrix4x4 m_transform;
+		Mesh* m_mesh;
+		Material* m_material;
+		MaterialProperties* m_materialProperties;
 		QVector3D m_position;
 		float m_distanceFromCamera;
+		std::size_t m_lodLevel;
+	};
+
+	// Sort key of an opaque draw, and its index in m_opaqueGroupBuffer
+	struct SortEntry {
+		std::uint64_t m_key;
+		std::uint32_t m_index;
+	};
+
+	// Small numbers given to the resources in the order they are first drawn in a frame, so that they fit in the sort keys
+	struct SortIds {
+		std::vector<std::uint32_t> m_frames;
+		std::vector<std::uint32_t> m_ids;
+		std::uint32_t m_frame;
+		std::uint32_t m_count;
+	};
+
+	// Draws of the candidates [chunk * DrawListChunkSize, (chunk + 1) * DrawListChunkSize), and their part of the draw stats
+	struct DrawListChunk {
+		std::vector<GroupBufferData> m_opaque;
+		std::vector<GroupBufferData> m_translucent;
+		std::size_t m_visible;
+		DrawStats m_stats;
+
+		// Pixels covered by the bounding spheres of the opaque draws
+		float m_opaqueArea;
+
+		// Where the draws of the chunk go in the draw lists
+		std::size_t m_opaqueOffset;
+		std::size_t m_translucentOffset;
 	};
 
-	static bool OpaqueSorter(GroupBufferData const& a, GroupBufferData const& b);
 	static bool TranslucentSorter(GroupBufferData const& a, GroupBufferData const& b);
 
+	// Stable, 8 bits of the keys per pass
+	static void RadixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch);
+
+	std::uint32_t sortId(SortIds&, ResourceHandle);
+	std::uint64_t opaqueSortKey(GroupBufferData const&, float maxDistance);
+
 	std::uintptr_t m_rendererID;
 	std::vector<QPointer<MeshCache>> m_meshCaches;
 	std::vector<QPointer<MaterialCache>> m_materialCaches;
@@ -80,6 +270,42 @@ private:
 	std::vector<GroupBufferData> m_opaqueGroupBuffer;
 	std::vector<GroupBufferData> m_translucentGroupBuffer;
 
+	OpaqueSortPolicy m_opaqueSortPolicy;
+	DepthPrePass m_depthPrePass;
+	float m_depthPrePassOverdraw;
+	std::vector<SortEntry> m_opaqueOrder;
+	std::vector<SortEntry> m_sortScratch;
+	SortIds m_materialSortIds;
+	SortIds m_materialPropertiesSortIds;
+	SortIds m_meshSortIds;
+
+	// Bounding spheres of m_drawCandidates, one array per coordinate for the batched frustum test
+	std::vector<Scene::InstanceHandle> m_drawCandidates;
+	std::vector<float> m_boundsX;
+	std::vector<float> m_boundsY;
+	std::vector<float> m_boundsZ;
+	std::vector<float> m_boundsRadius;
+	std::vector<std::uint8_t> m_boundsVisible;
+
+	// Distance from the camera plane to the nearest point of each sphere
+	std::vector<float> m_boundsDepth;
+	std::vector<DrawListChunk> m_drawListChunks;
+
+	QSize m_viewportSize;
+	float m_lodPixelError;
+	float m_minimumPixelSize;
+	DrawStats m_drawStats;
+
+	// Level of detail each instance was last drawn at, and the frame it was drawn in, at the index of its handle.
+	std::vector<std::size_t> m_lodLevels;
+	std::vector<std::uint32_t> m_lodFrames;
+	std::uint32_t m_frameIndex;
+
+	LightClusters m_lightClusters;
+	std::vector<std::size_t> m_closestLightIds;
+
+	bool m_softwareOcclusionCulling;
+	OcclusionBuffer m_occlusionBuffer;
 	Scene const* m_currentScene;
 
 public:
@@ -1,15 +1,86 @@
 #include "A3D/rendererogl.h"
-#include <cstddef>
 
 namespace A3D {
 
+// Writes the matrices a layout declares to its block at data
+static void writeTransforms(char* data, MaterialCacheOGL::TransformLayout const& layout, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix) {
+	GLint const* offsets = layout.m_offsets;
+
+	auto write = [&](MaterialCacheOGL::TransformMatrix matrix, QMatrix4x4 const& value) {
+		std::memcpy(data + offsets[matrix], value.constData(), 16 * sizeof(float));
+	};
+	auto declared = [&](MaterialCacheOGL::TransformMatrix matrix) { return offsets[matrix] >= 0; };
+
+	if(declared(MaterialCacheOGL::ProjectionMatrix))
+		write(MaterialCacheOGL::ProjectionMatrix, projMatrix);
+	if(declared(MaterialCacheOGL::ViewMatrix))
+		write(MaterialCacheOGL::ViewMatrix, viewMatrix);
+	if(declared(MaterialCacheOGL::ModelMatrix))
+		write(MaterialCacheOGL::ModelMatrix, modelMatrix);
+	if(declared(MaterialCacheOGL::ModelNormalMatrix))
+		write(MaterialCacheOGL::ModelNormalMatrix, modelMatrix.inverted().transposed());
+
+	bool const needsMvp = declared(MaterialCacheOGL::ModelViewProjectionMatrix) || declared(MaterialCacheOGL::ModelViewProjectionNormalMatrix);
+	bool const needsMv  = needsMvp || declared(MaterialCacheOGL::ModelViewMatrix) || declared(MaterialCacheOGL::ModelViewNormalMatrix);
+	if(needsMv) {
+		QMatrix4x4 const mvMatrix = viewMatrix * modelMatrix;
+		if(declared(MaterialCacheOGL::ModelViewMatrix))
+			write(MaterialCacheOGL::ModelViewMatrix, mvMatrix);
+		if(declared(MaterialCacheOGL::ModelViewNormalMatrix))
+			write(MaterialCacheOGL::ModelViewNormalMatrix, mvMatrix.inverted().transposed());
+
+		if(needsMvp) {
+			QMatrix4x4 const mvpMatrix = projMatrix * mvMatrix;
+			if(declared(MaterialCacheOGL::ModelViewProjectionMatrix))
+				write(MaterialCacheOGL::ModelViewProjectionMatrix, mvpMatrix);
+			if(declared(MaterialCacheOGL::ModelViewProjectionNormalMatrix))
+				write(MaterialCacheOGL::ModelViewProjectionNormalMatrix, mvpMatrix.inverted().transposed());
+		}
+	}
+}
+
+// The cube mesh spans [-1, 1] on each axis
+static QMatrix4x4 boundingBoxMatrix(Scene const* scene, Scene::InstanceHandle instance) {
+	QVector3D const& boundsMin = scene->instanceBoundsMin(instance);
+	QVector3D const& boundsMax = scene->instanceBoundsMax(instance);
+	QMatrix4x4 boxMatrix;
+	boxMatrix.translate((boundsMin + boundsMax) * 0.5f);
+	boxMatrix.scale((boundsMax - boundsMin) * 0.5f);
+	return boxMatrix;
+}
+
 RendererOGL::RendererOGL(QOpenGLContext* ctx, CoreGLFunctions* gl)
 	: Renderer(),
 	  m_context(ctx),
 	  m_gl(gl),
+	  m_state(gl),
 	  m_skyboxMaterial(nullptr),
 	  m_skyboxMesh(nullptr),
+	  m_depthMaterial(nullptr),
+	  m_depthPrePassDone(false),
+	  m_occlusionCulling(false),
+	  m_occlusionQueryInterval(8),
+	  m_occlusionFrame(0),
+	  m_occlusionPass(false),
+	  m_occlusionScene(nullptr),
+	  m_cameraPosition(),
+	  m_cameraForward(),
+	  m_cameraNearPlane(0.f),
+	  m_boundingBoxMesh(nullptr),
+	  m_occlusionRecords(),
+	  m_pendingOcclusionQueries(),
+	  m_occlusionStats(),
+	  m_sceneData(),
 	  m_sceneUBO(0),
+	  m_clusterBuffers(),
+	  m_clusterTextures(),
+	  m_transformRing(0),
+	  m_transformSegmentSize(TransformSegmentBaseSize),
+	  m_transformAlignment(1),
+	  m_transformSegment(0),
+	  m_transformOffset(0),
+	  m_transformFences(),
+	  m_drawTransforms(),
 	  m_brdfCalculated(false),
 	  m_brdfLUT(0) {
 	log(LC_Debug, "Constructor: RendererOGL");
@@ -22,122 +93,175 @@ RendererOGL::~RendererOGL() {
 }
 
 void RendererOGL::pushState(bool withFramebuffer) {
-	if(m_stateStorage.size() > 24) {
+	if(m_state.stackSize() > 24) {
 		log(LC_Critical, "RendererOGL::pushState: GL State stack is too big.");
 		return;
 	}
 
-	StateStorage newStateStorage;
-
-	m_gl->glGetIntegerv(GL_VIEWPORT, newStateStorage.m_viewport);
-	m_gl->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &newStateStorage.m_drawFramebuffer);
-	m_gl->glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &newStateStorage.m_readFramebuffer);
-	m_gl->glGetBooleanv(GL_DEPTH_WRITEMASK, &newStateStorage.m_depthMask);
-	m_gl->glGetIntegerv(GL_CURRENT_PROGRAM, &newStateStorage.m_program);
-	for(GLenum e: { GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND }) {
-		GLboolean feature;
-		m_gl->glGetBooleanv(e, &feature);
-		newStateStorage.m_features[e] = feature;
-	}
-
-	for(std::pair<GLenum, GLenum> e: {
-			std::pair<GLenum, GLenum>{                  GL_TEXTURE_BINDING_1D,                   GL_TEXTURE_1D},
-             std::pair<GLenum, GLenum>{                  GL_TEXTURE_BINDING_2D,                   GL_TEXTURE_2D},
-			std::pair<GLenum, GLenum>{                  GL_TEXTURE_BINDING_3D,                   GL_TEXTURE_3D},
-             std::pair<GLenum, GLenum>{            GL_TEXTURE_BINDING_1D_ARRAY,             GL_TEXTURE_1D_ARRAY},
-			std::pair<GLenum, GLenum>{            GL_TEXTURE_BINDING_2D_ARRAY,             GL_TEXTURE_2D_ARRAY},
-             std::pair<GLenum, GLenum>{           GL_TEXTURE_BINDING_RECTANGLE,            GL_TEXTURE_RECTANGLE},
-			std::pair<GLenum, GLenum>{            GL_TEXTURE_BINDING_CUBE_MAP,             GL_TEXTURE_CUBE_MAP},
-			std::pair<GLenum, GLenum>{      GL_TEXTURE_BINDING_CUBE_MAP_ARRAY,       GL_TEXTURE_CUBE_MAP_ARRAY},
-             std::pair<GLenum, GLenum>{              GL_TEXTURE_BINDING_BUFFER,               GL_TEXTURE_BUFFER},
-			std::pair<GLenum, GLenum>{      GL_TEXTURE_BINDING_2D_MULTISAMPLE,       GL_TEXTURE_2D_MULTISAMPLE},
-			std::pair<GLenum, GLenum>{GL_TEXTURE_BINDING_2D_MULTISAMPLE_ARRAY, GL_TEXTURE_2D_MULTISAMPLE_ARRAY}
-    })
-	{
-		GLint textureBinding = 0;
-		m_gl->glGetIntegerv(e.first, &textureBinding);
-		newStateStorage.m_textureBindings[e.second] = textureBinding;
-	}
-
-	GLint activeTexture = 0;
-	m_gl->glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
-	newStateStorage.m_activeTexture = activeTexture;
-
-	newStateStorage.m_newFramebuffer = 0;
+	m_state.push();
+
+	GLuint newFramebuffer = 0;
 	if(withFramebuffer) {
-		m_gl->glGenFramebuffers(1, &newStateStorage.m_newFramebuffer);
-		if(newStateStorage.m_newFramebuffer)
-			m_gl->glBindFramebuffer(GL_FRAMEBUFFER, newStateStorage.m_newFramebuffer);
+		m_gl->glGenFramebuffers(1, &newFramebuffer);
+		if(newFramebuffer)
+			m_state.bindFramebuffer(GL_FRAMEBUFFER, newFramebuffer);
 	}
 
-	m_stateStorage.emplace(std::move(newStateStorage));
+	m_stateFramebuffers.push_back(newFramebuffer);
 }
 
 void RendererOGL::popState() {
-	if(m_stateStorage.empty()) {
+	if(m_state.isStackEmpty()) {
 		log(LC_Critical, "RendererOGL::popState: GL State stack is empty.");
 		return;
 	}
 
-	StateStorage& lastState = m_stateStorage.top();
+	m_state.pop();
+
+	GLuint newFramebuffer = m_stateFramebuffers.back();
+	m_stateFramebuffers.pop_back();
+	if(newFramebuffer)
+		m_gl->glDeleteFramebuffers(1, &newFramebuffer);
+}
+
+GLStateCache::Counters const& RendererOGL::glStateCounters() const {
+	return m_state.counters();
+}
+
+void RendererOGL::setOcclusionCulling(bool enabled) {
+	if(enabled && !m_occlusionCulling)
+		resetOcclusionRecords();
+	m_occlusionCulling = enabled;
+}
+bool RendererOGL::occlusionCulling() const {
+	return m_occlusionCulling;
+}
+
+void RendererOGL::setOcclusionQueryInterval(std::uint32_t frames) {
+	m_occlusionQueryInterval = std::max<std::uint32_t>(frames, 1);
+}
+std::uint32_t RendererOGL::occlusionQueryInterval() const {
+	return m_occlusionQueryInterval;
+}
+
+RendererOGL::OcclusionStats const& RendererOGL::occlusionStats() const {
+	return m_occlusionStats;
+}
+
+RendererOGL::OcclusionRecord* RendererOGL::occlusionRecord(DrawInfo const& drawInfo) {
+	Scene const* scene = drawInfo.m_scene;
+	if(!m_occlusionPass || !scene || drawInfo.m_instance == Scene::NullInstance)
+		return nullptr;
+
+	Scene::InstanceHandle const instance = drawInfo.m_instance;
+	if(!std::isfinite(scene->instanceSphereRadius(instance)))
+		return nullptr;
+
+	// Depth of the nearest corner of the box
+	QVector3D const& boundsMin = scene->instanceBoundsMin(instance);
+	QVector3D const& boundsMax = scene->instanceBoundsMax(instance);
+	QVector3D const center     = (boundsMin + boundsMax) * 0.5f;
+	QVector3D const extents    = (boundsMax - boundsMin) * 0.5f;
+	float const reach          = std::abs(m_cameraForward.x()) * extents.x() + std::abs(m_cameraForward.y()) * extents.y() + std::abs(m_cameraForward.z()) * extents.z();
+	if(QVector3D::dotProduct(center - m_cameraPosition, m_cameraForward) - reach <= m_cameraNearPlane)
+		return nullptr;
+
+	// The first query of the new records is spread over the interval
+	if(instance.index >= m_occlusionRecords.size()) {
+		std::size_t const first = m_occlusionRecords.size();
+		m_occlusionRecords.resize(scene->instanceCapacity());
+		for(std::size_t i = first; i < m_occlusionRecords.size(); ++i)
+			m_occlusionRecords[i] = OcclusionRecord{ 0, m_occlusionFrame + static_cast<std::uint32_t>(i % m_occlusionQueryInterval), true, false };
+	}
+	return &m_occlusionRecords[instance.index];
+}
 
-	for(auto it = lastState.m_features.begin(); it != lastState.m_features.end(); ++it) {
-		if(it->second)
-			m_gl->glEnable(it->first);
-		else
-			m_gl->glDisable(it->first);
+void RendererOGL::resetOcclusionRecords() {
+	for(std::size_t i = 0; i < m_occlusionRecords.size(); ++i) {
+		OcclusionRecord& record = m_occlusionRecords[i];
+		record.m_nextQueryFrame = m_occlusionFrame + static_cast<std::uint32_t>(i % m_occlusionQueryInterval);
+		record.m_visible        = true;
+		record.m_pending        = false;
 	}
-	m_gl->glViewport(lastState.m_viewport[0], lastState.m_viewport[1], lastState.m_viewport[2], lastState.m_viewport[3]);
-	m_gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, lastState.m_readFramebuffer);
-	m_gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, lastState.m_drawFramebuffer);
+	m_pendingOcclusionQueries.clear();
+}
+
+void RendererOGL::readOcclusionQueries() {
+	std::size_t stillPending = 0;
+	for(Scene::InstanceHandle instance: m_pendingOcclusionQueries) {
+		OcclusionRecord& record = m_occlusionRecords[instance.index];
+
+		GLuint available = GL_FALSE;
+		m_gl->glGetQueryObjectuiv(record.m_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available) {
+			m_pendingOcclusionQueries[stillPending++] = instance;
+			continue;
+		}
+
+		GLuint anySamplesPassed = GL_FALSE;
+		m_gl->glGetQueryObjectuiv(record.m_query, GL_QUERY_RESULT, &anySamplesPassed);
+		record.m_pending = false;
+		record.m_visible = (anySamplesPassed != GL_FALSE);
+		if(record.m_visible)
+			record.m_nextQueryFrame = m_occlusionFrame + m_occlusionQueryInterval;
 
-	for(auto it = lastState.m_textureBindings.begin(); it != lastState.m_textureBindings.end(); ++it) {
-		m_gl->glBindTexture(it->first, it->second);
+		++m_occlusionStats.readResults;
+		m_occlusionStats.occludedResults += !record.m_visible;
 	}
+	m_pendingOcclusionQueries.resize(stillPending);
+}
 
-	m_gl->glActiveTexture(lastState.m_activeTexture);
-	m_gl->glDepthMask(lastState.m_depthMask);
-	m_gl->glUseProgram(lastState.m_program);
+void RendererOGL::beginOcclusionQuery(OcclusionRecord& record, Scene::InstanceHandle instance) {
+	if(!record.m_query)
+		m_gl->glGenQueries(1, &record.m_query);
 
-	if(lastState.m_newFramebuffer)
-		m_gl->glDeleteFramebuffers(1, &lastState.m_newFramebuffer);
+	m_gl->glBeginQuery(GL_ANY_SAMPLES_PASSED, record.m_query);
+	record.m_pending = true;
+	m_pendingOcclusionQueries.push_back(instance);
+}
 
-	m_stateStorage.pop();
+void RendererOGL::queryBoundingBox(OcclusionRecord& record, DrawInfo const& drawInfo) {
+	if(!m_boundingBoxMesh)
+		m_boundingBoxMesh = Mesh::standardMesh(Mesh::CubeIndexedMesh);
+	if(!m_depthMaterial)
+		m_depthMaterial = Material::standardMaterial(Material::DepthMaterial);
+
+	MeshCacheOGL* meshCache    = buildMeshCache(m_boundingBoxMesh);
+	MaterialCacheOGL* matCache = buildMaterialCache(m_depthMaterial);
+
+	m_state.setColorMask(false);
+	m_state.setDepthMask(false);
+	m_state.setDepthFunc(GL_LEQUAL);
+	m_state.setEnabled(GLStateCache::CullFace, false);
+	matCache->install(m_state);
+	bindTransforms(matCache, preparedTransforms(drawInfo).m_boundingBoxOffset, boundingBoxMatrix(drawInfo.m_scene, drawInfo.m_instance), drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+
+	beginOcclusionQuery(record, drawInfo.m_instance);
+	meshCache->render(m_gl, m_state);
+	m_gl->glEndQuery(GL_ANY_SAMPLES_PASSED);
+	++m_occlusionStats.boundingBoxQueries;
+
+	m_state.setColorMask(true);
+	m_state.setDepthMask(true);
+	m_state.setDepthFunc(GL_LESS);
 }
 
 void RendererOGL::Draw(Group* g, DrawInfo const& drawInfo) {
-	if(!g || g->renderOptions() & Group::Hidden)
+	if(g && g->renderOptions() & Group::Hidden)
 		return;
 
-	Mesh* mesh                  = g->mesh();
-	Material* mat               = g->material();
-	MaterialProperties* matProp = g->materialProperties();
+	Mesh* mesh                  = drawInfo.m_mesh;
+	Material* mat               = drawInfo.m_material;
+	MaterialProperties* matProp = drawInfo.m_materialProperties;
 	if(!mesh || !mat || !matProp)
 		return;
 
-	{
-		SceneUBO_Data newSceneData = m_sceneData;
-		if(m_closestSceneLightsBuffer.capacity() < LightCount)
-			m_closestSceneLightsBuffer.reserve(LightCount);
-
-		getClosestSceneLights(drawInfo.m_groupPosition, LightCount, m_closestSceneLightsBuffer);
-
-		std::size_t lightCount = std::min<std::size_t>(LightCount, m_closestSceneLightsBuffer.size());
-
-		for(std::size_t i = 0; i < lightCount; ++i) {
-			newSceneData.m_lightPos[i]   = QVector4D(m_closestSceneLightsBuffer[i].second.position, 0.f);
-			newSceneData.m_lightColor[i] = m_closestSceneLightsBuffer[i].second.color;
-		}
-		for(std::size_t i = lightCount; i < LightCount; ++i) {
-			newSceneData.m_lightColor[i] = QVector4D(0.f, 0.f, 0.f, 0.f);
-			newSceneData.m_lightPos[i]   = QVector4D(0.f, 0.f, 0.f, -1.f);
-		}
-
-		if(std::memcmp(&m_sceneData, &newSceneData, sizeof(m_sceneData))) {
-			std::memcpy(&m_sceneData, &newSceneData, sizeof(m_sceneData));
-			RefreshSceneUBO();
-		}
-	}
+	// An occluded group is queried on its bounding box again before its draw, which is conditioned on the last query issued:
+	// while a query of an earlier frame has no result on the CPU yet, the GPU has it, and it is at most a frame late.
+	OcclusionRecord* record = occlusionRecord(drawInfo);
+	bool const occluded     = record && !record->m_visible;
+	if(occluded && !record->m_pending)
+		queryBoundingBox(*record, drawInfo);
 
 	MeshCacheOGL* meshCache                  = buildMeshCache(mesh);
 	MaterialCacheOGL* matCache               = buildMaterialCache(mat);
@@ -146,52 +270,329 @@ void RendererOGL::Draw(Group* g, DrawInfo const& drawInfo) {
 	Mesh::RenderOptions meshRenderOptions    = mesh->renderOptions();
 	Material::RenderOptions matRenderOptions = mat->renderOptions();
 
-	if(meshRenderOptions & Mesh::DisableCulling || matRenderOptions & Material::Translucent || matProp->isTranslucent())
-		m_gl->glDisable(GL_CULL_FACE);
+	m_state.setEnabled(GLStateCache::CullFace, !(meshRenderOptions & Mesh::DisableCulling || matRenderOptions & Material::Translucent || matProp->isTranslucent()));
 
-	matCache->install(m_gl);
-	matPropCache->install(m_gl, matCache);
+	matCache->install(m_state);
+	matPropCache->install(m_state, matCache);
 	for(std::size_t i = 0; i < MaterialProperties::MaxTextures; ++i) {
 		Texture* t = matProp->texture(static_cast<MaterialProperties::TextureSlot>(i));
 		if(t) {
 			TextureCacheOGL* tCache = buildTextureCache(t);
-			tCache->applyToSlot(m_gl, static_cast<GLuint>(i));
+			tCache->applyToSlot(m_state, static_cast<GLuint>(i));
+		}
+		else if(i == MaterialProperties::BrdfTextureSlot)
+			m_state.bindTexture(MaterialProperties::BrdfTextureSlot, GL_TEXTURE_2D, getBrdfLUT());
+	}
+	bindLightClusters();
+
+	// After the depth pre-pass, only the nearest fragments pass: they are shaded once
+	if(m_depthPrePassDone) {
+		bool const prePassed = matRenderOptions & Material::DepthPrePassCompatible && !occluded;
+		m_state.setDepthMask(!prePassed);
+		m_state.setDepthFunc(prePassed ? GL_LEQUAL : GL_LESS);
+	}
+
+	bindTransforms(matCache, preparedTransforms(drawInfo).m_offset, drawInfo.m_modelMatrix, drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+	if(occluded) {
+		// The GPU waits for the box, the CPU does not
+		m_gl->glBeginConditionalRender(record->m_query, GL_QUERY_WAIT);
+		meshCache->render(m_gl, m_state, drawInfo.m_lodLevel);
+		m_gl->glEndConditionalRender();
+		++m_occlusionStats.conditionalDraws;
+	}
+	else if(record && !record->m_pending && m_occlusionFrame >= record->m_nextQueryFrame) {
+		beginOcclusionQuery(*record, drawInfo.m_instance);
+		meshCache->render(m_gl, m_state, drawInfo.m_lodLevel);
+		m_gl->glEndQuery(GL_ANY_SAMPLES_PASSED);
+		++m_occlusionStats.drawQueries;
+	}
+	else
+		meshCache->render(m_gl, m_state, drawInfo.m_lodLevel);
+}
+
+void RendererOGL::DrawDepth(Group* g, DrawInfo const& drawInfo) {
+	if(g && g->renderOptions() & Group::Hidden)
+		return;
+
+	Mesh* mesh    = drawInfo.m_mesh;
+	Material* mat = drawInfo.m_material;
+	if(!mesh || !mat || !(mat->renderOptions() & Material::DepthPrePassCompatible))
+		return;
+
+	// Occluded groups are left out, so that their bounding box is tested against the others only
+	OcclusionRecord const* record = occlusionRecord(drawInfo);
+	if(record && !record->m_visible)
+		return;
+
+	if(!m_depthMaterial)
+		m_depthMaterial = Material::standardMaterial(Material::DepthMaterial);
+
+	MeshCacheOGL* meshCache    = buildMeshCache(mesh);
+	MaterialCacheOGL* matCache = buildMaterialCache(m_depthMaterial);
+
+	m_state.setEnabled(GLStateCache::CullFace, !(mesh->renderOptions() & Mesh::DisableCulling));
+	matCache->install(m_state);
+
+	bindTransforms(matCache, preparedTransforms(drawInfo).m_depthOffset, drawInfo.m_modelMatrix, drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+	meshCache->render(m_gl, m_state, drawInfo.m_lodLevel);
+}
+
+void RendererOGL::uploadLightClusters() {
+	LightClusters const& clusters = lightClusters();
+
+	static GLenum const formats[ClusterBufferCount] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	void const* const data[ClusterBufferCount]      = { clusters.lights().data(), clusters.clusters().data(), clusters.lightIndices().data() };
+	GLsizeiptr const sizes[ClusterBufferCount]      = {
+		static_cast<GLsizeiptr>(clusters.lights().size() * sizeof(LightClusters::PackedLight)),
+		static_cast<GLsizeiptr>(clusters.clusters().size() * sizeof(LightClusters::Cluster)),
+		static_cast<GLsizeiptr>(clusters.lightIndices().size() * sizeof(std::uint32_t)),
+	};
+
+	for(GLuint i = 0; i < ClusterBufferCount; ++i) {
+		bool const created = !m_clusterBuffers[i];
+		if(created) {
+			m_gl->glGenBuffers(1, &m_clusterBuffers[i]);
+			m_gl->glGenTextures(1, &m_clusterTextures[i]);
+			if(!m_clusterBuffers[i] || !m_clusterTextures[i])
+				return;
+		}
+
+		// Never empty, so that the buffer textures can always be read
+		m_gl->glBindBuffer(GL_TEXTURE_BUFFER, m_clusterBuffers[i]);
+		m_gl->glBufferData(GL_TEXTURE_BUFFER, std::max<GLsizeiptr>(sizes[i], 16), nullptr, GL_STREAM_DRAW);
+		if(sizes[i])
+			m_gl->glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+
+		// The texture reads whatever storage the buffer has: attached once.
+		if(created) {
+			m_state.bindTexture(TU_ClusterLights + i, GL_TEXTURE_BUFFER, m_clusterTextures[i]);
+			m_gl->glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_clusterBuffers[i]);
 		}
-		else if(i == MaterialProperties::BrdfTextureSlot) {
-			m_gl->glActiveTexture(GL_TEXTURE0 + MaterialProperties::BrdfTextureSlot);
-			m_gl->glBindTexture(GL_TEXTURE_2D, getBrdfLUT());
+	}
+	m_gl->glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void RendererOGL::bindLightClusters() {
+	for(GLuint i = 0; i < ClusterBufferCount; ++i)
+		m_state.bindTexture(TU_ClusterLights + i, GL_TEXTURE_BUFFER, m_clusterTextures[i]);
+}
+
+void RendererOGL::beginTransformFrame() {
+	if(!m_transformRing) {
+		m_gl->glGenBuffers(1, &m_transformRing);
+		if(!m_transformRing)
+			return;
+
+		m_gl->glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_transformAlignment);
+		m_transformAlignment = std::max(m_transformAlignment, 1);
+
+		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_transformRing);
+		m_gl->glBufferData(GL_UNIFORM_BUFFER, m_transformSegmentSize * TransformRingSegments, nullptr, GL_STREAM_DRAW);
+		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	m_transformSegment = (m_transformSegment + 1) % TransformRingSegments;
+	m_transformOffset  = static_cast<GLintptr>(m_transformSegment) * m_transformSegmentSize;
+
+	GLsync& fence = m_transformFences[m_transformSegment];
+	if(fence) {
+		// Set TransformRingSegments - 1 frames ago: the GPU is usually done with it, and this does not wait.
+		GLenum result = m_gl->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while(result == GL_TIMEOUT_EXPIRED)
+			result = m_gl->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+
+		m_gl->glDeleteSync(fence);
+		fence = nullptr;
+	}
+}
+
+void RendererOGL::endTransformFrame() {
+	if(!m_transformRing)
+		return;
+
+	GLsync& fence = m_transformFences[m_transformSegment];
+	if(fence)
+		m_gl->glDeleteSync(fence);
+	fence = m_gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+GLintptr RendererOGL::allocateTransforms(GLsizeiptr size) {
+	GLintptr offset           = (m_transformOffset + m_transformAlignment - 1) / m_transformAlignment * m_transformAlignment;
+	GLintptr const segmentEnd = static_cast<GLintptr>(m_transformSegment + 1) * m_transformSegmentSize;
+
+	if(offset + size > segmentEnd) {
+		// Orphans the storage of the ring: the draws in flight keep the old one, no fence has to be waited on.
+		m_transformSegmentSize *= 2;
+		while(m_transformSegmentSize < size)
+			m_transformSegmentSize *= 2;
+
+		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_transformRing);
+		m_gl->glBufferData(GL_UNIFORM_BUFFER, m_transformSegmentSize * TransformRingSegments, nullptr, GL_STREAM_DRAW);
+		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		for(GLsync& fence: m_transformFences) {
+			if(fence) {
+				m_gl->glDeleteSync(fence);
+				fence = nullptr;
+			}
 		}
+
+		offset = static_cast<GLintptr>(m_transformSegment) * m_transformSegmentSize;
+		log(LC_Debug, QString("RendererOGL: transform ring grown to %1 bytes per frame.").arg(m_transformSegmentSize));
+	}
+
+	m_transformOffset = offset + size;
+	return offset;
+}
+
+void RendererOGL::bindTransforms(MaterialCacheOGL* matCache, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix) {
+	MaterialCacheOGL::TransformLayout const& layout = matCache->transformLayout();
+	if(layout.m_size <= 0 || !m_transformRing)
+		return;
+
+	GLintptr const offset = allocateTransforms(layout.m_size);
+
+	// The range was not used since the fence of the segment was signaled: the driver does not have to synchronize.
+	m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_transformRing);
+	char* data = static_cast<char*>(m_gl->glMapBufferRange(GL_UNIFORM_BUFFER, offset, layout.m_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if(!data) {
+		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		return;
 	}
 
-	meshCache->render(m_gl, drawInfo.m_modelMatrix, drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+	writeTransforms(data, layout, modelMatrix, viewMatrix, projMatrix);
+
+	m_gl->glUnmapBuffer(GL_UNIFORM_BUFFER);
+	m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	m_state.bindUniformBufferRange(RendererOGL::UBO_MeshBinding, m_transformRing, offset, layout.m_size);
+}
+
+void RendererOGL::bindTransforms(MaterialCacheOGL* matCache, GLintptr preparedOffset, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix) {
+	if(preparedOffset < 0)
+		bindTransforms(matCache, modelMatrix, viewMatrix, projMatrix);
+	else
+		m_state.bindUniformBufferRange(RendererOGL::UBO_MeshBinding, m_transformRing, preparedOffset, matCache->transformLayout().m_size);
+}
 
-	if(meshRenderOptions & Mesh::DisableCulling || matRenderOptions & Material::Translucent || matProp->isTranslucent())
-		m_gl->glEnable(GL_CULL_FACE);
+RendererOGL::DrawTransforms const& RendererOGL::preparedTransforms(DrawInfo const& drawInfo) const {
+	static DrawTransforms const none = { -1, -1, -1, nullptr };
+	return drawInfo.m_drawIndex < m_drawTransforms.size() ? m_drawTransforms[drawInfo.m_drawIndex] : none;
 }
 
-void RendererOGL::RefreshSceneUBO() {
-	if(!m_sceneUBO)
+void RendererOGL::PrepareDraws(DrawInfo const& frameInfo, bool depthPrePass) {
+	std::size_t const drawCount   = frameDrawCount();
+	std::size_t const opaqueCount = frameOpaqueDrawCount();
+	m_drawTransforms.assign(drawCount, DrawTransforms{ -1, -1, -1, nullptr });
+	if(!m_transformRing || !drawCount)
+		return;
+
+	if(!m_depthMaterial)
+		m_depthMaterial = Material::standardMaterial(Material::DepthMaterial);
+	MaterialCacheOGL* depthCache = buildMaterialCache(m_depthMaterial);
+
+	// The blocks are placed first, as the caches may have to be built: no GL call is made while the range is mapped
+	DrawInfo drawInfo = frameInfo;
+	GLsizeiptr size   = 0;
+
+	auto place = [&](MaterialCacheOGL const* matCache, GLintptr& offset) {
+		GLint const blockSize = matCache->transformLayout().m_size;
+		if(blockSize <= 0)
+			return;
+
+		offset = (size + m_transformAlignment - 1) / m_transformAlignment * m_transformAlignment;
+		size   = offset + blockSize;
+	};
+	for(std::size_t i = 0; i < drawCount; ++i) {
+		frameDrawInfo(i, drawInfo);
+		if(!drawInfo.m_mesh || !drawInfo.m_material || !drawInfo.m_materialProperties)
+			continue;
+
+		DrawTransforms& transforms = m_drawTransforms[i];
+		transforms.m_materialCache = buildMaterialCache(drawInfo.m_material);
+		place(transforms.m_materialCache, transforms.m_offset);
+		if(i >= opaqueCount)
+			continue;
+
+		// The blocks DrawDepth() and Draw() will bind
+		OcclusionRecord const* record = occlusionRecord(drawInfo);
+		bool const occluded           = record && !record->m_visible;
+		if(depthPrePass && !occluded && drawInfo.m_material->renderOptions() & Material::DepthPrePassCompatible)
+			place(depthCache, transforms.m_depthOffset);
+		if(occluded && !record->m_pending)
+			place(depthCache, transforms.m_boundingBoxOffset);
+	}
+	if(!size)
+		return;
+
+	// One range for the whole frame, in the segment no draw in flight reads
+	GLintptr const base = allocateTransforms(size);
+	m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_transformRing);
+	char* data = static_cast<char*>(m_gl->glMapBufferRange(GL_UNIFORM_BUFFER, base, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if(!data) {
+		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		m_drawTransforms.assign(drawCount, DrawTransforms{ -1, -1, -1, nullptr });
 		return;
-	m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_sceneUBO);
-	m_gl->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(m_sceneData), &m_sceneData);
+	}
+
+	MaterialCacheOGL::TransformLayout const& depthLayout = depthCache->transformLayout();
+	for(std::size_t i = 0; i < drawCount; ++i) {
+		DrawTransforms& transforms = m_drawTransforms[i];
+		if(!transforms.m_materialCache)
+			continue;
+
+		frameDrawInfo(i, drawInfo);
+		if(transforms.m_offset >= 0) {
+			writeTransforms(data + transforms.m_offset, transforms.m_materialCache->transformLayout(), drawInfo.m_modelMatrix, drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+			transforms.m_offset += base;
+		}
+		if(transforms.m_depthOffset >= 0) {
+			writeTransforms(data + transforms.m_depthOffset, depthLayout, drawInfo.m_modelMatrix, drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+			transforms.m_depthOffset += base;
+		}
+		if(transforms.m_boundingBoxOffset >= 0) {
+			writeTransforms(data + transforms.m_boundingBoxOffset, depthLayout, boundingBoxMatrix(drawInfo.m_scene, drawInfo.m_instance), drawInfo.m_viewMatrix, drawInfo.m_projMatrix);
+			transforms.m_boundingBoxOffset += base;
+		}
+	}
+
+	m_gl->glUnmapBuffer(GL_UNIFORM_BUFFER);
 	m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void RendererOGL::BeginDrawing(Camera const& cam, Scene const* scene) {
 	Renderer::BeginDrawing(cam, scene);
 
+	// Other code may have used the context since the last frame
+	m_state.sync();
+	m_state.resetCounters();
+
+	beginTransformFrame();
 	genBrdfLUT();
 
-	m_gl->glDisable(GL_BLEND);
-	m_gl->glEnable(GL_MULTISAMPLE);
-	m_gl->glEnable(GL_CULL_FACE);
-	m_gl->glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+	m_state.setEnabled(GLStateCache::Blend, false);
+	m_state.setEnabled(GLStateCache::Multisample, true);
+	m_state.setEnabled(GLStateCache::CullFace, true);
+	m_state.setEnabled(GLStateCache::CubemapSeamless, true);
 	m_gl->glClearColor(0.f, 0.f, 0.f, 0.f);
 	m_gl->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	m_skyboxView = cam.getView();
 	m_skyboxProj = cam.getProjection();
 
+	m_occlusionStats = OcclusionStats();
+	if(m_occlusionCulling) {
+		if(scene != m_occlusionScene)
+			resetOcclusionRecords();
+		m_occlusionScene = scene;
+
+		++m_occlusionFrame;
+		m_cameraPosition  = cam.position();
+		m_cameraForward   = cam.forward();
+		m_cameraNearPlane = cam.nearPlane();
+		readOcclusionQueries();
+	}
+
 	if(!m_sceneUBO) {
 		m_gl->glGenBuffers(1, &m_sceneUBO);
 
@@ -201,21 +602,39 @@ void RendererOGL::BeginDrawing(Camera const& cam, Scene const* scene) {
 		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_sceneUBO);
 		m_gl->glBufferData(GL_UNIFORM_BUFFER, sizeof(m_sceneData), nullptr, GL_DYNAMIC_DRAW);
 		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		// Uploaded below, whatever it was before
+		m_sceneData = SceneUBO_Data();
 	}
 
-	QVector4D const newCamPos = QVector4D(cam.position());
-	if(m_sceneData.m_cameraPos != newCamPos) {
-		m_sceneData.m_cameraPos = newCamPos;
+	LightClusters const& clusters = lightClusters();
+	SceneUBO_Data newSceneData    = SceneUBO_Data();
+	newSceneData.m_cameraPos      = QVector4D(cam.position());
+	newSceneData.m_cameraForward  = QVector4D(cam.forward());
+	newSceneData.m_clusterGrid[0] = LightClusters::GridWidth;
+	newSceneData.m_clusterGrid[1] = LightClusters::GridHeight;
+	newSceneData.m_clusterGrid[2] = LightClusters::GridDepth;
+	newSceneData.m_clusterGrid[3] = clusters.isOrthogonal() ? 1 : 0;
+	newSceneData.m_clusterDepth   = QVector4D(clusters.depthScale(), clusters.depthBias(), 0.f, 0.f);
+	if(std::memcmp(&m_sceneData, &newSceneData, sizeof(m_sceneData))) {
+		std::memcpy(&m_sceneData, &newSceneData, sizeof(m_sceneData));
 		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, m_sceneUBO);
-		m_gl->glBufferSubData(GL_UNIFORM_BUFFER, offsetof(SceneUBO_Data, m_cameraPos), sizeof(m_sceneData.m_cameraPos), &m_sceneData.m_cameraPos);
+		m_gl->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(m_sceneData), &m_sceneData);
 		m_gl->glBindBuffer(GL_UNIFORM_BUFFER, 0);
 	}
 
-	m_gl->glBindBufferBase(GL_UNIFORM_BUFFER, RendererOGL::UBO_SceneBinding, m_sceneUBO);
+	m_state.bindUniformBuffer(RendererOGL::UBO_SceneBinding, m_sceneUBO);
+	uploadLightClusters();
 }
 
 void RendererOGL::EndDrawing(Scene const* scene) {
 	Renderer::EndDrawing(scene);
+
+	// The vertex arrays stay bound between draws
+	m_state.bindVertexArray(0);
+	m_drawTransforms.clear();
+
+	endTransformFrame();
 }
 
 void RendererOGL::BeginOpaque() {
@@ -233,30 +652,47 @@ void RendererOGL::BeginOpaque() {
 		MaterialCacheOGL* matCache = buildMaterialCache(m_skyboxMaterial);
 		CubemapCacheOGL* ccCache   = buildCubemapCache(c);
 
-		m_gl->glDepthMask(GL_FALSE);
-		m_gl->glDisable(GL_CULL_FACE);
-		matCache->install(m_gl);
-		ccCache->applyToSlot(m_gl, static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot), -1, -1);
-		meshCache->render(m_gl, QMatrix4x4(), m_skyboxView, m_skyboxProj);
-		m_gl->glEnable(GL_CULL_FACE);
-		m_gl->glDepthMask(GL_TRUE);
+		m_state.setDepthMask(false);
+		m_state.setEnabled(GLStateCache::CullFace, false);
+		matCache->install(m_state);
+		ccCache->applyToSlot(m_state, static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot), -1, -1);
+		bindTransforms(matCache, QMatrix4x4(), m_skyboxView, m_skyboxProj);
+		meshCache->render(m_gl, m_state);
+		m_state.setEnabled(GLStateCache::CullFace, true);
+		m_state.setDepthMask(true);
 
-		ccCache->applyToSlot(m_gl, -1, static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot), static_cast<GLuint>(MaterialProperties::PrefilterTextureSlot));
+		ccCache->applyToSlot(m_state, -1, static_cast<GLuint>(MaterialProperties::EnvironmentTextureSlot), static_cast<GLuint>(MaterialProperties::PrefilterTextureSlot));
 	}
 
-	m_gl->glEnable(GL_DEPTH_TEST);
-	m_gl->glDepthFunc(GL_LESS);
+	m_state.setEnabled(GLStateCache::DepthTest, true);
+	m_state.setDepthFunc(GL_LESS);
+	m_occlusionPass = m_occlusionCulling;
+}
+void RendererOGL::EndOpaque() {
+	m_occlusionPass    = false;
+	m_depthPrePassDone = false;
+	m_state.setDepthMask(true);
+	m_state.setDepthFunc(GL_LESS);
+}
+
+void RendererOGL::BeginDepthPrePass() {
+	m_state.setColorMask(false);
+	m_state.setDepthMask(true);
+	m_state.setDepthFunc(GL_LESS);
+}
+void RendererOGL::EndDepthPrePass() {
+	m_state.setColorMask(true);
+	m_depthPrePassDone = true;
 }
-void RendererOGL::EndOpaque() {}
 
 void RendererOGL::BeginTranslucent() {
-	m_gl->glDepthMask(GL_FALSE);
-	m_gl->glEnable(GL_BLEND);
-	m_gl->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	m_state.setDepthMask(false);
+	m_state.setEnabled(GLStateCache::Blend, true);
+	m_state.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 void RendererOGL::EndTranslucent() {
-	m_gl->glDepthMask(GL_TRUE);
-	m_gl->glDisable(GL_BLEND);
+	m_state.setDepthMask(true);
+	m_state.setEnabled(GLStateCache::Blend, false);
 }
 
 class ContextSwitcher : public NonCopyable {
@@ -291,7 +727,11 @@ void RendererOGL::Delete(MeshCache* meshCache) {
 	ContextSwitcher switcher(m_context);
 	Q_UNUSED(switcher);
 
+	releaseCache(m_meshCacheSlots, meshCache->mesh(), meshCache);
 	delete meshCache;
+
+	// The names of deleted objects may be reused
+	m_state.invalidateBindings();
 }
 
 void RendererOGL::Delete(MaterialCache* matCache) {
@@ -303,7 +743,10 @@ void RendererOGL::Delete(MaterialCache* matCache) {
 	ContextSwitcher switcher(m_context);
 	Q_UNUSED(switcher);
 
+	releaseCache(m_materialCacheSlots, matCache->material(), matCache);
 	delete matCache;
+
+	m_state.invalidateBindings();
 }
 
 void RendererOGL::Delete(MaterialPropertiesCache* matPropCache) {
@@ -315,7 +758,10 @@ void RendererOGL::Delete(MaterialPropertiesCache* matPropCache) {
 	ContextSwitcher switcher(m_context);
 	Q_UNUSED(switcher);
 
+	releaseCache(m_materialPropertiesCacheSlots, matPropCache->materialProperties(), matPropCache);
 	delete matPropCache;
+
+	m_state.invalidateBindings();
 }
 
 void RendererOGL::Delete(TextureCache* texCache) {
@@ -327,7 +773,10 @@ void RendererOGL::Delete(TextureCache* texCache) {
 	ContextSwitcher switcher(m_context);
 	Q_UNUSED(switcher);
 
+	releaseCache(m_textureCacheSlots, texCache->texture(), texCache);
 	delete texCache;
+
+	m_state.invalidateBindings();
 }
 
 void RendererOGL::Delete(CubemapCache* cubemapCache) {
@@ -339,7 +788,10 @@ void RendererOGL::Delete(CubemapCache* cubemapCache) {
 	ContextSwitcher switcher(m_context);
 	Q_UNUSED(switcher);
 
+	releaseCache(m_cubemapCacheSlots, cubemapCache->cubemap(), cubemapCache);
 	delete cubemapCache;
+
+	m_state.invalidateBindings();
 }
 
 void RendererOGL::DeleteAllResources() {
@@ -352,18 +804,56 @@ void RendererOGL::DeleteAllResources() {
 	Q_UNUSED(switcher);
 
 	Renderer::runDeleteOnAllResources();
+	m_meshCacheSlots.clear();
+	m_materialCacheSlots.clear();
+	m_materialPropertiesCacheSlots.clear();
+	m_textureCacheSlots.clear();
+	m_cubemapCacheSlots.clear();
 
 	if(m_sceneUBO) {
 		m_gl->glDeleteBuffers(1, &m_sceneUBO);
 		m_sceneUBO = 0;
 	}
 
+	for(GLuint i = 0; i < ClusterBufferCount; ++i) {
+		if(m_clusterTextures[i]) {
+			m_gl->glDeleteTextures(1, &m_clusterTextures[i]);
+			m_clusterTextures[i] = 0;
+		}
+		if(m_clusterBuffers[i]) {
+			m_gl->glDeleteBuffers(1, &m_clusterBuffers[i]);
+			m_clusterBuffers[i] = 0;
+		}
+	}
+
 	if(m_brdfLUT) {
 		m_gl->glDeleteTextures(1, &m_brdfLUT);
 		m_brdfLUT = 0;
 	}
 
+	for(OcclusionRecord& record: m_occlusionRecords) {
+		if(record.m_query)
+			m_gl->glDeleteQueries(1, &record.m_query);
+	}
+	m_occlusionRecords.clear();
+	m_pendingOcclusionQueries.clear();
+	m_occlusionScene = nullptr;
+
+	for(GLsync& fence: m_transformFences) {
+		if(fence) {
+			m_gl->glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	if(m_transformRing) {
+		m_gl->glDeleteBuffers(1, &m_transformRing);
+		m_transformRing = 0;
+	}
+	m_transformSegmentSize = TransformSegmentBaseSize;
+
 	m_brdfCalculated = false;
+	m_state.invalidateBindings();
 }
 
 void RendererOGL::PreLoadEntity(Entity* e) {
@@ -417,22 +907,23 @@ void RendererOGL::genBrdfLUT() {
 	MaterialCacheOGL* matCache = buildMaterialCache(brdfMat);
 
 	static QSize const brdfLutSize(512, 512);
-	m_gl->glBindTexture(GL_TEXTURE_2D, texSlot);
+	m_state.bindTexture(GL_TEXTURE_2D, texSlot);
 	m_gl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, brdfLutSize.width(), brdfLutSize.height(), 0, GL_RG, GL_FLOAT, 0);
 	m_gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	m_gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	m_gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	m_gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	m_gl->glViewport(0, 0, brdfLutSize.width(), brdfLutSize.height());
-	m_gl->glDisable(GL_DEPTH_TEST);
-	m_gl->glDisable(GL_CULL_FACE);
+	m_state.setViewport(0, 0, brdfLutSize.width(), brdfLutSize.height());
+	m_state.setEnabled(GLStateCache::DepthTest, false);
+	m_state.setEnabled(GLStateCache::CullFace, false);
 
 	m_gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_brdfLUT, 0);
 	m_gl->glClear(GL_COLOR_BUFFER_BIT);
 
-	matCache->install(m_gl);
-	meshCache->render(m_gl, QMatrix4x4(), QMatrix4x4(), QMatrix4x4());
+	matCache->install(m_state);
+	bindTransforms(matCache, QMatrix4x4(), QMatrix4x4(), QMatrix4x4());
+	meshCache->render(m_gl, m_state);
 	popState();
 
 	m_brdfCalculated = true;
@@ -446,62 +937,87 @@ GLuint RendererOGL::getBrdfLUT() {
 }
 
 MeshCacheOGL* RendererOGL::buildMeshCache(Mesh* mesh) {
-	std::pair<MeshCacheOGL*, bool> mc = mesh->getOrEmplaceMeshCache<MeshCacheOGL>(rendererID());
-
-	if(mc.first->isDirty())
-		mc.first->update(this, m_gl);
+	MeshCacheOGL* cache = findCache(m_meshCacheSlots, mesh->handle());
+	if(!cache) {
+		std::pair<MeshCacheOGL*, bool> mc = mesh->getOrEmplaceMeshCache<MeshCacheOGL>(rendererID());
+		if(mc.second)
+			addToMeshCaches(mc.first);
+
+		cache = mc.first;
+		storeCache(m_meshCacheSlots, mesh->handle(), cache);
+	}
 
-	if(mc.second)
-		addToMeshCaches(mc.first);
+	if(cache->isDirty())
+		updateCache(cache);
 
-	return mc.first;
+	return cache;
 }
 
 MaterialCacheOGL* RendererOGL::buildMaterialCache(Material* material) {
-	std::pair<MaterialCacheOGL*, bool> mc = material->getOrEmplaceMaterialCache<MaterialCacheOGL>(rendererID());
-
-	if(mc.first->isDirty())
-		mc.first->update(this, m_gl);
+	MaterialCacheOGL* cache = findCache(m_materialCacheSlots, material->handle());
+	if(!cache) {
+		std::pair<MaterialCacheOGL*, bool> mc = material->getOrEmplaceMaterialCache<MaterialCacheOGL>(rendererID());
+		if(mc.second)
+			addToMaterialCaches(mc.first);
+
+		cache = mc.first;
+		storeCache(m_materialCacheSlots, material->handle(), cache);
+	}
 
-	if(mc.second)
-		addToMaterialCaches(mc.first);
+	if(cache->isDirty())
+		updateCache(cache);
 
-	return mc.first;
+	return cache;
 }
 MaterialPropertiesCacheOGL* RendererOGL::buildMaterialPropertiesCache(MaterialProperties* materialProperties) {
-	std::pair<MaterialPropertiesCacheOGL*, bool> mc = materialProperties->getOrEmplaceMaterialPropertiesCache<MaterialPropertiesCacheOGL>(rendererID());
-
-	if(mc.first->isDirty())
-		mc.first->update(this, m_gl);
+	MaterialPropertiesCacheOGL* cache = findCache(m_materialPropertiesCacheSlots, materialProperties->handle());
+	if(!cache) {
+		std::pair<MaterialPropertiesCacheOGL*, bool> mc = materialProperties->getOrEmplaceMaterialPropertiesCache<MaterialPropertiesCacheOGL>(rendererID());
+		if(mc.second)
+			addToMaterialPropertiesCaches(mc.first);
+
+		cache = mc.first;
+		storeCache(m_materialPropertiesCacheSlots, materialProperties->handle(), cache);
+	}
 
-	if(mc.second)
-		addToMaterialPropertiesCaches(mc.first);
+	if(cache->isDirty())
+		updateCache(cache);
 
-	return mc.first;
+	return cache;
 }
 
 TextureCacheOGL* RendererOGL::buildTextureCache(Texture* texture) {
-	std::pair<TextureCacheOGL*, bool> tc = texture->getOrEmplaceTextureCache<TextureCacheOGL>(rendererID());
-
-	if(tc.first->isDirty())
-		tc.first->update(this, m_gl);
+	TextureCacheOGL* cache = findCache(m_textureCacheSlots, texture->handle());
+	if(!cache) {
+		std::pair<TextureCacheOGL*, bool> tc = texture->getOrEmplaceTextureCache<TextureCacheOGL>(rendererID());
+		if(tc.second)
+			addToTextureCaches(tc.first);
+
+		cache = tc.first;
+		storeCache(m_textureCacheSlots, texture->handle(), cache);
+	}
 
-	if(tc.second)
-		addToTextureCaches(tc.first);
+	if(cache->isDirty())
+		updateCache(cache);
 
-	return tc.first;
+	return cache;
 }
 
 CubemapCacheOGL* RendererOGL::buildCubemapCache(Cubemap* cubemap) {
-	std::pair<CubemapCacheOGL*, bool> cc = cubemap->getOrEmplaceCubemapCache<CubemapCacheOGL>(rendererID());
-
-	if(cc.first->isDirty())
-		cc.first->update(this, m_gl);
+	CubemapCacheOGL* cache = findCache(m_cubemapCacheSlots, cubemap->handle());
+	if(!cache) {
+		std::pair<CubemapCacheOGL*, bool> cc = cubemap->getOrEmplaceCubemapCache<CubemapCacheOGL>(rendererID());
+		if(cc.second)
+			addToCubemapCaches(cc.first);
+
+		cache = cc.first;
+		storeCache(m_cubemapCacheSlots, cubemap->handle(), cache);
+	}
 
-	if(cc.second)
-		addToCubemapCaches(cc.first);
+	if(cache->isDirty())
+		updateCache(cache);
 
-	return cc.first;
+	return cache;
 }
 
 }
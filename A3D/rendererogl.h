@@ -8,8 +8,8 @@
 #include "A3D/materialpropertiescacheogl.h"
 #include "A3D/texturecacheogl.h"
 #include "A3D/cubemapcacheogl.h"
+#include "A3D/glstatecache.h"
 #include <queue>
-#include <stack>
 
 namespace A3D {
 
@@ -21,10 +21,18 @@ public:
 		UBO_SceneBinding              = 2,
 	};
 
+	// Texture units of the light cluster buffers, after those of the material properties
+	enum ClusterTextureUnits {
+		TU_ClusterLights       = MaterialProperties::MaxTextures,
+		TU_ClusterRecords      = MaterialProperties::MaxTextures + 1,
+		TU_ClusterLightIndices = MaterialProperties::MaxTextures + 2,
+	};
+
 	RendererOGL(QOpenGLContext*, CoreGLFunctions*);
 	~RendererOGL();
 
 	virtual void Draw(Group*, DrawInfo const&) override;
+	virtual void DrawDepth(Group*, DrawInfo const&) override;
 	virtual void PreLoadEntity(Entity*) override;
 	virtual void Delete(MeshCache*) override;
 	virtual void Delete(MaterialCache*) override;
@@ -33,12 +41,49 @@ public:
 	virtual void Delete(CubemapCache*) override;
 	virtual void DeleteAllResources() override;
 
+	// State changes sent to and skipped by the state cache since the current (or last) frame began.
+	GLStateCache::Counters const& glStateCounters() const;
+
+	// Occlusion culling of the opaque draws with GL_ANY_SAMPLES_PASSED queries, off by default.
+	// The results are read one frame late, when the GPU has them: the CPU never waits.
+	// A group found visible is assumed to stay visible for occlusionQueryInterval() frames, then queried with its own draw.
+	// A group found occluded is queried every frame on its bounding box, and drawn under conditional rendering of that query:
+	// the GPU skips it while its box is hidden, and draws it in the frame it appears. While the CPU has no result of the last query
+	// yet, no other is issued, and the draw is conditioned on that one: it is at most a frame late.
+	// A query only sees the depth of what was drawn before it: the culling works best with the depth pre-pass, or with FrontToBack sorting.
+	void setOcclusionCulling(bool);
+	bool occlusionCulling() const;
+
+	// Defaults to 8 frames.
+	void setOcclusionQueryInterval(std::uint32_t frames);
+	std::uint32_t occlusionQueryInterval() const;
+
+	// Counters of the current (or last) frame
+	struct OcclusionStats {
+		// Queries issued with the draw of a visible group, and on the bounding box of an occluded one
+		std::size_t drawQueries;
+		std::size_t boundingBoxQueries;
+
+		// Draws under conditional rendering
+		std::size_t conditionalDraws;
+
+		// Results read at the beginning of the frame, and how many of them found their group occluded
+		std::size_t readResults;
+		std::size_t occludedResults;
+	};
+	OcclusionStats const& occlusionStats() const;
+
 protected:
 	virtual void BeginDrawing(Camera const&, Scene const*) override;
 	virtual void EndDrawing(Scene const*) override;
 
 	virtual void BeginOpaque() override;
 	virtual void EndOpaque() override;
+
+	// Writes the MeshUBO_Data blocks of every draw of the frame in one mapping of the ring: the draws then only bind theirs.
+	virtual void PrepareDraws(DrawInfo const& frameInfo, bool depthPrePass) override;
+	virtual void BeginDepthPrePass() override;
+	virtual void EndDepthPrePass() override;
 	virtual void BeginTranslucent() override;
 	virtual void EndTranslucent() override;
 
@@ -49,29 +94,75 @@ private:
 	friend class TextureCacheOGL;
 	friend class CubemapCacheOGL;
 
+	// Saves the state in m_state, and binds a new framebuffer if withFramebuffer is true.
 	void pushState(bool withFramebuffer);
 	void popState();
 
-	struct StateStorage {
-		GLint m_viewport[4];
-		std::map<GLenum, GLboolean> m_features;
-		std::map<GLenum, GLint> m_textureBindings;
-		GLenum m_activeTexture;
-		GLint m_drawFramebuffer;
-		GLint m_readFramebuffer;
-		GLint m_program;
-		GLboolean m_depthMask;
-
-		GLuint m_newFramebuffer;
+	// Rebuilds a dirty cache: the update binds through Qt and raw GL calls, so the bindings m_state knows are forgotten afterwards.
+	template <typename T>
+	inline void updateCache(T* cache) {
+		m_state.bindVertexArray(0);
+		cache->update(this, m_gl);
+		m_state.invalidateBindings();
+	}
+
+	// The MeshUBO_Data blocks of the draws are written one after the other in a ring buffer, split in a segment per frame in flight.
+	// A segment is written again once the fence of the frame that used it last is signaled.
+	enum {
+		TransformRingSegments    = 3,
+		TransformSegmentBaseSize = 64 * 1024,
 	};
 
-	std::stack<StateStorage> m_stateStorage;
+	void beginTransformFrame();
+	void endTransformFrame();
 
-	enum {
-		LightCount = 4
+	// Offset of size free bytes in the segment of the frame, grown when it is full.
+	GLintptr allocateTransforms(GLsizeiptr size);
+
+	// Writes the matrices the program of the material declares, and binds them to UBO_MeshBinding.
+	void bindTransforms(MaterialCacheOGL*, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix);
+
+	// Binds the block PrepareDraws() wrote at preparedOffset instead, when it wrote one (not -1).
+	void bindTransforms(MaterialCacheOGL*, GLintptr preparedOffset, QMatrix4x4 const& modelMatrix, QMatrix4x4 const& viewMatrix, QMatrix4x4 const& projMatrix);
+
+	// Blocks PrepareDraws() wrote for a draw of the frame, as offsets in the ring (-1 when none): for Draw(), DrawDepth(),
+	// and the bounding box query of an occluded group. The material cache is the one of the Draw() block.
+	struct DrawTransforms {
+		GLintptr m_offset;
+		GLintptr m_depthOffset;
+		GLintptr m_boundingBoxOffset;
+		MaterialCacheOGL const* m_materialCache;
 	};
+	DrawTransforms const& preparedTransforms(DrawInfo const&) const;
+
+	// Occlusion state of an instance of the scene, at the index of its handle. New instances are assumed visible.
+	struct OcclusionRecord {
+		GLuint m_query;
+		std::uint32_t m_nextQueryFrame;
+		bool m_visible;
+
+		// The query was issued, its result was not read yet
+		bool m_pending;
+	};
+
+	// Record of an opaque draw, null when the draw is not occlusion culled: occlusion culling is off,
+	// the instance has no bounds, or its bounding box reaches the near plane (the clipped box could be hidden while the group is not).
+	OcclusionRecord* occlusionRecord(DrawInfo const&);
+
+	// Forgets the results, e.g. when another scene is drawn
+	void resetOcclusionRecords();
+
+	// Reads the results the GPU already has
+	void readOcclusionQueries();
+
+	// Issues the query of the record on the bounding box of the instance, without writing color or depth.
+	void queryBoundingBox(OcclusionRecord&, DrawInfo const&);
+	void beginOcclusionQuery(OcclusionRecord&, Scene::InstanceHandle);
+
+	// Writes lightClusters() to the texture buffers, one per array, orphaning their storage every frame.
+	void uploadLightClusters();
+	void bindLightClusters();
 
-	void RefreshSceneUBO();
 	void DrawOpaque(Entity* root, QMatrix4x4 const& parentMatrix, QMatrix4x4 const& projMatrix, QMatrix4x4 const& viewMatrix, std::deque<Entity*>* translucentList);
 	void DrawTranslucent(std::deque<Entity*>& entities, QMatrix4x4 const& parentMatrix, QMatrix4x4 const& projMatrix, QMatrix4x4 const& viewMatrix);
 
@@ -81,6 +172,39 @@ private:
 	TextureCacheOGL* buildTextureCache(Texture*);
 	CubemapCacheOGL* buildCubemapCache(Cubemap*);
 
+	// Cache of a resource for this renderer, at the index of its handle.
+	// A slot of another generation was filled for a resource that has been destroyed since.
+	template <typename T>
+	struct CacheSlot {
+		std::uint32_t generation;
+		T* cache;
+	};
+
+	template <typename T>
+	static inline T* findCache(std::vector<CacheSlot<T>> const& cacheSlots, ResourceHandle handle) {
+		if(handle.index >= cacheSlots.size())
+			return nullptr;
+		CacheSlot<T> const& slot = cacheSlots[handle.index];
+		return slot.generation == handle.generation ? slot.cache : nullptr;
+	}
+
+	template <typename T>
+	static void storeCache(std::vector<CacheSlot<T>>& cacheSlots, ResourceHandle handle, T* cache) {
+		if(handle.index >= cacheSlots.size())
+			cacheSlots.resize(handle.index + 1, CacheSlot<T>{ 0, nullptr });
+		cacheSlots[handle.index] = CacheSlot<T>{ handle.generation, cache };
+	}
+
+	// Empties the slot of a cache about to be deleted, so that its resource, still alive, does not find it again
+	template <typename T, typename U>
+	static void releaseCache(std::vector<CacheSlot<T>>& cacheSlots, Resource const* resource, U const* cache) {
+		if(!resource)
+			return;
+		ResourceHandle const handle = resource->handle();
+		if(handle.index < cacheSlots.size() && static_cast<U const*>(cacheSlots[handle.index].cache) == cache)
+			cacheSlots[handle.index] = CacheSlot<T>{ 0, nullptr };
+	}
+
 	// Will draw on screen for one frame!
 	// Should be called when a framebuffer is active, and you have to assume that the framebuffer
 	// will be dirty afterwards.
@@ -91,8 +215,18 @@ private:
 
 	QPointer<QOpenGLContext> m_context;
 	CoreGLFunctions* m_gl;
+	GLStateCache m_state;
+
+	// Framebuffer created by each pushState(), 0 when none was
+	std::vector<GLuint> m_stateFramebuffers;
+
 	std::vector<Entity*> m_translucentEntityBuffer;
-	std::vector<std::pair<std::size_t, PointLightInfo>> m_closestSceneLightsBuffer;
+
+	std::vector<CacheSlot<MeshCacheOGL>> m_meshCacheSlots;
+	std::vector<CacheSlot<MaterialCacheOGL>> m_materialCacheSlots;
+	std::vector<CacheSlot<MaterialPropertiesCacheOGL>> m_materialPropertiesCacheSlots;
+	std::vector<CacheSlot<TextureCacheOGL>> m_textureCacheSlots;
+	std::vector<CacheSlot<CubemapCacheOGL>> m_cubemapCacheSlots;
 
 
 	// Skybox data
@@ -101,15 +235,56 @@ private:
 	QMatrix4x4 m_skyboxView;
 	QMatrix4x4 m_skyboxProj;
 
+	// Depth pre-pass: the opaque draws that follow it test against the depth it wrote, without writing it again
+	A3D::Material* m_depthMaterial;
+	bool m_depthPrePassDone;
+
+	// Occlusion culling. The bounding boxes are drawn with the cube mesh and the depth material.
+	bool m_occlusionCulling;
+	std::uint32_t m_occlusionQueryInterval;
+	std::uint32_t m_occlusionFrame;
+	bool m_occlusionPass;
+	Scene const* m_occlusionScene;
+	QVector3D m_cameraPosition;
+	QVector3D m_cameraForward;
+	float m_cameraNearPlane;
+	A3D::Mesh* m_boundingBoxMesh;
+	std::vector<OcclusionRecord> m_occlusionRecords;
+	std::vector<Scene::InstanceHandle> m_pendingOcclusionQueries;
+	OcclusionStats m_occlusionStats;
+
 	struct SceneUBO_Data {
 		QVector4D m_cameraPos;
+		QVector4D m_cameraForward;
+
+		// Width, height and depth of the light cluster grid, then 1 for orthogonal projections
+		std::int32_t m_clusterGrid[4];
 
-		QVector4D m_lightPos[4];
-		QVector4D m_lightColor[4];
+		// LightClusters::depthScale() and depthBias()
+		QVector4D m_clusterDepth;
 	};
 	SceneUBO_Data m_sceneData;
 	GLuint m_sceneUBO;
 
+	// Lights, clusters and light indices of the light clusters, and the buffer textures reading them
+	enum {
+		ClusterLightsBuffer,
+		ClusterRecordsBuffer,
+		ClusterLightIndicesBuffer,
+
+		ClusterBufferCount,
+	};
+	GLuint m_clusterBuffers[ClusterBufferCount];
+	GLuint m_clusterTextures[ClusterBufferCount];
+
+	GLuint m_transformRing;
+	GLsizeiptr m_transformSegmentSize;
+	GLint m_transformAlignment;
+	std::size_t m_transformSegment;
+	GLintptr m_transformOffset;
+	GLsync m_transformFences[TransformRingSegments];
+	std::vector<DrawTransforms> m_drawTransforms;
+
 	bool m_brdfCalculated;
 	GLuint m_brdfLUT;
 };
@@ -1,10 +1,55 @@
 #include "A3D/resource.h"
+#include <mutex>
 
 namespace A3D {
 
+namespace {
+
+// Generation of every handle index, and the indices of destroyed resources
+struct HandleAllocator {
+	std::mutex mutex;
+	std::vector<std::uint32_t> generations;
+	std::vector<std::uint32_t> freeIndices;
+};
+
+// Never destroyed, as static resources may outlive it
+HandleAllocator& handleAllocator() {
+	static HandleAllocator* allocator = new HandleAllocator();
+	return *allocator;
+}
+
+ResourceHandle allocateHandle() {
+	HandleAllocator& allocator = handleAllocator();
+	std::lock_guard<std::mutex> lock(allocator.mutex);
+
+	if(!allocator.freeIndices.empty()) {
+		std::uint32_t const index = allocator.freeIndices.back();
+		allocator.freeIndices.pop_back();
+		return ResourceHandle{ index, allocator.generations[index] };
+	}
+
+	allocator.generations.push_back(0);
+	return ResourceHandle{ static_cast<std::uint32_t>(allocator.generations.size() - 1), 0 };
+}
+
+void releaseHandle(ResourceHandle handle) {
+	HandleAllocator& allocator = handleAllocator();
+	std::lock_guard<std::mutex> lock(allocator.mutex);
+
+	++allocator.generations[handle.index];
+	allocator.freeIndices.push_back(handle.index);
+}
+
+}
+
 Resource::Resource(ResourceManager* resourceManager)
 	: QObject{ resourceManager },
-	  m_resourceManager(resourceManager) {}
+	  m_resourceManager(resourceManager),
+	  m_handle(allocateHandle()) {}
+
+Resource::~Resource() {
+	releaseHandle(m_handle);
+}
 
 ResourceManager* Resource::resourceManager() const {
 	return m_resourceManager;
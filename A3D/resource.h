@@ -7,15 +7,26 @@
 
 namespace A3D {
 
+// Identifies a live resource, for renderers to find its cache by indexing an array.
+// Indices are reused once a resource is destroyed, with the next generation: a handle with an older generation is stale.
+struct ResourceHandle {
+	std::uint32_t index;
+	std::uint32_t generation;
+};
+
 class Resource : public QObject {
 	Q_OBJECT
 public:
 	explicit Resource(ResourceManager*);
+	~Resource();
 
 	ResourceManager* resourceManager() const;
 
+	inline ResourceHandle handle() const { return m_handle; }
+
 private:
 	ResourceManager* m_resourceManager;
+	ResourceHandle m_handle;
 };
 
 }
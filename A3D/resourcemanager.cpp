@@ -3,15 +3,45 @@
 #include "A3D/material.h"
 #include "A3D/texture.h"
 #include "A3D/model.h"
+#include "A3D/modelimport.h"
+#include "A3D/modelloadtask.h"
 
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QCryptographicHash>
+#include <QThreadPool>
+#include <QRunnable>
 
 namespace A3D {
 
+namespace {
+
+class LoadRunnable : public QRunnable {
+public:
+	explicit LoadRunnable(std::function<void()> fn)
+		: m_fn(std::move(fn)) {}
+	void run() override { m_fn(); }
+
+private:
+	std::function<void()> m_fn;
+};
+
+}
+
 ResourceManager::ResourceManager(QObject* parent)
-	: QObject{ parent } {}
+	: QObject{ parent },
+	  m_importMemoryLimit(0),
+	  m_lodTriangleRatios(Mesh::defaultLodTriangleRatios()),
+	  m_loadThreadPool(new QThreadPool(this)) {}
+
+ResourceManager::~ResourceManager() {
+	// The workers use this object: stop them before any member goes away.
+	QList<ModelLoadTask*> const tasks = findChildren<ModelLoadTask*>();
+	for(auto it = tasks.begin(); it != tasks.end(); ++it)
+		(*it)->cancel();
+	m_loadThreadPool->waitForDone();
+}
 
 Model* ResourceManager::getLoadedModel(QString const& name) const {
 	auto it = m_models.find(name);
@@ -113,6 +143,24 @@ QString ResourceManager::locateFile(OpenFileResult const& parent, QString const&
 	return QFileInfo::exists(rv) ? rv : QString();
 }
 
+QByteArray ResourceManager::mapFile(OpenFileResult const& ofr) const {
+	if(!ofr.stream)
+		return QByteArray();
+
+	if(QFileDevice* fd = qobject_cast<QFileDevice*>(ofr.stream.get())) {
+		qint64 const size = fd->size();
+		if(size > 0 && size <= static_cast<qint64>(std::numeric_limits<decltype(QByteArray().size())>::max())) {
+			if(uchar* data = fd->map(0, size))
+				return QByteArray::fromRawData(reinterpret_cast<char const*>(data), static_cast<decltype(QByteArray().size())>(size));
+		}
+	}
+
+	// Make sure the whole file is returned even if it has been read before.
+	if(!ofr.stream->isSequential())
+		ofr.stream->seek(0);
+	return ofr.stream->readAll();
+}
+
 ResourceManager::OpenFileResult ResourceManager::openFile(QString name, QString const& path) const {
 	OpenFileResult r;
 	r.name = std::move(name);
@@ -151,27 +199,301 @@ ResourceManager::OpenFileResult ResourceManager::openFile(OpenFileResult const&
 	return r;
 }
 
-Model* ResourceManager::loadModel(QString name, QString const& path, InputFormat fmt) {
-	OpenFileResult ofr = openFile(name, path);
+ResourceManager::ImportSettings ResourceManager::importSettings(LoadOptions options) const {
+	return ImportSettings{ options, m_modelCacheDirectory, m_importMemoryLimit, m_lodTriangleRatios };
+}
+
+bool ResourceManager::importModel(OpenFileResult ofr, InputFormat fmt, ImportSettings const& settings, ModelImport& out, ImportProgress const& progress) const {
 	if(!ofr.stream)
-		return nullptr;
+		return false;
 
 	if(fmt == IF_AutoDetect) {
-		int lastDot = path.lastIndexOf('.');
+		int lastDot = ofr.uri.lastIndexOf('.');
 		if(lastDot < 0)
-			return nullptr;
-		QString extension = path.mid(lastDot + 1).toLower();
+			return false;
+		QString extension = ofr.uri.mid(lastDot + 1).toLower();
 
 		if(extension == "obj")
 			fmt = IF_OBJ;
+		else if(extension == "gltf" || extension == "glb")
+			fmt = IF_GLTF;
+	}
+
+	// glTF buffers are already binary and are used in place: there is nothing to gain from the cache.
+	QString const cachePath = (fmt == IF_GLTF) ? QString() : modelCachePath(settings, ofr);
+
+	ModelCacheKey cacheKey;
+	if(!cachePath.isEmpty()) {
+		cacheKey = modelCacheKey(ofr);
+		if(readModelCache(ofr, cacheKey, cachePath, out))
+			return true;
+
+		// The source is about to be consumed by the importer.
+		if(cacheKey.sourceHash.isEmpty())
+			cacheKey.sourceHash = QCryptographicHash::hash(mapFile(ofr), QCryptographicHash::Md5);
 	}
 
+	bool imported = false;
 	switch(fmt) {
 	case IF_OBJ:
-		return loadModel_OBJ(std::move(ofr));
+		if(settings.options & StreamingLoad)
+			imported = importModel_OBJStreaming(std::move(ofr), settings, out, progress);
+		else
+			imported = importModel_OBJ(std::move(ofr), settings, out, progress);
+		break;
+	case IF_GLTF:
+		imported = importModel_GLTF(std::move(ofr), settings, out, progress);
+		break;
+	default:
+		break;
+	}
+
+	// Before the cache is written, so that the levels are only built once.
+	if(imported && (settings.options & GenerateLods)) {
+		auto generateLods = [&out, &settings](std::size_t groupIndex) {
+			ModelImport::Group& group = out.groups[groupIndex];
+			if(group.drawMode != Mesh::IndexedTriangles)
+				return;
+
+			if(group.packed.vertexData)
+				group.lods = Mesh::generateLods(Mesh::unpackVertices(group.packed, group.contents), Mesh::unpackIndices(group.packed), group.contents, settings.lodTriangleRatios);
+			else
+				group.lods = Mesh::generateLods(group.vertices, group.indices, group.contents, settings.lodTriangleRatios);
+
+			for(auto it = group.lods.begin(); it != group.lods.end(); ++it)
+				log(LC_Debug, QString("Group %1: LOD with %2 triangles, error %3").arg(group.name).arg(it->indices.size() / 3).arg(it->error));
+		};
+
+		// A streaming import expands a single group at a time.
+		if(settings.options & StreamingLoad) {
+			for(std::size_t i = 0; i < out.groups.size(); ++i)
+				generateLods(i);
+		}
+		else
+			parallelFor(out.groups.size(), generateLods);
+	}
+
+	if(imported && !cachePath.isEmpty())
+		writeModelCache(cacheKey, cachePath, out);
+
+	return imported;
+}
+
+Model* ResourceManager::buildModel(ModelImport& import, ModelLoadTask* task) {
+	std::unique_ptr<Model> newModel = std::make_unique<Model>(this);
+
+	for(auto it = import.groups.begin(); it != import.groups.end(); ++it) {
+		ModelImport::Group& group = *it;
+		Group* newGroup           = newModel->addGroup(group.name);
+		newGroup->setPosition(group.position);
+		newGroup->setRotation(group.rotation);
+		newGroup->setScale(group.scale);
+
+		for(auto propIt = group.properties.begin(); propIt != group.properties.end(); ++propIt)
+			newGroup->setProperty(propIt->first.constData(), propIt->second);
+
+		MaterialProperties* matProp = new MaterialProperties(this);
+		newGroup->setMaterialProperties(matProp);
+		newGroup->setMaterial(Material::standardMaterial(Material::PBRMaterial));
+
+		// Candidate images of each slot, in the order they were referenced
+		std::map<MaterialProperties::TextureSlot, std::vector<ModelImport::TextureRef const*>> slotCandidates;
+		for(auto texIt = group.textures.begin(); texIt != group.textures.end(); ++texIt)
+			slotCandidates[texIt->slot].push_back(&*texIt);
+
+		for(auto slotIt = slotCandidates.begin(); slotIt != slotCandidates.end(); ++slotIt) {
+			std::vector<QString> candidates;
+			bool waiting = false;
+			Texture* t   = nullptr;
+
+			for(auto refIt = slotIt->second.begin(); refIt != slotIt->second.end(); ++refIt) {
+				ModelImport::TextureRef const& ref = **refIt;
+				candidates.push_back(ref.name);
+
+				Texture* loaded = getLoadedTexture(ref.name);
+				if(!loaded && task) {
+					waiting = true;
+					task->m_pendingTextures.emplace(ref.name, ref);
+					continue;
+				}
+				if(!loaded) {
+					Image const i = ref.decode();
+					if(!i.isNull())
+						loaded = registerTexture(ref.name, new Texture(i, this));
+				}
+
+				if(loaded)
+					t = loaded;
+			}
+
+			if(waiting) {
+				task->m_pendingSlots.push_back(ModelLoadTask::PendingSlot{ matProp, slotIt->first, std::move(candidates) });
+				t = Texture::standardTexture(Texture::MissingTexture);
+			}
+
+			if(t)
+				matProp->setTexture(t, slotIt->first);
+		}
+
+		Mesh* mesh = new Mesh(this);
+		mesh->setDrawMode(group.drawMode);
+		mesh->setRenderOptions(group.renderOptions);
+		if(group.packed.vertexData)
+			mesh->setPackedBuffers(group.contents, std::move(group.packed));
+		else {
+			mesh->setContents(group.contents);
+			mesh->vertices() = std::move(group.vertices);
+			mesh->indices()  = std::move(group.indices);
+		}
+		mesh->setLods(std::move(group.lods));
+
+		this->registerMesh(import.uri + "/" + group.name, mesh);
+		newGroup->setMesh(mesh);
 	}
 
-	return nullptr;
+	this->registerModel(import.name, newModel.get());
+	return newModel.release();
+}
+
+Model* ResourceManager::loadModel(QString name, QString const& path, InputFormat fmt, LoadOptions options) {
+	ModelImport import;
+	if(!importModel(openFile(std::move(name), path), fmt, importSettings(options), import))
+		return nullptr;
+
+	return buildModel(import);
+}
+
+ModelLoadTask* ResourceManager::loadModelAsync(QString name, QString const& path, InputFormat fmt, LoadOptions options) {
+	ModelLoadTask* task = new ModelLoadTask(this);
+
+	// The workers only hold the shared state and a guarded pointer to the task,
+	// and post everything else back to this thread.
+	std::shared_ptr<ModelLoadTask::SharedState> shared = task->m_shared;
+	QPointer<ModelLoadTask> taskPtr(task);
+	ImportSettings const settings = importSettings(options);
+
+	m_loadThreadPool->start(new LoadRunnable([this, shared, taskPtr, name, path, fmt, settings]() {
+		std::shared_ptr<ModelImport> import = std::make_shared<ModelImport>();
+
+		auto progress = [this, shared, taskPtr](float p) -> bool {
+			QMetaObject::invokeMethod(
+				this,
+				[taskPtr, p]() {
+					if(taskPtr)
+						taskPtr->setProgress(p * ModelLoadTask::ImportProgressWeight);
+				},
+				Qt::QueuedConnection);
+			return !shared->cancelled;
+		};
+
+		bool const imported = !shared->cancelled && importModel(openFile(name, path), fmt, settings, *import, progress);
+
+		QMetaObject::invokeMethod(
+			this,
+			[this, taskPtr, import, imported]() {
+				ModelLoadTask* task = taskPtr;
+				if(!task || task->isDone())
+					return;
+				if(!imported) {
+					task->finish(ModelLoadTask::Failed);
+					return;
+				}
+
+				task->m_model = buildModel(*import, task);
+				task->m_state = ModelLoadTask::LoadingTextures;
+				task->setProgress(ModelLoadTask::ImportProgressWeight);
+				emit task->modelReady(task->m_model);
+
+				// The model may have been dropped by a connected slot.
+				if(task->isDone())
+					return;
+
+				task->m_textureCount = task->m_pendingTextures.size();
+				if(task->m_pendingTextures.empty()) {
+					task->finish(ModelLoadTask::Finished);
+					return;
+				}
+
+				std::shared_ptr<ModelLoadTask::SharedState> shared = task->m_shared;
+				for(auto it = task->m_pendingTextures.begin(); it != task->m_pendingTextures.end(); ++it) {
+					ModelImport::TextureRef const ref = it->second;
+					m_loadThreadPool->start(new LoadRunnable([this, shared, taskPtr, ref]() {
+						if(shared->cancelled)
+							return;
+
+						Image const image = ref.decode();
+						QMetaObject::invokeMethod(
+							this,
+							[this, taskPtr, name = ref.name, image]() {
+								if(taskPtr)
+									textureDecoded(taskPtr, name, image);
+							},
+							Qt::QueuedConnection);
+					}));
+				}
+			},
+			Qt::QueuedConnection);
+	}));
+
+	return task;
+}
+
+void ResourceManager::textureDecoded(ModelLoadTask* task, QString const& name, Image const& image) {
+	if(task->isDone() || !task->m_pendingTextures.erase(name))
+		return;
+
+	// Another load may have registered the same image in the meantime.
+	if(!getLoadedTexture(name) && !image.isNull())
+		registerTexture(name, new Texture(image, this));
+
+	for(auto it = task->m_pendingSlots.begin(); it != task->m_pendingSlots.end();) {
+		ModelLoadTask::PendingSlot const& pending = *it;
+
+		bool ready = true;
+		Texture* t = nullptr;
+		for(auto nameIt = pending.candidates.begin(); nameIt != pending.candidates.end(); ++nameIt) {
+			if(task->m_pendingTextures.count(*nameIt))
+				ready = false;
+			else if(Texture* loaded = getLoadedTexture(*nameIt))
+				t = loaded;
+		}
+
+		if(!ready) {
+			++it;
+			continue;
+		}
+
+		if(pending.materialProperties)
+			pending.materialProperties->setTexture(t, pending.slot);
+		it = task->m_pendingSlots.erase(it);
+	}
+
+	std::size_t const decoded = task->m_textureCount - task->m_pendingTextures.size();
+	task->setProgress(ModelLoadTask::ImportProgressWeight + (1.f - ModelLoadTask::ImportProgressWeight) * static_cast<float>(decoded) / static_cast<float>(task->m_textureCount));
+
+	if(task->m_pendingTextures.empty())
+		task->finish(ModelLoadTask::Finished);
+}
+
+void ResourceManager::setModelCacheDirectory(QString const& path) {
+	m_modelCacheDirectory = path;
+}
+QString const& ResourceManager::modelCacheDirectory() const {
+	return m_modelCacheDirectory;
+}
+
+void ResourceManager::setImportMemoryLimit(qint64 bytes) {
+	m_importMemoryLimit = bytes;
+}
+qint64 ResourceManager::importMemoryLimit() const {
+	return m_importMemoryLimit;
+}
+
+void ResourceManager::setLodTriangleRatios(std::vector<float> const& ratios) {
+	m_lodTriangleRatios = ratios;
+}
+std::vector<float> const& ResourceManager::lodTriangleRatios() const {
+	return m_lodTriangleRatios;
 }
 
 }
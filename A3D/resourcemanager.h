@@ -4,6 +4,8 @@
 #include "A3D/common.h"
 #include <QObject>
 
+QT_FORWARD_DECLARE_CLASS(QThreadPool)
+
 namespace A3D {
 
 class Texture;
@@ -11,6 +13,9 @@ class Mesh;
 class Material;
 class Model;
 class Cubemap;
+class ModelLoadTask;
+class Image;
+struct ModelImport;
 
 class ResourceManager : public QObject {
 	Q_OBJECT
@@ -18,8 +23,36 @@ public:
 	enum InputFormat {
 		IF_AutoDetect,
 		IF_OBJ,
+
+		// glTF 2.0, either .gltf (JSON, with external or embedded buffers) or binary .glb
+		IF_GLTF,
 	};
+
+	enum LoadOption {
+		NoLoadOptions = 0x0,
+
+		// Parse the file and build the meshes on the global QThreadPool.
+		// The resulting Model is identical to the one produced by a serial load.
+		ParallelLoad = 0x1,
+
+		// Bounded-memory import for very large files: faces are welded as they are read,
+		// and each group is packed as soon as its last face has been read.
+		// Packed groups go to a temporary file once importMemoryLimit() is exceeded.
+		// The file is read twice and the import is serial (ParallelLoad is ignored).
+		StreamingLoad = 0x2,
+
+		// Reorders the triangles and vertices of the imported meshes for the GPU caches (see Mesh::optimizeVertexCache).
+		// Meshes that are used in place from a glTF file are left as they are.
+		OptimizeMeshes = 0x4,
+
+		// Builds the levels of detail of the imported meshes (see Mesh::generateLods), at lodTriangleRatios().
+		// Groups are simplified in parallel, or one at a time under StreamingLoad. Cached models keep their levels.
+		GenerateLods = 0x8,
+	};
+	Q_DECLARE_FLAGS(LoadOptions, LoadOption)
+
 	explicit ResourceManager(QObject* parent = nullptr);
+	~ResourceManager();
 
 	Model* getLoadedModel(QString const& name) const;
 	Mesh* getLoadedMesh(QString const& name) const;
@@ -39,7 +72,28 @@ public:
 	QStringList registeredTextures() const;
 	QStringList registeredCubemap() const;
 
-	Model* loadModel(QString name, QString const& path, InputFormat fmt = IF_AutoDetect);
+	Model* loadModel(QString name, QString const& path, InputFormat fmt = IF_AutoDetect, LoadOptions options = NoLoadOptions);
+
+	// Reads and parses the file, then decodes its textures, on worker threads.
+	// The Model is published on this ResourceManager's thread as soon as its geometry is ready;
+	// texture slots show Texture::standardTexture(MissingTexture) until their image has been decoded.
+	// The returned task is owned by this ResourceManager. Deleting it cancels the load.
+	ModelLoadTask* loadModelAsync(QString name, QString const& path, InputFormat fmt = IF_AutoDetect, LoadOptions options = NoLoadOptions);
+
+	// Directory where imported models are stored in a binary, memory-mappable format.
+	// Later loads of the same (unchanged) source file are served from there.
+	// Empty (the default) disables the cache.
+	void setModelCacheDirectory(QString const& path);
+	QString const& modelCacheDirectory() const;
+
+	// Memory, in bytes, a StreamingLoad may use before it starts spilling packed groups to disk.
+	// 0 (the default) means no limit.
+	void setImportMemoryLimit(qint64 bytes);
+	qint64 importMemoryLimit() const;
+
+	// Triangle ratios of the levels GenerateLods builds, from the most detailed one. Defaults to Mesh::defaultLodTriangleRatios().
+	void setLodTriangleRatios(std::vector<float> const& ratios);
+	std::vector<float> const& lodTriangleRatios() const;
 
 private:
 	struct OpenFileResult {
@@ -53,15 +107,69 @@ private:
 	OpenFileResult openFile(OpenFileResult const& parent, QString const& relativePath) const;
 	QString locateFile(OpenFileResult const& parent, QString const& relativePath) const;
 
-	Model* loadModel_OBJ(OpenFileResult);
+	// Returns the whole contents of the file.
+	// When the device supports it the file is memory-mapped and the returned array does not own its data:
+	// it is only valid for as long as the OpenFileResult's stream is alive.
+	QByteArray mapFile(OpenFileResult const&) const;
+
+	// Copy of the settings an import uses, so that it does not read members from a worker thread.
+	struct ImportSettings {
+		LoadOptions options;
+		QString cacheDirectory;
+		qint64 memoryLimit;
+		std::vector<float> lodTriangleRatios;
+	};
+	ImportSettings importSettings(LoadOptions) const;
+
+	// Reports the import progress in [0, 1]. Returning false cancels the import.
+	// It may be called from several threads at once.
+	using ImportProgress = std::function<bool(float)>;
+
+	// The import functions only fill a ModelImport and do not touch the registered resources,
+	// so they can run on any thread.
+	bool importModel(OpenFileResult, InputFormat, ImportSettings const&, ModelImport&, ImportProgress const& = ImportProgress()) const;
+	bool importModel_OBJ(OpenFileResult, ImportSettings const&, ModelImport&, ImportProgress const&) const;
+	bool importModel_OBJStreaming(OpenFileResult, ImportSettings const&, ModelImport&, ImportProgress const&) const;
+	bool importModel_GLTF(OpenFileResult, ImportSettings const&, ModelImport&, ImportProgress const&) const;
+
+	// Reads the MTL files an OBJ refers to and adds the textures of each group's "obj_Material".
+	void importMaterials_MTL(OpenFileResult const& obj, QStringList const& materialFiles, ModelImport&) const;
+
+	// Creates and registers the Model. Textures that are not loaded yet are decoded right away,
+	// or left to the task (with a placeholder in their slot) when one is given.
+	Model* buildModel(ModelImport&, ModelLoadTask* = nullptr);
+
+	void textureDecoded(ModelLoadTask*, QString const& name, Image const& image);
+
+	// Identifies the version of a source file a model cache was built from.
+	// The content hash is only computed when the size and modification time are not enough.
+	struct ModelCacheKey {
+		qint64 sourceSize;
+		qint64 sourceModified;
+		QByteArray sourceHash;
+	};
+
+	static QString modelCachePath(ImportSettings const&, OpenFileResult const&);
+	static ModelCacheKey modelCacheKey(OpenFileResult const&);
+	bool readModelCache(OpenFileResult const&, ModelCacheKey&, QString const& cachePath, ModelImport&) const;
+	bool writeModelCache(ModelCacheKey const&, QString const& cachePath, ModelImport const&) const;
 
 	std::map<QString, QPointer<Model>> m_models;
 	std::map<QString, QPointer<Mesh>> m_meshes;
 	std::map<QString, QPointer<Material>> m_materials;
 	std::map<QString, QPointer<Texture>> m_textures;
 	std::map<QString, QPointer<Cubemap>> m_cubemap;
+
+	QString m_modelCacheDirectory;
+	qint64 m_importMemoryLimit;
+	std::vector<float> m_lodTriangleRatios;
+
+	// Runs the asynchronous loads; waited for on destruction.
+	QThreadPool* m_loadThreadPool;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(ResourceManager::LoadOptions)
+
 }
 
 #endif // A3DRESOURCEMANAGER_H
@@ -0,0 +1,405 @@
+#include "A3D/resourcemanager.h"
+#include "A3D/modelimport.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <cstring>
+
+namespace A3D {
+
+namespace {
+
+// Model cache file layout, all integers in native byte order:
+//   ModelCacheHeader
+//   groupCount group records (see writeModelCache)
+//   vertex and index buffers, 16-byte aligned, at record offsets relative to ModelCacheHeader::dataOffset
+char const ModelCacheMagic[4]         = { 'A', '3', 'D', 'M' };
+std::uint32_t const ModelCacheVersion = 2;
+std::size_t const ModelCacheAlignment = 16;
+
+struct ModelCacheHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t vertexSize; // sizeof(Mesh::Vertex) guards against layout changes
+	std::uint32_t groupCount;
+	std::int64_t sourceSize;
+	std::int64_t sourceModified;
+	std::uint8_t sourceHash[16];
+	std::uint64_t dataOffset;
+};
+
+class ModelCacheWriter {
+public:
+	template <typename T>
+	void write(T const& value) {
+		m_data.append(reinterpret_cast<char const*>(&value), static_cast<int>(sizeof(value)));
+	}
+	void writeString(QString const& str) {
+		QByteArray const utf8 = str.toUtf8();
+		write(static_cast<std::uint32_t>(utf8.size()));
+		m_data.append(utf8);
+	}
+	void align() {
+		while(static_cast<std::size_t>(m_data.size()) % ModelCacheAlignment)
+			m_data.append("\0", 1);
+	}
+
+	std::size_t size() const { return static_cast<std::size_t>(m_data.size()); }
+	QByteArray const& data() const { return m_data; }
+
+private:
+	QByteArray m_data;
+};
+
+// Bounds-checked reader over the mapped file.
+// Any read past the end turns the reader invalid, and all the following reads fail.
+class ModelCacheReader {
+public:
+	ModelCacheReader(std::uint8_t const* begin, std::uint8_t const* end)
+		: m_ptr(begin),
+		  m_end(end) {}
+
+	template <typename T>
+	bool read(T& value) {
+		if(!m_ptr || static_cast<std::size_t>(m_end - m_ptr) < sizeof(value))
+			return fail();
+		std::memcpy(&value, m_ptr, sizeof(value));
+		m_ptr += sizeof(value);
+		return true;
+	}
+	bool readString(QString& str) {
+		std::uint32_t len = 0;
+		if(!read(len) || static_cast<std::size_t>(m_end - m_ptr) < len)
+			return fail();
+		str = QString::fromUtf8(reinterpret_cast<char const*>(m_ptr), static_cast<int>(len));
+		m_ptr += len;
+		return true;
+	}
+
+	bool isValid() const { return m_ptr != nullptr; }
+
+private:
+	bool fail() {
+		m_ptr = nullptr;
+		return false;
+	}
+
+	std::uint8_t const* m_ptr;
+	std::uint8_t const* m_end;
+};
+
+}
+
+QString ResourceManager::modelCachePath(ImportSettings const& settings, OpenFileResult const& ofr) {
+	if(settings.cacheDirectory.isEmpty() || ofr.uri.isEmpty())
+		return QString();
+
+	// Imports with a different mesh processing are cached separately.
+	QString variant = ofr.uri;
+	if(settings.options & OptimizeMeshes)
+		variant += "|optimized";
+	if(settings.options & GenerateLods) {
+		variant += "|lods";
+		for(auto it = settings.lodTriangleRatios.begin(); it != settings.lodTriangleRatios.end(); ++it)
+			variant += ":" + QString::number(*it);
+	}
+
+	QByteArray const name = QCryptographicHash::hash(variant.toUtf8(), QCryptographicHash::Md5).toHex();
+	return settings.cacheDirectory + QDir::separator() + QString::fromLatin1(name) + ".a3dm";
+}
+
+ResourceManager::ModelCacheKey ResourceManager::modelCacheKey(OpenFileResult const& ofr) {
+	QFileInfo fi(ofr.uri);
+
+	ModelCacheKey key;
+	key.sourceSize     = fi.size();
+	key.sourceModified = fi.lastModified().toMSecsSinceEpoch();
+	return key;
+}
+
+bool ResourceManager::readModelCache(OpenFileResult const& ofr, ModelCacheKey& key, QString const& cachePath, ModelImport& out) const {
+	// The file stays mapped for as long as any of the meshes refers to it.
+	std::shared_ptr<QFile> file = std::make_shared<QFile>(cachePath);
+	if(!file->open(QFile::ReadOnly))
+		return false;
+
+	qint64 const fileSize = file->size();
+	if(fileSize < static_cast<qint64>(sizeof(ModelCacheHeader)))
+		return false;
+
+	std::uint8_t const* const fileBegin = file->map(0, fileSize);
+	if(!fileBegin)
+		return false;
+	std::uint8_t const* const fileEnd = fileBegin + fileSize;
+
+	ModelCacheReader reader(fileBegin, fileEnd);
+	ModelCacheHeader header;
+	reader.read(header);
+
+	if(std::memcmp(header.magic, ModelCacheMagic, sizeof(ModelCacheMagic)) != 0 || header.version != ModelCacheVersion || header.vertexSize != sizeof(Mesh::Vertex))
+		return false;
+	if(header.sourceSize != key.sourceSize || header.dataOffset > static_cast<std::uint64_t>(fileSize))
+		return false;
+
+	// Same size but touched since: only reuse the cache if the contents did not change.
+	if(header.sourceModified != key.sourceModified) {
+		if(key.sourceHash.isEmpty())
+			key.sourceHash = QCryptographicHash::hash(mapFile(ofr), QCryptographicHash::Md5);
+		if(key.sourceHash.size() != static_cast<int>(sizeof(header.sourceHash)) || std::memcmp(key.sourceHash.constData(), header.sourceHash, sizeof(header.sourceHash)) != 0)
+			return false;
+	}
+
+	std::uint8_t const* const dataBegin = fileBegin + header.dataOffset;
+	std::size_t const dataSize          = static_cast<std::size_t>(fileEnd - dataBegin);
+
+	ModelImport result;
+	result.name = ofr.name;
+	result.uri  = ofr.uri;
+	result.groups.resize(header.groupCount);
+
+	for(auto it = result.groups.begin(); it != result.groups.end(); ++it) {
+		ModelImport::Group& group = *it;
+		reader.readString(group.name);
+
+		std::uint32_t propertyCount = 0;
+		reader.read(propertyCount);
+		for(std::uint32_t i = 0; i < propertyCount && reader.isValid(); ++i) {
+			QString name, value;
+			reader.readString(name);
+			reader.readString(value);
+			group.properties[name.toUtf8()] = value;
+		}
+
+		std::uint32_t textureCount = 0;
+		reader.read(textureCount);
+		for(std::uint32_t i = 0; i < textureCount && reader.isValid(); ++i) {
+			std::uint32_t slot = 0;
+			QString path;
+			reader.read(slot);
+			reader.readString(path);
+			if(slot < MaterialProperties::MaxTextures)
+				group.textures.push_back(ModelImport::TextureRef{ static_cast<MaterialProperties::TextureSlot>(slot), path, path, QByteArray(), ModelImport::TextureRef::AllChannels });
+		}
+
+		std::uint32_t contents = 0, drawMode = 0, renderOptions = 0, indexSize = 0;
+		std::uint64_t vertexCount = 0, vertexOffset = 0, indexCount = 0, indexOffset = 0;
+		reader.read(contents);
+		reader.read(drawMode);
+		reader.read(renderOptions);
+		reader.read(indexSize);
+		reader.read(vertexCount);
+		reader.read(vertexOffset);
+		reader.read(indexCount);
+		reader.read(indexOffset);
+
+		if(!reader.isValid() || drawMode > Mesh::IndexedTriangleStrips || (indexSize != 1 && indexSize != 2 && indexSize != 4))
+			return false;
+
+		group.contents      = Mesh::Contents(QFlag(static_cast<int>(contents)));
+		group.drawMode      = static_cast<Mesh::DrawMode>(drawMode);
+		group.renderOptions = Mesh::RenderOptions(QFlag(static_cast<int>(renderOptions)));
+		group.position      = QVector3D();
+		group.rotation      = QQuaternion();
+		group.scale         = QVector3D(1.f, 1.f, 1.f);
+
+		std::uint64_t const vertexBytes = vertexCount * Mesh::packedVertexSize(group.contents);
+		std::uint64_t const indexBytes  = indexCount * indexSize;
+		if(vertexOffset > dataSize || vertexBytes > dataSize - vertexOffset || indexOffset > dataSize || indexBytes > dataSize - indexOffset)
+			return false;
+
+		group.packed.storage     = file;
+		group.packed.vertexData  = dataBegin + vertexOffset;
+		group.packed.vertexCount = static_cast<std::size_t>(vertexCount);
+		group.packed.indexData   = dataBegin + indexOffset;
+		group.packed.indexCount  = static_cast<std::size_t>(indexCount);
+		group.packed.indexSize   = indexSize;
+
+		// Levels of detail are small next to the group: they are copied out of the file.
+		std::uint32_t lodCount = 0;
+		reader.read(lodCount);
+		for(std::uint32_t i = 0; i < lodCount && reader.isValid(); ++i) {
+			float error                 = 0.f;
+			std::uint64_t lodIndexCount = 0, lodIndexOffset = 0;
+			reader.read(error);
+			reader.read(lodIndexCount);
+			reader.read(lodIndexOffset);
+			if(lodIndexOffset > dataSize || lodIndexCount * indexSize > dataSize - lodIndexOffset)
+				return false;
+
+			Mesh::PackedBuffers const lodIndices{ nullptr, nullptr, 0, dataBegin + lodIndexOffset, static_cast<std::size_t>(lodIndexCount), indexSize };
+			group.lods.push_back(Mesh::Lod{ error, Mesh::unpackIndices(lodIndices) });
+		}
+	}
+
+	if(!reader.isValid())
+		return false;
+
+	// This may run on a worker thread, while the meshes holding the file belong to this one.
+	file->moveToThread(thread());
+
+	log(LC_Debug, "Model loaded from cache: " + cachePath);
+	out = std::move(result);
+	return true;
+}
+
+bool ResourceManager::writeModelCache(ModelCacheKey const& key, QString const& cachePath, ModelImport const& import) const {
+	if(key.sourceHash.size() != static_cast<int>(sizeof(ModelCacheHeader().sourceHash)))
+		return false;
+
+	ModelCacheHeader header;
+	std::memcpy(header.magic, ModelCacheMagic, sizeof(ModelCacheMagic));
+	header.version        = ModelCacheVersion;
+	header.vertexSize     = static_cast<std::uint32_t>(sizeof(Mesh::Vertex));
+	header.groupCount     = static_cast<std::uint32_t>(import.groups.size());
+	header.sourceSize     = key.sourceSize;
+	header.sourceModified = key.sourceModified;
+	header.dataOffset     = 0;
+	std::memcpy(header.sourceHash, key.sourceHash.constData(), sizeof(header.sourceHash));
+
+	auto alignedSize = [](std::uint64_t size) -> std::uint64_t {
+		return (size + ModelCacheAlignment - 1) & ~static_cast<std::uint64_t>(ModelCacheAlignment - 1);
+	};
+
+	// The records are written first, so the buffer offsets are computed up front
+	// and the buffers are then written one group at a time.
+	ModelCacheWriter records;
+	records.write(header);
+
+	std::vector<std::uint32_t> indexSizes;
+	indexSizes.reserve(import.groups.size());
+	std::uint64_t dataSize = 0;
+
+	for(auto it = import.groups.begin(); it != import.groups.end(); ++it) {
+		ModelImport::Group const& group = *it;
+
+		// The cache holds flat groups with plain image files.
+		if(group.position != QVector3D() || group.rotation != QQuaternion() || group.scale != QVector3D(1.f, 1.f, 1.f))
+			return false;
+		for(auto texIt = group.textures.begin(); texIt != group.textures.end(); ++texIt) {
+			if(!texIt->data.isEmpty() || texIt->channel != ModelImport::TextureRef::AllChannels)
+				return false;
+		}
+
+		records.writeString(group.name);
+
+		records.write(static_cast<std::uint32_t>(group.properties.size()));
+		for(auto propIt = group.properties.begin(); propIt != group.properties.end(); ++propIt) {
+			records.writeString(QString::fromUtf8(propIt->first));
+			records.writeString(propIt->second.toString());
+		}
+
+		records.write(static_cast<std::uint32_t>(group.textures.size()));
+		for(auto texIt = group.textures.begin(); texIt != group.textures.end(); ++texIt) {
+			records.write(static_cast<std::uint32_t>(texIt->slot));
+			records.writeString(texIt->path);
+		}
+
+		std::uint64_t vertexCount = group.vertices.size();
+		std::uint64_t indexCount  = group.indices.size();
+		std::uint32_t indexSize   = 0;
+		if(group.packed.vertexData) {
+			vertexCount = group.packed.vertexCount;
+			indexCount  = group.packed.indexCount;
+			indexSize   = static_cast<std::uint32_t>(group.packed.indexSize);
+		}
+		else {
+			// Same narrowing as the renderer would do on upload.
+			std::uint32_t maxIndex = 0;
+			for(auto ixIt = group.indices.begin(); ixIt != group.indices.end(); ++ixIt)
+				maxIndex = std::max(maxIndex, *ixIt);
+			indexSize = static_cast<std::uint32_t>(Mesh::packedIndexSize(maxIndex));
+		}
+		indexSizes.push_back(indexSize);
+
+		std::uint64_t const vertexOffset = dataSize;
+		dataSize += alignedSize(vertexCount * Mesh::packedVertexSize(group.contents));
+		std::uint64_t const indexOffset = dataSize;
+		dataSize += alignedSize(indexCount * indexSize);
+
+		records.write(static_cast<std::uint32_t>(group.contents));
+		records.write(static_cast<std::uint32_t>(group.drawMode));
+		records.write(static_cast<std::uint32_t>(group.renderOptions));
+		records.write(indexSize);
+		records.write(vertexCount);
+		records.write(vertexOffset);
+		records.write(indexCount);
+		records.write(indexOffset);
+
+		records.write(static_cast<std::uint32_t>(group.lods.size()));
+		for(auto lodIt = group.lods.begin(); lodIt != group.lods.end(); ++lodIt) {
+			std::uint64_t const lodIndexOffset = dataSize;
+			dataSize += alignedSize(lodIt->indices.size() * indexSize);
+
+			records.write(lodIt->error);
+			records.write(static_cast<std::uint64_t>(lodIt->indices.size()));
+			records.write(lodIndexOffset);
+		}
+	}
+	records.align();
+
+	header.dataOffset = records.size();
+
+	if(!QDir().mkpath(QFileInfo(cachePath).absolutePath()))
+		return false;
+
+	QSaveFile file(cachePath);
+	if(!file.open(QIODevice::WriteOnly))
+		return false;
+
+	QByteArray recordData = records.data();
+	std::memcpy(recordData.data(), &header, sizeof(header));
+
+	auto writeAligned = [&file, &alignedSize](void const* data, std::uint64_t size) -> bool {
+		static char const padding[ModelCacheAlignment] = {};
+		qint64 const padSize                           = static_cast<qint64>(alignedSize(size) - size);
+		return file.write(reinterpret_cast<char const*>(data), static_cast<qint64>(size)) == static_cast<qint64>(size) && file.write(padding, padSize) == padSize;
+	};
+
+	auto writeIndices = [&writeAligned](std::vector<std::uint32_t> const& indices, std::uint32_t indexSize) -> bool {
+		ModelCacheWriter indexData;
+		for(auto ixIt = indices.begin(); ixIt != indices.end(); ++ixIt) {
+			if(indexSize == sizeof(std::uint8_t))
+				indexData.write(static_cast<std::uint8_t>(*ixIt));
+			else if(indexSize == sizeof(std::uint16_t))
+				indexData.write(static_cast<std::uint16_t>(*ixIt));
+			else
+				indexData.write(*ixIt);
+		}
+		return writeAligned(indexData.data().constData(), indexData.size());
+	};
+
+	bool written = (file.write(recordData) == recordData.size());
+	for(std::size_t i = 0; i < import.groups.size() && written; ++i) {
+		ModelImport::Group const& group = import.groups[i];
+		std::uint32_t const indexSize   = indexSizes[i];
+
+		// Pre-packed buffers are already in the cache format.
+		if(group.packed.vertexData) {
+			written = writeAligned(group.packed.vertexData, group.packed.vertexCount * Mesh::packedVertexSize(group.contents)) &&
+			          writeAligned(group.packed.indexData, group.packed.indexCount * group.packed.indexSize);
+		}
+		else {
+			std::vector<std::uint8_t> const vertexData = Mesh::packVertices(group.vertices, group.contents);
+			written                                    = writeAligned(vertexData.data(), vertexData.size()) && writeIndices(group.indices, indexSize);
+		}
+
+		for(auto lodIt = group.lods.begin(); lodIt != group.lods.end() && written; ++lodIt)
+			written = writeIndices(lodIt->indices, indexSize);
+	}
+
+	if(!written) {
+		file.cancelWriting();
+		return false;
+	}
+
+	if(!file.commit())
+		return false;
+
+	log(LC_Debug, "Model cache written: " + cachePath + " (" + import.uri + ")");
+	return true;
+}
+
+}
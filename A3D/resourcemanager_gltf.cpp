@@ -0,0 +1,674 @@
+#include "A3D/resourcemanager.h"
+#include "A3D/modelimport.h"
+
+#include <QIODevice>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUrl>
+#include <cstring>
+#include <set>
+
+namespace A3D {
+
+namespace {
+
+// GLB container: a 12 bytes header { magic, version, length }, then chunks of { length, type, data } padded to 4 bytes.
+std::uint32_t const GlbMagic     = 0x46546C67; // "glTF"
+std::uint32_t const GlbJsonChunk = 0x4E4F534A; // "JSON"
+std::uint32_t const GlbBinChunk  = 0x004E4942; // "BIN\0"
+
+enum GltfComponentType {
+	GltfByte          = 5120,
+	GltfUnsignedByte  = 5121,
+	GltfShort         = 5122,
+	GltfUnsignedShort = 5123,
+	GltfUnsignedInt   = 5125,
+	GltfFloat         = 5126,
+};
+
+enum GltfPrimitiveMode {
+	GltfTriangles     = 4,
+	GltfTriangleStrip = 5,
+};
+
+// Bytes of a glTF buffer, and whatever keeps them alive (e.g. the mapped file).
+struct GltfBuffer {
+	std::shared_ptr<void const> owner;
+	std::uint8_t const* data;
+	std::size_t size;
+};
+
+// Held by the meshes through Mesh::PackedBuffers::storage.
+// The vertex and index buffers either point into one of the glTF buffers, or into the copies made here.
+struct GltfMeshStorage {
+	std::vector<std::shared_ptr<GltfBuffer>> buffers;
+	std::vector<std::uint8_t> vertices;
+	std::vector<std::uint8_t> indices;
+};
+
+// Bounds-checked view of an accessor
+struct GltfAccessor {
+	std::uint8_t const* data;
+	std::size_t count;
+	std::size_t stride;
+	int componentType;
+	std::size_t componentSize;
+	int componentCount;
+	bool normalized;
+
+	inline std::size_t elementSize() const { return componentSize * static_cast<std::size_t>(componentCount); }
+	inline std::uint8_t const* element(std::size_t i) const { return data + i * stride; }
+};
+
+std::size_t gltfComponentSize(int componentType) {
+	switch(componentType) {
+	case GltfByte:
+	case GltfUnsignedByte:
+		return 1;
+	case GltfShort:
+	case GltfUnsignedShort:
+		return 2;
+	case GltfUnsignedInt:
+	case GltfFloat:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+int gltfComponentCount(QString const& type) {
+	if(type == "SCALAR")
+		return 1;
+	if(type == "VEC2")
+		return 2;
+	if(type == "VEC3")
+		return 3;
+	if(type == "VEC4" || type == "MAT2")
+		return 4;
+	if(type == "MAT3")
+		return 9;
+	if(type == "MAT4")
+		return 16;
+	return 0;
+}
+
+bool resolveGltfAccessor(QJsonObject const& root, std::vector<std::shared_ptr<GltfBuffer>> const& buffers, int index, GltfAccessor& out) {
+	QJsonObject const accessor = root["accessors"].toArray().at(index).toObject();
+	if(accessor.isEmpty() || accessor.contains("sparse"))
+		return false;
+
+	QJsonObject const bufferView = root["bufferViews"].toArray().at(accessor["bufferView"].toInt(-1)).toObject();
+	int const bufferIndex        = bufferView["buffer"].toInt(-1);
+	if(bufferView.isEmpty() || bufferIndex < 0 || static_cast<std::size_t>(bufferIndex) >= buffers.size() || !buffers[bufferIndex])
+		return false;
+	GltfBuffer const& buffer = *buffers[bufferIndex];
+
+	out.componentType  = accessor["componentType"].toInt();
+	out.componentSize  = gltfComponentSize(out.componentType);
+	out.componentCount = gltfComponentCount(accessor["type"].toString());
+	out.normalized     = accessor["normalized"].toBool(false);
+	out.count          = static_cast<std::size_t>(std::max(0.0, accessor["count"].toDouble()));
+	if(!out.componentSize || !out.componentCount)
+		return false;
+
+	double const viewOffset     = bufferView["byteOffset"].toDouble(0.0);
+	double const viewLength     = bufferView["byteLength"].toDouble(-1.0);
+	double const accessorOffset = accessor["byteOffset"].toDouble(0.0);
+	double const byteStride     = bufferView["byteStride"].toDouble(0.0);
+	if(viewOffset < 0.0 || viewLength < 0.0 || accessorOffset < 0.0 || byteStride < 0.0 || viewOffset + viewLength > static_cast<double>(buffer.size))
+		return false;
+
+	out.stride = byteStride > 0.0 ? static_cast<std::size_t>(byteStride) : out.elementSize();
+	out.data   = buffer.data + static_cast<std::size_t>(viewOffset) + static_cast<std::size_t>(accessorOffset);
+
+	// The last element has to fit in the buffer view
+	if(out.count && accessorOffset + static_cast<double>(out.stride) * static_cast<double>(out.count - 1) + static_cast<double>(out.elementSize()) > viewLength)
+		return false;
+	return true;
+}
+
+// Reads a component as a float, following the glTF rules for normalized integers.
+float readGltfFloat(GltfAccessor const& a, std::size_t element, int component) {
+	std::uint8_t const* p = a.element(element) + static_cast<std::size_t>(component) * a.componentSize;
+	switch(a.componentType) {
+	case GltfFloat: {
+		float f;
+		std::memcpy(&f, p, sizeof(f));
+		return f;
+	}
+	case GltfUnsignedByte:
+		return a.normalized ? static_cast<float>(*p) / 255.f : static_cast<float>(*p);
+	case GltfByte: {
+		std::int8_t i;
+		std::memcpy(&i, p, sizeof(i));
+		return a.normalized ? std::max(static_cast<float>(i) / 127.f, -1.f) : static_cast<float>(i);
+	}
+	case GltfUnsignedShort: {
+		std::uint16_t i;
+		std::memcpy(&i, p, sizeof(i));
+		return a.normalized ? static_cast<float>(i) / 65535.f : static_cast<float>(i);
+	}
+	case GltfShort: {
+		std::int16_t i;
+		std::memcpy(&i, p, sizeof(i));
+		return a.normalized ? std::max(static_cast<float>(i) / 32767.f, -1.f) : static_cast<float>(i);
+	}
+	case GltfUnsignedInt: {
+		std::uint32_t i;
+		std::memcpy(&i, p, sizeof(i));
+		return static_cast<float>(i);
+	}
+	default:
+		return 0.f;
+	}
+}
+
+std::uint32_t readGltfUInt(GltfAccessor const& a, std::size_t element, int component) {
+	std::uint8_t const* p = a.element(element) + static_cast<std::size_t>(component) * a.componentSize;
+	switch(a.componentSize) {
+	case sizeof(std::uint8_t):
+		return *p;
+	case sizeof(std::uint16_t): {
+		std::uint16_t i;
+		std::memcpy(&i, p, sizeof(i));
+		return i;
+	}
+	default: {
+		std::uint32_t i;
+		std::memcpy(&i, p, sizeof(i));
+		return i;
+	}
+	}
+}
+
+// Decodes the payload of a "data:[<mediatype>][;base64],<data>" URI.
+QByteArray decodeGltfDataUri(QString const& uri) {
+	QByteArray const utf8 = uri.toUtf8();
+	int const comma       = utf8.indexOf(',');
+	if(comma < 0)
+		return QByteArray();
+	return QByteArray::fromBase64(utf8.mid(comma + 1));
+}
+
+struct GltfTransform {
+	QVector3D translation;
+	QQuaternion rotation;
+	QVector3D scale;
+};
+
+GltfTransform gltfNodeTransform(QJsonObject const& node) {
+	GltfTransform t{ QVector3D(), QQuaternion(), QVector3D(1.f, 1.f, 1.f) };
+
+	QJsonArray const matrix = node["matrix"].toArray();
+	if(matrix.size() == 16) {
+		// Column-major; decomposed into translation, rotation and scale.
+		float m[16];
+		for(int i = 0; i < 16; ++i)
+			m[i] = static_cast<float>(matrix.at(i).toDouble());
+
+		QVector3D xAxis(m[0], m[1], m[2]);
+		QVector3D yAxis(m[4], m[5], m[6]);
+		QVector3D zAxis(m[8], m[9], m[10]);
+
+		t.translation = QVector3D(m[12], m[13], m[14]);
+		t.scale       = QVector3D(xAxis.length(), yAxis.length(), zAxis.length());
+		if(QVector3D::dotProduct(QVector3D::crossProduct(xAxis, yAxis), zAxis) < 0.f)
+			t.scale.setX(-t.scale.x());
+
+		if(t.scale.x() != 0.f && t.scale.y() != 0.f && t.scale.z() != 0.f)
+			t.rotation = QQuaternion::fromAxes(xAxis / t.scale.x(), yAxis / t.scale.y(), zAxis / t.scale.z());
+		return t;
+	}
+
+	QJsonArray const translation = node["translation"].toArray();
+	QJsonArray const rotation    = node["rotation"].toArray();
+	QJsonArray const scale       = node["scale"].toArray();
+
+	if(translation.size() == 3)
+		t.translation = QVector3D(static_cast<float>(translation.at(0).toDouble()), static_cast<float>(translation.at(1).toDouble()), static_cast<float>(translation.at(2).toDouble()));
+	if(rotation.size() == 4) {
+		// glTF stores { x, y, z, w }
+		t.rotation = QQuaternion(static_cast<float>(rotation.at(3).toDouble()), static_cast<float>(rotation.at(0).toDouble()), static_cast<float>(rotation.at(1).toDouble()),
+		                         static_cast<float>(rotation.at(2).toDouble()));
+	}
+	if(scale.size() == 3)
+		t.scale = QVector3D(static_cast<float>(scale.at(0).toDouble()), static_cast<float>(scale.at(1).toDouble()), static_cast<float>(scale.at(2).toDouble()));
+	return t;
+}
+
+// Groups have no hierarchy: node transforms are flattened.
+// Exact unless a node with a non-uniform scale has rotated children.
+GltfTransform combineGltfTransforms(GltfTransform const& parent, GltfTransform const& local) {
+	return GltfTransform{ parent.translation + parent.rotation.rotatedVector(parent.scale * local.translation), parent.rotation * local.rotation, parent.scale * local.scale };
+}
+
+}
+
+bool ResourceManager::importModel_GLTF(OpenFileResult ofr, ImportSettings const&, ModelImport& out, ImportProgress const& progress) const {
+	if(!ofr.stream)
+		return false;
+
+	// The meshes may point straight into the mapped file, which then has to outlive this function.
+	std::shared_ptr<QByteArray const> const fileData = std::make_shared<QByteArray const>(mapFile(ofr));
+	std::shared_ptr<QIODevice> const fileOwner       = std::shared_ptr<QIODevice>(ofr.stream.release());
+
+	// This may run on a worker thread, while the meshes holding the file belong to this one.
+	fileOwner->moveToThread(thread());
+
+	std::uint8_t const* const fileBegin = reinterpret_cast<std::uint8_t const*>(fileData->constData());
+	std::size_t const fileSize          = static_cast<std::size_t>(fileData->size());
+
+	auto readU32 = [fileBegin](std::size_t offset) -> std::uint32_t {
+		std::uint32_t value;
+		std::memcpy(&value, fileBegin + offset, sizeof(value));
+		return value;
+	};
+
+	QByteArray json;
+	std::shared_ptr<GltfBuffer> binChunk;
+
+	if(fileSize >= 12 && readU32(0) == GlbMagic) {
+		if(readU32(4) != 2) {
+			log(LC_Debug, "Unsupported GLB version: " + ofr.uri);
+			return false;
+		}
+
+		std::size_t const length = std::min<std::size_t>(fileSize, readU32(8));
+		std::size_t offset       = 12;
+		while(length - offset >= 8) {
+			std::size_t const chunkLength = readU32(offset);
+			std::uint32_t const chunkType = readU32(offset + 4);
+			if(chunkLength > length - offset - 8)
+				break;
+
+			std::uint8_t const* chunkData = fileBegin + offset + 8;
+			if(chunkType == GlbJsonChunk && json.isEmpty())
+				json = QByteArray(reinterpret_cast<char const*>(chunkData), static_cast<int>(chunkLength));
+			else if(chunkType == GlbBinChunk && !binChunk) {
+				// Keeps both the mapping and the file data alive
+				std::shared_ptr<void const> owner = std::make_shared<std::pair<std::shared_ptr<QIODevice>, std::shared_ptr<QByteArray const>>>(fileOwner, fileData);
+				binChunk                          = std::make_shared<GltfBuffer>(GltfBuffer{ owner, chunkData, chunkLength });
+			}
+
+			offset += 8 + ((chunkLength + 3) & ~std::size_t(3));
+		}
+	}
+	else
+		json = *fileData;
+
+	QJsonParseError error;
+	QJsonDocument const document = QJsonDocument::fromJson(json, &error);
+	if(error.error != QJsonParseError::NoError || !document.isObject()) {
+		log(LC_Debug, "Invalid glTF file: " + ofr.uri + " (" + error.errorString() + ")");
+		return false;
+	}
+	json.clear();
+
+	QJsonObject const root = document.object();
+	if(!root["asset"].toObject()["version"].toString().startsWith(QChar('2'))) {
+		log(LC_Debug, "Unsupported glTF version: " + ofr.uri);
+		return false;
+	}
+
+	// Buffers: the GLB binary chunk, external files, or embedded data URIs
+	std::vector<std::shared_ptr<GltfBuffer>> buffers;
+	{
+		QJsonArray const jsonBuffers = root["buffers"].toArray();
+		for(int i = 0; i < jsonBuffers.size(); ++i) {
+			QJsonObject const jsonBuffer = jsonBuffers.at(i).toObject();
+			QString const uri            = jsonBuffer["uri"].toString();
+			std::shared_ptr<GltfBuffer> buffer;
+
+			if(uri.isEmpty()) {
+				if(i == 0)
+					buffer = binChunk;
+			}
+			else if(uri.startsWith("data:")) {
+				std::shared_ptr<QByteArray const> data = std::make_shared<QByteArray const>(decodeGltfDataUri(uri));
+				buffer = std::make_shared<GltfBuffer>(GltfBuffer{ data, reinterpret_cast<std::uint8_t const*>(data->constData()), static_cast<std::size_t>(data->size()) });
+			}
+			else {
+				OpenFileResult bin = openFile(ofr, QUrl::fromPercentEncoding(uri.toUtf8()));
+				if(bin.stream) {
+					std::shared_ptr<QByteArray const> const binData = std::make_shared<QByteArray const>(mapFile(bin));
+					bin.stream->moveToThread(thread());
+
+					std::shared_ptr<void const> owner =
+						std::make_shared<std::pair<std::shared_ptr<QIODevice>, std::shared_ptr<QByteArray const>>>(std::shared_ptr<QIODevice>(bin.stream.release()), binData);
+					buffer = std::make_shared<GltfBuffer>(GltfBuffer{ owner, reinterpret_cast<std::uint8_t const*>(binData->constData()), static_cast<std::size_t>(binData->size()) });
+				}
+			}
+
+			double const byteLength = jsonBuffer["byteLength"].toDouble(-1.0);
+			if(buffer && (byteLength < 0.0 || static_cast<double>(buffer->size) < byteLength))
+				buffer.reset();
+			if(!buffer)
+				log(LC_Debug, QString("glTF buffer %1 is missing: %2").arg(i).arg(ofr.uri));
+
+			buffers.push_back(buffer);
+		}
+	}
+
+	// Materials, mapped onto the PBR texture slots.
+	// glTF packs roughness (green) and metallic (blue) in one image, while each slot samples the red channel.
+	struct MaterialInfo {
+		QString name;
+		std::vector<ModelImport::TextureRef> textures;
+	};
+	std::vector<MaterialInfo> materials;
+	{
+		QJsonArray const images   = root["images"].toArray();
+		QJsonArray const textures = root["textures"].toArray();
+
+		auto addTexture = [&](MaterialInfo& material, QJsonValue const& textureInfo, MaterialProperties::TextureSlot slot, ModelImport::TextureRef::Channel channel) {
+			int const source         = textures.at(textureInfo.toObject()["index"].toInt(-1)).toObject()["source"].toInt(-1);
+			QJsonObject const image  = images.at(source).toObject();
+			QString const uri        = image["uri"].toString();
+			ModelImport::TextureRef ref{ slot, QString(), QString(), QByteArray(), channel };
+
+			if(image.contains("bufferView")) {
+				QJsonObject const bufferView = root["bufferViews"].toArray().at(image["bufferView"].toInt(-1)).toObject();
+				int const bufferIndex        = bufferView["buffer"].toInt(-1);
+				double const offset          = bufferView["byteOffset"].toDouble(0.0);
+				double const length          = bufferView["byteLength"].toDouble(-1.0);
+				if(bufferIndex < 0 || static_cast<std::size_t>(bufferIndex) >= buffers.size() || !buffers[bufferIndex] || offset < 0.0 || length < 0.0 ||
+				   offset + length > static_cast<double>(buffers[bufferIndex]->size))
+					return;
+
+				ref.data = QByteArray(reinterpret_cast<char const*>(buffers[bufferIndex]->data) + static_cast<std::size_t>(offset), static_cast<int>(length));
+				ref.name = ofr.uri + "#image" + QString::number(source);
+			}
+			else if(uri.startsWith("data:")) {
+				ref.data = decodeGltfDataUri(uri);
+				ref.name = ofr.uri + "#image" + QString::number(source);
+			}
+			else if(!uri.isEmpty()) {
+				ref.path = locateFile(ofr, QUrl::fromPercentEncoding(uri.toUtf8()));
+				ref.name = ref.path;
+			}
+
+			if(ref.name.isEmpty() || (ref.path.isEmpty() && ref.data.isEmpty()))
+				return;
+
+			if(channel == ModelImport::TextureRef::GreenChannel)
+				ref.name += "#G";
+			else if(channel == ModelImport::TextureRef::BlueChannel)
+				ref.name += "#B";
+			else if(channel == ModelImport::TextureRef::RedChannel)
+				ref.name += "#R";
+
+			material.textures.push_back(ref);
+		};
+
+		QJsonArray const jsonMaterials = root["materials"].toArray();
+		for(auto it = jsonMaterials.begin(); it != jsonMaterials.end(); ++it) {
+			QJsonObject const jsonMaterial = (*it).toObject();
+			QJsonObject const pbr          = jsonMaterial["pbrMetallicRoughness"].toObject();
+
+			materials.emplace_back();
+			MaterialInfo& material = materials.back();
+			material.name          = jsonMaterial["name"].toString();
+
+			addTexture(material, pbr["baseColorTexture"], MaterialProperties::AlbedoTextureSlot, ModelImport::TextureRef::AllChannels);
+			addTexture(material, jsonMaterial["normalTexture"], MaterialProperties::NormalTextureSlot, ModelImport::TextureRef::AllChannels);
+			addTexture(material, pbr["metallicRoughnessTexture"], MaterialProperties::MetallicTextureSlot, ModelImport::TextureRef::BlueChannel);
+			addTexture(material, pbr["metallicRoughnessTexture"], MaterialProperties::RoughnessTextureSlot, ModelImport::TextureRef::GreenChannel);
+			addTexture(material, jsonMaterial["occlusionTexture"], MaterialProperties::AOTextureSlot, ModelImport::TextureRef::AllChannels);
+		}
+	}
+
+	// Primitives of a glTF mesh, built the first time a node uses it and shared by all its instances.
+	struct Primitive {
+		Mesh::Contents contents;
+		Mesh::DrawMode drawMode;
+		Mesh::PackedBuffers packed;
+		int material;
+	};
+
+	QJsonArray const jsonMeshes = root["meshes"].toArray();
+	std::map<int, std::vector<Primitive>> meshes;
+
+	auto buildPrimitive = [&](QJsonObject const& jsonPrimitive, Primitive& primitive) -> bool {
+		int const mode = jsonPrimitive["mode"].toInt(GltfTriangles);
+		if(mode != GltfTriangles && mode != GltfTriangleStrip)
+			return false;
+
+		QJsonObject const attributes = jsonPrimitive["attributes"].toObject();
+
+		GltfAccessor position;
+		if(!resolveGltfAccessor(root, buffers, attributes["POSITION"].toInt(-1), position) || position.componentType != GltfFloat || position.componentCount != 3)
+			return false;
+		std::size_t const vertexCount = position.count;
+
+		// Optional attributes, with the component count they need and whether they are stored as floats in a packed vertex
+		struct Attribute {
+			char const* name;
+			Mesh::Content content;
+			int componentCount;
+			bool isFloat;
+			GltfAccessor accessor;
+		};
+		Attribute attributeList[] = {
+			{      "POSITION",     Mesh::Position3D, 3,  true, position },
+			{    "TEXCOORD_0", Mesh::TextureCoord2D, 2,  true, GltfAccessor() },
+			{        "NORMAL",       Mesh::Normal3D, 3,  true, GltfAccessor() },
+			{       "COLOR_0",        Mesh::Color4D, 4,  true, GltfAccessor() },
+			{      "JOINTS_0",        Mesh::BoneIDs, 4, false, GltfAccessor() },
+			{     "WEIGHTS_0",    Mesh::BoneWeights, 4,  true, GltfAccessor() },
+		};
+
+		Mesh::Contents contents = Mesh::Position3D;
+		for(Attribute& attribute: attributeList) {
+			if(attribute.content == Mesh::Position3D || !attributes.contains(attribute.name))
+				continue;
+			if(!resolveGltfAccessor(root, buffers, attributes[attribute.name].toInt(-1), attribute.accessor) || attribute.accessor.count != vertexCount)
+				return false;
+
+			// RGB colors
+			if(attribute.content == Mesh::Color4D && attribute.accessor.componentCount == 3) {
+				attribute.content        = Mesh::Color3D;
+				attribute.componentCount = 3;
+			}
+			if(attribute.accessor.componentCount != attribute.componentCount)
+				return false;
+
+			contents |= attribute.content;
+		}
+
+		std::shared_ptr<GltfMeshStorage> storage = std::make_shared<GltfMeshStorage>();
+		storage->buffers                         = buffers;
+
+		std::size_t const vertexSize = Mesh::packedVertexSize(contents);
+
+		// Interleaved data in the packed layout is used in place.
+		bool inPlace = (position.stride == vertexSize);
+		for(Attribute const& attribute: attributeList) {
+			if(!(contents & attribute.content))
+				continue;
+			bool const sameType = attribute.isFloat ? (attribute.accessor.componentType == GltfFloat) : (attribute.accessor.componentType == GltfUnsignedByte);
+			inPlace             = inPlace && sameType && attribute.accessor.stride == vertexSize &&
+			          attribute.accessor.data == position.data + Mesh::packedAttributeOffset(contents, attribute.content);
+		}
+
+		std::uint8_t const* vertexData = position.data;
+		if(!inPlace) {
+			// Interleave: plain copies when the type already matches, conversions otherwise.
+			storage->vertices.resize(vertexCount * vertexSize);
+			for(Attribute const& attribute: attributeList) {
+				if(!(contents & attribute.content))
+					continue;
+
+				GltfAccessor const& accessor = attribute.accessor;
+				std::uint8_t* pDst           = storage->vertices.data() + Mesh::packedAttributeOffset(contents, attribute.content);
+
+				bool const sameType = attribute.isFloat ? (accessor.componentType == GltfFloat) : (accessor.componentType == GltfUnsignedByte);
+				for(std::size_t i = 0; i < vertexCount; ++i, pDst += vertexSize) {
+					if(sameType)
+						std::memcpy(pDst, accessor.element(i), accessor.elementSize());
+					else if(attribute.isFloat) {
+						for(int c = 0; c < attribute.componentCount; ++c) {
+							float const f = readGltfFloat(accessor, i, c);
+							std::memcpy(pDst + static_cast<std::size_t>(c) * sizeof(float), &f, sizeof(f));
+						}
+					}
+					else {
+						for(int c = 0; c < attribute.componentCount; ++c)
+							pDst[c] = static_cast<std::uint8_t>(std::min<std::uint32_t>(readGltfUInt(accessor, i, c), std::numeric_limits<std::uint8_t>::max()));
+					}
+				}
+			}
+			vertexData = storage->vertices.data();
+		}
+
+		primitive.contents = contents;
+		primitive.material = jsonPrimitive["material"].toInt(-1);
+		primitive.packed   = Mesh::PackedBuffers{ storage, vertexData, vertexCount, nullptr, 0, sizeof(std::uint32_t) };
+
+		if(!jsonPrimitive.contains("indices")) {
+			primitive.drawMode = (mode == GltfTriangles) ? Mesh::Triangles : Mesh::TriangleStrips;
+			return true;
+		}
+
+		GltfAccessor indices;
+		if(!resolveGltfAccessor(root, buffers, jsonPrimitive["indices"].toInt(-1), indices) || indices.componentCount != 1 ||
+		   (indices.componentType != GltfUnsignedByte && indices.componentType != GltfUnsignedShort && indices.componentType != GltfUnsignedInt))
+			return false;
+
+		// Out of range indices would make the renderer read past the vertex buffer.
+		for(std::size_t i = 0; i < indices.count; ++i) {
+			if(readGltfUInt(indices, i, 0) >= vertexCount)
+				return false;
+		}
+
+		std::uint8_t const* indexData = indices.data;
+		if(indices.stride != indices.componentSize) {
+			storage->indices.resize(indices.count * indices.componentSize);
+			for(std::size_t i = 0; i < indices.count; ++i)
+				std::memcpy(storage->indices.data() + i * indices.componentSize, indices.element(i), indices.componentSize);
+			indexData = storage->indices.data();
+		}
+
+		primitive.drawMode          = (mode == GltfTriangles) ? Mesh::IndexedTriangles : Mesh::IndexedTriangleStrips;
+		primitive.packed.indexData  = indexData;
+		primitive.packed.indexCount = indices.count;
+		primitive.packed.indexSize  = indices.componentSize;
+		return true;
+	};
+
+	auto getMesh = [&](int meshIndex) -> std::vector<Primitive> const& {
+		auto found = meshes.find(meshIndex);
+		if(found != meshes.end())
+			return found->second;
+
+		std::vector<Primitive>& primitives = meshes[meshIndex];
+		QJsonArray const jsonPrimitives    = jsonMeshes.at(meshIndex).toObject()["primitives"].toArray();
+		for(int i = 0; i < jsonPrimitives.size(); ++i) {
+			Primitive primitive;
+			if(buildPrimitive(jsonPrimitives.at(i).toObject(), primitive))
+				primitives.push_back(primitive);
+			else
+				log(LC_Debug, QString("glTF mesh %1: primitive %2 skipped (unsupported or invalid)").arg(meshIndex).arg(i));
+		}
+		return primitives;
+	};
+
+	// Walk the node hierarchy of the default scene; each primitive of each mesh instance becomes a Group.
+	QJsonArray const nodes = root["nodes"].toArray();
+
+	std::vector<int> rootNodes;
+	QJsonArray const scenes = root["scenes"].toArray();
+	if(!scenes.isEmpty()) {
+		QJsonArray const sceneNodes = scenes.at(root["scene"].toInt(0)).toObject()["nodes"].toArray();
+		for(auto it = sceneNodes.begin(); it != sceneNodes.end(); ++it)
+			rootNodes.push_back((*it).toInt(-1));
+	}
+	else {
+		// No scene: every node that is not a child is a root.
+		std::vector<bool> isChild(static_cast<std::size_t>(nodes.size()), false);
+		for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+			QJsonArray const children = (*it).toObject()["children"].toArray();
+			for(auto childIt = children.begin(); childIt != children.end(); ++childIt) {
+				int const child = (*childIt).toInt(-1);
+				if(child >= 0 && child < nodes.size())
+					isChild[static_cast<std::size_t>(child)] = true;
+			}
+		}
+		for(int i = 0; i < nodes.size(); ++i) {
+			if(!isChild[static_cast<std::size_t>(i)])
+				rootNodes.push_back(i);
+		}
+	}
+
+	out.name = ofr.name;
+	out.uri  = ofr.uri;
+	out.groups.clear();
+
+	std::set<QString> groupNames;
+	std::vector<bool> visited(static_cast<std::size_t>(nodes.size()), false);
+	std::size_t nodesDone = 0;
+
+	std::function<bool(int, GltfTransform const&)> visitNode = [&](int nodeIndex, GltfTransform const& parentTransform) -> bool {
+		// Malformed files may have cycles
+		if(nodeIndex < 0 || nodeIndex >= nodes.size() || visited[static_cast<std::size_t>(nodeIndex)])
+			return true;
+		visited[static_cast<std::size_t>(nodeIndex)] = true;
+
+		QJsonObject const node        = nodes.at(nodeIndex).toObject();
+		GltfTransform const transform = combineGltfTransforms(parentTransform, gltfNodeTransform(node));
+
+		if(node.contains("mesh")) {
+			std::vector<Primitive> const& primitives = getMesh(node["mesh"].toInt(-1));
+
+			QString baseName = node["name"].toString();
+			if(baseName.isEmpty())
+				baseName = QString("node%1").arg(nodeIndex);
+
+			for(std::size_t i = 0; i < primitives.size(); ++i) {
+				Primitive const& primitive = primitives[i];
+
+				QString name = (primitives.size() > 1) ? QString("%1/%2").arg(baseName).arg(i) : baseName;
+				for(int suffix = 1; groupNames.count(name); ++suffix)
+					name = QString("%1#%2").arg(baseName).arg(suffix);
+				groupNames.insert(name);
+
+				out.groups.emplace_back();
+				ModelImport::Group& group = out.groups.back();
+				group.name                = name;
+				group.contents            = primitive.contents;
+				group.drawMode            = primitive.drawMode;
+				group.renderOptions       = Mesh::NoOptions;
+				group.position            = transform.translation;
+				group.rotation            = transform.rotation;
+				group.scale               = transform.scale;
+				group.packed              = primitive.packed;
+
+				if(primitive.material >= 0 && static_cast<std::size_t>(primitive.material) < materials.size()) {
+					MaterialInfo const& material         = materials[static_cast<std::size_t>(primitive.material)];
+					group.properties["gltf_Material"]    = material.name;
+					group.textures                       = material.textures;
+				}
+			}
+		}
+
+		if(progress && !progress(static_cast<float>(++nodesDone) / static_cast<float>(std::max(1, nodes.size()))))
+			return false;
+
+		QJsonArray const children = node["children"].toArray();
+		for(auto it = children.begin(); it != children.end(); ++it) {
+			if(!visitNode((*it).toInt(-1), transform))
+				return false;
+		}
+		return true;
+	};
+
+	GltfTransform const identity{ QVector3D(), QQuaternion(), QVector3D(1.f, 1.f, 1.f) };
+	for(auto it = rootNodes.begin(); it != rootNodes.end(); ++it) {
+		if(!visitNode(*it, identity))
+			return false;
+	}
+
+	return true;
+}
+
+}
@@ -1,222 +1,443 @@
 #include "A3D/resourcemanager.h"
-#include "A3D/model.h"
+#include "A3D/modelimport.h"
 
 #include <QIODevice>
+#include <QTemporaryFile>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 
 namespace A3D {
 
-Model* ResourceManager::loadModel_OBJ(OpenFileResult ofr) {
-	if(!ofr.stream)
-		return nullptr;
-
-	struct FaceInfo {
-		std::uint16_t smoothingGroup;
-		std::int32_t indices_v[3];
-		std::int32_t indices_vt[3];
-		std::int32_t indices_vn[3];
+namespace {
+
+// Non-owning view over a single line of a memory-mapped OBJ / MTL file.
+// All the parsing happens in-place on the raw bytes: nothing is allocated per line.
+class ObjLineScanner {
+public:
+	struct Token {
+		char const* begin;
+		char const* end;
+
+		inline bool isEmpty() const { return begin == end; }
+		inline std::size_t size() const { return static_cast<std::size_t>(end - begin); }
+		inline bool equals(char const* literal) const {
+			std::size_t const len = std::strlen(literal);
+			return size() == len && std::memcmp(begin, literal, len) == 0;
+		}
+		inline QString toString() const { return QString::fromUtf8(begin, static_cast<int>(size())); }
 	};
 
-	struct GroupInfo {
-		std::uint16_t lastSmoothingGroup;
-		Mesh::Contents contents;
-		QString material;
-		std::vector<FaceInfo> faces;
-	};
+	inline ObjLineScanner(char const* begin, char const* end)
+		: m_ptr(begin),
+		  m_end(end) {}
 
-	std::map<QString, GroupInfo> groups;
+	inline static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+	inline static bool isDigit(char c) { return c >= '0' && c <= '9'; }
 
-	std::vector<QVector3D> v;
-	std::vector<QVector2D> vt;
-	std::vector<QVector3D> vn;
+	inline void skipSpaces() {
+		while(m_ptr != m_end && isSpace(*m_ptr))
+			++m_ptr;
+	}
 
-	QStringList materialFiles;
+	inline bool atEnd() {
+		skipSpaces();
+		return m_ptr == m_end;
+	}
 
-	// Load .obj
-	{
-		v.reserve(128);
-		vt.reserve(128);
-		vn.reserve(128);
-		auto currentGroup = groups.end();
-
-		QIODevice& device = *ofr.stream;
-		QTextStream fin(&device);
-		QString line;
-		QString token;
-
-		while(fin.readLineInto(&line)) {
-			line = line.trimmed();
-
-			QTextStream lineStream(&line);
-			lineStream >> token;
-
-			if(token.isEmpty() || token.startsWith('#'))
-				continue;
-			else if(token == "mtllib") {
-				QString materialFile;
-				lineStream.skipWhiteSpace();
-				lineStream.readLineInto(&materialFile);
-				materialFiles.append(std::move(materialFile));
-				continue;
-			}
-			else if(token == "v") {
-				float x, y, z;
-				lineStream >> x >> y >> z;
-				v.emplace_back(x, y, z);
-				continue;
-			}
-			else if(token == "vt") {
-				float x, y;
-				lineStream >> x >> y;
-				vt.emplace_back(x, y);
-				continue;
-			}
-			else if(token == "vn") {
-				float x, y, z;
-				lineStream >> x >> y >> z;
-				vn.emplace_back(x, y, z);
-				continue;
-			}
-			else if(token == "g") {
-				QString currentGroupName;
-				lineStream.skipWhiteSpace();
-				lineStream.readLineInto(&currentGroupName);
-				auto iter    = groups.insert_or_assign(currentGroupName, GroupInfo{ 0, Mesh::Position3D | Mesh::TextureCoord2D | Mesh::Normal3D | Mesh::SmoothingGroup });
-				currentGroup = iter.first;
-				continue;
+	// Next whitespace-delimited token.
+	inline Token token() {
+		skipSpaces();
+		char const* begin = m_ptr;
+		while(m_ptr != m_end && !isSpace(*m_ptr))
+			++m_ptr;
+		return Token{ begin, m_ptr };
+	}
+
+	// Skips the rest of the current token, if any.
+	inline void skipToken() {
+		while(m_ptr != m_end && !isSpace(*m_ptr))
+			++m_ptr;
+	}
+
+	// Everything until the end of the line, without leading and trailing whitespace.
+	inline Token rest() {
+		skipSpaces();
+		char const* end = m_end;
+		while(end != m_ptr && isSpace(*(end - 1)))
+			--end;
+		Token t{ m_ptr, end };
+		m_ptr = m_end;
+		return t;
+	}
+
+	// The last whitespace-delimited token of the line (skips texture map options like "-bm 1.0").
+	inline Token lastToken() {
+		Token t{ m_ptr, m_ptr };
+		while(!atEnd())
+			t = token();
+		return t;
+	}
+
+	inline bool readFloat(float& out) {
+		skipSpaces();
+		return parseFloat(m_ptr, m_end, out);
+	}
+
+	inline bool readInt(std::int32_t& out) {
+		skipSpaces();
+		return parseInt(m_ptr, m_end, out);
+	}
+
+	inline bool consume(char c) {
+		if(m_ptr != m_end && *m_ptr == c) {
+			++m_ptr;
+			return true;
+		}
+		return false;
+	}
+
+	static bool parseInt(char const*& p, char const* end, std::int32_t& out) {
+		char const* s = p;
+		bool negative = false;
+		if(s != end && (*s == '-' || *s == '+')) {
+			negative = (*s == '-');
+			++s;
+		}
+		if(s == end || !isDigit(*s))
+			return false;
+
+		std::int64_t value = 0;
+		while(s != end && isDigit(*s)) {
+			if(value < std::numeric_limits<std::int32_t>::max())
+				value = value * 10 + (*s - '0');
+			++s;
+		}
+
+		value = std::min<std::int64_t>(value, std::numeric_limits<std::int32_t>::max());
+		out   = static_cast<std::int32_t>(negative ? -value : value);
+		p     = s;
+		return true;
+	}
+
+	// Decimal float parser in the spirit of std::from_chars.
+	// Up to 19 significant digits are accumulated in an integer and scaled once,
+	// which is exact for any value a CAD exporter realistically writes.
+	static bool parseFloat(char const*& p, char const* end, float& out) {
+		static double const powersOf10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+			                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		static int const maxTablePower   = static_cast<int>(sizeof(powersOf10) / sizeof(*powersOf10)) - 1;
+
+		char const* s = p;
+		bool negative = false;
+		if(s != end && (*s == '-' || *s == '+')) {
+			negative = (*s == '-');
+			++s;
+		}
+
+		std::uint64_t mantissa = 0;
+		int significantDigits  = 0;
+		int exponent           = 0;
+		bool anyDigit          = false;
+
+		while(s != end && isDigit(*s)) {
+			anyDigit = true;
+			if(significantDigits < 19) {
+				mantissa = mantissa * 10 + static_cast<std::uint64_t>(*s - '0');
+				if(mantissa)
+					++significantDigits;
 			}
+			else
+				++exponent;
+			++s;
+		}
 
-			auto requireGroup = [&]() {
-				if(currentGroup == groups.end()) {
-					auto iter    = groups.insert_or_assign("[default]", GroupInfo{ 0, Mesh::Position3D | Mesh::TextureCoord2D | Mesh::Normal3D | Mesh::SmoothingGroup });
-					currentGroup = iter.first;
+		if(s != end && *s == '.') {
+			++s;
+			while(s != end && isDigit(*s)) {
+				anyDigit = true;
+				if(significantDigits < 19) {
+					mantissa = mantissa * 10 + static_cast<std::uint64_t>(*s - '0');
+					if(mantissa)
+						++significantDigits;
+					--exponent;
 				}
-			};
+				++s;
+			}
+		}
 
-			if(token == "usemtl") {
-				requireGroup();
-				lineStream.skipWhiteSpace();
-				lineStream.readLineInto(&currentGroup->second.material);
-				continue;
+		if(!anyDigit)
+			return false;
+
+		if(s != end && (*s == 'e' || *s == 'E')) {
+			char const* e = s + 1;
+			std::int32_t explicitExponent;
+			if(parseInt(e, end, explicitExponent)) {
+				exponent = static_cast<int>(std::max<std::int64_t>(std::min<std::int64_t>(static_cast<std::int64_t>(exponent) + explicitExponent, 4096), -4096));
+				s        = e;
 			}
-			else if(token == "s") {
-				requireGroup();
-				lineStream >> currentGroup->second.lastSmoothingGroup;
-				continue;
+		}
+
+		double value = static_cast<double>(mantissa);
+		if(mantissa) {
+			if(exponent >= 0 && exponent <= maxTablePower)
+				value *= powersOf10[exponent];
+			else if(exponent < 0 && -exponent <= maxTablePower)
+				value /= powersOf10[-exponent];
+			else
+				value *= std::pow(10.0, exponent);
+		}
+
+		out = static_cast<float>(negative ? -value : value);
+		p   = s;
+		return true;
+	}
+
+private:
+	char const* m_ptr;
+	char const* m_end;
+};
+
+// Calls fn(lineBegin, lineEnd) for every line of the buffer.
+template <typename F>
+void forEachLine(char const* begin, char const* end, F&& fn) {
+	while(begin < end) {
+		char const* lineEnd = static_cast<char const*>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin)));
+		if(!lineEnd)
+			lineEnd = end;
+		fn(begin, lineEnd);
+		begin = lineEnd + 1;
+	}
+}
+
+// Returns the position right after the first newline at or after p.
+char const* nextLineStart(char const* p, char const* end) {
+	char const* lineEnd = static_cast<char const*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+	return lineEnd ? lineEnd + 1 : end;
+}
+
+// OptimizeMeshes: reorders a welded group for the GPU caches and logs the gain.
+void optimizeGroup(ModelImport::Group const& group, std::vector<Mesh::Vertex>& vertices, std::vector<std::uint32_t>& indices) {
+	Mesh::VertexCacheOptimizeStats const stats = Mesh::optimizeVertexCache(vertices, indices, group.contents);
+	log(LC_Debug,
+	    QString("OBJ group %1: ACMR %2 -> %3, ATVR %4 -> %5").arg(group.name).arg(stats.before.acmr()).arg(stats.after.acmr()).arg(stats.before.atvr()).arg(stats.after.atvr()));
+}
+
+// Corner of an "f" statement: the { v, vt, vn } indices as written in the file, 0 when missing.
+struct ObjCorner {
+	std::int32_t indices[3];
+};
+
+// Reads the corners of an "f" statement.
+// Returns the attributes that at least one of the corners does not have.
+Mesh::Contents readObjPolygon(ObjLineScanner& line, std::vector<ObjCorner>& polygon) {
+	Mesh::Contents missingContents = Mesh::Contents();
+	polygon.clear();
+
+	while(!line.atEnd()) {
+		ObjCorner corner = { { 0, 0, 0 } };
+
+		// Could not read Position attribute; Stop reading this face.
+		if(!line.readInt(corner.indices[0]))
+			break;
+
+		if(line.consume('/')) {
+			if(!line.readInt(corner.indices[1]))
+				missingContents |= Mesh::TextureCoord2D;
+
+			if(!line.consume('/') || !line.readInt(corner.indices[2]))
+				missingContents |= Mesh::Normal3D;
+		}
+		else
+			missingContents |= (Mesh::TextureCoord2D | Mesh::Normal3D);
+
+		// Skip whatever is left of a malformed corner
+		line.skipToken();
+
+		polygon.push_back(corner);
+	}
+
+	return missingContents;
+}
+
+// Resolves an OBJ index (1-based, or relative to the end of the list when negative) against the count of elements read so far.
+// Returns -1 for missing indices.
+inline std::int32_t resolveObjIndex(std::int32_t ix, std::size_t currentCount) {
+	if(ix > 0)
+		return ix - 1;
+	if(ix < 0)
+		return static_cast<std::int32_t>(static_cast<std::int64_t>(currentCount) + ix);
+	return -1;
+}
+
+// Attribute at a resolved OBJ index, or a null one if the index is invalid.
+template <typename T>
+inline T objAttribute(std::vector<T> const& in, std::int32_t ix) {
+	if(ix < 0 || ix >= static_cast<std::int32_t>(in.size()))
+		return T();
+	return in[static_cast<std::size_t>(ix)];
+}
+
+struct ObjFace {
+	// 0-based absolute indices, negative if missing or invalid.
+	std::int32_t indices_v[3];
+	std::int32_t indices_vt[3];
+	std::int32_t indices_vn[3];
+};
+
+// Result of parsing a newline-aligned slice of an OBJ file.
+// Statements that change the parser state are recorded in order, so that
+// the chunks can be replayed one after the other exactly as a serial parse would.
+struct ObjChunk {
+	enum StatementType {
+		GroupStatement,
+		MaterialStatement,
+		SmoothingStatement,
+		MaterialLibraryStatement,
+		FacesStatement,
+	};
+
+	struct Statement {
+		StatementType type;
+
+		// Group, material or library name
+		QString text;
+
+		// SmoothingStatement: the smoothing group
+		std::uint16_t smoothingGroup;
+
+		// FacesStatement: [faceBegin, faceEnd) in faces, and the attributes that were missing
+		std::size_t faceBegin;
+		std::size_t faceEnd;
+		Mesh::Contents missingContents;
+	};
+
+	std::vector<QVector3D> v;
+	std::vector<QVector2D> vt;
+	std::vector<QVector3D> vn;
+
+	std::vector<Statement> statements;
+	std::vector<ObjFace> faces;
+
+	// Negative OBJ indices point before the start of this chunk when they are large enough.
+	// They are stored relative to this chunk's first v / vt / vn, and these lists
+	// (face * 3 + corner) tell which entries must be rebased once the chunk offsets are known.
+	std::vector<std::size_t> relative_v;
+	std::vector<std::size_t> relative_vt;
+	std::vector<std::size_t> relative_vn;
+};
+
+void parseObjChunk(char const* begin, char const* end, ObjChunk& chunk) {
+	// Rough estimate to avoid most of the reallocations
+	std::size_t const estimatedLines = static_cast<std::size_t>(end - begin) / 32;
+	chunk.v.reserve(std::max<std::size_t>(128, estimatedLines / 4));
+	chunk.vt.reserve(std::max<std::size_t>(128, estimatedLines / 4));
+	chunk.vn.reserve(std::max<std::size_t>(128, estimatedLines / 4));
+	chunk.faces.reserve(estimatedLines / 4);
+
+	// Polygon corners of the current face line
+	std::vector<ObjCorner> polygon;
+	polygon.reserve(8);
+
+	auto pushStatement = [&](ObjChunk::StatementType type) -> ObjChunk::Statement& {
+		chunk.statements.emplace_back();
+		ObjChunk::Statement& s = chunk.statements.back();
+		s.type                 = type;
+		s.smoothingGroup       = 0;
+		s.faceBegin            = 0;
+		s.faceEnd              = 0;
+		return s;
+	};
+
+	forEachLine(begin, end, [&](char const* lineBegin, char const* lineEnd) {
+		ObjLineScanner line(lineBegin, lineEnd);
+		ObjLineScanner::Token const token = line.token();
+
+		if(token.isEmpty() || *token.begin == '#')
+			return;
+		else if(token.equals("v")) {
+			float x = 0.f, y = 0.f, z = 0.f;
+			line.readFloat(x);
+			line.readFloat(y);
+			line.readFloat(z);
+			chunk.v.emplace_back(x, y, z);
+		}
+		else if(token.equals("vt")) {
+			float x = 0.f, y = 0.f;
+			line.readFloat(x);
+			line.readFloat(y);
+			chunk.vt.emplace_back(x, y);
+		}
+		else if(token.equals("vn")) {
+			float x = 0.f, y = 0.f, z = 0.f;
+			line.readFloat(x);
+			line.readFloat(y);
+			line.readFloat(z);
+			chunk.vn.emplace_back(x, y, z);
+		}
+		else if(token.equals("f")) {
+			Mesh::Contents const missingContents = readObjPolygon(line, polygon);
+
+			if(polygon.size() < 3)
+				return;
+
+			// Consecutive face lines with the same missing attributes share one statement
+			if(chunk.statements.empty() || chunk.statements.back().type != ObjChunk::FacesStatement || chunk.statements.back().missingContents != missingContents) {
+				ObjChunk::Statement& s = pushStatement(ObjChunk::FacesStatement);
+				s.faceBegin            = chunk.faces.size();
+				s.faceEnd              = chunk.faces.size();
+				s.missingContents      = missingContents;
 			}
-			else if(token == "f") {
-				requireGroup();
-				QString vertexDefinition;
-				std::int32_t indices[4][3] = { 0 };
-
-				std::size_t verticesRead = 0;
-				for(std::size_t currentVertex = 0; currentVertex < 4; ++currentVertex, ++verticesRead) {
-					lineStream >> vertexDefinition;
-
-					QStringList vertexDefinitions = vertexDefinition.split(QChar('/'));
-
-					bool ok            = true;
-					int lastAttribRead = -1;
-
-					for(int attribIndex = 0; attribIndex < vertexDefinitions.size() && attribIndex < 3; ++attribIndex) {
-						indices[verticesRead][attribIndex] = vertexDefinitions[attribIndex].toFloat(&ok);
-
-						if(ok) {
-							lastAttribRead = attribIndex;
-						}
-						else {
-							indices[verticesRead][attribIndex] = 0.f;
-							// Could not read Position attribute; Break the loop.
-							if(attribIndex == 0)
-								break;
-
-							if(attribIndex == 1)
-								currentGroup->second.contents = currentGroup->second.contents & ~Mesh::TextureCoord2D;
-
-							if(attribIndex == 2)
-								currentGroup->second.contents = currentGroup->second.contents & ~Mesh::Normal3D;
-						}
-					}
-
-					// If we couldn't read the position of the last vertex,
-					// do not count this vertex as "read".
-					if(!ok && lastAttribRead <= 0)
-						break;
-				}
 
-				if(verticesRead == 3) {
-					std::vector<FaceInfo>& vector = currentGroup->second.faces;
-					vector.emplace_back();
-					FaceInfo& fi = vector.back();
-
-					fi.smoothingGroup = currentGroup->second.lastSmoothingGroup;
-					fi.indices_v[0]   = indices[0][0];
-					fi.indices_v[1]   = indices[1][0];
-					fi.indices_v[2]   = indices[2][0];
-
-					if(currentGroup->second.contents & Mesh::TextureCoord2D) {
-						fi.indices_vt[0] = indices[0][1];
-						fi.indices_vt[1] = indices[1][1];
-						fi.indices_vt[2] = indices[2][1];
-					}
-
-					if(currentGroup->second.contents & Mesh::Normal3D) {
-						fi.indices_vn[0] = indices[0][2];
-						fi.indices_vn[1] = indices[1][2];
-						fi.indices_vn[2] = indices[2][2];
-					}
-				}
-				else if(verticesRead == 4) {
-					std::vector<FaceInfo>& vector = currentGroup->second.faces;
-
-					// Quad: Triangulate.
-					vector.emplace_back();
-					{
-						FaceInfo& fi = vector.back();
-
-						fi.smoothingGroup = currentGroup->second.lastSmoothingGroup;
-						fi.indices_v[0]   = indices[0][0];
-						fi.indices_v[1]   = indices[1][0];
-						fi.indices_v[2]   = indices[2][0];
-
-						if(currentGroup->second.contents & Mesh::TextureCoord2D) {
-							fi.indices_vt[0] = indices[0][1];
-							fi.indices_vt[1] = indices[1][1];
-							fi.indices_vt[2] = indices[2][1];
-						}
-
-						if(currentGroup->second.contents & Mesh::Normal3D) {
-							fi.indices_vn[0] = indices[0][2];
-							fi.indices_vn[1] = indices[1][2];
-							fi.indices_vn[2] = indices[2][2];
-						}
-					}
-
-					vector.emplace_back();
-					{
-						FaceInfo& fi = vector.back();
-
-						fi.smoothingGroup = currentGroup->second.lastSmoothingGroup;
-						fi.indices_v[0]   = indices[0][0];
-						fi.indices_v[1]   = indices[2][0];
-						fi.indices_v[2]   = indices[3][0];
-
-						if(currentGroup->second.contents & Mesh::TextureCoord2D) {
-							fi.indices_vt[0] = indices[0][1];
-							fi.indices_vt[1] = indices[2][1];
-							fi.indices_vt[2] = indices[3][1];
-						}
-
-						if(currentGroup->second.contents & Mesh::Normal3D) {
-							fi.indices_vn[0] = indices[0][2];
-							fi.indices_vn[1] = indices[2][2];
-							fi.indices_vn[2] = indices[3][2];
-						}
-					}
+			// Triangulate as a fan: (0, 1, 2), (0, 2, 3), ...
+			for(std::size_t i = 2; i < polygon.size(); ++i) {
+				std::size_t const faceIndex = chunk.faces.size();
+				chunk.faces.emplace_back();
+				ObjFace& fi = chunk.faces.back();
+
+				// Relative indices are resolved against this chunk only and flagged for rebasing.
+				std::size_t const corners[3] = { 0, i - 1, i };
+				for(std::size_t c = 0; c < 3; ++c) {
+					ObjCorner const& corner = polygon[corners[c]];
+
+					fi.indices_v[c]  = resolveObjIndex(corner.indices[0], chunk.v.size());
+					fi.indices_vt[c] = resolveObjIndex(corner.indices[1], chunk.vt.size());
+					fi.indices_vn[c] = resolveObjIndex(corner.indices[2], chunk.vn.size());
+
+					if(corner.indices[0] < 0)
+						chunk.relative_v.push_back(faceIndex * 3 + c);
+					if(corner.indices[1] < 0)
+						chunk.relative_vt.push_back(faceIndex * 3 + c);
+					if(corner.indices[2] < 0)
+						chunk.relative_vn.push_back(faceIndex * 3 + c);
 				}
 			}
+
+			chunk.statements.back().faceEnd = chunk.faces.size();
 		}
-	}
+		else if(token.equals("g")) {
+			pushStatement(ObjChunk::GroupStatement).text = line.rest().toString();
+		}
+		else if(token.equals("usemtl")) {
+			pushStatement(ObjChunk::MaterialStatement).text = line.rest().toString();
+		}
+		else if(token.equals("s")) {
+			std::int32_t smoothingGroup = 0;
+			if(!line.readInt(smoothingGroup))
+				smoothingGroup = 0; // "s off"
+			pushStatement(ObjChunk::SmoothingStatement).smoothingGroup = static_cast<std::uint16_t>(smoothingGroup);
+		}
+		else if(token.equals("mtllib")) {
+			pushStatement(ObjChunk::MaterialLibraryStatement).text = line.rest().toString();
+		}
+	});
+}
 
+}
+
+void ResourceManager::importMaterials_MTL(OpenFileResult const& ofr, QStringList const& materialFiles, ModelImport& out) const {
 	struct MaterialInformations {
 		float opacity;
 		float specularExponent;
@@ -235,233 +456,659 @@ Model* ResourceManager::loadModel_OBJ(OpenFileResult ofr) {
 
 	std::map<QString, MaterialInformations> materials;
 
-	// Load .mtl
-	{
-		auto currentMaterial = materials.end();
+	auto currentMaterial = materials.end();
 
-		for(auto it = materialFiles.begin(); it != materialFiles.end(); ++it) {
-			OpenFileResult mtl = openFile(ofr, *it);
-			if(!mtl.stream) {
-				log(LC_Debug, "MTL file couldn't be opened: " + *it);
-				continue;
+	for(auto it = materialFiles.begin(); it != materialFiles.end(); ++it) {
+		OpenFileResult mtl = openFile(ofr, *it);
+		if(!mtl.stream) {
+			log(LC_Debug, "MTL file couldn't be opened: " + *it);
+			continue;
+		}
+
+		QByteArray const data = mapFile(mtl);
+
+		forEachLine(data.constData(), data.constData() + data.size(), [&](char const* lineBegin, char const* lineEnd) {
+			ObjLineScanner line(lineBegin, lineEnd);
+			ObjLineScanner::Token const token = line.token();
+
+			if(token.isEmpty() || *token.begin == '#')
+				return;
+			else if(token.equals("newmtl")) {
+				currentMaterial = materials.insert_or_assign(line.rest().toString(), MaterialInformations{ 1.f, 1.f }).first;
+				return;
 			}
 
-			QIODevice& device = *mtl.stream;
-			QTextStream fin(&device);
-			QString line;
-			QString token;
-
-			while(fin.readLineInto(&line)) {
-				line = line.trimmed();
-
-				QTextStream lineStream(&line);
-				lineStream >> token;
-
-				if(token.isEmpty() || token.startsWith('#'))
-					continue;
-				else if(token == "newmtl") {
-					QString currentMaterialName;
-					lineStream.skipWhiteSpace();
-					lineStream.readLineInto(&currentMaterialName);
-					auto iter       = materials.insert_or_assign(currentMaterialName, MaterialInformations{ 1.f, 1.f });
-					currentMaterial = iter.first;
-				}
+			if(currentMaterial == materials.end())
+				return;
 
-				if(currentMaterial == materials.end())
-					continue;
+			auto readColor = [&]() -> QVector3D {
+				float r = 0.f, g = 0.f, b = 0.f;
+				line.readFloat(r);
+				line.readFloat(g);
+				line.readFloat(b);
+				return QVector3D(r, g, b);
+			};
 
-				if(token == "Kd") {
-					float r, g, b;
-					lineStream >> r >> g >> b;
-					currentMaterial->second.diffuse = QVector3D(r, g, b);
-				}
-				else if(token == "Ka") {
-					float r, g, b;
-					lineStream >> r >> g >> b;
-					currentMaterial->second.ambient = QVector3D(r, g, b);
-				}
-				else if(token == "Ks") {
-					float r, g, b;
-					lineStream >> r >> g >> b;
-					currentMaterial->second.specular = QVector3D(r, g, b);
-				}
-				else if(token == "Ke") {
-					float r, g, b;
-					lineStream >> r >> g >> b;
-					currentMaterial->second.emissive = QVector3D(r, g, b);
-				}
-				else if(token == "Ns") {
-					lineStream >> currentMaterial->second.specularExponent;
-				}
-				else if(token == "d") {
-					lineStream >> currentMaterial->second.opacity;
-				}
-				else if(token == "map_Kd") {
-					QString location;
-					lineStream >> location;
-					currentMaterial->second.diffuseMap = locateFile(mtl, location);
-				}
-				else if(token == "map_Ka") {
-					QString location;
-					lineStream >> location;
-					currentMaterial->second.ambientMap = locateFile(mtl, location);
-				}
-				else if(token == "map_Ks") {
-					QString location;
-					lineStream >> location;
-					currentMaterial->second.specularMap = locateFile(mtl, location);
+			MaterialInformations& mat = currentMaterial->second;
+			if(token.equals("Kd"))
+				mat.diffuse = readColor();
+			else if(token.equals("Ka"))
+				mat.ambient = readColor();
+			else if(token.equals("Ks"))
+				mat.specular = readColor();
+			else if(token.equals("Ke"))
+				mat.emissive = readColor();
+			else if(token.equals("Ns"))
+				line.readFloat(mat.specularExponent);
+			else if(token.equals("d"))
+				line.readFloat(mat.opacity);
+			else if(token.equals("map_Kd"))
+				mat.diffuseMap = locateFile(mtl, line.lastToken().toString());
+			else if(token.equals("map_Ka"))
+				mat.ambientMap = locateFile(mtl, line.lastToken().toString());
+			else if(token.equals("map_Ks"))
+				mat.specularMap = locateFile(mtl, line.lastToken().toString());
+			else if(token.equals("map_Ke"))
+				mat.emissiveMap = locateFile(mtl, line.lastToken().toString());
+		});
+	}
+
+	// Textures of the material each group uses ("obj_Material")
+	for(auto it = out.groups.begin(); it != out.groups.end(); ++it) {
+		ModelImport::Group& group = *it;
+
+		auto foundMaterial = materials.find(group.properties["obj_Material"].toString());
+		if(foundMaterial == materials.end())
+			continue;
+		MaterialInformations const& mat = foundMaterial->second;
+
+		auto addTexture = [&group](MaterialProperties::TextureSlot slot, QString const& path) {
+			if(!path.isEmpty())
+				group.textures.push_back(ModelImport::TextureRef{ slot, path, path, QByteArray(), ModelImport::TextureRef::AllChannels });
+		};
+		addTexture(MaterialProperties::AlbedoTextureSlot, mat.diffuseMap);
+		addTexture(MaterialProperties::AlbedoTextureSlot, mat.ambientMap);
+		addTexture(MaterialProperties::MetallicTextureSlot, mat.specularMap);
+		addTexture(MaterialProperties::NormalTextureSlot, mat.bumpMap);
+	}
+}
+
+bool ResourceManager::importModel_OBJ(OpenFileResult ofr, ImportSettings const& settings, ModelImport& out, ImportProgress const& progress) const {
+	if(!ofr.stream)
+		return false;
+
+	LoadOptions const options = settings.options;
+	auto runFor               = [options](std::size_t count, std::function<void(std::size_t)> const& fn) {
+		if(options & ParallelLoad)
+			parallelFor(count, fn);
+		else {
+			for(std::size_t i = 0; i < count; ++i)
+				fn(i);
+		}
+	};
+
+	// Parsing accounts for most of the progress, expanding the groups for the rest.
+	// Tasks that start after a cancellation return immediately.
+	std::atomic<bool> cancelled(false);
+	std::atomic<std::size_t> stepsDone(0);
+	auto advance = [&](float phaseBegin, float phaseEnd, std::size_t phaseSteps) {
+		std::size_t const done = ++stepsDone;
+		if(progress && !progress(phaseBegin + (phaseEnd - phaseBegin) * static_cast<float>(done) / static_cast<float>(std::max<std::size_t>(1, phaseSteps))))
+			cancelled = true;
+	};
+
+	struct FaceRange {
+		ObjFace const* begin;
+		ObjFace const* end;
+		std::uint16_t smoothingGroup;
+	};
+
+	struct GroupInfo {
+		std::uint16_t lastSmoothingGroup;
+		Mesh::Contents contents;
+		QString material;
+		std::vector<FaceRange> faces;
+		std::size_t faceCount;
+	};
+
+	std::map<QString, GroupInfo> groups;
+
+	std::vector<QVector3D> v;
+	std::vector<QVector2D> vt;
+	std::vector<QVector3D> vn;
+
+	QStringList materialFiles;
+
+	// The file is kept mapped until all the faces have been consumed.
+	QByteArray const data = mapFile(ofr);
+	std::vector<ObjChunk> chunks;
+
+	// Load .obj
+	{
+		char const* const dataBegin = data.constData();
+		char const* const dataEnd   = dataBegin + data.size();
+
+		// Split the file into newline-aligned chunks of at least 1MB.
+		// Serial loads only split the file to be able to report progress.
+		std::size_t maxChunks = 1;
+		if(options & ParallelLoad)
+			maxChunks = static_cast<std::size_t>(std::max(1, QThreadPool::globalInstance()->maxThreadCount())) * 4;
+		else if(progress)
+			maxChunks = 16;
+		std::size_t const chunkCount = std::max<std::size_t>(1, std::min<std::size_t>(maxChunks, static_cast<std::size_t>(data.size()) >> 20));
+
+		std::vector<char const*> boundaries(chunkCount + 1, dataEnd);
+		boundaries[0] = dataBegin;
+		for(std::size_t i = 1; i < chunkCount; ++i)
+			boundaries[i] = std::max(boundaries[i - 1], nextLineStart(dataBegin + (static_cast<std::size_t>(data.size()) * i) / chunkCount, dataEnd));
+
+		chunks.resize(chunkCount);
+		runFor(chunkCount, [&](std::size_t i) {
+			if(cancelled)
+				return;
+			parseObjChunk(boundaries[i], boundaries[i + 1], chunks[i]);
+			advance(0.f, 0.7f, chunkCount);
+		});
+		if(cancelled)
+			return false;
+		stepsDone = 0;
+
+		// Prefix sums of the per-chunk attribute counts
+		std::vector<std::size_t> offset_v(chunkCount + 1, 0);
+		std::vector<std::size_t> offset_vt(chunkCount + 1, 0);
+		std::vector<std::size_t> offset_vn(chunkCount + 1, 0);
+		for(std::size_t i = 0; i < chunkCount; ++i) {
+			offset_v[i + 1]  = offset_v[i] + chunks[i].v.size();
+			offset_vt[i + 1] = offset_vt[i] + chunks[i].vt.size();
+			offset_vn[i + 1] = offset_vn[i] + chunks[i].vn.size();
+		}
+
+		v.resize(offset_v[chunkCount]);
+		vt.resize(offset_vt[chunkCount]);
+		vn.resize(offset_vn[chunkCount]);
+
+		runFor(chunkCount, [&](std::size_t i) {
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.v.begin(), chunk.v.end(), v.begin() + static_cast<std::ptrdiff_t>(offset_v[i]));
+			std::copy(chunk.vt.begin(), chunk.vt.end(), vt.begin() + static_cast<std::ptrdiff_t>(offset_vt[i]));
+			std::copy(chunk.vn.begin(), chunk.vn.end(), vn.begin() + static_cast<std::ptrdiff_t>(offset_vn[i]));
+			std::vector<QVector3D>().swap(chunk.v);
+			std::vector<QVector2D>().swap(chunk.vt);
+			std::vector<QVector3D>().swap(chunk.vn);
+
+			auto rebase = [&chunk](std::vector<std::size_t> const& positions, std::int32_t(ObjFace::*indices)[3], std::size_t offset) {
+				for(auto it = positions.begin(); it != positions.end(); ++it) {
+					std::int32_t& ix = (chunk.faces[*it / 3].*indices)[*it % 3];
+					ix               = static_cast<std::int32_t>(static_cast<std::int64_t>(ix) + static_cast<std::int64_t>(offset));
 				}
-				else if(token == "map_Ke") {
-					QString location;
-					lineStream >> location;
-					currentMaterial->second.emissiveMap = locateFile(mtl, location);
+			};
+			rebase(chunk.relative_v, &ObjFace::indices_v, offset_v[i]);
+			rebase(chunk.relative_vt, &ObjFace::indices_vt, offset_vt[i]);
+			rebase(chunk.relative_vn, &ObjFace::indices_vn, offset_vn[i]);
+		});
+
+		// Replay the statements in file order
+		auto currentGroup                    = groups.end();
+		Mesh::Contents const defaultContents = Mesh::Position3D | Mesh::TextureCoord2D | Mesh::Normal3D | Mesh::SmoothingGroup;
+
+		auto requireGroup = [&]() {
+			if(currentGroup == groups.end())
+				currentGroup = groups.try_emplace("[default]", GroupInfo{ 0, defaultContents }).first;
+		};
+
+		for(auto chunkIt = chunks.begin(); chunkIt != chunks.end(); ++chunkIt) {
+			for(auto it = chunkIt->statements.begin(); it != chunkIt->statements.end(); ++it) {
+				switch(it->type) {
+				case ObjChunk::GroupStatement:
+					currentGroup = groups.try_emplace(it->text, GroupInfo{ 0, defaultContents }).first;
+					break;
+				case ObjChunk::MaterialStatement:
+					requireGroup();
+					currentGroup->second.material = it->text;
+					break;
+				case ObjChunk::SmoothingStatement:
+					requireGroup();
+					currentGroup->second.lastSmoothingGroup = it->smoothingGroup;
+					break;
+				case ObjChunk::MaterialLibraryStatement:
+					materialFiles.append(it->text);
+					break;
+				case ObjChunk::FacesStatement:
+					requireGroup();
+					currentGroup->second.contents = currentGroup->second.contents & ~it->missingContents;
+					currentGroup->second.faces.push_back(FaceRange{ chunkIt->faces.data() + it->faceBegin, chunkIt->faces.data() + it->faceEnd, currentGroup->second.lastSmoothingGroup });
+					currentGroup->second.faceCount += (it->faceEnd - it->faceBegin);
+					break;
 				}
 			}
 		}
 	}
 
-	std::unique_ptr<Model> newModel = std::make_unique<Model>(this);
+	out.name = ofr.name;
+	out.uri  = ofr.uri;
+	out.groups.resize(groups.size());
+
+	std::vector<GroupInfo const*> groupInfos;
+	groupInfos.reserve(groups.size());
+
+	std::size_t groupIndex = 0;
+	for(auto it = groups.begin(); it != groups.end(); ++it, ++groupIndex) {
+		GroupInfo const& gi       = it->second;
+		ModelImport::Group& group = out.groups[groupIndex];
+		groupInfos.push_back(&gi);
+
+		group.name                       = it->first;
+		group.properties["obj_Material"] = gi.material;
+		group.contents                   = gi.contents;
+		group.drawMode                   = Mesh::IndexedTriangles;
+		group.renderOptions              = Mesh::NoOptions;
+		group.position                   = QVector3D();
+		group.rotation                   = QQuaternion();
+		group.scale                      = QVector3D(1.f, 1.f, 1.f);
+		group.packed                     = Mesh::PackedBuffers();
+	}
 
-	auto getVertex3D = [&](std::vector<QVector3D> const& in, std::int32_t ix) -> QVector3D {
-		std::int32_t realIndex = ix;
-		if(realIndex < 0)
-			realIndex = static_cast<std::int32_t>(in.size()) - realIndex;
-		else
-			realIndex -= 1;
+	importMaterials_MTL(ofr, materialFiles, out);
+
+	// Expand the faces into vertex and index buffers, one group per task.
+	runFor(out.groups.size(), [&](std::size_t groupIndex) {
+		if(cancelled)
+			return;
+
+		GroupInfo const& gi       = *groupInfos[groupIndex];
+		ModelImport::Group& group = out.groups[groupIndex];
+
+		std::vector<Mesh::Vertex>& vertices = group.vertices;
+		std::vector<std::uint32_t>& indices = group.indices;
+
+		// Reserve memory for worst-case scenario
+		vertices.reserve(gi.faceCount * 3);
+		indices.reserve(gi.faceCount * 3);
+
+		for(auto rangeIter = gi.faces.begin(); rangeIter != gi.faces.end(); ++rangeIter) {
+			for(ObjFace const* faceIter = rangeIter->begin; faceIter != rangeIter->end; ++faceIter) {
+				ObjFace const& face = *faceIter;
+
+				for(std::size_t vertexIndex = 0; vertexIndex < 3; ++vertexIndex) {
+					indices.emplace_back(static_cast<std::uint32_t>(vertices.size()));
+					vertices.emplace_back();
+					Mesh::Vertex& vertex = vertices.back();
+
+					if(gi.contents & Mesh::Position3D)
+						vertex.Position3D = objAttribute(v, face.indices_v[vertexIndex]);
+					if(gi.contents & Mesh::Normal3D)
+						vertex.Normal3D = objAttribute(vn, face.indices_vn[vertexIndex]);
+					if(gi.contents & Mesh::TextureCoord2D)
+						vertex.TextureCoord2D = objAttribute(vt, face.indices_vt[vertexIndex]);
+					vertex.SmoothingGroup = static_cast<std::uint8_t>(rangeIter->smoothingGroup);
+				}
+			}
+		}
+
+		// We will rebuild triangle indices in-engine.
+		Mesh::WeldStats const weldStats = Mesh::optimizeIndices(vertices, indices, group.contents);
+		log(LC_Debug, QString("OBJ group %1: welded %2 vertices into %3 (%4x)").arg(group.name).arg(weldStats.inputVertexCount).arg(weldStats.outputVertexCount).arg(weldStats.dedupRatio()));
+
+		if(options & OptimizeMeshes)
+			optimizeGroup(group, vertices, indices);
+
+		advance(0.7f, 1.f, out.groups.size());
+	});
+
+	return !cancelled;
+}
 
-		if(realIndex < 0 || realIndex >= static_cast<std::int32_t>(in.size()))
-			return QVector3D();
-		return in[realIndex];
+
+bool ResourceManager::importModel_OBJStreaming(OpenFileResult ofr, ImportSettings const& settings, ModelImport& out, ImportProgress const& progress) const {
+	if(!ofr.stream)
+		return false;
+
+	// Pages of a mapped file can be dropped and read again by the system, so they are not counted against the limit.
+	QByteArray const data       = mapFile(ofr);
+	char const* const dataBegin = data.constData();
+	char const* const dataEnd   = dataBegin + data.size();
+
+	// Calls fn on every line, 1MB of the file at a time, and reports the progress in between.
+	auto forEachSlice = [&](float phaseBegin, float phaseEnd, auto&& fn) -> bool {
+		std::size_t const sliceSize = std::size_t(1) << 20;
+
+		char const* sliceBegin = dataBegin;
+		while(sliceBegin < dataEnd) {
+			char const* sliceEnd = (static_cast<std::size_t>(dataEnd - sliceBegin) > sliceSize) ? nextLineStart(sliceBegin + sliceSize, dataEnd) : dataEnd;
+			forEachLine(sliceBegin, sliceEnd, fn);
+			sliceBegin = sliceEnd;
+
+			float const done = static_cast<float>(sliceBegin - dataBegin) / static_cast<float>(dataEnd - dataBegin);
+			if(progress && !progress(phaseBegin + (phaseEnd - phaseBegin) * done))
+				return false;
+		}
+		return true;
 	};
 
-	auto getVertex2D = [&](std::vector<QVector2D> const& in, std::int32_t ix) -> QVector2D {
-		std::int32_t realIndex = ix;
-		if(realIndex < 0)
-			realIndex = static_cast<std::int32_t>(in.size()) - realIndex;
-		else
-			realIndex -= 1;
+	struct StreamGroup {
+		Mesh::Contents contents;
+		QString material;
+		std::uint16_t lastSmoothingGroup;
+
+		// Start of the line holding the last face of the group, null if there is none
+		char const* lastFace;
 
-		if(realIndex < 0 || realIndex >= static_cast<std::int32_t>(in.size()))
-			return QVector2D();
-		return in[realIndex];
+		// Index in out.groups
+		std::size_t index;
+
+		// Only alive while the faces of the group are being read
+		std::unique_ptr<Mesh::VertexWelder> welder;
+		std::vector<std::uint32_t> indices;
 	};
 
-	for(auto it = groups.begin(); it != groups.end(); ++it) {
-		Group* newGroup     = newModel->addGroup(it->first);
-		GroupInfo const& gi = it->second;
+	std::map<QString, StreamGroup> groups;
+	QStringList materialFiles;
 
-		newGroup->setProperty("obj_Material", gi.material);
+	auto currentGroup                    = groups.end();
+	Mesh::Contents const defaultContents = Mesh::Position3D | Mesh::TextureCoord2D | Mesh::Normal3D | Mesh::SmoothingGroup;
 
-		MaterialProperties* matProp                      = new MaterialProperties(this);
-		newGroup->setMaterialProperties(matProp);
-		newGroup->setMaterial(Material::standardMaterial(Material::PBRMaterial));
+	auto requireGroup = [&]() {
+		if(currentGroup == groups.end())
+			currentGroup = groups.try_emplace("[default]", StreamGroup{ defaultContents }).first;
+	};
 
-		auto foundMaterial = materials.find(gi.material);
-		if(foundMaterial != materials.end()) {
+	std::vector<ObjCorner> polygon;
+	polygon.reserve(8);
+
+	// First pass: count the attributes, and find the contents and the last face of every group,
+	// so that the faces can be welded as they are read and each group packed as soon as it is complete.
+	std::size_t count_v = 0, count_vt = 0, count_vn = 0;
+
+	bool const firstPass = forEachSlice(0.f, 0.3f, [&](char const* lineBegin, char const* lineEnd) {
+		ObjLineScanner line(lineBegin, lineEnd);
+		ObjLineScanner::Token const token = line.token();
+
+		if(token.isEmpty() || *token.begin == '#')
+			return;
+		else if(token.equals("v"))
+			++count_v;
+		else if(token.equals("vt"))
+			++count_vt;
+		else if(token.equals("vn"))
+			++count_vn;
+		else if(token.equals("f")) {
+			Mesh::Contents const missingContents = readObjPolygon(line, polygon);
+			if(polygon.size() < 3)
+				return;
+
+			requireGroup();
+			currentGroup->second.contents = currentGroup->second.contents & ~missingContents;
+			currentGroup->second.lastFace = lineBegin;
+		}
+		else if(token.equals("g")) {
+			currentGroup = groups.try_emplace(line.rest().toString(), StreamGroup{ defaultContents }).first;
+		}
+		else if(token.equals("usemtl")) {
+			requireGroup();
+			currentGroup->second.material = line.rest().toString();
+		}
+		else if(token.equals("s")) {
+			requireGroup();
+		}
+		else if(token.equals("mtllib")) {
+			materialFiles.append(line.rest().toString());
+		}
+	});
+	if(!firstPass)
+		return false;
+
+	out.name = ofr.name;
+	out.uri  = ofr.uri;
+	out.groups.resize(groups.size());
+
+	std::size_t groupIndex = 0;
+	for(auto it = groups.begin(); it != groups.end(); ++it, ++groupIndex) {
+		StreamGroup& sg           = it->second;
+		ModelImport::Group& group = out.groups[groupIndex];
+		sg.index                  = groupIndex;
+
+		group.name                       = it->first;
+		group.properties["obj_Material"] = sg.material;
+		group.contents                   = sg.contents;
+		group.drawMode                   = Mesh::IndexedTriangles;
+		group.renderOptions              = Mesh::NoOptions;
+		group.position                   = QVector3D();
+		group.rotation                   = QQuaternion();
+		group.scale                      = QVector3D(1.f, 1.f, 1.f);
+		group.packed                     = Mesh::PackedBuffers();
+	}
 
-			MaterialInformations const& mat = foundMaterial->second;
+	std::vector<QVector3D> v;
+	std::vector<QVector2D> vt;
+	std::vector<QVector3D> vn;
+	v.reserve(count_v);
+	vt.reserve(count_vt);
+	vn.reserve(count_vn);
+
+	// Packed groups still in memory, and the ones moved to the spill file
+	struct SpilledGroup {
+		std::size_t index;
+		qint64 vertexOffset;
+		qint64 indexOffset;
+	};
 
-			if(!mat.diffuseMap.isEmpty()) {
-				Texture* t = getLoadedTexture(mat.diffuseMap);
-				if(!t) {
-					Image i(QImage(mat.diffuseMap));
-					if(!i.isNull())
-						t = registerTexture(mat.diffuseMap, new Texture(i, this));
-				}
+	std::vector<std::size_t> packedInMemory;
+	std::size_t packedBytes = 0;
+	std::vector<SpilledGroup> spilledGroups;
+	std::shared_ptr<QTemporaryFile> spillFile;
+	bool spillFailed = false;
+	bool limitLogged = false;
+
+	auto memoryUsage = [&]() -> std::size_t {
+		std::size_t bytes = packedBytes + v.capacity() * sizeof(QVector3D) + vt.capacity() * sizeof(QVector2D) + vn.capacity() * sizeof(QVector3D);
+		for(auto it = groups.begin(); it != groups.end(); ++it) {
+			if(it->second.welder)
+				bytes += it->second.welder->memoryUsage() + it->second.indices.capacity() * sizeof(std::uint32_t);
+		}
+		return bytes;
+	};
 
-				if(t)
-					matProp->setTexture(t, MaterialProperties::AlbedoTextureSlot);
-			}
+	auto spill = [&]() -> bool {
+		if(!spillFile) {
+			spillFile = std::make_shared<QTemporaryFile>();
+			if(!spillFile->open())
+				return false;
+		}
 
-			if(!mat.ambientMap.isEmpty()) {
-				Texture* t = getLoadedTexture(mat.ambientMap);
-				if(!t) {
-					Image i(QImage(mat.ambientMap));
-					if(!i.isNull())
-						t = registerTexture(mat.ambientMap, new Texture(i, this));
-				}
+		// 16-byte aligned, like the model cache
+		auto writeAligned = [&](std::uint8_t const* bytes, std::size_t size) -> bool {
+			static char const padding[16] = {};
+			qint64 const padSize          = static_cast<qint64>((16 - size % 16) % 16);
+			return spillFile->write(reinterpret_cast<char const*>(bytes), static_cast<qint64>(size)) == static_cast<qint64>(size) && spillFile->write(padding, padSize) == padSize;
+		};
+
+		for(auto it = packedInMemory.begin(); it != packedInMemory.end(); ++it) {
+			ModelImport::Group& group   = out.groups[*it];
+			Mesh::PackedBuffers& packed = group.packed;
+
+			SpilledGroup spilled{ *it, spillFile->pos(), 0 };
+			if(!writeAligned(packed.vertexData, packed.vertexCount * Mesh::packedVertexSize(group.contents)))
+				return false;
+			spilled.indexOffset = spillFile->pos();
+			if(!writeAligned(packed.indexData, packed.indexCount * packed.indexSize))
+				return false;
+
+			// The pointers are set again once the spill file is mapped.
+			packed.storage.reset();
+			packed.vertexData = nullptr;
+			packed.indexData  = nullptr;
+			spilledGroups.push_back(spilled);
+		}
 
-				if(t)
-					matProp->setTexture(t, MaterialProperties::AlbedoTextureSlot);
-			}
+		packedInMemory.clear();
+		packedBytes = 0;
+		return true;
+	};
 
-			if(!mat.specularMap.isEmpty()) {
-				Texture* t = getLoadedTexture(mat.specularMap);
-				if(!t) {
-					Image i(QImage(mat.specularMap));
-					if(!i.isNull())
-						t = registerTexture(mat.specularMap, new Texture(i, this));
-				}
+	auto enforceMemoryLimit = [&]() {
+		if(settings.memoryLimit <= 0 || memoryUsage() <= static_cast<std::size_t>(settings.memoryLimit))
+			return;
 
-				if(t)
-					matProp->setTexture(t, MaterialProperties::MetallicTextureSlot);
-			}
+		if(!packedInMemory.empty() && !spillFailed && !spill()) {
+			spillFailed = true;
+			log(LC_Debug, "OBJ streaming import: could not write the spill file, keeping the groups in memory");
+		}
 
-			/*
-			if(!mat.emissiveMap.isEmpty()) {
-				Texture* t = getLoadedTexture(mat.emissiveMap);
-				if(!t) {
-					Image i(QImage(mat.emissiveMap));
-					if(!i.isNull())
-						t = registerTexture(mat.emissiveMap, new Texture(i, this));
-				}
+		if(!limitLogged && memoryUsage() > static_cast<std::size_t>(settings.memoryLimit)) {
+			limitLogged = true;
+			log(LC_Debug, "OBJ streaming import: memory limit exceeded by the data still being read: " + ofr.uri);
+		}
+	};
 
-				if(t)
-					matProp->setTexture(t, MaterialProperties::MetallicTextureSlot);
-			}
-			*/
-
-			if(!mat.bumpMap.isEmpty()) {
-				Texture* t = getLoadedTexture(mat.emissiveMap);
-				if(!t) {
-					Image i(QImage(mat.emissiveMap));
-					if(!i.isNull())
-						t = registerTexture(mat.emissiveMap, new Texture(i, this));
-				}
+	auto finishGroup = [&](StreamGroup& sg) {
+		ModelImport::Group& group = out.groups[sg.index];
+
+		Mesh::WeldStats const weldStats = sg.welder->stats();
+		log(LC_Debug, QString("OBJ group %1: welded %2 vertices into %3 (%4x)").arg(group.name).arg(weldStats.inputVertexCount).arg(weldStats.outputVertexCount).arg(weldStats.dedupRatio()));
+
+		if(settings.options & OptimizeMeshes)
+			optimizeGroup(group, sg.welder->vertices(), sg.indices);
+
+		// Vertices, then indices (4-byte aligned) in the same buffer
+		std::size_t const vertexCount = sg.welder->vertices().size();
+		std::size_t const indexCount  = sg.indices.size();
+		std::size_t const indexSize   = Mesh::packedIndexSize(vertexCount ? static_cast<std::uint32_t>(vertexCount - 1) : 0);
+
+		std::shared_ptr<std::vector<std::uint8_t>> buffer = std::make_shared<std::vector<std::uint8_t>>(Mesh::packVertices(sg.welder->vertices(), group.contents));
+		sg.welder.reset();
+
+		std::size_t const indexOffset = (buffer->size() + 3) & ~std::size_t(3);
+		buffer->resize(indexOffset + indexCount * indexSize);
 
-				if(t)
-					matProp->setTexture(t, MaterialProperties::NormalTextureSlot);
+		std::uint8_t* pIndex = buffer->data() + indexOffset;
+		for(auto it = sg.indices.begin(); it != sg.indices.end(); ++it, pIndex += indexSize) {
+			if(indexSize == sizeof(std::uint8_t))
+				*pIndex = static_cast<std::uint8_t>(*it);
+			else if(indexSize == sizeof(std::uint16_t)) {
+				std::uint16_t const ix = static_cast<std::uint16_t>(*it);
+				std::memcpy(pIndex, &ix, sizeof(ix));
 			}
+			else
+				std::memcpy(pIndex, &*it, sizeof(std::uint32_t));
 		}
+		std::vector<std::uint32_t>().swap(sg.indices);
 
-		Mesh* mesh = new Mesh(this);
-		mesh->setContents(gi.contents);
-		mesh->setDrawMode(Mesh::IndexedTriangles);
+		group.packed = Mesh::PackedBuffers{ buffer, buffer->data(), vertexCount, buffer->data() + indexOffset, indexCount, indexSize };
+		packedInMemory.push_back(sg.index);
+		packedBytes += buffer->capacity();
 
-		std::vector<Mesh::Vertex>& vertices = mesh->vertices();
-		std::vector<std::uint32_t>& indices = mesh->indices();
+		enforceMemoryLimit();
+	};
 
-		// Reserve memory for worst-case scenario
-		vertices.reserve(gi.faces.size() * 3);
-		indices.reserve(gi.faces.size() * 3);
-
-		for(auto faceIter = gi.faces.begin(); faceIter != gi.faces.end(); ++faceIter) {
-			FaceInfo const& face = *faceIter;
-
-			for(std::size_t vertexIndex = 0; vertexIndex < 3; ++vertexIndex) {
-				indices.emplace_back(static_cast<std::uint32_t>(vertices.size()));
-				vertices.emplace_back();
-				Mesh::Vertex& vertex = vertices.back();
-
-				if(gi.contents & Mesh::Position3D)
-					vertex.Position3D = getVertex3D(v, face.indices_v[vertexIndex]);
-				if(gi.contents & Mesh::Normal3D)
-					vertex.Normal3D = getVertex3D(vn, face.indices_vn[vertexIndex]);
-				if(gi.contents & Mesh::TextureCoord2D)
-					vertex.TextureCoord2D = getVertex2D(vt, face.indices_vt[vertexIndex]);
-				vertex.SmoothingGroup = face.smoothingGroup;
+	// Second pass: weld the faces into their group, and pack each group after its last face.
+	std::size_t facesSinceCheck = 0;
+	currentGroup                = groups.end();
+
+	bool const secondPass = forEachSlice(0.3f, 1.f, [&](char const* lineBegin, char const* lineEnd) {
+		ObjLineScanner line(lineBegin, lineEnd);
+		ObjLineScanner::Token const token = line.token();
+
+		if(token.isEmpty() || *token.begin == '#')
+			return;
+		else if(token.equals("v")) {
+			float x = 0.f, y = 0.f, z = 0.f;
+			line.readFloat(x);
+			line.readFloat(y);
+			line.readFloat(z);
+			v.emplace_back(x, y, z);
+		}
+		else if(token.equals("vt")) {
+			float x = 0.f, y = 0.f;
+			line.readFloat(x);
+			line.readFloat(y);
+			vt.emplace_back(x, y);
+		}
+		else if(token.equals("vn")) {
+			float x = 0.f, y = 0.f, z = 0.f;
+			line.readFloat(x);
+			line.readFloat(y);
+			line.readFloat(z);
+			vn.emplace_back(x, y, z);
+		}
+		else if(token.equals("f")) {
+			readObjPolygon(line, polygon);
+			if(polygon.size() < 3)
+				return;
+
+			requireGroup();
+			StreamGroup& sg = currentGroup->second;
+			if(!sg.welder)
+				sg.welder = std::make_unique<Mesh::VertexWelder>(sg.contents);
+
+			// Triangulate as a fan: (0, 1, 2), (0, 2, 3), ...
+			for(std::size_t i = 2; i < polygon.size(); ++i) {
+				std::size_t const corners[3] = { 0, i - 1, i };
+				for(std::size_t c = 0; c < 3; ++c) {
+					ObjCorner const& corner = polygon[corners[c]];
+					Mesh::Vertex vertex     = Mesh::Vertex();
+
+					if(sg.contents & Mesh::Position3D)
+						vertex.Position3D = objAttribute(v, resolveObjIndex(corner.indices[0], v.size()));
+					if(sg.contents & Mesh::Normal3D)
+						vertex.Normal3D = objAttribute(vn, resolveObjIndex(corner.indices[2], vn.size()));
+					if(sg.contents & Mesh::TextureCoord2D)
+						vertex.TextureCoord2D = objAttribute(vt, resolveObjIndex(corner.indices[1], vt.size()));
+					vertex.SmoothingGroup = static_cast<std::uint8_t>(sg.lastSmoothingGroup);
+
+					sg.indices.push_back(sg.welder->add(vertex));
+				}
+			}
+
+			if(lineBegin == sg.lastFace)
+				finishGroup(sg);
+			else if(++facesSinceCheck >= 65536) {
+				facesSinceCheck = 0;
+				enforceMemoryLimit();
 			}
 		}
+		else if(token.equals("g")) {
+			currentGroup = groups.find(line.rest().toString());
+		}
+		else if(token.equals("usemtl")) {
+			requireGroup();
+		}
+		else if(token.equals("s")) {
+			std::int32_t smoothingGroup = 0;
+			if(!line.readInt(smoothingGroup))
+				smoothingGroup = 0; // "s off"
+			requireGroup();
+			currentGroup->second.lastSmoothingGroup = static_cast<std::uint16_t>(smoothingGroup);
+		}
+	});
+	if(!secondPass)
+		return false;
+
+	std::vector<QVector3D>().swap(v);
+	std::vector<QVector2D>().swap(vt);
+	std::vector<QVector3D>().swap(vn);
+
+	if(!spilledGroups.empty()) {
+		spillFile->flush();
+		std::uint8_t const* spillData = spillFile->map(0, spillFile->size());
+		if(!spillData) {
+			log(LC_Debug, "OBJ streaming import: could not map the spill file");
+			return false;
+		}
 
-		// We will rebuild triangle indices in-engine.
-		mesh->optimizeIndices();
+		for(auto it = spilledGroups.begin(); it != spilledGroups.end(); ++it) {
+			Mesh::PackedBuffers& packed = out.groups[it->index].packed;
+			packed.storage              = spillFile;
+			packed.vertexData           = spillData + it->vertexOffset;
+			packed.indexData            = spillData + it->indexOffset;
+		}
 
-		this->registerMesh(ofr.uri + "/" + it->first, mesh);
-		newGroup->setMesh(mesh);
+		// This may run on a worker thread, while the meshes holding the file belong to this one.
+		spillFile->moveToThread(thread());
+		log(LC_Debug, QString("OBJ streaming import: %1 groups spilled to disk").arg(spilledGroups.size()));
 	}
 
-	this->registerModel(ofr.name, newModel.get());
-	return newModel.release();
+	importMaterials_MTL(ofr, materialFiles, out);
+	return true;
 }
 
 }
@@ -4,8 +4,14 @@ namespace A3D {
 
 Scene::Scene(QObject* parent)
 	: Entity{ nullptr },
-	  m_runTimeMultiplier(1.f) {
+	  m_runTimeMultiplier(1.f),
+	  m_lightsDirty(false),
+	  m_lightBoundsMin(),
+	  m_lightBoundsMax(),
+	  m_lightRangeMax(0.f),
+	  m_transformUpdateCount(0) {
 	QObject::setParent(parent);
+	m_scene = this;
 	log(LC_Debug, "Constructor: Scene");
 }
 Scene::~Scene() {
@@ -21,6 +27,7 @@ ResourceManager const* Scene::resourceManager() const {
 }
 
 PointLightInfo& Scene::getOrCreateLight(std::size_t id) {
+	m_lightsDirty = true;
 	return m_lights[id];
 }
 PointLightInfo const* Scene::getLight(std::size_t id) const {
@@ -33,6 +40,164 @@ std::map<std::size_t, PointLightInfo> const& Scene::lights() const {
 	return m_lights;
 }
 
+void Scene::updateLightIndex() const {
+	m_lightsDirty = false;
+
+	// Lights are only ever added: the same count means the same lights.
+	bool moved = (m_indexedLights.size() != m_lights.size());
+	if(!moved) {
+		auto indexed = m_indexedLights.begin();
+		for(auto it = m_lights.begin(); it != m_lights.end(); ++it, ++indexed) {
+			if(indexed->light.position == it->second.position && indexed->light.color == it->second.color)
+				continue;
+
+			moved          = moved || indexed->light.position != it->second.position;
+			indexed->light = it->second;
+			indexed->range = it->second.range();
+		}
+	}
+	else {
+		m_indexedLights.clear();
+		m_indexedLights.reserve(m_lights.size());
+		for(auto it = m_lights.begin(); it != m_lights.end(); ++it)
+			m_indexedLights.push_back(IndexedLight{ it->first, it->second, it->second.range() });
+	}
+
+	// A color change alone changes the range, not the tree
+	m_lightRangeMax = 0.f;
+	for(IndexedLight const& indexed: m_indexedLights)
+		m_lightRangeMax = std::max(m_lightRangeMax, indexed.range);
+	if(!moved)
+		return;
+
+	m_lightBoundsMin = m_indexedLights.empty() ? QVector3D() : m_indexedLights.front().light.position;
+	m_lightBoundsMax = m_lightBoundsMin;
+	for(IndexedLight const& indexed: m_indexedLights) {
+		for(int axis = 0; axis < 3; ++axis) {
+			m_lightBoundsMin[axis] = std::min(m_lightBoundsMin[axis], indexed.light.position[axis]);
+			m_lightBoundsMax[axis] = std::max(m_lightBoundsMax[axis], indexed.light.position[axis]);
+		}
+	}
+
+	m_lightTree.resize(m_indexedLights.size());
+	m_lightTreeAxes.resize(m_indexedLights.size());
+	for(std::size_t i = 0; i < m_lightTree.size(); ++i)
+		m_lightTree[i] = static_cast<std::uint32_t>(i);
+	buildLightTree(0, m_lightTree.size());
+}
+
+void Scene::buildLightTree(std::size_t begin, std::size_t end) const {
+	if(end - begin < 2)
+		return;
+
+	QVector3D min = m_indexedLights[m_lightTree[begin]].light.position;
+	QVector3D max = min;
+	for(std::size_t i = begin + 1; i < end; ++i) {
+		QVector3D const& position = m_indexedLights[m_lightTree[i]].light.position;
+		for(int axis = 0; axis < 3; ++axis) {
+			min[axis] = std::min(min[axis], position[axis]);
+			max[axis] = std::max(max[axis], position[axis]);
+		}
+	}
+
+	QVector3D const size     = max - min;
+	int const axis           = size.x() >= size.y() && size.x() >= size.z() ? 0 : (size.y() >= size.z() ? 1 : 2);
+	std::size_t const middle = begin + (end - begin) / 2;
+	std::nth_element(m_lightTree.begin() + begin, m_lightTree.begin() + middle, m_lightTree.begin() + end, [&](std::uint32_t a, std::uint32_t b) {
+		return m_indexedLights[a].light.position[axis] < m_indexedLights[b].light.position[axis];
+	});
+	m_lightTreeAxes[middle] = static_cast<std::uint8_t>(axis);
+
+	buildLightTree(begin, middle);
+	buildLightTree(middle + 1, end);
+}
+
+void Scene::queryLightTree(std::size_t begin, std::size_t end, QVector3D const& point, std::size_t count, float maxDistanceSquared, std::vector<std::pair<float, std::uint32_t>>& nearest) const {
+	if(begin >= end)
+		return;
+
+	std::size_t const middle    = begin + (end - begin) / 2;
+	std::uint32_t const index   = m_lightTree[middle];
+	QVector3D const& position   = m_indexedLights[index].light.position;
+	float const distanceSquared = (position - point).lengthSquared();
+	if(distanceSquared <= maxDistanceSquared && (nearest.size() < count || distanceSquared < nearest.front().first)) {
+		if(nearest.size() == count) {
+			std::pop_heap(nearest.begin(), nearest.end());
+			nearest.pop_back();
+		}
+		nearest.emplace_back(distanceSquared, index);
+		std::push_heap(nearest.begin(), nearest.end());
+	}
+
+	// The side of the point first; the other one only when the splitting plane is closer than the farthest light kept
+	int const axis           = m_lightTreeAxes[middle];
+	float const offset       = point[axis] - position[axis];
+	float const planeSquared = offset * offset;
+	bool const leftSide      = offset < 0.f;
+	queryLightTree(leftSide ? begin : middle + 1, leftSide ? middle : end, point, count, maxDistanceSquared, nearest);
+	if(planeSquared <= maxDistanceSquared && (nearest.size() < count || planeSquared < nearest.front().first))
+		queryLightTree(leftSide ? middle + 1 : begin, leftSide ? end : middle, point, count, maxDistanceSquared, nearest);
+}
+
+void Scene::queryLightTree(std::size_t begin, std::size_t end, QVector3D const& min, QVector3D const& max, Frustum const& frustum, std::vector<std::uint32_t>& result) const {
+	if(begin >= end)
+		return;
+
+	// No light of the subtree reaches farther than its box grown by the largest range
+	QVector3D const reach(m_lightRangeMax, m_lightRangeMax, m_lightRangeMax);
+	if(!frustum.intersectsBox(min - reach, max + reach))
+		return;
+
+	std::size_t const middle    = begin + (end - begin) / 2;
+	std::uint32_t const index   = m_lightTree[middle];
+	IndexedLight const& indexed = m_indexedLights[index];
+	QVector3D const& position   = indexed.light.position;
+	if(indexed.range > 0.f && frustum.intersectsSphere(position, indexed.range))
+		result.push_back(index);
+
+	// The lights before the middle are on the lower side of its position, the ones after it on the upper side
+	int const axis     = m_lightTreeAxes[middle];
+	QVector3D lowerMax = max;
+	QVector3D upperMin = min;
+	lowerMax[axis]     = position[axis];
+	upperMin[axis]     = position[axis];
+	queryLightTree(begin, middle, min, lowerMax, frustum, result);
+	queryLightTree(middle + 1, end, upperMin, max, frustum, result);
+}
+
+void Scene::queryLights(Frustum const& frustum, std::vector<std::size_t>& result) const {
+	if(m_lightsDirty)
+		updateLightIndex();
+	result.clear();
+	if(m_lightRangeMax <= 0.f)
+		return;
+
+	m_frustumLights.clear();
+	queryLightTree(0, m_lightTree.size(), m_lightBoundsMin, m_lightBoundsMax, frustum, m_frustumLights);
+
+	// m_indexedLights is in the order of the ids
+	std::sort(m_frustumLights.begin(), m_frustumLights.end());
+	for(std::uint32_t index: m_frustumLights)
+		result.push_back(m_indexedLights[index].id);
+}
+
+void Scene::queryNearestLights(QVector3D const& point, std::size_t count, std::vector<std::size_t>& result, float maxDistance) const {
+	if(m_lightsDirty)
+		updateLightIndex();
+	result.clear();
+	if(!count)
+		return;
+
+	float const maxDistanceSquared = maxDistance < std::sqrt(std::numeric_limits<float>::max()) ? maxDistance * maxDistance : std::numeric_limits<float>::max();
+	m_nearestLights.clear();
+	queryLightTree(0, m_lightTree.size(), point, count, maxDistanceSquared, m_nearestLights);
+
+	// Closest first; the pairs keep the order of the lights for equal distances
+	std::sort_heap(m_nearestLights.begin(), m_nearestLights.end());
+	for(auto const& nearest: m_nearestLights)
+		result.push_back(m_indexedLights[nearest.second].id);
+}
+
 Cubemap* Scene::skybox() const {
 	return m_skybox;
 }
@@ -7,21 +7,128 @@
 #include "A3D/resourcemanager.h"
 #include "A3D/cubemap.h"
 #include "A3D/scenecontroller.h"
+#include "A3D/dynamicaabbtree.h"
+#include "A3D/frustum.h"
+#include <unordered_map>
+#include <unordered_set>
 
 namespace A3D {
 
 struct PointLightInfo {
-	// Z is the intensity multiplier of the light
+	// Radiance a light adds past its range, before the surface terms
+	static constexpr float Cutoff = 1.f / 256.f;
+
+	// W is the intensity multiplier of the light
 	QVector4D color;
 	QVector3D position;
+
+	// Color times intensity, what the light adds at a distance of 1
+	inline QVector3D radiance() const { return color.toVector3D() * (1.f + color.w()); }
+
+	// Distance past which the light adds less than Cutoff, 0 for a light without radiance
+	inline float range() const {
+		QVector3D const r     = radiance();
+		float const strongest = std::max({ r.x(), r.y(), r.z() });
+		return strongest > 0.f ? std::sqrt(strongest / Cutoff) : 0.f;
+	}
 };
 
 class Scene : public Entity {
 	Q_OBJECT
 public:
+	// Handle of a drawable instance: a mesh drawn with a material and material properties, at a world transform.
+	// The index of a removed instance is reused with the next generation: a handle with an older generation is stale.
+	struct InstanceHandle {
+		std::uint32_t index;
+		std::uint32_t generation;
+
+		inline bool operator==(InstanceHandle const& other) const { return index == other.index && generation == other.generation; }
+		inline bool operator!=(InstanceHandle const& other) const { return !(*this == other); }
+	};
+	static constexpr InstanceHandle NullInstance = { std::numeric_limits<std::uint32_t>::max(), 0 };
+
+	struct RayHit {
+		InstanceHandle instance;
+
+		// Null for the instances added with addInstance()
+		Entity* entity;
+		Group* group;
+
+		// Triangle of the group's mesh, see Mesh::triangleVertices()
+		std::size_t triangle;
+
+		// Weights of the three vertices of the triangle at the hit point
+		QVector3D barycentric;
+
+		// From the ray origin, in world units
+		float distance;
+		QVector3D position;
+	};
+
 	explicit Scene(QObject* parent = nullptr);
 	~Scene();
 
+	// The scene keeps its drawable instances in arrays indexed by their handle (structure of arrays),
+	// and a bounding volume hierarchy of their bounds in world space.
+	// Every group that can be drawn (visible, with a mesh, a material and material properties) is an instance, the scene
+	// follows the changes of the entities, models and groups; meshes modified in place are only picked up on the next change
+	// of their group, or after invalidateIndex(). Instances of 2D meshes have no bounds in world space: they are only returned by queryFrustum().
+	void updateIndex();
+	void invalidateIndex();
+
+	// Instances the queries can return
+	std::size_t indexedInstanceCount() const;
+
+	// The index of every handle in use is smaller than this
+	inline std::size_t instanceCapacity() const { return m_instanceFlags.size(); }
+
+	// Whether the instance is in the scene: false for NullInstance and stale handles
+	inline bool isInstanceValid(InstanceHandle instance) const {
+		return instance.index < m_instanceFlags.size() && (m_instanceFlags[instance.index] & InstanceUsed) && m_instanceGenerations[instance.index] == instance.generation;
+	}
+
+	// World matrices of entities and instances computed since the scene was created.
+	// Only what moved (or was indexed again) since the previous update is computed again.
+	std::size_t transformUpdateCount() const;
+
+	// Instances without an Entity, Model and Group, for scenes with very many objects: each one only takes an entry in the arrays
+	// and a leaf in the hierarchy. The resources are not owned by the scene. Stale handles are ignored.
+	InstanceHandle addInstance(Mesh*, Material*, MaterialProperties*, QMatrix4x4 const& transform);
+	void removeInstance(InstanceHandle);
+	void setInstanceTransform(InstanceHandle, QMatrix4x4 const&);
+	void setInstanceHidden(InstanceHandle, bool hidden);
+
+	// Instance data, for handles in use. Entity and group are null for the instances added with addInstance().
+	inline Entity* instanceEntity(InstanceHandle instance) const { return m_instanceEntities[instance.index]; }
+	inline Group* instanceGroup(InstanceHandle instance) const { return m_instanceGroups[instance.index]; }
+	inline Mesh* instanceMesh(InstanceHandle instance) const { return m_instanceMeshes[instance.index]; }
+	inline Material* instanceMaterial(InstanceHandle instance) const { return m_instanceMaterials[instance.index]; }
+	inline MaterialProperties* instanceMaterialProperties(InstanceHandle instance) const { return m_instanceMaterialProperties[instance.index]; }
+	inline QMatrix4x4 const& instanceTransform(InstanceHandle instance) const { return m_instanceTransforms[instance.index]; }
+
+	// Largest scale factor of the transform
+	inline float instanceScale(InstanceHandle instance) const { return m_instanceScales[instance.index]; }
+
+	inline QVector3D const& instanceBoundsMin(InstanceHandle instance) const { return m_instanceBoundsMin[instance.index]; }
+	inline QVector3D const& instanceBoundsMax(InstanceHandle instance) const { return m_instanceBoundsMax[instance.index]; }
+	inline QVector3D instanceSphereCenter(InstanceHandle instance) const { return QVector3D(m_instanceSphereX[instance.index], m_instanceSphereY[instance.index], m_instanceSphereZ[instance.index]); }
+	inline float instanceSphereRadius(InstanceHandle instance) const { return m_instanceSphereRadius[instance.index]; }
+
+	// The queries update the index first.
+	void queryBox(QVector3D const& min, QVector3D const& max, std::vector<InstanceHandle>& result);
+	void queryRange(QVector3D const& center, float radius, std::vector<InstanceHandle>& result);
+
+	// Up to count instances, the closest first, by distance from the point to their bounding box.
+	void queryNearest(QVector3D const& point, std::size_t count, std::vector<InstanceHandle>& result, float maxDistance = std::numeric_limits<float>::max());
+
+	// With exact false, the instances of the nodes that intersect the frustum are returned without testing their own bounds,
+	// for callers that test them in batches.
+	void queryFrustum(Frustum const&, std::vector<InstanceHandle>& result, bool exact = true);
+
+	// Closest triangle of the indexed 3D instances the ray hits, from either side.
+	// Each mesh builds its Mesh::bvh() the first time a ray reaches its bounds; instances of the same mesh share it.
+	bool raycast(QVector3D const& origin, QVector3D const& direction, RayHit& hit, float maxDistance = std::numeric_limits<float>::max());
+
 	ResourceManager* resourceManager();
 	ResourceManager const* resourceManager() const;
 
@@ -29,6 +136,18 @@ public:
 	PointLightInfo const* getLight(std::size_t id) const;
 	std::map<std::size_t, PointLightInfo> const& lights() const;
 
+	// The lights are kept in a k-d tree of their positions, built again when lights were added or moved; both queries walk it.
+	// As they are modified through references, updateLightIndex() compares them with the copies the tree was built from.
+	// The queries only call it after getOrCreateLight(); lights modified through references kept from before are picked up
+	// by the next explicit call, which Renderer::DrawAll() makes every frame.
+	void updateLightIndex() const;
+
+	// Lights whose range intersects the frustum, by increasing id
+	void queryLights(Frustum const&, std::vector<std::size_t>& result) const;
+
+	// Up to count lights, the closest first, by distance from the point to their position.
+	void queryNearestLights(QVector3D const& point, std::size_t count, std::vector<std::size_t>& result, float maxDistance = std::numeric_limits<float>::max()) const;
+
 	Cubemap* skybox() const;
 	void setSkybox(Cubemap*);
 
@@ -51,6 +170,39 @@ public slots:
 	void updateScene();
 
 private:
+	friend class Entity;
+
+	enum InstanceFlag {
+		InstanceUsed   = 0x1,
+		InstanceHidden = 0x2,
+	};
+
+	// Leaf of the instances without bounds
+	static constexpr std::uint32_t UnboundedLeaf = DynamicAabbTree::NullNode - 1;
+
+	void entityChanged(Entity*);
+	void entityRemoved(Entity*);
+
+	// Indexes the groups of the entity again, then those of its children.
+	void indexEntity(Entity*, bool hidden);
+
+	// Indices of the instances in the arrays
+	std::uint32_t allocateInstance();
+	void releaseInstance(std::uint32_t instance);
+	inline InstanceHandle instanceHandle(std::uint32_t instance) const { return InstanceHandle{ instance, m_instanceGenerations[instance] }; }
+
+	// Computes the bounds of the instance from its transform and mesh, and moves its leaf.
+	void updateInstanceBounds(std::uint32_t instance);
+
+	// Sorts m_lightTree[begin, end) into a k-d tree: the median on the widest axis, then each half.
+	void buildLightTree(std::size_t begin, std::size_t end) const;
+
+	// Nearest lights of the subtree m_lightTree[begin, end) in the max-heap of (squared distance, index in m_indexedLights)
+	void queryLightTree(std::size_t begin, std::size_t end, QVector3D const& point, std::size_t count, float maxDistanceSquared, std::vector<std::pair<float, std::uint32_t>>& nearest) const;
+
+	// Lights of the subtree m_lightTree[begin, end), whose positions lie in [min, max], intersecting the frustum: their indices in m_indexedLights
+	void queryLightTree(std::size_t begin, std::size_t end, QVector3D const& min, QVector3D const& max, Frustum const& frustum, std::vector<std::uint32_t>& result) const;
+
 	QElapsedTimer m_sceneRunTimer;
 	float m_runTimeMultiplier;
 
@@ -58,7 +210,54 @@ private:
 	ResourceManager m_resourceManager;
 	std::map<std::size_t, PointLightInfo> m_lights;
 
+	// Copy of each light the tree was built from, in the order of m_lights
+	struct IndexedLight {
+		std::size_t id;
+		PointLightInfo light;
+		float range;
+	};
+	mutable std::vector<IndexedLight> m_indexedLights;
+	mutable bool m_lightsDirty;
+
+	// Box of the light positions, and the largest range: the bounds of the tree for the frustum queries
+	mutable QVector3D m_lightBoundsMin;
+	mutable QVector3D m_lightBoundsMax;
+	mutable float m_lightRangeMax;
+
+	// Indices in m_indexedLights: the node of the range [begin, end) is at its middle, with the axis it splits in m_lightTreeAxes
+	mutable std::vector<std::uint32_t> m_lightTree;
+	mutable std::vector<std::uint8_t> m_lightTreeAxes;
+	mutable std::vector<std::pair<float, std::uint32_t>> m_nearestLights;
+	mutable std::vector<std::uint32_t> m_frustumLights;
+
 	QPointer<Cubemap> m_skybox;
+
+	DynamicAabbTree m_index;
+
+	// Instances, one entry per handle index in each array. m_instanceLeaves holds the leaf of each instance in m_index,
+	// NullNode for hidden and unused ones.
+	std::vector<std::uint8_t> m_instanceFlags;
+	std::vector<std::uint32_t> m_instanceGenerations;
+	std::vector<std::uint32_t> m_instanceLeaves;
+	std::vector<Entity*> m_instanceEntities;
+	std::vector<Group*> m_instanceGroups;
+	std::vector<QPointer<Mesh>> m_instanceMeshes;
+	std::vector<QPointer<Material>> m_instanceMaterials;
+	std::vector<QPointer<MaterialProperties>> m_instanceMaterialProperties;
+	std::vector<QMatrix4x4> m_instanceTransforms;
+	std::vector<float> m_instanceScales;
+	std::vector<QVector3D> m_instanceBoundsMin;
+	std::vector<QVector3D> m_instanceBoundsMax;
+	std::vector<float> m_instanceSphereX;
+	std::vector<float> m_instanceSphereY;
+	std::vector<float> m_instanceSphereZ;
+	std::vector<float> m_instanceSphereRadius;
+
+	std::vector<std::uint32_t> m_freeInstances;
+	std::vector<std::uint32_t> m_unboundedInstances;
+	std::unordered_map<Entity const*, std::vector<std::uint32_t>> m_entityInstances;
+	std::unordered_set<Entity*> m_dirtyEntities;
+	std::size_t m_transformUpdateCount;
 };
 
 }
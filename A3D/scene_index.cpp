@@ -0,0 +1,364 @@
+#include "A3D/scene.h"
+
+namespace A3D {
+
+namespace {
+
+// Box around a transformed box (Arvo, "Transforming Axis-Aligned Bounding Boxes", 1990).
+void transformBox(QMatrix4x4 const& m, QVector3D const& min, QVector3D const& max, QVector3D& outMin, QVector3D& outMax) {
+	for(int row = 0; row < 3; ++row) {
+		float lo = m(row, 3);
+		float hi = m(row, 3);
+		for(int col = 0; col < 3; ++col) {
+			float const a = m(row, col) * min[col];
+			float const b = m(row, col) * max[col];
+			lo += std::min(a, b);
+			hi += std::max(a, b);
+		}
+		outMin[row] = lo;
+		outMax[row] = hi;
+	}
+}
+
+}
+
+void Scene::entityChanged(Entity* entity) {
+	m_dirtyEntities.insert(entity);
+}
+
+void Scene::entityRemoved(Entity* entity) {
+	m_dirtyEntities.erase(entity);
+
+	auto it = m_entityInstances.find(entity);
+	if(it != m_entityInstances.end()) {
+		for(auto instance = it->second.begin(); instance != it->second.end(); ++instance)
+			releaseInstance(*instance);
+		m_entityInstances.erase(it);
+	}
+
+	std::vector<QPointer<Entity>> const& children = entity->childrenEntities();
+	for(auto child = children.begin(); child != children.end(); ++child) {
+		if(!child->isNull())
+			entityRemoved(*child);
+	}
+}
+
+void Scene::invalidateIndex() {
+	entityChanged(this);
+
+	// Instances added with addInstance() have no entity to follow
+	for(std::uint32_t instance = 0; instance < m_instanceFlags.size(); ++instance) {
+		if((m_instanceFlags[instance] & InstanceUsed) && !m_instanceEntities[instance])
+			updateInstanceBounds(instance);
+	}
+}
+
+std::size_t Scene::indexedInstanceCount() const {
+	return m_index.leafCount() + m_unboundedInstances.size();
+}
+
+std::size_t Scene::transformUpdateCount() const {
+	return m_transformUpdateCount;
+}
+
+void Scene::updateIndex() {
+	if(m_dirtyEntities.empty())
+		return;
+
+	// Entities below another changed entity are indexed with it.
+	std::vector<Entity*> changed;
+	for(auto it = m_dirtyEntities.begin(); it != m_dirtyEntities.end(); ++it) {
+		bool parentChanged = false;
+		for(Entity* p = (*it)->parentEntity(); p && !parentChanged; p = p->parentEntity())
+			parentChanged = (m_dirtyEntities.find(p) != m_dirtyEntities.end());
+		if(!parentChanged)
+			changed.push_back(*it);
+	}
+	m_dirtyEntities.clear();
+
+	for(auto it = changed.begin(); it != changed.end(); ++it) {
+		Entity* e   = *it;
+		bool hidden = false;
+		for(Entity* p = e; p && !hidden; p = p->parentEntity())
+			hidden = (p->renderOptions() & Entity::Hidden);
+		indexEntity(e, hidden);
+	}
+}
+
+void Scene::indexEntity(Entity* e, bool hidden) {
+	std::vector<std::uint32_t> instances;
+	auto existing = m_entityInstances.find(e);
+	if(existing != m_entityInstances.end())
+		instances = std::move(existing->second);
+
+	// Instances (and their leaves) are reused in order, so that a moving entity only updates its leaves.
+	std::size_t used = 0;
+	Model* m         = e->model();
+	if(!hidden && m && !(m->renderOptions() & Model::Hidden)) {
+		QMatrix4x4 const& worldMatrix                    = e->worldMatrix();
+		std::map<QString, QPointer<Group>> const& groups = m->groups();
+		for(auto it = groups.begin(); it != groups.end(); ++it) {
+			Group* g = it->second;
+			if(!g || g->renderOptions() & Group::Hidden || !g->mesh() || !g->material() || !g->materialProperties())
+				continue;
+
+			if(used == instances.size())
+				instances.push_back(allocateInstance());
+			std::uint32_t const instance = instances[used++];
+
+			m_instanceEntities[instance]           = e;
+			m_instanceGroups[instance]             = g;
+			m_instanceMeshes[instance]             = g->mesh();
+			m_instanceMaterials[instance]          = g->material();
+			m_instanceMaterialProperties[instance] = g->materialProperties();
+			m_instanceTransforms[instance]         = worldMatrix * g->entitySpaceMatrix();
+			updateInstanceBounds(instance);
+		}
+	}
+
+	for(std::size_t i = used; i < instances.size(); ++i)
+		releaseInstance(instances[i]);
+	instances.resize(used);
+
+	if(!instances.empty())
+		m_entityInstances[e] = std::move(instances);
+	else if(existing != m_entityInstances.end())
+		m_entityInstances.erase(existing);
+
+	std::vector<QPointer<Entity>> const& children = e->childrenEntities();
+	for(auto it = children.begin(); it != children.end(); ++it) {
+		if(it->isNull())
+			continue;
+		Entity* child = *it;
+		indexEntity(child, hidden || (child->renderOptions() & Entity::Hidden));
+	}
+}
+
+std::uint32_t Scene::allocateInstance() {
+	if(!m_freeInstances.empty()) {
+		std::uint32_t const instance = m_freeInstances.back();
+		m_freeInstances.pop_back();
+		m_instanceFlags[instance] = InstanceUsed;
+		return instance;
+	}
+
+	std::uint32_t const instance = static_cast<std::uint32_t>(m_instanceFlags.size());
+	m_instanceFlags.push_back(InstanceUsed);
+	m_instanceGenerations.push_back(0);
+	m_instanceLeaves.push_back(DynamicAabbTree::NullNode);
+	m_instanceEntities.push_back(nullptr);
+	m_instanceGroups.push_back(nullptr);
+	m_instanceMeshes.emplace_back();
+	m_instanceMaterials.emplace_back();
+	m_instanceMaterialProperties.emplace_back();
+	m_instanceTransforms.emplace_back();
+	m_instanceScales.push_back(1.f);
+	m_instanceBoundsMin.emplace_back();
+	m_instanceBoundsMax.emplace_back();
+	m_instanceSphereX.push_back(0.f);
+	m_instanceSphereY.push_back(0.f);
+	m_instanceSphereZ.push_back(0.f);
+	m_instanceSphereRadius.push_back(0.f);
+	return instance;
+}
+
+void Scene::releaseInstance(std::uint32_t instance) {
+	std::uint32_t& leaf = m_instanceLeaves[instance];
+	if(leaf == UnboundedLeaf)
+		m_unboundedInstances.erase(std::remove(m_unboundedInstances.begin(), m_unboundedInstances.end(), instance), m_unboundedInstances.end());
+	else if(leaf != DynamicAabbTree::NullNode)
+		m_index.remove(leaf);
+
+	leaf                                   = DynamicAabbTree::NullNode;
+	m_instanceFlags[instance]              = 0;
+	m_instanceEntities[instance]           = nullptr;
+	m_instanceGroups[instance]             = nullptr;
+	m_instanceMeshes[instance]             = nullptr;
+	m_instanceMaterials[instance]          = nullptr;
+	m_instanceMaterialProperties[instance] = nullptr;
+	++m_instanceGenerations[instance];
+	m_freeInstances.push_back(instance);
+}
+
+void Scene::updateInstanceBounds(std::uint32_t instance) {
+	QMatrix4x4 const& transform = m_instanceTransforms[instance];
+	Mesh const* mesh            = m_instanceMeshes[instance];
+	std::uint32_t& leaf         = m_instanceLeaves[instance];
+	++m_transformUpdateCount;
+
+	if(!mesh || (m_instanceFlags[instance] & InstanceHidden)) {
+		if(leaf == UnboundedLeaf)
+			m_unboundedInstances.erase(std::remove(m_unboundedInstances.begin(), m_unboundedInstances.end(), instance), m_unboundedInstances.end());
+		else if(leaf != DynamicAabbTree::NullNode)
+			m_index.remove(leaf);
+		leaf = DynamicAabbTree::NullNode;
+		return;
+	}
+
+	float const scale           = std::max({ transform.column(0).toVector3D().length(), transform.column(1).toVector3D().length(), transform.column(2).toVector3D().length() });
+	Mesh::Bounds const& bounds  = mesh->bounds();
+	QVector3D const center      = transform * bounds.center;
+	m_instanceScales[instance]  = scale;
+	m_instanceSphereX[instance] = center.x();
+	m_instanceSphereY[instance] = center.y();
+	m_instanceSphereZ[instance] = center.z();
+
+	if(mesh->contents() & Mesh::Position3D) {
+		transformBox(transform, bounds.min, bounds.max, m_instanceBoundsMin[instance], m_instanceBoundsMax[instance]);
+		m_instanceSphereRadius[instance] = bounds.radius * scale;
+
+		if(leaf == UnboundedLeaf) {
+			m_unboundedInstances.erase(std::remove(m_unboundedInstances.begin(), m_unboundedInstances.end(), instance), m_unboundedInstances.end());
+			leaf = DynamicAabbTree::NullNode;
+		}
+		if(leaf == DynamicAabbTree::NullNode)
+			leaf = m_index.insert(m_instanceBoundsMin[instance], m_instanceBoundsMax[instance], instance);
+		else
+			m_index.update(leaf, m_instanceBoundsMin[instance], m_instanceBoundsMax[instance]);
+	}
+	else {
+		// 2D meshes are not positioned in world space
+		m_instanceBoundsMin[instance]    = QVector3D(-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+		m_instanceBoundsMax[instance]    = -m_instanceBoundsMin[instance];
+		m_instanceSphereRadius[instance] = std::numeric_limits<float>::infinity();
+
+		if(leaf != UnboundedLeaf) {
+			if(leaf != DynamicAabbTree::NullNode)
+				m_index.remove(leaf);
+			leaf = UnboundedLeaf;
+			m_unboundedInstances.push_back(instance);
+		}
+	}
+}
+
+Scene::InstanceHandle Scene::addInstance(Mesh* mesh, Material* material, MaterialProperties* materialProperties, QMatrix4x4 const& transform) {
+	if(!mesh || !material || !materialProperties)
+		return NullInstance;
+
+	std::uint32_t const instance           = allocateInstance();
+	m_instanceMeshes[instance]             = mesh;
+	m_instanceMaterials[instance]          = material;
+	m_instanceMaterialProperties[instance] = materialProperties;
+	m_instanceTransforms[instance]         = transform;
+	updateInstanceBounds(instance);
+	return instanceHandle(instance);
+}
+
+void Scene::removeInstance(InstanceHandle handle) {
+	// The instances of the groups go away with their entity
+	if(!isInstanceValid(handle) || m_instanceEntities[handle.index])
+		return;
+	releaseInstance(handle.index);
+}
+
+void Scene::setInstanceTransform(InstanceHandle handle, QMatrix4x4 const& transform) {
+	if(!isInstanceValid(handle) || m_instanceEntities[handle.index])
+		return;
+	m_instanceTransforms[handle.index] = transform;
+	updateInstanceBounds(handle.index);
+}
+
+void Scene::setInstanceHidden(InstanceHandle handle, bool hidden) {
+	if(!isInstanceValid(handle) || m_instanceEntities[handle.index])
+		return;
+
+	std::uint32_t const instance = handle.index;
+	if(hidden == static_cast<bool>(m_instanceFlags[instance] & InstanceHidden))
+		return;
+
+	if(hidden)
+		m_instanceFlags[instance] |= InstanceHidden;
+	else
+		m_instanceFlags[instance] &= ~InstanceHidden;
+	updateInstanceBounds(instance);
+}
+
+void Scene::queryBox(QVector3D const& min, QVector3D const& max, std::vector<InstanceHandle>& result) {
+	updateIndex();
+	result.clear();
+	m_index.queryBox(min, max, [&](std::uint32_t instance) {
+		if(DynamicAabbTree::overlaps(m_instanceBoundsMin[instance], m_instanceBoundsMax[instance], min, max))
+			result.push_back(instanceHandle(instance));
+	});
+}
+
+void Scene::queryRange(QVector3D const& center, float radius, std::vector<InstanceHandle>& result) {
+	updateIndex();
+	result.clear();
+	m_index.querySphere(center, radius, [&](std::uint32_t instance) {
+		if(DynamicAabbTree::distanceSquared(center, m_instanceBoundsMin[instance], m_instanceBoundsMax[instance]) <= radius * radius)
+			result.push_back(instanceHandle(instance));
+	});
+}
+
+void Scene::queryNearest(QVector3D const& point, std::size_t count, std::vector<InstanceHandle>& result, float maxDistance) {
+	updateIndex();
+	result.clear();
+	if(!count)
+		return;
+
+	m_index.queryNearest(
+		point,
+		[&](std::uint32_t instance) -> float {
+			return std::sqrt(DynamicAabbTree::distanceSquared(point, m_instanceBoundsMin[instance], m_instanceBoundsMax[instance]));
+		},
+		[&](std::uint32_t instance, float distance) -> bool {
+			if(distance > maxDistance)
+				return false;
+			result.push_back(instanceHandle(instance));
+			return result.size() < count;
+		}
+	);
+}
+
+void Scene::queryFrustum(Frustum const& frustum, std::vector<InstanceHandle>& result, bool exact) {
+	updateIndex();
+	result.clear();
+	m_index.queryFrustum(frustum, [&](std::uint32_t instance, bool contained) {
+		if(contained || !exact || frustum.intersectsBox(m_instanceBoundsMin[instance], m_instanceBoundsMax[instance]))
+			result.push_back(instanceHandle(instance));
+	});
+
+	for(std::uint32_t instance: m_unboundedInstances)
+		result.push_back(instanceHandle(instance));
+}
+
+bool Scene::raycast(QVector3D const& origin, QVector3D const& direction, RayHit& hit, float maxDistance) {
+	updateIndex();
+
+	float const length = direction.length();
+	if(length <= 0.f)
+		return false;
+
+	// The direction is normalized, so that distances in the local space of each instance are world distances too.
+	QVector3D const worldDirection = direction / length;
+	bool found                     = false;
+	m_index.queryRay(origin, worldDirection, maxDistance, [&](std::uint32_t instance, float) -> float {
+		Mesh const* mesh = m_instanceMeshes[instance];
+		if(!mesh)
+			return maxDistance;
+
+		bool invertible             = false;
+		QMatrix4x4 const toInstance = m_instanceTransforms[instance].inverted(&invertible);
+		if(!invertible)
+			return maxDistance;
+
+		MeshBvh::Hit meshHit;
+		if(!mesh->bvh().intersect(toInstance.map(origin), toInstance.mapVector(worldDirection), meshHit, maxDistance))
+			return maxDistance;
+
+		maxDistance     = meshHit.distance;
+		found           = true;
+		hit.instance    = instanceHandle(instance);
+		hit.entity      = m_instanceEntities[instance];
+		hit.group       = m_instanceGroups[instance];
+		hit.triangle    = meshHit.triangle;
+		hit.barycentric = QVector3D(1.f - meshHit.u - meshHit.v, meshHit.u, meshHit.v);
+		hit.distance    = meshHit.distance;
+		hit.position    = origin + worldDirection * meshHit.distance;
+		return maxDistance;
+	});
+	return found;
+}
+
+}
@@ -1,5 +1,6 @@
 #include "A3D/texturecacheogl.h"
 #include "A3D/texture.h"
+#include "A3D/glstatecache.h"
 #include <QOpenGLPixelTransferOptions>
 
 namespace A3D {
@@ -110,11 +111,10 @@ void TextureCacheOGL::update(RendererOGL*, CoreGLFunctions* gl) {
 	markClean();
 }
 
-void TextureCacheOGL::applyToSlot(CoreGLFunctions* gl, GLuint slot) {
+void TextureCacheOGL::applyToSlot(GLStateCache& state, GLuint slot) {
 	if(!m_texture)
 		return;
-	gl->glActiveTexture(GL_TEXTURE0 + slot);
-	gl->glBindTexture(GL_TEXTURE_2D, m_texture->textureId());
+	state.bindTexture(slot, GL_TEXTURE_2D, m_texture->textureId());
 }
 
 }
@@ -8,6 +8,7 @@
 namespace A3D {
 
 class RendererOGL;
+class GLStateCache;
 class TextureCacheOGL : public TextureCache {
 	Q_OBJECT
 public:
@@ -15,7 +16,7 @@ public:
 	~TextureCacheOGL();
 
 	void update(RendererOGL*, CoreGLFunctions*);
-	void applyToSlot(CoreGLFunctions*, GLuint slot);
+	void applyToSlot(GLStateCache&, GLuint slot);
 
 private:
 	std::unique_ptr<QOpenGLTexture> m_texture;
@@ -122,6 +122,8 @@ void View::resizeGL(int w, int h) {
 	if(!m_initDoneGL)
 		return;
 
+	m_renderer->setViewportSize(QSize(w, h) * devicePixelRatioF());
+
 	// Update the Camera
 	if(m_camera.projectionMode() == Camera::PM_PERSPECTIVE) {
 		float fWidth  = static_cast<float>(w);
@@ -3,6 +3,7 @@
 #include <QFile>
 #include <QDir>
 #include <QTimer>
+#include <QStandardPaths>
 
 #include "A3D/view.h"
 #include "A3D/keyboardcameracontroller.h"
@@ -83,6 +84,7 @@ int main(int argc, char* argv[]) {
 		FloorTiles06 = loadPBRMaterial(":/A3D/SampleResources/Materials/FloorTiles06", "floor_tiles_06", "png");
 		FloorTiles06->setParent(s->resourceManager());
 
+		s->resourceManager()->setModelCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/Models");
 		sampleModel = s->resourceManager()->loadModel("Sphere", ":/A3D/SampleResources/Models/Sphere/Sphere.obj");
 		if(!sampleModel) {
 			sampleModel   = new A3D::Model(s->resourceManager());
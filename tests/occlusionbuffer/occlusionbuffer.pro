@@ -0,0 +1,18 @@
+QT       += core gui testlib
+QT       -= widgets
+
+CONFIG += c++17 testcase
+CONFIG -= app_bundle
+
+TARGET = tst_occlusionbuffer
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    ../../A3D/common.cpp \
+    ../../A3D/occlusionbuffer.cpp \
+    tst_occlusionbuffer.cpp
+
+HEADERS += \
+	../../A3D/common.h \
+	../../A3D/occlusionbuffer.h
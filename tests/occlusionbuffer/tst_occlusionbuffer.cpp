@@ -0,0 +1,95 @@
+#include "A3D/occlusionbuffer.h"
+#include <QtTest>
+#include <QThreadPool>
+#include <algorithm>
+
+using namespace A3D;
+
+class TestOcclusionBuffer : public QObject {
+	Q_OBJECT
+private slots:
+	void initTestCase();
+
+	void coveredBox();
+	void partiallyCoveredBox();
+	void boxInFront();
+	void sameDepthWithAnyThreadCount();
+
+private:
+	void rasterize(OcclusionBuffer& buffer) const;
+
+	QMatrix4x4 m_viewProjection;
+};
+
+// Square of 8 x 8 units, 10 units in front of a camera looking down -z
+static float const occluderPositions[] = {
+	-4.f, -4.f, -10.f,
+	+4.f, -4.f, -10.f,
+	+4.f, +4.f, -10.f,
+	-4.f, +4.f, -10.f,
+};
+static std::uint32_t const occluderTriangles[] = {
+	0, 1, 2,
+	0, 2, 3,
+};
+
+void TestOcclusionBuffer::initTestCase() {
+	m_viewProjection.perspective(60.f, 2.f, 0.1f, 100.f);
+}
+
+void TestOcclusionBuffer::rasterize(OcclusionBuffer& buffer) const {
+	buffer.clear(m_viewProjection);
+	buffer.addOccluder(occluderPositions, 4, occluderTriangles, 2, QMatrix4x4());
+	buffer.rasterize();
+}
+
+void TestOcclusionBuffer::coveredBox() {
+	OcclusionBuffer buffer;
+	rasterize(buffer);
+	QCOMPARE(buffer.rasterizedTriangles(), std::size_t(2));
+
+	QVERIFY(buffer.isOccluded(QVector3D(-1.f, -1.f, -21.f), QVector3D(1.f, 1.f, -19.f)));
+}
+
+void TestOcclusionBuffer::partiallyCoveredBox() {
+	OcclusionBuffer buffer;
+	rasterize(buffer);
+
+	// Behind the square, but reaching past its right edge
+	QVERIFY(!buffer.isOccluded(QVector3D(5.f, -1.f, -21.f), QVector3D(12.f, 1.f, -19.f)));
+}
+
+void TestOcclusionBuffer::boxInFront() {
+	OcclusionBuffer buffer;
+	rasterize(buffer);
+
+	// Within the square on screen, but nearer than it
+	QVERIFY(!buffer.isOccluded(QVector3D(-0.5f, -0.5f, -6.f), QVector3D(0.5f, 0.5f, -5.f)));
+
+	// Crossing it
+	QVERIFY(!buffer.isOccluded(QVector3D(-0.5f, -0.5f, -12.f), QVector3D(0.5f, 0.5f, -8.f)));
+}
+
+void TestOcclusionBuffer::sameDepthWithAnyThreadCount() {
+	QThreadPool* pool        = QThreadPool::globalInstance();
+	int const maxThreadCount = pool->maxThreadCount();
+
+	OcclusionBuffer reference;
+	pool->setMaxThreadCount(1);
+	rasterize(reference);
+
+	OcclusionBuffer buffer;
+	pool->setMaxThreadCount(std::max(maxThreadCount, 4));
+	rasterize(buffer);
+	pool->setMaxThreadCount(maxThreadCount);
+
+	QSize const resolution = buffer.resolution();
+	for(int y = 0; y < resolution.height(); ++y) {
+		for(int x = 0; x < resolution.width(); ++x)
+			QCOMPARE(buffer.depth(x, y), reference.depth(x, y));
+	}
+}
+
+QTEST_APPLESS_MAIN(TestOcclusionBuffer)
+
+#include "tst_occlusionbuffer.moc"